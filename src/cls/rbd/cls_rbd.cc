@@ -82,6 +82,9 @@ cls_method_handle_t h_snapshot_add;
 cls_method_handle_t h_snapshot_remove;
 cls_method_handle_t h_get_all_features;
 cls_method_handle_t h_copyup;
+cls_method_handle_t h_object_map_update;
+cls_method_handle_t h_object_map_snap_add;
+cls_method_handle_t h_object_map_snap_remove;
 cls_method_handle_t h_get_id;
 cls_method_handle_t h_set_id;
 cls_method_handle_t h_dir_get_id;
@@ -1386,6 +1389,232 @@ int copyup(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 }
 
 
+/************************ rbd_object_map object methods ******************/
+
+/*
+ * The object map object holds:
+ *
+ * data: a bitmap with one bit per data object (bit i of byte i / 8 for
+ *   object i), set if the object may exist in the head or any snapshot.
+ *   Bytes past the end read as zero, i.e. a missing map says that no
+ *   objects exist.
+ *
+ * omap dirty_<snapid>: bitmap of the objects modified between the
+ *   previous snapshot and this one.  A missing key means we do not
+ *   know, i.e. every object may have been modified.
+ *
+ * omap dirty_head: bitmap of the objects modified since the latest
+ *   snapshot.  This sorts after all of the snapshot keys.  A missing
+ *   key means nothing has been modified.
+ */
+
+static string dirty_key(snapid_t snap_id)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%s%016llx", RBD_OBJECT_MAP_DIRTY_PREFIX,
+	   (unsigned long long)snap_id.val);
+  return buf;
+}
+
+/// set or clear bits [start, end) of bitmap bl, which starts at byte off
+static void bitmap_update(bufferlist& bl, uint64_t off, uint64_t start,
+			  uint64_t end, bool set)
+{
+  uint64_t len = (end + 7) / 8 - off;
+  if (bl.length() < len)
+    bl.append_zero(len - bl.length());
+  char *p = bl.c_str();
+  for (uint64_t i = start; i < end; ++i) {
+    char bit = 1 << (i % 8);
+    if (set)
+      p[i / 8 - off] |= bit;
+    else
+      p[i / 8 - off] &= ~bit;
+  }
+}
+
+static int read_dirty(cls_method_context_t hctx, const string& key,
+		      bufferlist *bl)
+{
+  int r = cls_cxx_map_get_val(hctx, key, bl);
+  if (r < 0 && r != -ENOENT)
+    CLS_ERR("error reading %s: %d", key.c_str(), r);
+  return r;
+}
+
+/**
+ * Set or clear a range of bits in an image's object map, and record
+ * the objects as modified since the latest snapshot.  Clearing bits
+ * never grows the map.
+ *
+ * Input:
+ * @param start first object number to update
+ * @param end one past the last object number to update
+ * @param state OBJECT_MAP_CLEAR, OBJECT_MAP_SET or OBJECT_MAP_TOUCH
+ *
+ * Output:
+ * @returns 0 on success, negative error code on failure
+ */
+int object_map_update(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t start, end;
+  uint8_t state;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(start, iter);
+    ::decode(end, iter);
+    ::decode(state, iter);
+  } catch (const buffer::error &err) {
+    return -EINVAL;
+  }
+
+  if (end < start || state > OBJECT_MAP_TOUCH)
+    return -EINVAL;
+
+  uint64_t size = 0;
+  int r = cls_cxx_stat(hctx, &size, NULL);
+  if (r < 0 && r != -ENOENT)
+    return r;
+
+  if (state == OBJECT_MAP_CLEAR && end > size * 8)
+    end = size * 8;
+  if (start >= end)
+    return 0;
+
+  CLS_LOG(20, "object_map_update %llu~%llu state=%d",
+	  (unsigned long long)start, (unsigned long long)(end - start),
+	  (int)state);
+
+  if (state != OBJECT_MAP_TOUCH) {
+    uint64_t byte_start = start / 8;
+    uint64_t byte_end = (end + 7) / 8;
+    bufferlist bl;
+    if (byte_start < size) {
+      r = cls_cxx_read(hctx, byte_start, MIN(byte_end, size) - byte_start,
+		       &bl);
+      if (r < 0) {
+	CLS_ERR("object_map_update: error reading map: %d", r);
+	return r;
+      }
+    }
+    bitmap_update(bl, byte_start, start, end, state == OBJECT_MAP_SET);
+    r = cls_cxx_write(hctx, byte_start, bl.length(), &bl);
+    if (r < 0) {
+      CLS_ERR("object_map_update: error writing map: %d", r);
+      return r;
+    }
+  }
+
+  bufferlist dirty;
+  r = read_dirty(hctx, RBD_OBJECT_MAP_DIRTY_HEAD, &dirty);
+  if (r < 0 && r != -ENOENT)
+    return r;
+  bitmap_update(dirty, 0, start, end, true);
+  return cls_cxx_map_set_val(hctx, RBD_OBJECT_MAP_DIRTY_HEAD, &dirty);
+}
+
+/**
+ * Start a new modification interval for a snapshot that was just
+ * added: the objects modified since the previous snapshot become
+ * that snapshot's dirty map.
+ *
+ * Input:
+ * @param snap_id id of the new snapshot
+ *
+ * Output:
+ * @returns 0 on success, negative error code on failure
+ */
+int object_map_snap_add(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  snapid_t snap_id;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(snap_id, iter);
+  } catch (const buffer::error &err) {
+    return -EINVAL;
+  }
+
+  CLS_LOG(20, "object_map_snap_add %llu", (unsigned long long)snap_id.val);
+
+  bufferlist dirty;
+  int r = read_dirty(hctx, RBD_OBJECT_MAP_DIRTY_HEAD, &dirty);
+  if (r < 0 && r != -ENOENT)
+    return r;
+  if (r == 0) {
+    r = cls_cxx_map_remove_key(hctx, RBD_OBJECT_MAP_DIRTY_HEAD);
+    if (r < 0)
+      return r;
+  }
+  return cls_cxx_map_set_val(hctx, dirty_key(snap_id), &dirty);
+}
+
+/**
+ * Fold a removed snapshot's dirty map into the interval that follows
+ * it, so that diffs across the removed snapshot stay complete.
+ *
+ * Input:
+ * @param snap_id id of the removed snapshot
+ * @param num_objects number of objects to mark as modified if the
+ *   snapshot's dirty map is missing
+ *
+ * Output:
+ * @returns 0 on success, negative error code on failure
+ */
+int object_map_snap_remove(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  snapid_t snap_id;
+  uint64_t num_objects;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(snap_id, iter);
+    ::decode(num_objects, iter);
+  } catch (const buffer::error &err) {
+    return -EINVAL;
+  }
+
+  CLS_LOG(20, "object_map_snap_remove %llu", (unsigned long long)snap_id.val);
+
+  string key = dirty_key(snap_id);
+  bufferlist dirty;
+  int r = read_dirty(hctx, key, &dirty);
+  if (r < 0 && r != -ENOENT)
+    return r;
+  bool known = (r == 0);
+
+  map<string, bufferlist> vals;
+  r = cls_cxx_map_get_vals(hctx, key, RBD_OBJECT_MAP_DIRTY_PREFIX, 1, &vals);
+  if (r < 0 && r != -ENOENT)
+    return r;
+  string next_key = RBD_OBJECT_MAP_DIRTY_HEAD;
+  bufferlist next;
+  if (!vals.empty()) {
+    next_key = vals.begin()->first;
+    next.claim(vals.begin()->second);
+  }
+
+  if (known) {
+    if (next.length() < dirty.length())
+      next.append_zero(dirty.length() - next.length());
+    char *p = next.c_str();
+    const char *q = dirty.c_str();
+    for (unsigned i = 0; i < dirty.length(); ++i)
+      p[i] |= q[i];
+  } else {
+    bitmap_update(next, 0, 0, num_objects, true);
+  }
+
+  r = cls_cxx_map_set_val(hctx, next_key, &next);
+  if (r < 0)
+    return r;
+  if (known) {
+    r = cls_cxx_map_remove_key(hctx, key);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+
 /************************ rbd_id object methods **************************/
 
 /**
@@ -2046,6 +2275,17 @@ void __cls_init()
 			  CLS_METHOD_RD | CLS_METHOD_WR,
 			  set_stripe_unit_count, &h_set_stripe_unit_count);
 
+  /* methods for the rbd_object_map.$image_id objects */
+  cls_register_cxx_method(h_class, "object_map_update",
+			  CLS_METHOD_RD | CLS_METHOD_WR,
+			  object_map_update, &h_object_map_update);
+  cls_register_cxx_method(h_class, "object_map_snap_add",
+			  CLS_METHOD_RD | CLS_METHOD_WR,
+			  object_map_snap_add, &h_object_map_snap_add);
+  cls_register_cxx_method(h_class, "object_map_snap_remove",
+			  CLS_METHOD_RD | CLS_METHOD_WR,
+			  object_map_snap_remove, &h_object_map_snap_remove);
+
   /* methods for the rbd_children object */
   cls_register_cxx_method(h_class, "add_child",
 			  CLS_METHOD_RD | CLS_METHOD_WR,
@@ -8,6 +8,17 @@
 #include "common/Formatter.h"
 #include "librbd/parent_types.h"
 
+/// omap keys of the object map's per-snapshot and head dirty maps
+#define RBD_OBJECT_MAP_DIRTY_PREFIX "dirty_"
+#define RBD_OBJECT_MAP_DIRTY_HEAD "dirty_head"
+
+/// object map update states
+enum {
+  OBJECT_MAP_CLEAR = 0,  ///< object no longer exists
+  OBJECT_MAP_SET = 1,    ///< object may exist
+  OBJECT_MAP_TOUCH = 2,  ///< existence unchanged, object was modified
+};
+
 /// information about our parent image, if any
 struct cls_rbd_parent {
   int64_t pool;        ///< parent pool id
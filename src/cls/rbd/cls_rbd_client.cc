@@ -516,6 +516,44 @@ namespace librbd {
     }
 
 
+    /********************* rbd_object_map object methods *******************/
+
+    int object_map_update(librados::IoCtx *ioctx, const std::string &oid,
+			  uint64_t start, uint64_t end, uint8_t state)
+    {
+      librados::ObjectWriteOperation op;
+      object_map_update(&op, start, end, state);
+      return ioctx->operate(oid, &op);
+    }
+
+    void object_map_update(librados::ObjectWriteOperation *op,
+			   uint64_t start, uint64_t end, uint8_t state)
+    {
+      bufferlist in;
+      ::encode(start, in);
+      ::encode(end, in);
+      ::encode(state, in);
+      op->exec("rbd", "object_map_update", in);
+    }
+
+    int object_map_snap_add(librados::IoCtx *ioctx, const std::string &oid,
+			    snapid_t snap_id)
+    {
+      bufferlist in, out;
+      ::encode(snap_id, in);
+      return ioctx->exec(oid, "rbd", "object_map_snap_add", in, out);
+    }
+
+    int object_map_snap_remove(librados::IoCtx *ioctx, const std::string &oid,
+			       snapid_t snap_id, uint64_t num_objects)
+    {
+      bufferlist in, out;
+      ::encode(snap_id, in);
+      ::encode(num_objects, in);
+      return ioctx->exec(oid, "rbd", "object_map_snap_remove", in, out);
+    }
+
+
     /************************ rbd_id object methods ************************/
 
     int get_id(librados::IoCtx *ioctx, const std::string &oid, std::string *id)
@@ -78,6 +78,16 @@ namespace librbd {
     int set_stripe_unit_count(librados::IoCtx *ioctx, const std::string &oid,
 			      uint64_t stripe_unit, uint64_t stripe_count);
 
+    // operations on rbd_object_map objects
+    int object_map_update(librados::IoCtx *ioctx, const std::string &oid,
+			  uint64_t start, uint64_t end, uint8_t state);
+    void object_map_update(librados::ObjectWriteOperation *op,
+			   uint64_t start, uint64_t end, uint8_t state);
+    int object_map_snap_add(librados::IoCtx *ioctx, const std::string &oid,
+			    snapid_t snap_id);
+    int object_map_snap_remove(librados::IoCtx *ioctx, const std::string &oid,
+			       snapid_t snap_id, uint64_t num_objects);
+
     // operations on rbd_id objects
     int get_id(librados::IoCtx *ioctx, const std::string &oid, std::string *id);
     int set_id(librados::IoCtx *ioctx, const std::string &oid, std::string id);
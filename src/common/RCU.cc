@@ -0,0 +1,36 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <sched.h>
+#include <unistd.h>
+
+#include "common/RCU.h"
+
+void RCU::synchronize()
+{
+  Mutex::Locker l(m_sync_lock);
+  for (int i = 0; i < 2; ++i) {
+    unsigned old = m_gen.inc() - 1;
+    // order the bump (and the pointer updates before it) before we look
+    // at the counters
+    __sync_synchronize();
+    wait_for_readers(old & 1);
+  }
+}
+
+void RCU::wait_for_readers(unsigned idx)
+{
+  for (unsigned spins = 0; ; ++spins) {
+    unsigned long n = 0;
+    for (unsigned i = 0; i < NUM_SHARDS; ++i)
+      n += m_shards[i].readers[idx].read();
+    if (n == 0)
+      break;
+    // read sections are short; spin a little before sleeping
+    if (spins < 100)
+      sched_yield();
+    else
+      usleep(100);
+  }
+  __sync_synchronize();
+}
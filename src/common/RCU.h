@@ -0,0 +1,111 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_COMMON_RCU_H
+#define CEPH_COMMON_RCU_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "include/atomic.h"
+#include "common/Mutex.h"
+
+/**
+ * Read-copy-update for data that is read far more often than it
+ * changes.
+ *
+ * Readers bracket their use of an RCUPointer with read_lock() and
+ * read_unlock().  These only touch a counter in one of NUM_SHARDS
+ * cache-line-sized slots, picked by thread id, so readers on different
+ * cpus do not bounce a shared cache line the way they do with an
+ * RWLock.  A writer publishes a new version with RCUPointer::set() and
+ * then calls synchronize(), which returns once every read section that
+ * might still see the old version has ended; the old version may then
+ * be freed.
+ *
+ * This is sleepable RCU: read sections may block (briefly; writers wait
+ * for them), and nothing depends on the scheduler.  Each slot has two
+ * counters, and a reader counts itself in the one picked by the parity
+ * of the current generation.  synchronize() bumps the generation and
+ * waits for the old parity's counters to drain, twice, so that readers
+ * that raced with either bump are waited for too.
+ */
+class RCU {
+public:
+  static const unsigned NUM_SHARDS = 64;
+  static const unsigned CACHE_LINE = 64;
+
+  RCU() : m_gen(0), m_sync_lock("RCU::m_sync_lock") {}
+
+  /// enter a read section; pass the result to read_unlock()
+  unsigned read_lock() {
+    unsigned shard = get_shard();
+    unsigned idx = m_gen.read() & 1;
+    m_shards[shard].readers[idx].inc();
+    // order the count before our loads of the protected pointers
+    __sync_synchronize();
+    return shard * 2 + idx;
+  }
+
+  void read_unlock(unsigned token) {
+    // order our loads of the protected pointers before the count
+    __sync_synchronize();
+    m_shards[token / 2].readers[token % 2].dec();
+  }
+
+  /**
+   * Wait for all read sections that were active when this was called.
+   *
+   * May not be called from within a read section.
+   */
+  void synchronize();
+
+private:
+  struct Shard {
+    ceph::atomic_t readers[2];
+    char pad[CACHE_LINE - (2 * sizeof(ceph::atomic_t)) % CACHE_LINE];
+  };
+
+  ceph::atomic_t m_gen;
+  Mutex m_sync_lock;  ///< serializes synchronize()
+  Shard m_shards[NUM_SHARDS];
+
+  static unsigned get_shard() {
+    // pthread_t values are usually far apart and aligned; mix all the
+    // bits into the top ones
+    uint64_t h = (uint64_t)pthread_self() * 0x9e3779b97f4a7c15ull;
+    return h >> 58;  // NUM_SHARDS == 64
+  }
+  void wait_for_readers(unsigned idx);
+};
+
+/**
+ * A pointer published to RCU readers.
+ *
+ * Readers load it with read() inside a read section and may use what it
+ * points to until they leave the section.  Writers serialize among
+ * themselves and call RCU::synchronize() before freeing whatever they
+ * replaced.
+ */
+template <typename T>
+class RCUPointer {
+#ifdef NO_ATOMIC_OPS
+  ceph::atomic_spinlock_t<T*> m_ptr;
+#else
+  ceph::atomic_t m_ptr;
+#endif
+public:
+  RCUPointer() : m_ptr(0) {}
+  T *read() const {
+    return (T*)m_ptr.read();
+  }
+  void set(T *p) {
+#ifdef NO_ATOMIC_OPS
+    m_ptr.set(p);
+#else
+    m_ptr.set((AO_t)p);
+#endif
+  }
+};
+
+#endif
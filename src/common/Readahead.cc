@@ -5,18 +5,33 @@
 
 using namespace std;
 
+Readahead::Stream::Stream()
+  : nr_consec_read(0),
+    consec_read_bytes(0),
+    last_pos(0),
+    gap(0),
+    readahead_start(0),
+    readahead_pos(0),
+    readahead_trigger_pos(0),
+    readahead_size(0),
+    readahead_bytes(0),
+    hit_bytes(0),
+    last_used(0) {
+}
+
 Readahead::Readahead()
   : m_trigger_requests(10),
     m_readahead_min_bytes(0),
     m_readahead_max_bytes(NO_LIMIT),
     m_alignments(),
     m_lock("Readahead::m_lock"),
-    m_nr_consec_read(0),
-    m_consec_read_bytes(0),
-    m_last_pos(0),
-    m_readahead_pos(0),
-    m_readahead_trigger_pos(0),
-    m_readahead_size(0),
+    m_streams(1),
+    m_cur(&m_streams[0]),
+    m_clock(0),
+    m_adaptive(false),
+    m_window_bytes(NO_LIMIT),
+    m_hit_bytes(0),
+    m_wasted_bytes(0),
     m_pending(0),
     m_pending_lock("Readahead::m_pending_lock"),
     m_pending_cond() {
@@ -43,38 +58,106 @@ Readahead::extent_t Readahead::update(uint64_t offset, uint64_t length, uint64_t
   return extent;
 }
 
+Readahead::Stream *Readahead::_find_stream(uint64_t offset, uint64_t length) {
+  for (vector<Stream>::iterator p = m_streams.begin(); p != m_streams.end(); ++p) {
+    if (p->gap == 0 && offset == p->last_pos) {
+      return &*p;
+    }
+  }
+  if (m_streams.size() == 1) {
+    return NULL;
+  }
+  // a constant stride; the gap is fixed by the second read of a stream
+  for (vector<Stream>::iterator p = m_streams.begin(); p != m_streams.end(); ++p) {
+    if (offset <= p->last_pos || offset - p->last_pos > length) {
+      continue;
+    }
+    if (p->nr_consec_read == 0) {
+      p->gap = offset - p->last_pos;
+      return &*p;
+    }
+    if (offset - p->last_pos == p->gap) {
+      return &*p;
+    }
+  }
+  return NULL;
+}
+
+void Readahead::_end_stream(Stream *s) {
+  if (s->readahead_bytes == 0) {
+    return;
+  }
+  uint64_t wasted = s->readahead_bytes - s->hit_bytes;
+  m_wasted_bytes += wasted;
+  if (!m_adaptive) {
+    return;
+  }
+  uint64_t floor = MAX(m_readahead_min_bytes, m_readahead_max_bytes / 16);
+  if (s->hit_bytes < wasted) {
+    // mostly unread: these streams are shorter than our readahead
+    m_window_bytes = MAX(m_window_bytes / 2, floor);
+  } else if (wasted < s->readahead_bytes / 8) {
+    m_window_bytes = MIN(m_window_bytes * 2, m_readahead_max_bytes);
+  }
+}
+
 void Readahead::_observe_read(uint64_t offset, uint64_t length) {
-  if (offset == m_last_pos) {
-    m_nr_consec_read++;
-    m_consec_read_bytes += length;
+  Stream *s = _find_stream(offset, length);
+  if (s) {
+    s->nr_consec_read++;
+    s->consec_read_bytes += length;
+    if (offset < s->readahead_pos && offset + length > s->readahead_start) {
+      uint64_t hit = MIN(offset + length, s->readahead_pos) -
+	MAX(offset, s->readahead_start);
+      s->hit_bytes = MIN(s->hit_bytes + hit, s->readahead_bytes);
+      m_hit_bytes += hit;
+    }
   } else {
-    m_nr_consec_read = 0;
-    m_consec_read_bytes = 0;
-    m_readahead_trigger_pos = 0;
-    m_readahead_size = 0;
+    // replace the least recently used stream, sparing established ones
+    s = &m_streams[0];
+    for (vector<Stream>::iterator p = m_streams.begin(); p != m_streams.end(); ++p) {
+      bool p_single = (p->nr_consec_read == 0);
+      bool s_single = (s->nr_consec_read == 0);
+      if (p_single != s_single) {
+	if (p_single) {
+	  s = &*p;
+	}
+      } else if (p->last_used < s->last_used) {
+	s = &*p;
+      }
+    }
+    _end_stream(s);
+    *s = Stream();
   }
-  m_last_pos = offset + length;
+  s->last_pos = offset + length;
+  s->last_used = ++m_clock;
+  m_cur = s;
 }
 
 Readahead::extent_t Readahead::_compute_readahead(uint64_t limit) {
+  Stream *s = m_cur;
   uint64_t readahead_offset = 0;
   uint64_t readahead_length = 0;
-  if (m_nr_consec_read >= m_trigger_requests) {
+  if (s->nr_consec_read >= m_trigger_requests) {
     // currently reading sequentially
-    if (m_last_pos >= m_readahead_trigger_pos) {
+    if (s->last_pos >= s->readahead_trigger_pos) {
       // need to read ahead
-      if (m_readahead_size == 0) {
+      if (s->readahead_size == 0) {
 	// initial readahead trigger
-	m_readahead_size = m_consec_read_bytes;
-	m_readahead_pos = m_last_pos;
+	s->readahead_size = s->consec_read_bytes;
+	s->readahead_pos = s->last_pos;
+	s->readahead_start = s->last_pos;
       } else {
 	// continuing readahead trigger
-	m_readahead_size *= 2;
+	s->readahead_size *= 2;
+      }
+      s->readahead_size = MAX(s->readahead_size, m_readahead_min_bytes);
+      s->readahead_size = MIN(s->readahead_size, m_readahead_max_bytes);
+      if (m_adaptive) {
+	s->readahead_size = MIN(s->readahead_size, m_window_bytes);
       }
-      m_readahead_size = MAX(m_readahead_size, m_readahead_min_bytes);
-      m_readahead_size = MIN(m_readahead_size, m_readahead_max_bytes);
-      readahead_offset = m_readahead_pos;
-      readahead_length = m_readahead_size;
+      readahead_offset = s->readahead_pos;
+      readahead_length = s->readahead_size;
 
       // Snap to the first alignment possible
       uint64_t readahead_end = readahead_offset + readahead_length;
@@ -96,15 +179,16 @@ Readahead::extent_t Readahead::_compute_readahead(uint64_t limit) {
 	  readahead_length = align_next - readahead_offset;
 	  break;
 	}
-	// Note that m_readahead_size should remain unadjusted.
+	// Note that readahead_size should remain unadjusted.
       }
 
-      if (m_readahead_pos + readahead_length > limit) {
-	readahead_length = limit - m_readahead_pos;
+      if (s->readahead_pos + readahead_length > limit) {
+	readahead_length = limit - s->readahead_pos;
       }
 
-      m_readahead_trigger_pos = m_readahead_pos + readahead_length / 2;
-      m_readahead_pos += readahead_length;
+      s->readahead_trigger_pos = s->readahead_pos + readahead_length / 2;
+      s->readahead_pos += readahead_length;
+      s->readahead_bytes += readahead_length;
     }
   }
   return extent_t(readahead_offset, readahead_length);
@@ -151,6 +235,30 @@ void Readahead::set_min_readahead_size(uint64_t min_readahead_size) {
 void Readahead::set_max_readahead_size(uint64_t max_readahead_size) {
   m_lock.Lock();
   m_readahead_max_bytes = max_readahead_size;
+  m_window_bytes = max_readahead_size;
+  m_lock.Unlock();
+}
+
+void Readahead::set_max_streams(unsigned max_streams) {
+  m_lock.Lock();
+  m_streams.assign(max_streams ? max_streams : 1, Stream());
+  m_cur = &m_streams[0];
+  m_lock.Unlock();
+}
+
+void Readahead::set_adaptive(bool adaptive) {
+  m_lock.Lock();
+  m_adaptive = adaptive;
+  m_window_bytes = m_readahead_max_bytes;
+  m_lock.Unlock();
+}
+
+void Readahead::get_stats(uint64_t *hit_bytes, uint64_t *wasted_bytes) {
+  m_lock.Lock();
+  *hit_bytes = m_hit_bytes;
+  *wasted_bytes = m_wasted_bytes;
+  m_hit_bytes = 0;
+  m_wasted_bytes = 0;
   m_lock.Unlock();
 }
 
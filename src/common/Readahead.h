@@ -14,6 +14,13 @@
 
    Minimum and maximum readahead sizes may be violated by up to 50\% if alignment is enabled.
    Minimum readahead size may be violated if the end of the readahead target is reached.
+
+   By default a single sequential stream is tracked, and any other read restarts it.
+   With set_max_streams(), several streams are tracked at once, so that interleaved
+   sequential scans each trigger readahead, and reads that skip a constant gap no
+   larger than themselves also form a stream.  With set_adaptive(), the readahead
+   size is additionally capped by a window that shrinks when streams end with most
+   of their readahead unread, and grows back when readahead is mostly read.
  */
 class Readahead {
 public:
@@ -86,6 +93,24 @@ public:
    */
   void set_max_readahead_size(uint64_t max_readahead_size);
 
+  /**
+     Sets the number of read streams tracked at once.
+     When a read does not continue any stream, it starts a new one in place of
+     the least recently used stream, preferring streams of a single read.
+   */
+  void set_max_streams(unsigned max_streams);
+
+  /**
+     Sets whether the readahead size adapts to how much readahead is read.
+   */
+  void set_adaptive(bool adaptive);
+
+  /**
+     Returns the number of readahead bytes that were read, and the number that
+     were not read before their stream ended, since the last call.
+   */
+  void get_stats(uint64_t *hit_bytes, uint64_t *wasted_bytes);
+
   /**
      Sets the alignment units.
      If the end point of a readahead request can be aligned to an alignment unit
@@ -95,6 +120,42 @@ public:
   void set_alignments(const std::vector<uint64_t> &alignments);
 
 private:
+  /// State of one read stream
+  struct Stream {
+    /// Number of consecutive read requests in the stream
+    int nr_consec_read;
+
+    /// Number of bytes read in the stream
+    uint64_t consec_read_bytes;
+
+    /// Position of the read stream
+    uint64_t last_pos;
+
+    /// Bytes skipped between the reads of a strided stream
+    uint64_t gap;
+
+    /// Position of the first readahead of the stream
+    uint64_t readahead_start;
+
+    /// Position of the readahead stream
+    uint64_t readahead_pos;
+
+    /// When readahead is already triggered and the read stream crosses this point, readahead is continued
+    uint64_t readahead_trigger_pos;
+
+    /// Size of the next readahead request (barring changes due to alignment, etc.)
+    uint64_t readahead_size;
+
+    /// Bytes of readahead issued, and read, for the stream
+    uint64_t readahead_bytes;
+    uint64_t hit_bytes;
+
+    /// Value of m_clock when the stream was last read
+    uint64_t last_used;
+
+    Stream();
+  };
+
   /**
      Records that a read request has been received.
      m_lock must be held while calling.
@@ -102,7 +163,20 @@ private:
   void _observe_read(uint64_t offset, uint64_t length);
 
   /**
-     Computes the next readahead request.
+     Finds the stream a read continues, or NULL.
+     m_lock must be held while calling.
+   */
+  Stream *_find_stream(uint64_t offset, uint64_t length);
+
+  /**
+     Accounts for the unread readahead of a stream that is being replaced,
+     and adapts the readahead window to it.
+     m_lock must be held while calling.
+   */
+  void _end_stream(Stream *s);
+
+  /**
+     Computes the next readahead request for the most recently read stream.
      m_lock must be held while calling.
   */
   extent_t _compute_readahead(uint64_t limit);
@@ -122,23 +196,24 @@ private:
   /// Held while reading/modifying any state except m_pending
   Mutex m_lock;
 
-  /// Number of consecutive read requests in the current sequential stream
-  int m_nr_consec_read;
+  /// Tracked read streams; there is always at least one
+  std::vector<Stream> m_streams;
 
-  /// Number of bytes read in the current sequenial stream
-  uint64_t m_consec_read_bytes;
+  /// Stream of the most recent read
+  Stream *m_cur;
 
-  /// Position of the read stream
-  uint64_t m_last_pos;
+  /// Incremented on every read, to find the least recently used stream
+  uint64_t m_clock;
 
-  /// Position of the readahead stream
-  uint64_t m_readahead_pos;
+  /// Whether m_window_bytes limits the readahead size
+  bool m_adaptive;
 
-  /// When readahead is already triggered and the read stream crosses this point, readahead is continued
-  uint64_t m_readahead_trigger_pos;
+  /// Current limit of the readahead size, if adaptive
+  uint64_t m_window_bytes;
 
-  /// Size of the next readahead request (barring changes due to alignment, etc.)
-  uint64_t m_readahead_size;
+  /// Readahead bytes read, and not read, since the last get_stats()
+  uint64_t m_hit_bytes;
+  uint64_t m_wasted_bytes;
 
   /// Number of pending readahead requests, as determined by inc_pending() and dec_pending()
   int m_pending;
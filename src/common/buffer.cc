@@ -734,12 +734,21 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
   bool buffer::ptr::is_zero() const
   {
     const char *data = c_str();
-    for (size_t p = 0; p < _len; p++) {
+    size_t len = _len;
+
+    // check a small prefix byte by byte; once it is known to be zero,
+    // comparing the buffer against itself shifted by that prefix checks
+    // the rest, and lets the (vectorized) libc memcmp do the work.
+    const size_t prefix = 16;
+    size_t n = len < prefix ? len : prefix;
+    for (size_t p = 0; p < n; p++) {
       if (data[p] != 0) {
 	return false;
       }
     }
-    return true;
+    if (len <= prefix)
+      return true;
+    return memcmp(data, data + prefix, len - prefix) == 0;
   }
 
   void buffer::ptr::append(char c)
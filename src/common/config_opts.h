@@ -154,9 +154,11 @@ OPTION(mon_sync_fs_threshold, OPT_INT, 5)   // sync() when writing this many obj
 OPTION(mon_compact_on_start, OPT_BOOL, false)  // compact leveldb on ceph-mon start
 OPTION(mon_compact_on_bootstrap, OPT_BOOL, false)  // trigger leveldb compaction on bootstrap
 OPTION(mon_compact_on_trim, OPT_BOOL, true)       // compact (a prefix) when we trim old states
+OPTION(mon_store_cache_size, OPT_U64, 32 << 20)  // bytes of recently read/written store values to cache in memory
 OPTION(mon_tick_interval, OPT_INT, 5)
 OPTION(mon_subscribe_interval, OPT_DOUBLE, 300)
 OPTION(mon_delta_reset_interval, OPT_DOUBLE, 10)   // seconds of inactivity before we reset the pg delta to 0
+OPTION(mon_osd_cache_size, OPT_INT, 10)  // number of encoded osdmaps (and incrementals) to cache
 OPTION(mon_osd_laggy_halflife, OPT_INT, 60*60)        // (seconds) how quickly our laggy estimations decay
 OPTION(mon_osd_laggy_weight, OPT_DOUBLE, .3)          // weight for new 'samples's in laggy estimations
 OPTION(mon_osd_adjust_heartbeat_grace, OPT_BOOL, true)    // true if we should scale based on laggy estimations
@@ -217,6 +219,7 @@ OPTION(mon_data_size_warn, OPT_U64, 15*1024*1024*1024) // issue a warning when t
 OPTION(mon_config_key_max_entry_size, OPT_INT, 4096) // max num bytes per config-key entry
 OPTION(mon_sync_timeout, OPT_DOUBLE, 60.0)
 OPTION(mon_sync_max_payload_size, OPT_U32, 1048576) // max size for a sync chunk payload (say, 1MB)
+OPTION(mon_sync_max_chunks_in_flight, OPT_INT, 4) // chunk requests a sync requester keeps outstanding
 OPTION(mon_sync_debug, OPT_BOOL, false) // enable sync-specific debug
 OPTION(mon_sync_debug_leader, OPT_INT, -1) // monitor to be used as the sync leader
 OPTION(mon_sync_debug_provider, OPT_INT, -1) // monitor to be used as the sync provider
@@ -241,6 +244,7 @@ OPTION(paxos_stash_full_interval, OPT_INT, 25)   // how often (in commits) to st
 OPTION(paxos_max_join_drift, OPT_INT, 10) // max paxos iterations before we must first sync the monitor stores
 OPTION(paxos_propose_interval, OPT_DOUBLE, 1.0)  // gather updates for this long before proposing a map update
 OPTION(paxos_min_wait, OPT_DOUBLE, 0.05)  // min time to gather updates for after period of inactivity
+OPTION(paxos_max_batch_proposals, OPT_INT, 16)  // max queued proposals to fold into a single paxos round
 OPTION(paxos_min, OPT_INT, 500)       // minimum number of paxos states to keep around
 OPTION(paxos_trim_min, OPT_INT, 250)  // number of extra proposals tolerated before trimming
 OPTION(paxos_trim_max, OPT_INT, 500) // max number of extra proposals to trim at a time
@@ -310,6 +314,7 @@ OPTION(objecter_inflight_op_bytes, OPT_U64, 1024*1024*100) // max in-flight data
 OPTION(objecter_inflight_ops, OPT_U64, 1024)               // max in-flight ios
 OPTION(objecter_completion_locks_per_session, OPT_U64, 32) // num of completion locks per each session, for serializing same object responses
 OPTION(objecter_inject_no_watch_ping, OPT_BOOL, false)   // suppress watch pings
+OPTION(objecter_balance_reads_by_latency, OPT_BOOL, false) // send balanced/localized reads of clean replicated pgs to the least loaded replica
 
 OPTION(journaler_allow_split_entries, OPT_BOOL, true)
 OPTION(journaler_write_head_interval, OPT_INT, 15)
@@ -442,6 +447,9 @@ OPTION(osd_agent_delay_time, OPT_FLOAT, 5.0)
 
 // decay atime and hist histograms after how many objects go by
 OPTION(osd_agent_hist_halflife, OPT_INT, 1000)
+OPTION(osd_agent_temp_sketch_width, OPT_INT, 0) // counters per row of the per-pg temperature sketch (e.g. 1024); 0 disables it and keeps atime based eviction
+OPTION(osd_agent_temp_sketch_depth, OPT_INT, 4)
+OPTION(osd_agent_temp_halflife, OPT_DOUBLE, 600) // seconds
 
 // must be this amount over the threshold to enable,
 // this amount below the threshold to disable.
@@ -496,10 +504,14 @@ OPTION(osd_tier_default_cache_hit_set_count, OPT_INT, 4)
 OPTION(osd_tier_default_cache_hit_set_period, OPT_INT, 1200)
 OPTION(osd_tier_default_cache_hit_set_type, OPT_STR, "bloom")
 OPTION(osd_tier_default_cache_min_read_recency_for_promote, OPT_INT, 1) // number of recent HitSets the object must appear in to be promoted (on read)
+OPTION(osd_tier_promote_min_temp, OPT_DOUBLE, 0) // decayed hits an object needs to be promoted on read; 0 to use the pool's hit set recency instead
 
 OPTION(osd_map_dedup, OPT_BOOL, true)
 OPTION(osd_map_max_advance, OPT_INT, 200) // make this < cache_size!
 OPTION(osd_map_cache_size, OPT_INT, 500)
+OPTION(osd_map_full_checkpoint_interval, OPT_INT, 1) // store every Nth full map and rebuild the rest from incrementals; 1 stores all of them. Older OSDs cannot read a store written with N > 1
+OPTION(osd_map_pg_mapping_cache, OPT_BOOL, true) // cache crush placements with each osdmap (osd and objecter)
+OPTION(osd_pg_object_context_cache_count, OPT_INT, 64)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_map_share_max_epochs, OPT_INT, 100)  // cap on # of inc maps we send to peers, clients
 OPTION(osd_inject_bad_map_crc_probability, OPT_FLOAT, 0)
@@ -569,6 +581,7 @@ OPTION(osd_scrub_min_interval, OPT_FLOAT, 60*60*24)    // if load is low
 OPTION(osd_scrub_max_interval, OPT_FLOAT, 7*60*60*24)  // regardless of load
 OPTION(osd_scrub_chunk_min, OPT_INT, 5)
 OPTION(osd_scrub_chunk_max, OPT_INT, 25)
+OPTION(osd_scrub_hash_tree_depth, OPT_INT, 0) // if > 0, replicated pool replicas answer chunky scrub with a hash tree of 2^depth leaves; pair with a larger osd_scrub_chunk_max
 OPTION(osd_scrub_sleep, OPT_FLOAT, 0)   // sleep between [deep]scrub ops
 OPTION(osd_deep_scrub_interval, OPT_FLOAT, 60*60*24*7) // once a week
 OPTION(osd_deep_scrub_stride, OPT_INT, 524288)
@@ -589,6 +602,8 @@ OPTION(osd_pg_epoch_persisted_max_stale, OPT_U32, 200)
 OPTION(osd_min_pg_log_entries, OPT_U32, 3000)  // number of entries to keep in the pg log when trimming it
 OPTION(osd_max_pg_log_entries, OPT_U32, 10000) // max entries, say when degraded, before we trim
 OPTION(osd_pg_log_trim_min, OPT_U32, 100)
+OPTION(osd_pg_log_batched, OPT_BOOL, false) // store the pg log as one omap key per write batch rather than per entry
+OPTION(osd_pg_log_batch_max_entries, OPT_U32, 128) // max entries per batch when the whole log is rewritten
 OPTION(osd_op_complaint_time, OPT_FLOAT, 30) // how many seconds old makes an op complaint-worthy
 OPTION(osd_command_max_records, OPT_INT, 256)
 OPTION(osd_max_pg_blocked_by, OPT_U32, 16)    // max peer osds to report that are blocking our progress
@@ -805,6 +820,10 @@ OPTION(journal_discard, OPT_BOOL, false) //using ssd disk as journal, whether su
 
 OPTION(rados_mon_op_timeout, OPT_DOUBLE, 0) // how many seconds to wait for a response from the monitor before returning an error from a rados operation. 0 means on limit.
 OPTION(rados_osd_op_timeout, OPT_DOUBLE, 0) // how many seconds to wait for a response from osds before returning an error from a rados operation. 0 means no limit.
+OPTION(rados_op_batching, OPT_BOOL, false) // default for IoCtx::set_op_batching(): coalesce aio writes to an object while an earlier one is in flight
+OPTION(rados_op_batch_max_ops, OPT_INT, 64) // send a batch once this many ops are queued for the object
+OPTION(rados_op_batch_max_bytes, OPT_U64, 1<<20) // send a batch once this much data is queued for the object; larger ops are never batched
+OPTION(rados_striper_lockless_reads, OPT_BOOL, false) // let libradosstriper reads skip the shared lock on the striped object unless a truncation or removal holds it exclusively; a trunc/remove starting after that check may then run concurrently with the data reads, and the read may then return zeros in place of the truncated or removed data
 
 OPTION(rbd_cache, OPT_BOOL, true) // whether to enable caching (writeback unless rbd_cache_max_dirty is 0)
 OPTION(rbd_cache_writethrough_until_flush, OPT_BOOL, true) // whether to make writeback caching writethrough until flush is called, to be sure the user of librbd will send flushs so that writeback is safe
@@ -814,7 +833,12 @@ OPTION(rbd_cache_target_dirty, OPT_LONGLONG, 16<<20) // target dirty limit in by
 OPTION(rbd_cache_max_dirty_age, OPT_FLOAT, 1.0)      // seconds in cache before writeback starts
 OPTION(rbd_cache_max_dirty_object, OPT_INT, 0)       // dirty limit for objects - set to 0 for auto calculate from rbd_cache_size
 OPTION(rbd_cache_block_writes_upfront, OPT_BOOL, false) // whether to block writes to the cache before the aio_write call completes (true), or block before the aio completion is called (false)
-OPTION(rbd_concurrent_management_ops, OPT_INT, 10) // how many operations can be in flight for a management operation like deleting or resizing an image
+OPTION(rbd_cache_shards, OPT_INT, 1) // number of independently locked cache shards per image; size and dirty limits are split evenly between them
+OPTION(rbd_persistent_cache_path, OPT_STR, "") // file, block device or directory holding a persistent write log for writable images; empty to disable
+OPTION(rbd_persistent_cache_size, OPT_LONGLONG, 1<<30) // size in bytes of a newly created persistent write log file
+OPTION(rbd_persistent_cache_writeback_ops, OPT_INT, 16) // writes from the persistent write log in flight to the cluster at once
+OPTION(rbd_persistent_cache_debug_skip_writeback, OPT_BOOL, false) // testing only: while set, don't write the persistent write log back, and on close leave it to be replayed as if the client had crashed
+OPTION(rbd_concurrent_management_ops, OPT_INT, 10) // how many operations can be in flight for a management operation like deleting or resizing an image, or for copying, exporting or importing one
 OPTION(rbd_balance_snap_reads, OPT_BOOL, false)
 OPTION(rbd_localize_snap_reads, OPT_BOOL, false)
 OPTION(rbd_balance_parent_reads, OPT_BOOL, false)
@@ -822,6 +846,8 @@ OPTION(rbd_localize_parent_reads, OPT_BOOL, true)
 OPTION(rbd_readahead_trigger_requests, OPT_INT, 10) // number of sequential requests necessary to trigger readahead
 OPTION(rbd_readahead_max_bytes, OPT_LONGLONG, 512 * 1024) // set to 0 to disable readahead
 OPTION(rbd_readahead_disable_after_bytes, OPT_LONGLONG, 50 * 1024 * 1024) // how many bytes are read in total before readahead is disabled
+OPTION(rbd_readahead_max_streams, OPT_INT, 4) // number of interleaved sequential or strided read streams tracked per image
+OPTION(rbd_readahead_adaptive, OPT_BOOL, true) // shrink the readahead size when readahead goes unread, and grow it back when it is read
 
 /*
  * The following options change the behavior for librbd's image creation methods that
@@ -843,7 +869,7 @@ OPTION(rbd_default_format, OPT_INT, 1)
 OPTION(rbd_default_order, OPT_INT, 22)
 OPTION(rbd_default_stripe_count, OPT_U64, 0) // changing requires stripingv2 feature
 OPTION(rbd_default_stripe_unit, OPT_U64, 0) // changing to non-object size requires stripingv2 feature
-OPTION(rbd_default_features, OPT_INT, 3) // 1 for layering, 3 for layering+stripingv2. only applies to format 2 images
+OPTION(rbd_default_features, OPT_INT, 3) // 1 for layering, 3 for layering+stripingv2, 7 to add the object map. only applies to format 2 images
 
 OPTION(nss_db_path, OPT_STR, "") // path to nss db
 
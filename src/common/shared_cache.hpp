@@ -149,6 +149,21 @@ public:
     }
   }
 
+  /// drop the cache's own references; entries in use elsewhere remain
+  void clear() {
+    list<VPtr> to_release;
+    {
+      Mutex::Locker l(lock);
+      for (typename list<pair<K, VPtr> >::iterator i = lru.begin();
+	   i != lru.end();
+	   ++i)
+	to_release.push_back(i->second);
+      contents.clear();
+      lru.clear();
+      size = 0;
+    }
+  }
+
   void set_size(size_t new_size) {
     list<VPtr> to_release;
     {
@@ -164,6 +179,18 @@ public:
     return weak_refs.begin()->first;
   }
 
+  /// get refs to every live value, without touching the lru
+  void get_all(map<K, VPtr> *out) {
+    Mutex::Locker l(lock);
+    for (typename map<K, pair<WeakVPtr, V*> >::iterator i = weak_refs.begin();
+	 i != weak_refs.end();
+	 ++i) {
+      VPtr val = i->second.first.lock();
+      if (val)
+	out->insert(make_pair(i->first, val));
+    }
+  }
+
   VPtr lower_bound(const K& key) {
     VPtr val;
     list<VPtr> to_release;
@@ -219,6 +246,69 @@ public:
     return val;
   }
 
+  /**
+   * Looks up key, inserting a default constructed value if it is not
+   * present, and bumps it to the front of the LRU.
+   */
+  VPtr lookup_or_create(const K &key) {
+    VPtr val;
+    list<VPtr> to_release;
+    {
+      Mutex::Locker l(lock);
+      ++waiting;
+      bool retry = false;
+      do {
+	retry = false;
+	typename map<K, pair<WeakVPtr, V*> >::iterator i = weak_refs.find(key);
+	if (i != weak_refs.end()) {
+	  val = i->second.first.lock();
+	  if (val) {
+	    lru_add(key, val, &to_release);
+	  } else {
+	    retry = true;
+	  }
+	}
+	if (retry)
+	  cond.Wait(lock);
+      } while (retry);
+      if (!val) {
+	V *value = new V();
+	val = VPtr(value, Cleanup(this, key));
+	weak_refs.insert(make_pair(key, make_pair(val, value)));
+	lru_add(key, val, &to_release);
+      }
+      --waiting;
+    }
+    return val;
+  }
+
+  /// true if no value is referenced, by the cache or by anyone else
+  bool empty() {
+    Mutex::Locker l(lock);
+    return weak_refs.empty();
+  }
+
+  /// next live entry with a key greater than key, cached or not
+  bool get_next(const K &key, pair<K, VPtr> *next) {
+    pair<K, VPtr> r;
+    {
+      Mutex::Locker l(lock);
+      VPtr next_val;
+      typename map<K, pair<WeakVPtr, V*> >::iterator i =
+	weak_refs.upper_bound(key);
+      while (i != weak_refs.end() &&
+	     !(next_val = i->second.first.lock()))
+	++i;
+      if (i == weak_refs.end())
+	return false;
+      if (next)
+	r = make_pair(i->first, next_val);
+    }
+    if (next)
+      *next = r;
+    return true;
+  }
+
   /***
    * Inserts a key if not present, or bumps it to the front of the LRU if
    * it is, and then gives you a reference to the value. If the key already
@@ -1,9 +1,45 @@
 
 #include "CrushTester.h"
+#include "common/Thread.h"
+#include "common/errno.h"
 
 #include <algorithm>
+#include <math.h>
 #include <stdlib.h>
 
+// don't bother spinning up a thread for fewer inputs than this
+#define CRUSH_TESTER_MIN_X_PER_THREAD 1024
+
+namespace {
+  /*
+   * Maps a contiguous slice of inputs.  crush_do_rule keeps the uniform
+   * bucket permutation and the choose_tries profile in the map itself,
+   * which is why CrushWrapper::do_rule takes mapper_lock; giving each
+   * thread its own decoded copy of the map lets them run unserialized.
+   */
+  class CrushMapperThread : public Thread {
+    CrushWrapper crush;
+    int ruleno, nr;
+    const vector<__u32>& weight;
+    int first, last;
+    vector<int> *out;
+
+  public:
+    CrushMapperThread(bufferlist& bl, int r, int n, const vector<__u32>& w,
+		      int f, int l, vector<int> *o)
+      : ruleno(r), nr(n), weight(w), first(f), last(l), out(o) {
+      bufferlist::iterator p = bl.begin();
+      crush.decode(p);
+    }
+
+    void *entry() {
+      for (int x = first; x <= last; x++)
+	crush.do_rule(ruleno, x, out[x - first], nr, weight);
+      return NULL;
+    }
+  };
+}
+
 
 void CrushTester::set_device_weight(int dev, float f)
 {
@@ -467,6 +503,13 @@ int CrushTester::test()
       for (unsigned i = 0; i < num_devices; i++)
         num_objects_expected[i] = (proportional_weights[i]*expected_objects);
 
+      // map everything up front (possibly in parallel); the mappings are
+      // then consumed in order below, so the output does not depend on
+      // the number of threads
+      vector< vector<int> > mappings;
+      if (use_crush)
+        map_range(crush, r, nr, min_x, max_x, weight, mappings);
+
       for (int current_batch = 0; current_batch < num_batches; current_batch++) {
         if (current_batch == (num_batches - 1)) {
           batch_max = max_x;
@@ -489,7 +532,7 @@ int CrushTester::test()
           if (use_crush) {
             if (output_mappings)
 	      err << "CRUSH"; // prepend CRUSH to placement output
-            crush.do_rule(r, x, out, nr, weight);
+            out.swap(mappings[x - min_x]);
           } else {
             if (output_mappings)
 	      err << "RNG"; // prepend RNG to placement output to denote simulation
@@ -554,6 +597,9 @@ int CrushTester::test()
           }
         }
 
+      if (output_utilization_stats)
+        show_utilization_stats(r, nr, weight, per, num_objects_expected);
+
       if (output_data_file)
         for (unsigned i = 0; i < per.size(); i++) {
           vector_data_buffer_f.clear();
@@ -597,3 +643,249 @@ int CrushTester::test()
 
   return 0;
 }
+
+void CrushTester::map_range(CrushWrapper& c, int ruleno, int nr,
+			    int first, int last, const vector<__u32>& weight,
+			    vector< vector<int> >& out)
+{
+  int n = last - first + 1;
+  out.resize(n);
+
+  // the choose_tries profile lives in the map, so profile serially
+  int threads = min(num_threads, n / CRUSH_TESTER_MIN_X_PER_THREAD);
+  if (threads <= 1 || output_choose_tries) {
+    for (int x = first; x <= last; x++)
+      c.do_rule(ruleno, x, out[x - first], nr, weight);
+    return;
+  }
+
+  bufferlist bl;
+  c.encode(bl);
+  vector<CrushMapperThread*> workers;
+  for (int i = 0; i < threads; i++) {
+    int f = first + (int)((int64_t)n * i / threads);
+    int l = first + (int)((int64_t)n * (i + 1) / threads) - 1;
+    workers.push_back(new CrushMapperThread(bl, ruleno, nr, weight, f, l,
+					    &out[f - first]));
+    workers.back()->create();
+  }
+  for (vector<CrushMapperThread*>::iterator p = workers.begin();
+       p != workers.end();
+       ++p) {
+    (*p)->join();
+    delete *p;
+  }
+}
+
+void CrushTester::show_utilization_stats(int ruleno, int nr,
+					 const vector<__u32>& weight,
+					 const vector<int>& per,
+					 const vector<float>& expected)
+{
+  int devices = 0;
+  int64_t stored = 0;
+  double dev_sq = 0, binomial_var = 0, total_expected = 0;
+  int min_dev = -1, max_dev = -1;
+  double max_over = 0;
+  for (unsigned i = 0; i < per.size(); i++) {
+    if (weight[i] == 0)
+      continue;
+    devices++;
+    stored += per[i];
+    total_expected += expected[i];
+    double d = (double)per[i] - expected[i];
+    dev_sq += d * d;
+    if (min_dev < 0 || per[i] < per[min_dev])
+      min_dev = i;
+    if (max_dev < 0 || per[i] > per[max_dev])
+      max_dev = i;
+    if (expected[i] > 0 && (double)per[i] / expected[i] > max_over)
+      max_over = (double)per[i] / expected[i];
+  }
+  if (!devices)
+    return;
+  // each placement lands on device i with probability ~expected[i]/total,
+  // so a perfectly random placement has this much variance per device
+  for (unsigned i = 0; i < per.size(); i++)
+    if (weight[i] && total_expected > 0)
+      binomial_var += expected[i] * (1.0 - expected[i] / total_expected);
+
+  err << "rule " << ruleno << " (" << crush.get_rule_name(ruleno)
+      << ") num_rep " << nr << " utilization: " << devices << " devices, "
+      << stored << " stored, avg " << (double)stored / devices
+      << ", stddev " << sqrt(dev_sq / devices)
+      << " (expected " << sqrt(binomial_var / devices) << ")"
+      << ", min " << per[min_dev] << " (device " << min_dev << ")"
+      << ", max " << per[max_dev] << " (device " << max_dev << ")"
+      << ", max/expected " << max_over
+      << std::endl;
+}
+
+void CrushTester::get_compare_weights(CrushWrapper& other,
+				      vector<__u32>& weight)
+{
+  // both maps are evaluated with the same device weights
+  int max_devices = max(crush.get_max_devices(), other.get_max_devices());
+  weight.clear();
+  for (int o = 0; o < max_devices; o++) {
+    if (device_weight.count(o)) {
+      weight.push_back(device_weight[o]);
+    } else if (crush.check_item_present(o) || other.check_item_present(o)) {
+      weight.push_back(0x10000);
+    } else {
+      weight.push_back(0);
+    }
+  }
+  adjust_weights(weight);
+}
+
+void CrushTester::count_movement(CrushWrapper& a, CrushWrapper& b,
+				 int ruleno, int nr,
+				 const vector<__u32>& weight, int item,
+				 movement_t *m)
+{
+  vector< vector<int> > before, after;
+  map_range(a, ruleno, nr, min_x, max_x, weight, before);
+  map_range(b, ruleno, nr, min_x, max_x, weight, after);
+
+  for (unsigned i = 0; i < before.size(); i++) {
+    m->inputs++;
+    if (before[i] != after[i])
+      m->changed++;
+
+    bool had_item = false;
+    if (item != CRUSH_ITEM_NONE)
+      for (vector<int>::iterator p = before[i].begin();
+	   p != before[i].end();
+	   ++p)
+	if (*p != CRUSH_ITEM_NONE && a.subtree_contains(item, *p))
+	  had_item = true;
+
+    for (vector<int>::iterator p = after[i].begin();
+	 p != after[i].end();
+	 ++p) {
+      if (*p == CRUSH_ITEM_NONE)
+	continue;
+      m->placements++;
+      if (find(before[i].begin(), before[i].end(), *p) != before[i].end())
+	continue;
+      m->moved++;
+      if (item != CRUSH_ITEM_NONE && !had_item &&
+	  !b.subtree_contains(item, *p))
+	m->unrelated++;
+    }
+  }
+}
+
+int CrushTester::compare(CrushWrapper& other)
+{
+  if (min_rule < 0 || max_rule < 0) {
+    min_rule = 0;
+    max_rule = crush.get_max_rules() - 1;
+  }
+  if (min_x < 0 || max_x < 0) {
+    min_x = 0;
+    max_x = 1023;
+  }
+
+  vector<__u32> weight;
+  get_compare_weights(other, weight);
+
+  movement_t total;
+  for (int r = min_rule; r < crush.get_max_rules() && r <= max_rule; r++) {
+    if (!crush.rule_exists(r))
+      continue;
+    if (!other.rule_exists(r)) {
+      err << "rule " << r << " (" << crush.get_rule_name(r)
+	  << ") dne in the other map" << std::endl;
+      continue;
+    }
+    int minr = min_rep, maxr = max_rep;
+    if (min_rep < 0 || max_rep < 0) {
+      minr = crush.get_rule_mask_min_size(r);
+      maxr = crush.get_rule_mask_max_size(r);
+    }
+
+    for (int nr = minr; nr <= maxr; nr++) {
+      movement_t m;
+      count_movement(crush, other, r, nr, weight, CRUSH_ITEM_NONE, &m);
+      err << "rule " << r << " (" << crush.get_rule_name(r)
+	  << ") num_rep " << nr << ": " << m.changed << "/" << m.inputs
+	  << " mappings changed, " << m.moved << "/" << m.placements
+	  << " placements moved" << std::endl;
+      total.add(m);
+    }
+  }
+
+  err << "total: " << total.changed << "/" << total.inputs
+      << " mappings changed (" << (total.inputs ?
+				   100.0 * total.changed / total.inputs : 0)
+      << "%), " << total.moved << "/" << total.placements
+      << " placements moved (" << (total.placements ?
+				   100.0 * total.moved / total.placements : 0)
+      << "%)" << std::endl;
+  return 0;
+}
+
+int CrushTester::test_reweight(CephContext *cct, int item, float weight)
+{
+  if (min_rule < 0 || max_rule < 0) {
+    min_rule = 0;
+    max_rule = crush.get_max_rules() - 1;
+  }
+  if (min_x < 0 || max_x < 0) {
+    min_x = 0;
+    max_x = 1023;
+  }
+
+  bufferlist bl;
+  crush.encode(bl);
+
+  static const int algs[] = { CRUSH_BUCKET_STRAW, CRUSH_BUCKET_STRAW2 };
+  for (unsigned a = 0; a < sizeof(algs) / sizeof(algs[0]); a++) {
+    // the same map, with every straw(2) bucket switched to algs[a]
+    CrushWrapper before, after;
+    bufferlist::iterator p = bl.begin();
+    before.decode(p);
+    p = bl.begin();
+    after.decode(p);
+    for (int b = 0; b < crush.get_max_buckets(); b++) {
+      int id = -1 - b;
+      int alg = crush.get_bucket_alg(id);
+      if (alg != CRUSH_BUCKET_STRAW && alg != CRUSH_BUCKET_STRAW2)
+	continue;
+      before.bucket_set_alg(id, algs[a]);
+      after.bucket_set_alg(id, algs[a]);
+    }
+
+    int ret = after.adjust_item_weightf(cct, item, weight);
+    if (ret < 0) {
+      err << "unable to reweight item " << item << ": " << cpp_strerror(ret)
+	  << std::endl;
+      return ret;
+    }
+
+    vector<__u32> w;
+    get_compare_weights(after, w);
+
+    movement_t total;
+    for (int r = min_rule; r < crush.get_max_rules() && r <= max_rule; r++) {
+      if (!crush.rule_exists(r))
+	continue;
+      int minr = min_rep, maxr = max_rep;
+      if (min_rep < 0 || max_rep < 0) {
+	minr = crush.get_rule_mask_min_size(r);
+	maxr = crush.get_rule_mask_max_size(r);
+      }
+      for (int nr = minr; nr <= maxr; nr++)
+	count_movement(before, after, r, nr, w, item, &total);
+    }
+
+    err << crush_bucket_alg_name(algs[a]) << ": reweight item " << item
+	<< " to " << weight << ": " << total.changed << "/" << total.inputs
+	<< " mappings changed, " << total.moved << "/" << total.placements
+	<< " placements moved, " << total.unrelated
+	<< " of them between other items" << std::endl;
+  }
+  return 0;
+}
@@ -19,6 +19,7 @@ class CrushTester {
   int min_rep, max_rep;
 
   int num_batches;
+  int num_threads;
   bool use_crush;
 
   float mark_down_device_ratio;
@@ -30,6 +31,7 @@ class CrushTester {
   bool output_mappings;
   bool output_bad_mappings;
   bool output_choose_tries;
+  bool output_utilization_stats;
 
   bool output_data_file;
   bool output_csv;
@@ -74,6 +76,55 @@ class CrushTester {
    */
   int random_placement(int ruleno, vector<int>& out, int maxout, vector<__u32>& weight);
 
+  /*
+   * Map inputs first..last through ruleno on map c, storing the result for
+   * x in out[x - first].  With more than one thread the range is split into
+   * contiguous slices, each mapped on a private copy of the map.
+   */
+  void map_range(CrushWrapper& c, int ruleno, int nr, int first, int last,
+		 const vector<__u32>& weight, vector< vector<int> >& out);
+
+  struct movement_t {
+    int64_t inputs;      ///< inputs mapped
+    int64_t changed;     ///< inputs whose mapping changed
+    int64_t placements;  ///< placements in the new mappings
+    int64_t moved;       ///< placements not present in the old mapping
+    int64_t unrelated;   ///< moved, though neither source nor target is
+                         ///  the item of interest
+    movement_t()
+      : inputs(0), changed(0), placements(0), moved(0), unrelated(0) {}
+    void add(const movement_t& o) {
+      inputs += o.inputs;
+      changed += o.changed;
+      placements += o.placements;
+      moved += o.moved;
+      unrelated += o.unrelated;
+    }
+  };
+
+  /*
+   * Device weights for comparing this map with other: devices present in
+   * either map are in, subject to --weight and the mark down ratios.
+   */
+  void get_compare_weights(CrushWrapper& other, vector<__u32>& weight);
+
+  /*
+   * Map the inputs through ruleno on both a and b and accumulate the
+   * differences in m.  Moves that involve neither item (or a device
+   * under it) in the old mapping nor as the new target are counted as
+   * unrelated; pass CRUSH_ITEM_NONE to skip that.
+   */
+  void count_movement(CrushWrapper& a, CrushWrapper& b, int ruleno, int nr,
+		      const vector<__u32>& weight, int item, movement_t *m);
+
+  /*
+   * Summarize how evenly ruleno spread the inputs, comparing the number of
+   * objects stored on each device with the number expected from its weight.
+   */
+  void show_utilization_stats(int ruleno, int nr, const vector<__u32>& weight,
+			      const vector<int>& per,
+			      const vector<float>& expected);
+
   // scaffolding to store data for off-line processing
    struct tester_data_set {
      vector <string> device_utilization;
@@ -171,6 +222,7 @@ public:
       min_x(-1), max_x(-1),
       min_rep(-1), max_rep(-1),
       num_batches(1),
+      num_threads(1),
       use_crush(true),
       mark_down_device_ratio(0.0),
       mark_down_bucket_ratio(1.0),
@@ -180,6 +232,7 @@ public:
       output_mappings(false),
       output_bad_mappings(false),
       output_choose_tries(false),
+      output_utilization_stats(false),
       output_data_file(false),
       output_csv(false),
       output_data_file_name("")
@@ -249,6 +302,13 @@ public:
     return output_choose_tries;
   }
 
+  void set_output_utilization_stats(bool b) {
+    output_utilization_stats = b;
+  }
+  bool get_output_utilization_stats() const {
+    return output_utilization_stats;
+  }
+
   void set_batches(int b) {
     num_batches = b;
   }
@@ -256,6 +316,13 @@ public:
     return num_batches;
   }
 
+  void set_num_threads(int n) {
+    num_threads = n > 0 ? n : 1;
+  }
+  int get_num_threads() const {
+    return num_threads;
+  }
+
   void set_random_placement() {
     use_crush = false;
   }
@@ -334,6 +401,20 @@ public:
   }
 
   int test();
+
+  /*
+   * Map the same inputs through this map and other, and report how many
+   * inputs changed mapping and how many placements moved to another
+   * device, i.e. the data movement a switch to other would cause.
+   */
+  int compare(CrushWrapper& other);
+
+  /*
+   * Reweight item and report the resulting data movement, once with all
+   * straw and straw2 buckets of the map built as straw buckets and once
+   * built as straw2 buckets.  Ideally only data to or from item moves.
+   */
+  int test_reweight(CephContext *cct, int item, float weight);
 };
 
 #endif
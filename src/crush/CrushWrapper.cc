@@ -63,6 +63,42 @@ bool CrushWrapper::is_v3_rule(unsigned ruleid) const
   return false;
 }
 
+bool CrushWrapper::has_v4_buckets() const
+{
+  for (int i=0; i<crush->max_buckets; ++i) {
+    crush_bucket *b = crush->buckets[i];
+    if (b && b->alg == CRUSH_BUCKET_STRAW2)
+      return true;
+  }
+  return false;
+}
+
+int CrushWrapper::bucket_set_alg(int id, int alg)
+{
+  crush_bucket *b = get_bucket(id);
+  if (IS_ERR(b))
+    return PTR_ERR(b);
+  if (b->alg == alg)
+    return 0;
+  if (b->alg == CRUSH_BUCKET_TREE || alg == CRUSH_BUCKET_TREE)
+    return -EINVAL;  // tree buckets don't store items by position
+
+  vector<int> items(b->size), weights(b->size);
+  for (unsigned i = 0; i < b->size; ++i) {
+    items[i] = b->items[i];
+    weights[i] = crush_get_bucket_item_weight(b, i);
+  }
+  crush_bucket *nb = crush_make_bucket(crush, alg, b->hash, b->type, b->size,
+				       items.empty() ? NULL : &items[0],
+				       weights.empty() ? NULL : &weights[0]);
+  if (!nb)
+    return -EINVAL;
+  nb->id = b->id;
+  crush->buckets[-1-id] = nb;
+  crush_destroy_bucket(b);
+  return 0;
+}
+
 int CrushWrapper::can_rename_item(const string& srcname,
                                   const string& dstname,
                                   ostream *ss) const
@@ -1075,6 +1111,12 @@ void CrushWrapper::encode(bufferlist& bl, bool lean) const
       }
       break;
 
+    case CRUSH_BUCKET_STRAW2:
+      for (unsigned j=0; j<crush->buckets[i]->size; j++) {
+	::encode((reinterpret_cast<crush_bucket_straw2*>(crush->buckets[i]))->item_weights[j], bl);
+      }
+      break;
+
     default:
       assert(0);
       break;
@@ -1223,6 +1265,9 @@ void CrushWrapper::decode_crush_bucket(crush_bucket** bptr, bufferlist::iterator
   case CRUSH_BUCKET_STRAW:
     size = sizeof(crush_bucket_straw);
     break;
+  case CRUSH_BUCKET_STRAW2:
+    size = sizeof(crush_bucket_straw2);
+    break;
   default:
     {
       char str[128];
@@ -1286,6 +1331,15 @@ void CrushWrapper::decode_crush_bucket(crush_bucket** bptr, bufferlist::iterator
     break;
   }
 
+  case CRUSH_BUCKET_STRAW2: {
+    crush_bucket_straw2* cbs = reinterpret_cast<crush_bucket_straw2*>(bucket);
+    cbs->item_weights = (__u32*)calloc(1, bucket->size * sizeof(__u32));
+    for (unsigned j = 0; j < bucket->size; ++j) {
+      ::decode(cbs->item_weights[j], blp);
+    }
+    break;
+  }
+
   default:
     // We should have handled this case in the first switch statement
     assert(0);
@@ -1395,6 +1449,7 @@ void CrushWrapper::dump_tunables(Formatter *f) const
   f->dump_int("require_feature_tunables3", (int)has_nondefault_tunables3());
   f->dump_int("has_v2_rules", (int)has_v2_rules());
   f->dump_int("has_v3_rules", (int)has_v3_rules());
+  f->dump_int("has_v4_buckets", (int)has_v4_buckets());
 }
 
 void CrushWrapper::dump_rules(Formatter *f) const
@@ -245,6 +245,7 @@ public:
   }
   bool has_v2_rules() const;
   bool has_v3_rules() const;
+  bool has_v4_buckets() const;
 
   bool is_v2_rule(unsigned ruleid) const;
   bool is_v3_rule(unsigned ruleid) const;
@@ -900,6 +901,18 @@ public:
     assert(b);
     return crush_add_bucket(crush, bucketno, b, idout);
   }
+
+  /**
+   * rebuild a bucket with a different algorithm
+   *
+   * The bucket keeps its id, type, hash, items and item weights; only the
+   * way items are chosen (and hence the mappings) change.
+   *
+   * @param id bucket id
+   * @param alg new CRUSH_BUCKET_* algorithm
+   * @return 0 on success, negative on error
+   */
+  int bucket_set_alg(int id, int alg);
   
   void finalize() {
     assert(crush);
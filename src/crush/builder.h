@@ -40,5 +40,10 @@ crush_make_straw_bucket(struct crush_map *map,
 			int hash, int type, int size,
 			int *items,
 			int *weights);
+struct crush_bucket_straw2 *
+crush_make_straw2_bucket(struct crush_map *map,
+			 int hash, int type, int size,
+			 int *items,
+			 int *weights);
 
 #endif
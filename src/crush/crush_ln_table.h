@@ -0,0 +1,225 @@
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_CRUSH_LN_H
+#define CEPH_CRUSH_LN_H
+
+/*
+ * Lookup tables for crush_ln() (see mapper.c), a fixed-point log2 used
+ * by straw2 buckets.  They are generated, not hand-written:
+ *
+ *  __RH_LH_tbl[2*k]     = 2^56 / (256 + 2*k)          (RH, k = 0..128)
+ *  __RH_LH_tbl[2*k + 1] = 2^48 * log2(1 + k/128)      (LH)
+ *  __LL_tbl[k]          = 2^48 * log2(1 + k/2^15)     (k = 0..255)
+ *
+ * all rounded to the nearest integer.  Placement depends on these
+ * exact values; never change them.
+ */
+
+static __s64 __RH_LH_tbl[128*2+2] = {
+	0x0001000000000000ull, 0x0000000000000000ull,
+	0x0000fe03f80fe040ull, 0x000002dfca16dde1ull,
+	0x0000fc0fc0fc0fc1ull, 0x000005b9e5a170b5ull,
+	0x0000fa232cf25214ull, 0x0000088e68ea899aull,
+	0x0000f83e0f83e0f8ull, 0x00000b5d69bac77full,
+	0x0000f6603d980f66ull, 0x00000e26fd5c8556ull,
+	0x0000f4898d5f85bbull, 0x000010eb389fa2a0ull,
+	0x0000f2b9d6480f2cull, 0x000013aa2fdd27f2ull,
+	0x0000f0f0f0f0f0f1ull, 0x00001663f6fac913ull,
+	0x0000ef2eb71fc434ull, 0x00001918a16e4633ull,
+	0x0000ed7303b5cc0full, 0x00001bc84240adacull,
+	0x0000ebbdb2a5c162ull, 0x00001e72ec117fa6ull,
+	0x0000ea0ea0ea0ea1ull, 0x00002118b119b4f4ull,
+	0x0000e865ac7b7604ull, 0x000023b9a32eaa57ull,
+	0x0000e6c2b4481cd8ull, 0x00002655d3c4f15cull,
+	0x0000e525982af70dull, 0x000028ed53f307efull,
+	0x0000e38e38e38e39ull, 0x00002b803473f7adull,
+	0x0000e1fc780e1fc8ull, 0x00002e0e85a9de05ull,
+	0x0000e070381c0e07ull, 0x0000309857a05e07ull,
+	0x0000dee95c4ca038ull, 0x0000331dba0efce2ull,
+	0x0000dd67c8a60dd6ull, 0x0000359ebc5b69d9ull,
+	0x0000dbeb61eed19cull, 0x0000381b6d9bb29cull,
+	0x0000da740da740daull, 0x00003a93dc9864b3ull,
+	0x0000d901b2036407ull, 0x00003d0817ce9cd5ull,
+	0x0000d79435e50d79ull, 0x00003f782d7204d0ull,
+	0x0000d62b80d62b81ull, 0x000041e42b6ec0c0ull,
+	0x0000d4c77b03531eull, 0x0000444c1f6b4c2eull,
+	0x0000d3680d3680d3ull, 0x000046b016ca47c2ull,
+	0x0000d20d20d20d21ull, 0x000049101eac381dull,
+	0x0000d0b69fcbd258ull, 0x00004b6c43f1366bull,
+	0x0000cf6474a8819full, 0x00004dc4933a9338ull,
+	0x0000ce168a772508ull, 0x0000501918ec6c11ull,
+	0x0000cccccccccccdull, 0x00005269e12f346eull,
+	0x0000cb8727c065c4ull, 0x000054b6f7f1325bull,
+	0x0000ca4587e6b74full, 0x0000570068e7ef5aull,
+	0x0000c907da4e8711ull, 0x000059463f919defull,
+	0x0000c7ce0c7ce0c8ull, 0x00005b8887367433ull,
+	0x0000c6980c6980c7ull, 0x00005dc74ae9fbedull,
+	0x0000c565c87b5f9dull, 0x00006002958c5871ull,
+	0x0000c4372f855d82ull, 0x0000623a71cb82c9ull,
+	0x0000c30c30c30c31ull, 0x0000646eea247c5cull,
+	0x0000c1e4bbd595f7ull, 0x000066a008e4788dull,
+	0x0000c0c0c0c0c0c1ull, 0x000068cdd829fd81ull,
+	0x0000bfa02fe80bfaull, 0x00006af861e5fc7dull,
+	0x0000be82fa0be830ull, 0x00006d1fafdce20bull,
+	0x0000bd6910470766ull, 0x00006f43cba79e41ull,
+	0x0000bc52640bc526ull, 0x00007164beb4a56dull,
+	0x0000bb3ee721a54eull, 0x000073829248e962ull,
+	0x0000ba2e8ba2e8baull, 0x0000759d4f80cba8ull,
+	0x0000b92143fa36f6ull, 0x000077b4ff5108d9ull,
+	0x0000b81702e05c0cull, 0x000079c9aa879d53ull,
+	0x0000b70fbb5a19beull, 0x00007bdb59cca389ull,
+	0x0000b60b60b60b61ull, 0x00007dea15a32c1bull,
+	0x0000b509e68a9b95ull, 0x00007ff5e66a0ffeull,
+	0x0000b40b40b40b41ull, 0x000081fed45cbcccull,
+	0x0000b30f63528918ull, 0x00008404e793fb82ull,
+	0x0000b21642c8590bull, 0x000086082806b1d5ull,
+	0x0000b11fd3b80b12ull, 0x000088089d8a9e47ull,
+	0x0000b02c0b02c0b0ull, 0x00008a064fd50f2aull,
+	0x0000af3addc680afull, 0x00008c01467b94bbull,
+	0x0000ae4c415c9883ull, 0x00008df988f4ae80ull,
+	0x0000ad602b580ad6ull, 0x00008fef1e987409ull,
+	0x0000ac7691840ac7ull, 0x000091e20ea1393eull,
+	0x0000ab8f69e2835aull, 0x000093d2602c2e60ull,
+	0x0000aaaaaaaaaaabull, 0x000095c01a39fbd7ull,
+	0x0000a9c84a47a07full, 0x000097ab43af59f9ull,
+	0x0000a8e83f5717c1ull, 0x00009993e355a4e5ull,
+	0x0000a80a80a80a81ull, 0x00009b79ffdb6c8bull,
+	0x0000a72f0539782aull, 0x00009d5d9fd5010bull,
+	0x0000a655c4392d7bull, 0x00009f3ec9bcfb81ull,
+	0x0000a57eb50295fbull, 0x0000a11d83f4c355ull,
+	0x0000a4a9cf1d9683ull, 0x0000a2f9d4c5103aull,
+	0x0000a3d70a3d70a4ull, 0x0000a4d3c25e68dcull,
+	0x0000a3065e3fae7dull, 0x0000a6ab52d99e76ull,
+	0x0000a237c32b16d0ull, 0x0000a8808c384548ull,
+	0x0000a16b312ea8fcull, 0x0000aa5374652a1cull,
+	0x0000a0a0a0a0a0a1ull, 0x0000ac241134c4eaull,
+	0x00009fd809fd80a0ull, 0x0000adf26865a8a2ull,
+	0x00009f1165e72548ull, 0x0000afbe7fa0f04dull,
+	0x00009e4cad23dd5full, 0x0000b1885c7aa982ull,
+	0x00009d89d89d89d9ull, 0x0000b35004723c46ull,
+	0x00009cc8e160c3fbull, 0x0000b5157cf2d078ull,
+	0x00009c09c09c09c1ull, 0x0000b6d8cb53b0caull,
+	0x00009b4c6f9ef03aull, 0x0000b899f4d8ab64ull,
+	0x00009a90e7d95bc6ull, 0x0000ba58feb2703bull,
+	0x000099d722dabde6ull, 0x0000bc15edfeed33ull,
+	0x0000991f1a515886ull, 0x0000bdd0c7c9a817ull,
+	0x00009868c809868dull, 0x0000bf89910c1679ull,
+	0x000097b425ed097bull, 0x0000c1404eadf384ull,
+	0x000097012e025c05ull, 0x0000c2f5058593d9ull,
+	0x0000964fda6c0965ull, 0x0000c4a7ba58377cull,
+	0x000095a02568095aull, 0x0000c65871da59deull,
+	0x000094f2094f2095ull, 0x0000c80730b00016ull,
+	0x0000944580944581ull, 0x0000c9b3fb6d0559ull,
+	0x0000939a85c4093aull, 0x0000cb5ed69565b0ull,
+	0x000092f113840498ull, 0x0000cd07c69d8702ull,
+	0x0000924924924925ull, 0x0000ceaecfea8086ull,
+	0x000091a2b3c4d5e7ull, 0x0000d053f6d26089ull,
+	0x000090fdbc090fdcull, 0x0000d1f73f9c70c1ull,
+	0x0000905a38633e07ull, 0x0000d398ae817906ull,
+	0x00008fb823ee08fcull, 0x0000d53847ac00a7ull,
+	0x00008f1779d9fdc4ull, 0x0000d6d60f388e42ull,
+	0x00008e78356d1409ull, 0x0000d8720935e643ull,
+	0x00008dda52023769ull, 0x0000da0c39a54804ull,
+	0x00008d3dcb08d3ddull, 0x0000dba4a47aa997ull,
+	0x00008ca29c046515ull, 0x0000dd3b4d9cf24bull,
+	0x00008c08c08c08c1ull, 0x0000ded038e633f3ull,
+	0x00008b70344a139cull, 0x0000e0636a23e2efull,
+	0x00008ad8f2fba938ull, 0x0000e1f4e5170d03ull,
+	0x00008a42f870566aull, 0x0000e384ad748f0eull,
+	0x000089ae4089ae41ull, 0x0000e512c6e54999ull,
+	0x0000891ac73ae982ull, 0x0000e69f35065448ull,
+	0x0000888888888889ull, 0x0000e829fb693045ull,
+	0x000087f78087f781ull, 0x0000e9b31d93f98full,
+	0x00008767ab5f34e4ull, 0x0000eb3a9f019750ull,
+	0x000086d905447a35ull, 0x0000ecc08321eb31ull,
+	0x0000864b8a7de6d2ull, 0x0000ee44cd59ffabull,
+	0x000085bf37612ceeull, 0x0000efc781043579ull,
+	0x0000853408534085ull, 0x0000f148a170700aull,
+	0x000084a9f9c8084bull, 0x0000f2c831e44116ull,
+	0x0000842108421084ull, 0x0000f446359b1354ull,
+	0x0000839930523fbeull, 0x0000f5c2afc65448ull,
+	0x000083126e978d50ull, 0x0000f73da38d9d4bull,
+	0x0000828cbfbeb9a0ull, 0x0000f8b7140edbb2ull,
+	0x0000820820820821ull, 0x0000fa2f045e7833ull,
+	0x000081848da8faf1ull, 0x0000fba577877d7dull,
+	0x0000810204081020ull, 0x0000fd1a708bbe12ull,
+	0x0000808080808081ull, 0x0000fe8df263f958ull,
+	0x0000800000000000ull, 0x0001000000000000ull
+};
+
+static __s64 __LL_tbl[256] = {
+	0x0000000000000000ull, 0x00000002e2a60a00ull, 0x00000005c5464ec6ull, 0x00000008a7e0ce68ull,
+	0x0000000b8a7588fdull, 0x0000000e6d047e9dull, 0x000000114f8daf5eull, 0x0000001432111b58ull,
+	0x00000017148ec2a2ull, 0x00000019f706a552ull, 0x0000001cd978c380ull, 0x0000001fbbe51d43ull,
+	0x000000229e4bb2b2ull, 0x0000002580ac83e4ull, 0x00000028630790f0ull, 0x0000002b455cd9edull,
+	0x0000002e27ac5ef3ull, 0x0000003109f62017ull, 0x00000033ec3a1d72ull, 0x00000036ce78571aull,
+	0x00000039b0b0cd26ull, 0x0000003c92e37faeull, 0x0000003f75106ec8ull, 0x0000004257379a8cull,
+	0x0000004539590310ull, 0x000000481b74a86cull, 0x0000004afd8a8ab6ull, 0x0000004ddf9aaa06ull,
+	0x00000050c1a50673ull, 0x00000053a3a9a013ull, 0x0000005685a876feull, 0x0000005967a18b4bull,
+	0x0000005c4994dd10ull, 0x0000005f2b826c65ull, 0x000000620d6a3961ull, 0x00000064ef4c441aull,
+	0x00000067d1288ca8ull, 0x0000006ab2ff1322ull, 0x0000006d94cfd79full, 0x00000070769ada36ull,
+	0x0000007358601afdull, 0x000000763a1f9a0cull, 0x000000791bd9577aull, 0x0000007bfd8d535eull,
+	0x0000007edf3b8dcfull, 0x00000081c0e406e3ull, 0x00000084a286beb2ull, 0x000000878423b553ull,
+	0x0000008a65baeadcull, 0x0000008d474c5f66ull, 0x0000009028d81306ull, 0x000000930a5e05d3ull,
+	0x00000095ebde37e5ull, 0x00000098cd58a953ull, 0x0000009baecd5a34ull, 0x0000009e903c4a9eull,
+	0x000000a171a57aa8ull, 0x000000a45308ea6aull, 0x000000a7346699fbull, 0x000000aa15be8971ull,
+	0x000000acf710b8e3ull, 0x000000afd85d2869ull, 0x000000b2b9a3d819ull, 0x000000b59ae4c80aull,
+	0x000000b87c1ff854ull, 0x000000bb5d55690cull, 0x000000be3e851a4bull, 0x000000c11faf0c27ull,
+	0x000000c400d33eb6ull, 0x000000c6e1f1b211ull, 0x000000c9c30a664eull, 0x000000cca41d5b83ull,
+	0x000000cf852a91c8ull, 0x000000d266320934ull, 0x000000d54733c1ddull, 0x000000d8282fbbdbull,
+	0x000000db0925f744ull, 0x000000ddea167430ull, 0x000000e0cb0132b5ull, 0x000000e3abe632eaull,
+	0x000000e68cc574e7ull, 0x000000e96d9ef8c1ull, 0x000000ec4e72be91ull, 0x000000ef2f40c66cull,
+	0x000000f21009106aull, 0x000000f4f0cb9ca2ull, 0x000000f7d1886b2bull, 0x000000fab23f7c1aull,
+	0x000000fd92f0cf89ull, 0x00000100739c658dull, 0x0000010354423e3cull, 0x0000010634e259afull,
+	0x00000109157cb7fcull, 0x0000010bf611593aull, 0x0000010ed6a03d80ull, 0x00000111b72964e4ull,
+	0x0000011497accf7eull, 0x00000117782a7d64ull, 0x0000011a58a26eaeull, 0x0000011d3914a372ull,
+	0x0000012019811bc7ull, 0x00000122f9e7d7c3ull, 0x00000125da48d77full, 0x00000128baa41b10ull,
+	0x0000012b9af9a28eull, 0x0000012e7b496e0full, 0x000001315b937dabull, 0x000001343bd7d178ull,
+	0x000001371c16698cull, 0x00000139fc4f4600ull, 0x0000013cdc8266e9ull, 0x0000013fbcafcc5full,
+	0x000001429cd77678ull, 0x000001457cf9654cull, 0x000001485d1598f0ull, 0x0000014b3d2c117dull,
+	0x0000014e1d3ccf08ull, 0x00000150fd47d1a9ull, 0x00000153dd4d1977ull, 0x00000156bd4ca687ull,
+	0x000001599d4678f2ull, 0x0000015c7d3a90ceull, 0x0000015f5d28ee32ull, 0x000001623d119134ull,
+	0x000001651cf479ecull, 0x00000167fcd1a870ull, 0x0000016adca91cd8ull, 0x0000016dbc7ad739ull,
+	0x000001709c46d7abull, 0x000001737c0d1e44ull, 0x000001765bcdab1cull, 0x000001793b887e49ull,
+	0x0000017c1b3d97e2ull, 0x0000017efaecf7feull, 0x00000181da969eb4ull, 0x00000184ba3a8c1aull,
+	0x0000018799d8c047ull, 0x0000018a79713b52ull, 0x0000018d5903fd52ull, 0x000001903891065eull,
+	0x000001931818568cull, 0x00000195f799edf3ull, 0x00000198d715ccaaull, 0x0000019bb68bf2c8ull,
+	0x0000019e95fc6064ull, 0x000001a175671593ull, 0x000001a454cc126eull, 0x000001a7342b570bull,
+	0x000001aa1384e381ull, 0x000001acf2d8b7e6ull, 0x000001afd226d451ull, 0x000001b2b16f38d9ull,
+	0x000001b590b1e595ull, 0x000001b86feeda9cull, 0x000001bb4f261803ull, 0x000001be2e579de3ull,
+	0x000001c10d836c52ull, 0x000001c3eca98366ull, 0x000001c6cbc9e336ull, 0x000001c9aae48bdaull,
+	0x000001cc89f97d67ull, 0x000001cf6908b7f5ull, 0x000001d248123b9bull, 0x000001d52716086eull,
+	0x000001d806141e86ull, 0x000001dae50c7dfaull, 0x000001ddc3ff26e0ull, 0x000001e0a2ec194full,
+	0x000001e381d3555eull, 0x000001e660b4db23ull, 0x000001e93f90aab6ull, 0x000001ec1e66c42cull,
+	0x000001eefd37279dull, 0x000001f1dc01d520ull, 0x000001f4bac6cccaull, 0x000001f799860eb4ull,
+	0x000001fa783f9af3ull, 0x000001fd56f3719eull, 0x0000020035a192cdull, 0x000002031449fe95ull,
+	0x00000205f2ecb50dull, 0x00000208d189b64dull, 0x0000020bb021026aull, 0x0000020e8eb2997cull,
+	0x000002116d3e7b9aull, 0x000002144bc4a8d9ull, 0x000002172a452151ull, 0x0000021a08bfe518ull,
+	0x0000021ce734f445ull, 0x0000021fc5a44eefull, 0x00000222a40df52cull, 0x000002258271e713ull,
+	0x0000022860d024bcull, 0x0000022b3f28ae3bull, 0x0000022e1d7b83a9ull, 0x00000230fbc8a51cull,
+	0x00000233da1012aaull, 0x00000236b851cc6aull, 0x00000239968dd273ull, 0x0000023c74c424dcull,
+	0x0000023f52f4c3baull, 0x00000242311faf26ull, 0x000002450f44e735ull, 0x00000247ed646bfeull,
+	0x0000024acb7e3d99ull, 0x0000024da9925c1aull, 0x0000025087a0c79aull, 0x0000025365a9802full,
+	0x0000025643ac85efull, 0x0000025921a9d8f1ull, 0x0000025bffa1794cull, 0x0000025edd936716ull,
+	0x00000261bb7fa266ull, 0x0000026499662b54ull, 0x00000267774701f4ull, 0x0000026a5522265eull,
+	0x0000026d32f798a9ull, 0x0000027010c758ebull, 0x00000272ee91673cull, 0x00000275cc55c3b0ull,
+	0x00000278aa146e60ull, 0x0000027b87cd6761ull, 0x0000027e6580aecbull, 0x00000281432e44b4ull,
+	0x0000028420d62932ull, 0x00000286fe785c5dull, 0x00000289dc14de4aull, 0x0000028cb9abaf11ull,
+	0x0000028f973ccec8ull, 0x0000029274c83d86ull, 0x00000295524dfb61ull, 0x000002982fce0870ull,
+	0x0000029b0d4864c9ull, 0x0000029deabd1084ull, 0x000002a0c82c0bb6ull, 0x000002a3a5955676ull,
+	0x000002a682f8f0dcull, 0x000002a96056dafcull, 0x000002ac3daf14efull, 0x000002af1b019ecbull,
+	0x000002b1f84e78a6ull, 0x000002b4d595a296ull, 0x000002b7b2d71cb3ull, 0x000002ba9012e713ull,
+	0x000002bd6d4901cdull, 0x000002c04a796cf6ull, 0x000002c327a428a7ull, 0x000002c604c934f4ull,
+	0x000002c8e1e891f6ull, 0x000002cbbf023fc2ull, 0x000002ce9c163e6full, 0x000002d179248e14ull,
+	0x000002d4562d2ec6ull, 0x000002d73330209dull, 0x000002da102d63b0ull, 0x000002dced24f814ull
+};
+
+#endif
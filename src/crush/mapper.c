@@ -4,6 +4,7 @@
 # include <linux/slab.h>
 # include <linux/bug.h>
 # include <linux/kernel.h>
+# include <linux/math64.h>
 # ifndef dprintk
 #  define dprintk(args...)
 # endif
@@ -18,10 +19,13 @@
 # define kfree(x) free(x)
 /*# define DEBUG_INDEP*/
 # include "include/int_types.h"
+# define div64_s64(a, b) ((a) / (b))
+# define S64_MIN (-0x7fffffffffffffffll - 1)
 #endif
 
 #include "crush.h"
 #include "hash.h"
+#include "crush_ln_table.h"
 
 /*
  * Implement the core CRUSH mapping algorithm.
@@ -239,6 +243,98 @@ static int bucket_straw_choose(struct crush_bucket_straw *bucket,
 	return bucket->h.items[high];
 }
 
+/* straw2 */
+
+/*
+ * crush_ln - fixed-point log2 of (xin + 1)
+ * @xin: 16-bit input
+ *
+ * Returns 2^44 * log2(xin + 1).  The input is normalized to [2^15, 2^16];
+ * its top 8 bits pick a coarse reciprocal (RH) and log (LH) from a table,
+ * and the remaining fraction, scaled by RH, picks a fine correction (LL).
+ */
+static __u64 crush_ln(unsigned int xin)
+{
+	unsigned int x = xin, x1;
+	int iexpon, index1, index2;
+	__u64 RH, LH, LL, xl64, result;
+
+	x++;
+
+	/* normalize input */
+	iexpon = 15;
+	while (!(x & 0x18000)) {
+		x <<= 1;
+		iexpon--;
+	}
+
+	index1 = (x >> 8) << 1;
+	/* RH ~ 2^56/index1 */
+	RH = __RH_LH_tbl[index1 - 256];
+	/* LH ~ 2^48 * log2(index1/256) */
+	LH = __RH_LH_tbl[index1 + 1 - 256];
+
+	/* RH*x ~ 2^48 * (2^15 + xf), xf<2^8 */
+	xl64 = (__s64)x * RH;
+	xl64 >>= 48;
+	x1 = xl64;
+
+	result = iexpon;
+	result <<= (12 + 32);
+
+	index2 = x1 & 0xff;
+	/* LL ~ 2^48*log2(1.0+index2/2^15) */
+	LL = __LL_tbl[index2];
+
+	LH = LH + LL;
+
+	LH >>= (48 - 12 - 32);
+	result += LH;
+
+	return result;
+}
+
+/*
+ * Each item draws a straw of length ln(u) / weight, with u uniform in
+ * (0, 1]: the longest straw wins.  This makes the winner an exponential
+ * race in which item i wins with probability weight_i / sum(weights),
+ * and an item's draw does not depend on any other item's weight, so a
+ * reweight only moves inputs to or from the item being reweighted.
+ */
+static int bucket_straw2_choose(struct crush_bucket_straw2 *bucket,
+				int x, int r)
+{
+	unsigned int i, high = 0;
+	unsigned int u;
+	unsigned int w;
+	__s64 ln, draw, high_draw = 0;
+
+	for (i = 0; i < bucket->h.size; i++) {
+		w = bucket->item_weights[i];
+		if (w) {
+			u = crush_hash32_3(bucket->h.hash, x,
+					   bucket->h.items[i], r);
+			u &= 0xffff;
+
+			/*
+			 * ln(u) is negative; subtract 2^48 (log2(2^16) in
+			 * crush_ln's fixed point) so we divide a
+			 * negative number by the weight.
+			 */
+			ln = crush_ln(u) - 0x1000000000000ll;
+			draw = div64_s64(ln, w);
+		} else {
+			draw = S64_MIN;
+		}
+
+		if (i == 0 || draw > high_draw) {
+			high = i;
+			high_draw = draw;
+		}
+	}
+	return bucket->h.items[high];
+}
+
 static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
 {
 	dprintk(" crush_bucket_choose %d x=%d r=%d\n", in->id, x, r);
@@ -256,6 +352,9 @@ static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
 	case CRUSH_BUCKET_STRAW:
 		return bucket_straw_choose((struct crush_bucket_straw *)in,
 					   x, r);
+	case CRUSH_BUCKET_STRAW2:
+		return bucket_straw2_choose((struct crush_bucket_straw2 *)in,
+					    x, r);
 	default:
 		dprintk("unknown bucket %d alg %d\n", in->id, in->alg);
 		return in->items[0];
@@ -866,6 +866,22 @@ CEPH_RADOS_API void rados_ioctx_locator_set_key(rados_ioctx_t io,
  */
 CEPH_RADOS_API void rados_ioctx_set_namespace(rados_ioctx_t io,
                                               const char *nspace);
+
+/**
+ * Set whether small aio writes to the same object are coalesced
+ *
+ * While a write to an object is in flight, rados_aio_write(),
+ * rados_aio_append() and rados_aio_write_op_operate() calls for that
+ * object are queued, and sent together as a single op once it
+ * commits.  Each completion still gets its own result.  Other ops to
+ * such an object, reads included, are sent once the writes queued
+ * ahead of them have committed.  The default comes from the
+ * rados_op_batching option.
+ *
+ * @param io the io context to change
+ * @param enable nonzero to batch writes
+ */
+CEPH_RADOS_API void rados_ioctx_set_op_batching(rados_ioctx_t io, int enable);
 /** @} obj_loc */
 
 /**
@@ -1021,6 +1021,23 @@ namespace librados
     void locator_set_key(const std::string& key);
     void set_namespace(const std::string& nspace);
 
+    /**
+     * Coalesce small aio writes to the same object
+     *
+     * While a write to an object is in flight, aio_write(), aio_append()
+     * and aio_operate() calls for that object are queued, and sent
+     * together as a single op once it commits.  Each completion still
+     * gets its own result: if the combined op fails, its parts are
+     * resent one by one.  Completions of batched ops are only called
+     * once the write is safe, and cannot be canceled once sent with
+     * others.  Other ops to such an object, reads included, are sent
+     * once the writes queued ahead of them have committed.  The default
+     * comes from the rados_op_batching option.
+     *
+     * @param enable whether to batch writes
+     */
+    void set_op_batching(bool enable);
+
     int64_t get_id();
 
     uint32_t get_object_hash_position(const std::string& oid);
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <string>
 #include <map>
+#include <vector>
+#include <utility>
 #include "../rados/buffer.h"
 #include "../rados/librados.hpp"
 
@@ -174,6 +176,44 @@ namespace libradosstriper
      */
     int aio_read(const std::string& soid, librados::AioCompletion *c, ceph::bufferlist *pbl, size_t len, uint64_t off);
 
+    /**
+     * synchronously write several extents of the striped object, given as
+     * (offset, data) pairs, in one go.
+     * The striped object is opened once, all extents are mapped onto the
+     * underlying rados objects in a single pass and the pieces landing in
+     * the same rados object are written in one operation.
+     * NOTE: the data is not copied, the bufferlists are referenced until
+     * the write completes.
+     */
+    int writev(const std::string& soid,
+	       const std::vector<std::pair<uint64_t, ceph::bufferlist> >& extents);
+
+    /**
+     * asynchronously write several extents of the striped object in one go.
+     * See writev.
+     */
+    int aio_writev(const std::string& soid, librados::AioCompletion *c,
+		   const std::vector<std::pair<uint64_t, ceph::bufferlist> >& extents);
+
+    /**
+     * synchronously read several extents of the striped object, given as
+     * (offset, length) pairs, in one go.
+     * As for read, extents are clipped to the size of the striped object.
+     * The data of the clipped extents is placed one after the other in pbl
+     * and their total length is returned.
+     */
+    int readv(const std::string& soid,
+	      const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+	      ceph::bufferlist *pbl);
+
+    /**
+     * asynchronously read several extents of the striped object in one go.
+     * See readv.
+     */
+    int aio_readv(const std::string& soid, librados::AioCompletion *c,
+		  const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+		  ceph::bufferlist *pbl);
+
     /**
      * synchronously get striped object stats (size/mtime)
      */
@@ -204,6 +204,31 @@ CEPH_RBD_API int rbd_snap_set(rbd_image_t image, const char *snapname);
 
 CEPH_RBD_API int rbd_flatten(rbd_image_t image);
 
+/**
+ * Check an image's object map against the objects that exist.
+ *
+ * @param image the image to check
+ * @param inconsistent where to store the number of objects that
+ *   exist or changed between snapshots without the map saying so
+ * @param cb progress callback
+ * @param cbdata argument to pass to the callback
+ * @returns 0 on success, negative error code on failure
+ */
+CEPH_RBD_API int rbd_check_object_map(rbd_image_t image,
+				      uint64_t *inconsistent,
+				      librbd_progress_fn_t cb, void *cbdata);
+/**
+ * Rebuild an image's object map from the objects that exist.  The
+ * image must not be written to while this runs.
+ *
+ * @param image the image whose map to rebuild
+ * @param cb progress callback
+ * @param cbdata argument to pass to the callback
+ * @returns 0 on success, negative error code on failure
+ */
+CEPH_RBD_API int rbd_rebuild_object_map(rbd_image_t image,
+					librbd_progress_fn_t cb, void *cbdata);
+
 /**
  * List all images that are cloned from the image at the
  * snapshot that is set via rbd_snap_set().
@@ -129,6 +129,10 @@ public:
 
   int flatten();
   int flatten_with_progress(ProgressContext &prog_ctx);
+
+  /* object map (see librbd.h for details) */
+  int check_object_map(ProgressContext &prog_ctx, uint64_t *inconsistent);
+  int rebuild_object_map(ProgressContext &prog_ctx);
   /**
    * Returns a pair of poolname, imagename for each clone
    * of this image at the currently set snapshot.
@@ -16,6 +16,7 @@
 
 #include "IoCtxImpl.h"
 
+#include "common/perf_counters.h"
 #include "librados/AioCompletionImpl.h"
 #include "librados/PoolAsyncCompletionImpl.h"
 #include "librados/RadosClient.h"
@@ -28,7 +29,8 @@
 librados::IoCtxImpl::IoCtxImpl() :
   ref_cnt(0), client(NULL), poolid(0), assert_ver(0), last_objver(0),
   notify_timeout(30), aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock"),
-  aio_write_seq(0), objecter(NULL)
+  aio_write_seq(0), op_batching(false),
+  batch_lock("librados::IoCtxImpl::batch_lock"), objecter(NULL)
 {
 }
 
@@ -40,7 +42,8 @@ librados::IoCtxImpl::IoCtxImpl(RadosClient *c, Objecter *objecter,
     notify_timeout(c->cct->_conf->client_notify_timeout),
     oloc(poolid),
     aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock"),
-    aio_write_seq(0), objecter(objecter)
+    aio_write_seq(0), op_batching(c->cct->_conf->rados_op_batching),
+    batch_lock("librados::IoCtxImpl::batch_lock"), objecter(objecter)
 {
 }
 
@@ -146,6 +149,229 @@ void librados::IoCtxImpl::flush_aio_writes()
   aio_write_list_lock.Unlock();
 }
 
+// OP BATCHING
+
+void librados::IoCtxImpl::set_op_batching(bool enable)
+{
+  ldout(client->cct, 10) << "set_op_batching " << enable << dendl;
+  op_batching = enable;
+}
+
+bool librados::IoCtxImpl::can_batch(const ::ObjectOperation& o, int flags)
+{
+  if (!op_batching || flags || o.flags || o.priority || o.ops.empty())
+    return false;
+  uint64_t bytes = 0;
+  for (vector<OSDOp>::const_iterator p = o.ops.begin(); p != o.ops.end(); ++p)
+    bytes += p->indata.length();
+  return bytes < client->cct->_conf->rados_op_batch_max_bytes;
+}
+
+int librados::IoCtxImpl::aio_batch_mutate(const object_t& oid,
+					  ::ObjectOperation *o,
+					  AioCompletionImpl *c,
+					  const SnapContext& snap_context,
+					  utime_t mtime)
+{
+  c->io = this;
+  queue_aio_write(c);
+
+  BatchedOp *bop = new BatchedOp;
+  bop->c = c;
+  bop->deferred = NULL;
+  bop->ops.swap(o->ops);
+  bop->out_rval.swap(o->out_rval);
+  bop->snapc = snap_context;
+  bop->mtime = mtime;
+  bop->bytes = 0;
+  for (vector<OSDOp>::iterator p = bop->ops.begin(); p != bop->ops.end(); ++p)
+    bop->bytes += p->indata.length();
+  bop->onack = new C_aio_Ack(c);
+  bop->onsafe = new C_aio_Safe(c);
+  bop->r = 0;
+
+  Mutex::Locker l(batch_lock);
+  client->logger->inc(l_librados_batch_op);
+  map<object_t, ObjectBatches>::iterator p = batches.find(oid);
+  if (p == batches.end()) {
+    p = batches.insert(make_pair(oid, ObjectBatches())).first;
+    batched_objects.inc();
+  }
+  ObjectBatches& ob = p->second;
+  ob.queued.push_back(bop);
+  ob.queued_bytes += bop->bytes;
+  if (ob.in_flight.empty())
+    _send_queued(oid, ob);
+  else
+    ldout(client->cct, 20) << "aio_batch_mutate " << oid << " queued behind "
+			   << ob.in_flight.size() << " in flight" << dendl;
+  return 0;
+}
+
+/*
+ * Send an op that is not batched.  If the object has batches in flight
+ * it waits behind them and behind whatever is queued: a failed batch is
+ * resent op by op, and that must not reorder its ops after this one.
+ */
+void librados::IoCtxImpl::submit_op(const object_t& oid, Objecter::Op *op,
+				    AioCompletionImpl *c)
+{
+  if (batched_objects.read()) {
+    Mutex::Locker l(batch_lock);
+    map<object_t, ObjectBatches>::iterator p = batches.find(oid);
+    if (p != batches.end()) {
+      BatchedOp *bop = new BatchedOp;
+      bop->c = c;
+      bop->deferred = op;
+      bop->bytes = 0;
+      bop->onack = bop->onsafe = NULL;
+      bop->r = 0;
+      p->second.queued.push_back(bop);
+      ldout(client->cct, 20) << "submit_op " << oid << " queued behind "
+			     << p->second.in_flight.size() << " in flight"
+			     << dendl;
+      return;
+    }
+  }
+  ceph_tid_t tid = objecter->op_submit(op);
+  if (c)
+    c->tid = tid;
+}
+
+/*
+ * Called with nothing in flight to the object: send the deferred ops at
+ * the front of the queue, then the next batch, if any.
+ */
+void librados::IoCtxImpl::_send_queued(const object_t& oid, ObjectBatches& ob)
+{
+  assert(batch_lock.is_locked());
+  assert(ob.in_flight.empty());
+  while (!ob.queued.empty() && ob.queued.front()->deferred) {
+    BatchedOp *bop = ob.queued.front();
+    ob.queued.pop_front();
+    ceph_tid_t tid = objecter->op_submit(bop->deferred);
+    if (bop->c)
+      bop->c->tid = tid;
+    delete bop;
+  }
+  if (ob.queued.empty())
+    return;
+
+  const md_config_t *conf = client->cct->_conf;
+  OpBatch *b = new OpBatch(oid);
+  uint64_t bytes = 0;
+  do {
+    BatchedOp *bop = ob.queued.front();
+    if (bop->deferred)
+      break;
+    if (!b->ops.empty() &&
+	(bop->snapc.seq != b->ops.front()->snapc.seq ||
+	 bop->snapc.snaps != b->ops.front()->snapc.snaps ||
+	 b->ops.size() >= (unsigned)conf->rados_op_batch_max_ops ||
+	 bytes + bop->bytes > conf->rados_op_batch_max_bytes))
+      break;
+    b->ops.push_back(bop);
+    bytes += bop->bytes;
+    ob.queued.pop_front();
+  } while (!ob.queued.empty());
+  ob.queued_bytes -= bytes;
+  _send_batch(ob, b);
+}
+
+void librados::IoCtxImpl::_send_batch(ObjectBatches& ob, OpBatch *b)
+{
+  assert(batch_lock.is_locked());
+  assert(!b->ops.empty());
+  ::ObjectOperation op;
+  for (std::list<BatchedOp*>::iterator p = b->ops.begin();
+       p != b->ops.end();
+       ++p) {
+    op.ops.insert(op.ops.end(), (*p)->ops.begin(), (*p)->ops.end());
+    op.out_rval.insert(op.out_rval.end(), (*p)->out_rval.begin(),
+		       (*p)->out_rval.end());
+  }
+  ldout(client->cct, 20) << "_send_batch " << b->oid << " " << b->ops.size()
+			 << " ops" << dendl;
+
+  // complete in a finisher: the commit callback takes batch_lock,
+  // which we may hold while op_submit() waits for throttle budget that
+  // only the dispatch thread can give back.  not the one that runs user
+  // callbacks, since those may wait on an op queued behind this batch.
+  Context *oncommit = new C_OnFinisher(new C_BatchCommit(this, b),
+				       &client->batch_finisher);
+  Objecter::Op *objecter_op = objecter->prepare_mutate_op(
+    b->oid, oloc, op, b->ops.front()->snapc, b->ops.back()->mtime, 0,
+    NULL, oncommit, &b->objver);
+  objecter_op->reply_epoch = &b->reply_epoch;
+  ob.in_flight.insert(b);
+  b->tid = objecter->op_submit(objecter_op);
+  for (std::list<BatchedOp*>::iterator p = b->ops.begin();
+       p != b->ops.end();
+       ++p)
+    (*p)->c->tid = b->tid;
+
+  client->logger->inc(l_librados_batch_send);
+  client->logger->inc(l_librados_batch_size, b->ops.size());
+}
+
+void librados::IoCtxImpl::handle_batch_commit(OpBatch *b, int r)
+{
+  ldout(client->cct, 20) << "handle_batch_commit " << b->oid << " "
+			 << b->ops.size() << " ops r=" << r << dendl;
+  std::list<BatchedOp*> done;
+  batch_lock.Lock();
+  map<object_t, ObjectBatches>::iterator p = batches.find(b->oid);
+  assert(p != batches.end());
+  ObjectBatches& ob = p->second;
+  ob.in_flight.erase(b);
+
+  // without a reply, the objecter timed the op out or canceled it
+  if (!b->reply_epoch)
+    b->aborted = true;
+
+  // the osd applied none of a failed batch, so resend its ops one by
+  // one to give each its own result.  don't if it was aborted, since it
+  // may have been applied; then every op in the batch fails with r.
+  if (r < 0 && b->ops.size() > 1 && !b->aborted) {
+    ldout(client->cct, 10) << "handle_batch_commit " << b->oid << " r=" << r
+			   << ", resending " << b->ops.size()
+			   << " ops one by one" << dendl;
+    client->logger->inc(l_librados_batch_split);
+    while (!b->ops.empty()) {
+      OpBatch *one = new OpBatch(b->oid);
+      one->ops.push_back(b->ops.front());
+      b->ops.pop_front();
+      _send_batch(ob, one);
+    }
+  } else {
+    for (std::list<BatchedOp*>::iterator q = b->ops.begin();
+	 q != b->ops.end();
+	 ++q) {
+      (*q)->c->objver = b->objver;
+      (*q)->r = r;
+    }
+    done.swap(b->ops);
+  }
+
+  if (ob.in_flight.empty())
+    _send_queued(b->oid, ob);
+  if (ob.in_flight.empty() && ob.queued.empty()) {
+    batches.erase(p);
+    batched_objects.dec();
+  }
+  batch_lock.Unlock();
+  delete b;
+
+  // the last completion may drop the last ref to us
+  while (!done.empty()) {
+    BatchedOp *bop = done.front();
+    done.pop_front();
+    bop->onack->complete(bop->r);
+    bop->onsafe->complete(bop->r);
+    delete bop;
+  }
+}
+
 // SNAPS
 
 int librados::IoCtxImpl::snap_create(const char *snapName)
@@ -503,7 +729,7 @@ int librados::IoCtxImpl::operate(const object_t& oid, ::ObjectOperation *o,
   Objecter::Op *objecter_op = objecter->prepare_mutate_op(oid, oloc,
 	                                                  *o, snapc, ut, flags,
 	                                                  NULL, oncommit, &ver);
-  objecter->op_submit(objecter_op);
+  submit_op(oid, objecter_op, NULL);
 
   mylock.Lock();
   while (!done)
@@ -538,7 +764,7 @@ int librados::IoCtxImpl::operate_read(const object_t& oid,
   Objecter::Op *objecter_op = objecter->prepare_read_op(oid, oloc,
 	                                      *o, snap_seq, pbl, flags,
 	                                      onack, &ver);
-  objecter->op_submit(objecter_op);
+  submit_op(oid, objecter_op, NULL);
 
   mylock.Lock();
   while (!done)
@@ -566,7 +792,7 @@ int librados::IoCtxImpl::aio_operate_read(const object_t &oid,
   Objecter::Op *objecter_op = objecter->prepare_read_op(oid, oloc,
 		 *o, snap_seq, pbl, flags,
 		 onack, &c->objver);
-  c->tid = objecter->op_submit(objecter_op);
+  submit_op(oid, objecter_op, c);
   return 0;
 }
 
@@ -579,14 +805,18 @@ int librados::IoCtxImpl::aio_operate(const object_t& oid,
   if (snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  if (can_batch(*o, flags))
+    return aio_batch_mutate(oid, o, c, snap_context, ut);
+
   Context *onack = new C_aio_Ack(c);
   Context *oncommit = new C_aio_Safe(c);
 
   c->io = this;
   queue_aio_write(c);
 
-  c->tid = objecter->mutate(oid, oloc, *o, snap_context, ut, flags, onack, oncommit,
-		            &c->objver);
+  Objecter::Op *objecter_op = objecter->prepare_mutate_op(oid, oloc,
+		 *o, snap_context, ut, flags, onack, oncommit, &c->objver);
+  submit_op(oid, objecter_op, c);
 
   return 0;
 }
@@ -604,9 +834,11 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
   c->io = this;
   c->blp = pbl;
 
-  c->tid = objecter->read(oid, oloc,
-		 off, len, snapid, pbl, 0,
-		 onack, &c->objver);
+  ::ObjectOperation rd;
+  rd.read(off, len, NULL, NULL, NULL);
+  Objecter::Op *objecter_op = objecter->prepare_read_op(oid, oloc,
+		 rd, snapid, pbl, 0, onack, &c->objver);
+  submit_op(oid, objecter_op, c);
   return 0;
 }
 
@@ -625,9 +857,11 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
   c->bl.push_back(buffer::create_static(len, buf));
   c->blp = &c->bl;
 
-  c->tid = objecter->read(oid, oloc,
-		 off, len, snapid, &c->bl, 0,
-		 onack, &c->objver);
+  ::ObjectOperation rd;
+  rd.read(off, len, NULL, NULL, NULL);
+  Objecter::Op *objecter_op = objecter->prepare_read_op(oid, oloc,
+		 rd, snapid, &c->bl, 0, onack, &c->objver);
+  submit_op(oid, objecter_op, c);
 
   return 0;
 }
@@ -660,9 +894,9 @@ int librados::IoCtxImpl::aio_sparse_read(const object_t oid,
 
   onack->m_ops.sparse_read(off, len, m, data_bl, NULL);
 
-  c->tid = objecter->read(oid, oloc,
-		 onack->m_ops, snap_seq, NULL, 0,
-		 onack, &c->objver);
+  Objecter::Op *objecter_op = objecter->prepare_read_op(oid, oloc,
+		 onack->m_ops, snap_seq, NULL, 0, onack, &c->objver);
+  submit_op(oid, objecter_op, c);
   return 0;
 }
 
@@ -679,15 +913,21 @@ int librados::IoCtxImpl::aio_write(const object_t &oid, AioCompletionImpl *c,
   if (snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  ::ObjectOperation wr;
+  bufferlist data(bl);
+  wr.add_data(CEPH_OSD_OP_WRITE, off, len, data);
+  if (can_batch(wr, 0))
+    return aio_batch_mutate(oid, &wr, c, snapc, ut);
+
   c->io = this;
   queue_aio_write(c);
 
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  c->tid = objecter->write(oid, oloc,
-		  off, len, snapc, bl, ut, 0,
-		  onack, onsafe, &c->objver);
+  Objecter::Op *objecter_op = objecter->prepare_mutate_op(oid, oloc,
+		 wr, snapc, ut, 0, onack, onsafe, &c->objver);
+  submit_op(oid, objecter_op, c);
 
   return 0;
 }
@@ -703,15 +943,21 @@ int librados::IoCtxImpl::aio_append(const object_t &oid, AioCompletionImpl *c,
   if (snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  ::ObjectOperation wr;
+  bufferlist data(bl);
+  wr.add_data(CEPH_OSD_OP_APPEND, 0, len, data);
+  if (can_batch(wr, 0))
+    return aio_batch_mutate(oid, &wr, c, snapc, ut);
+
   c->io = this;
   queue_aio_write(c);
 
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  c->tid = objecter->append(oid, oloc,
-		   len, snapc, bl, ut, 0,
-		   onack, onsafe, &c->objver);
+  Objecter::Op *objecter_op = objecter->prepare_mutate_op(oid, oloc,
+		 wr, snapc, ut, 0, onack, onsafe, &c->objver);
+  submit_op(oid, objecter_op, c);
 
   return 0;
 }
@@ -734,9 +980,12 @@ int librados::IoCtxImpl::aio_write_full(const object_t &oid,
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  c->tid = objecter->write_full(oid, oloc,
-		       snapc, bl, ut, 0,
-		       onack, onsafe, &c->objver);
+  ::ObjectOperation wr;
+  bufferlist data(bl);
+  wr.write_full(data);
+  Objecter::Op *objecter_op = objecter->prepare_mutate_op(oid, oloc,
+		 wr, snapc, ut, 0, onack, onsafe, &c->objver);
+  submit_op(oid, objecter_op, c);
 
   return 0;
 }
@@ -755,9 +1004,11 @@ int librados::IoCtxImpl::aio_remove(const object_t &oid, AioCompletionImpl *c)
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  c->tid = objecter->remove(oid, oloc,
-		   snapc, ut, 0,
-		   onack, onsafe, &c->objver);
+  ::ObjectOperation wr;
+  wr.remove();
+  Objecter::Op *objecter_op = objecter->prepare_mutate_op(oid, oloc,
+		 wr, snapc, ut, 0, onack, onsafe, &c->objver);
+  submit_op(oid, objecter_op, c);
 
   return 0;
 }
@@ -769,15 +1020,67 @@ int librados::IoCtxImpl::aio_stat(const object_t& oid, AioCompletionImpl *c,
   c->io = this;
   C_aio_stat_Ack *onack = new C_aio_stat_Ack(c, pmtime);
 
-  c->tid = objecter->stat(oid, oloc,
-		 snap_seq, psize, &onack->mtime, 0,
-		 onack, &c->objver);
+  ::ObjectOperation rd;
+  rd.stat(psize, &onack->mtime, NULL);
+  Objecter::Op *objecter_op = objecter->prepare_read_op(oid, oloc,
+		 rd, snap_seq, NULL, 0, onack, &c->objver);
+  submit_op(oid, objecter_op, c);
 
   return 0;
 }
 
 int librados::IoCtxImpl::aio_cancel(AioCompletionImpl *c)
 {
+  BatchedOp *canceled = NULL;
+  batch_lock.Lock();
+  for (map<object_t, ObjectBatches>::iterator p = batches.begin();
+       p != batches.end() && !canceled;
+       ++p) {
+    ObjectBatches& ob = p->second;
+    for (std::list<BatchedOp*>::iterator q = ob.queued.begin();
+	 q != ob.queued.end();
+	 ++q) {
+      if ((*q)->c == c) {
+	canceled = *q;
+	ob.queued_bytes -= canceled->bytes;
+	ob.queued.erase(q);
+	break;
+      }
+    }
+    if (canceled)
+      break;
+    for (std::set<OpBatch*>::iterator q = ob.in_flight.begin();
+	 q != ob.in_flight.end();
+	 ++q) {
+      if ((*q)->tid == c->tid) {
+	if ((*q)->ops.size() > 1) {
+	  // canceling it would cancel the ops it was batched with
+	  batch_lock.Unlock();
+	  return -EBUSY;
+	}
+	(*q)->aborted = true;
+      }
+    }
+  }
+  batch_lock.Unlock();
+
+  if (canceled) {
+    if (canceled->deferred) {
+      // never submitted, so the objecter doesn't know about it
+      Objecter::Op *op = canceled->deferred;
+      if (op->onack)
+	op->onack->complete(-ECANCELED);
+      if (op->oncommit)
+	op->oncommit->complete(-ECANCELED);
+      op->onack = op->oncommit = NULL;
+      op->put();
+    } else {
+      canceled->onack->complete(-ECANCELED);
+      canceled->onsafe->complete(-ECANCELED);
+    }
+    delete canceled;
+    return 0;
+  }
   return objecter->op_cancel(c->tid, -ECANCELED);
 }
 
@@ -881,7 +1184,9 @@ int librados::IoCtxImpl::aio_exec(const object_t& oid, AioCompletionImpl *c,
   ::ObjectOperation rd;
   prepare_assert_ops(&rd);
   rd.call(cls, method, inbl);
-  c->tid = objecter->read(oid, oloc, rd, snap_seq, outbl, 0, onack, &c->objver);
+  Objecter::Op *objecter_op = objecter->prepare_read_op(oid, oloc,
+		 rd, snap_seq, outbl, 0, onack, &c->objver);
+  submit_op(oid, objecter_op, c);
 
   return 0;
 }
@@ -47,6 +47,47 @@ struct librados::IoCtxImpl {
   xlist<AioCompletionImpl*> aio_write_list;
   map<ceph_tid_t, std::list<AioCompletionImpl*> > aio_write_waiters;
 
+  /*
+   * Op batching.  While a batch of writes to an object is in flight,
+   * further aio writes to it are queued rather than sent, and go out
+   * together as a single compound op when it commits.  A compound op
+   * is one transaction on the osd: if it fails, nothing was applied,
+   * and its ops are resent one by one so that each gets its own result.
+   * Other ops to the object wait in the same queue, so that nothing is
+   * ever sent behind a batch that may still have to be resent.
+   */
+  struct BatchedOp {
+    AioCompletionImpl *c;
+    Objecter::Op *deferred;  ///< a non-batched op, sent as is when its turn comes
+    vector<OSDOp> ops;
+    vector<int*> out_rval;
+    ::SnapContext snapc;
+    utime_t mtime;
+    uint64_t bytes;
+    Context *onack, *onsafe;
+    int r;
+  };
+  struct OpBatch {
+    object_t oid;
+    std::list<BatchedOp*> ops;
+    version_t objver;
+    epoch_t reply_epoch;  ///< set when the osd replies
+    ceph_tid_t tid;
+    bool aborted;  ///< canceled or timed out; the osd may have applied it
+    OpBatch(const object_t& o)
+      : oid(o), objver(0), reply_epoch(0), tid(0), aborted(false) {}
+  };
+  struct ObjectBatches {
+    std::list<BatchedOp*> queued;
+    uint64_t queued_bytes;
+    std::set<OpBatch*> in_flight;
+    ObjectBatches() : queued_bytes(0) {}
+  };
+  bool op_batching;
+  Mutex batch_lock;
+  map<object_t, ObjectBatches> batches;
+  atomic_t batched_objects;  ///< batches.size(), read without batch_lock
+
   Objecter *objecter;
 
   IoCtxImpl();
@@ -65,6 +106,7 @@ struct librados::IoCtxImpl {
     last_objver = rhs.last_objver;
     notify_timeout = rhs.notify_timeout;
     oloc = rhs.oloc;
+    op_batching = rhs.op_batching;
     objecter = rhs.objecter;
   }
 
@@ -85,6 +127,25 @@ struct librados::IoCtxImpl {
   void flush_aio_writes_async(AioCompletionImpl *c);
   void flush_aio_writes();
 
+  void set_op_batching(bool enable);
+  bool can_batch(const ::ObjectOperation& o, int flags);
+  int aio_batch_mutate(const object_t& oid, ::ObjectOperation *o,
+		       AioCompletionImpl *c, const SnapContext& snap_context,
+		       utime_t mtime);
+  void submit_op(const object_t& oid, Objecter::Op *op, AioCompletionImpl *c);
+  void _send_queued(const object_t& oid, ObjectBatches& ob);
+  void _send_batch(ObjectBatches& ob, OpBatch *b);
+  void handle_batch_commit(OpBatch *b, int r);
+
+  struct C_BatchCommit : public Context {
+    IoCtxImpl *io;
+    OpBatch *b;
+    C_BatchCommit(IoCtxImpl *i, OpBatch *_b) : io(i), b(_b) {}
+    void finish(int r) {
+      io->handle_batch_commit(b, r);
+    }
+  };
+
   int64_t get_id() {
     return poolid;
   }
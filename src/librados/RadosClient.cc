@@ -25,6 +25,7 @@
 #include "common/config.h"
 #include "common/common_init.h"
 #include "common/errno.h"
+#include "common/perf_counters.h"
 #include "include/buffer.h"
 #include "include/stringify.h"
 
@@ -76,7 +77,7 @@ librados::RadosClient::RadosClient(CephContext *cct_)
     timer(cct, lock),
     refcnt(1),
     log_last_version(0), log_cb(NULL), log_cb_arg(NULL),
-    finisher(cct)
+    finisher(cct), batch_finisher(cct), logger(NULL)
 {
 }
 
@@ -229,6 +230,17 @@ int librados::RadosClient::connect()
     goto out;
   objecter->set_balanced_budget();
 
+  if (!logger) {
+    PerfCountersBuilder plb(cct, "librados", l_librados_first,
+			    l_librados_last);
+    plb.add_u64_counter(l_librados_batch_op, "batch_op");
+    plb.add_u64_counter(l_librados_batch_send, "batch_send");
+    plb.add_u64_avg(l_librados_batch_size, "batch_size");
+    plb.add_u64_counter(l_librados_batch_split, "batch_split");
+    logger = plb.create_perf_counters();
+    cct->get_perfcounters_collection()->add(logger);
+  }
+
   monclient.set_messenger(messenger);
 
   objecter->init();
@@ -264,6 +276,7 @@ int librados::RadosClient::connect()
   monclient.renew_subs();
 
   finisher.start();
+  batch_finisher.start();
 
   state = CONNECTED;
   instance_id = monclient.get_global_id();
@@ -287,6 +300,7 @@ void librados::RadosClient::shutdown()
     return;
   }
   if (state == CONNECTED) {
+    batch_finisher.stop();
     finisher.stop();
   }
   bool need_objecter = false;
@@ -329,6 +343,10 @@ librados::RadosClient::~RadosClient()
     delete messenger;
   if (objecter)
     delete objecter;
+  if (logger) {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+  }
   cct->put();
   cct = NULL;
 }
@@ -32,6 +32,16 @@ struct md_config_t;
 class Message;
 class MLog;
 class Messenger;
+class PerfCounters;
+
+enum {
+  l_librados_first = 27000,
+  l_librados_batch_op,     // ops submitted through op batching
+  l_librados_batch_send,   // compound ops sent for them
+  l_librados_batch_size,   // ops per compound op, i.e. the coalescing ratio
+  l_librados_batch_split,  // failed compound ops resent op by op
+  l_librados_last,
+};
 
 class librados::RadosClient : public Dispatcher
 {
@@ -74,6 +84,8 @@ private:
 
 public:
   Finisher finisher;
+  Finisher batch_finisher;  ///< op batching commits, apart from user callbacks
+  PerfCounters *logger;
 
   RadosClient(CephContext *cct_);
   ~RadosClient();
@@ -1794,6 +1794,11 @@ void librados::IoCtx::set_namespace(const string& nspace)
   io_ctx_impl->oloc.nspace = nspace;
 }
 
+void librados::IoCtx::set_op_batching(bool enable)
+{
+  io_ctx_impl->set_op_batching(enable);
+}
+
 int64_t librados::IoCtx::get_id()
 {
   return io_ctx_impl->get_id();
@@ -3047,6 +3052,14 @@ extern "C" void rados_ioctx_set_namespace(rados_ioctx_t io, const char *nspace)
   tracepoint(librados, rados_ioctx_set_namespace_exit);
 }
 
+extern "C" void rados_ioctx_set_op_batching(rados_ioctx_t io, int enable)
+{
+  tracepoint(librados, rados_ioctx_set_op_batching_enter, io, enable);
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  ctx->set_op_batching(enable);
+  tracepoint(librados, rados_ioctx_set_op_batching_exit);
+}
+
 extern "C" rados_t rados_ioctx_get_cluster(rados_ioctx_t io)
 {
   tracepoint(librados, rados_ioctx_get_cluster_enter, io);
@@ -29,6 +29,7 @@
 #include "libradosstriper/MultiAioCompletionImpl.h"
 #include "librados/AioCompletionImpl.h"
 #include <cls/lock/cls_lock_client.h>
+#include <cls/lock/cls_lock_ops.h>
 
 /*
  * This file contents the actual implementation of the rados striped objects interface.
@@ -49,13 +50,20 @@
  * However, a certain number of safety guards have been put to make the interface closer
  * to atomicity :
  *  - each data operation takes a shared lock on the first rados object for the
- *    whole time of the operation
+ *    whole time of the operation. Reads skip it when rados_striper_lockless_reads
+ *    is set : they then only check, in the same rados operation that fetches
+ *    the layout and size, that the exclusive lock is not held
  *  - the remove and trunc operations take an exclusive lock on the first rados object
  *    for the whole time of the operation
  * This makes sure that no removal/truncation of a striped object occurs while
  * data operations are happening and vice versa. It thus makes sure that the layout
  * of a striped object does not change during data operation, which is essential for
  * data consistency.
+ * Lockless reads get a weaker guarantee : only a removal/truncation that already
+ * holds the exclusive lock when the layout is fetched is detected. One starting
+ * after that first operation may run concurrently with the data reads, which
+ * may then find some of the rados objects truncated or gone and return 0s in
+ * place of their data.
  *
  * Still the writing to a striped object is not atomic. This means in particular that
  * the size of an object may not be in sync with its content at all times.
@@ -64,6 +72,11 @@
  * that a reader that comes too soon after a write will read 0s instead of the actual
  * data.
  *
+ * Vectored reads and writes map all their extents onto rados objects in a
+ * single pass, and issue all resulting rados operations under a single
+ * lock and completion. Writes send all pieces landing in a given rados
+ * object in one operation.
+ *
  * Note that remove handles the pieces of the striped object in reverse order,
  * so that the head object is removed last, making the completion of the deletion atomic.
  *
@@ -295,7 +308,8 @@ int libradosstriper::RadosStriperImpl::write(const std::string& soid,
   std::string lockCookie;
   int rc = createAndOpenStripedObject(soid, &layout, len+off, &lockCookie, true);
   if (rc) return rc;
-  return write_in_open_object(soid, layout, lockCookie, bl, len, off);
+  std::vector<std::pair<uint64_t, uint64_t> > extents(1, std::make_pair(off, (uint64_t)len));
+  return write_in_open_object(soid, layout, lockCookie, bl, extents);
 }
 
 int libradosstriper::RadosStriperImpl::append(const std::string& soid,
@@ -309,7 +323,8 @@ int libradosstriper::RadosStriperImpl::append(const std::string& soid,
   std::string lockCookie;
   int rc = openStripedObjectForWrite(soid, &layout, &size, &lockCookie, false);
   if (rc) return rc;
-  return write_in_open_object(soid, layout, lockCookie, bl, len, size);
+  std::vector<std::pair<uint64_t, uint64_t> > extents(1, std::make_pair(size, (uint64_t)len));
+  return write_in_open_object(soid, layout, lockCookie, bl, extents);
 }
 
 int libradosstriper::RadosStriperImpl::write_full(const std::string& soid,
@@ -339,6 +354,62 @@ int libradosstriper::RadosStriperImpl::read(const std::string& soid,
   return rc;
 }
 
+/**
+ * concatenates the data of the given extents into bl, without copying it,
+ * fills writeExtents with the matching (offset, length) pairs, skipping
+ * empty extents, and returns the size the striped object needs to have
+ */
+static uint64_t flatten_write_extents(const std::vector<std::pair<uint64_t, bufferlist> >& extents,
+				      bufferlist *bl,
+				      std::vector<std::pair<uint64_t, uint64_t> > *writeExtents)
+{
+  uint64_t end = 0;
+  for (std::vector<std::pair<uint64_t, bufferlist> >::const_iterator p = extents.begin();
+       p != extents.end();
+       ++p) {
+    uint64_t len = p->second.length();
+    if (len == 0)
+      continue;
+    bl->append(p->second);
+    writeExtents->push_back(std::make_pair(p->first, len));
+    end = std::max(end, p->first + len);
+  }
+  return end;
+}
+
+int libradosstriper::RadosStriperImpl::writev(const std::string& soid,
+					      const std::vector<std::pair<uint64_t, bufferlist> >& extents)
+{
+  bufferlist bl;
+  std::vector<std::pair<uint64_t, uint64_t> > writeExtents;
+  uint64_t size = flatten_write_extents(extents, &bl, &writeExtents);
+  // open the object once for all extents. This will create it if needed,
+  // retrieve its layout and size and take a shared lock on it
+  ceph_file_layout layout;
+  std::string lockCookie;
+  int rc = createAndOpenStripedObject(soid, &layout, size, &lockCookie, true);
+  if (rc) return rc;
+  return write_in_open_object(soid, layout, lockCookie, bl, writeExtents);
+}
+
+int libradosstriper::RadosStriperImpl::readv(const std::string& soid,
+					     const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+					     bufferlist* bl)
+{
+  // create a completion object
+  librados::AioCompletionImpl c;
+  // call asynchronous method
+  int rc = aio_readv(soid, &c, extents, bl);
+  // and wait for completion
+  if (!rc) {
+    // wait for completion
+    c.wait_for_complete_and_cb();
+    // return result
+    rc = c.get_return_value();
+  }
+  return rc;
+}
+
 ///////////////////////// asynchronous io /////////////////////////////
 
 int libradosstriper::RadosStriperImpl::aio_write(const std::string& soid,
@@ -351,7 +422,8 @@ int libradosstriper::RadosStriperImpl::aio_write(const std::string& soid,
   std::string lockCookie;
   int rc = createAndOpenStripedObject(soid, &layout, len+off, &lockCookie, true);
   if (rc) return rc;
-  return aio_write_in_open_object(soid, c, layout, lockCookie, bl, len, off);
+  std::vector<std::pair<uint64_t, uint64_t> > extents(1, std::make_pair(off, (uint64_t)len));
+  return aio_write_in_open_object(soid, c, layout, lockCookie, bl, extents);
 }
 
 int libradosstriper::RadosStriperImpl::aio_append(const std::string& soid,
@@ -365,7 +437,8 @@ int libradosstriper::RadosStriperImpl::aio_append(const std::string& soid,
   int rc = openStripedObjectForWrite(soid, &layout, &size, &lockCookie, false);
   if (rc) return rc;
   // create a completion object
-  return aio_write_in_open_object(soid, c, layout, lockCookie, bl, len, size);
+  std::vector<std::pair<uint64_t, uint64_t> > extents(1, std::make_pair(size, (uint64_t)len));
+  return aio_write_in_open_object(soid, c, layout, lockCookie, bl, extents);
 }
 
 int libradosstriper::RadosStriperImpl::aio_write_full(const std::string& soid,
@@ -377,11 +450,27 @@ int libradosstriper::RadosStriperImpl::aio_write_full(const std::string& soid,
   return aio_write(soid, c, bl, bl.length(), 0);
 }
 
+int libradosstriper::RadosStriperImpl::aio_writev(const std::string& soid,
+						  librados::AioCompletionImpl *c,
+						  const std::vector<std::pair<uint64_t, bufferlist> >& extents)
+{
+  bufferlist bl;
+  std::vector<std::pair<uint64_t, uint64_t> > writeExtents;
+  uint64_t size = flatten_write_extents(extents, &bl, &writeExtents);
+  ceph_file_layout layout;
+  std::string lockCookie;
+  int rc = createAndOpenStripedObject(soid, &layout, size, &lockCookie, true);
+  if (rc) return rc;
+  return aio_write_in_open_object(soid, c, layout, lockCookie, bl, writeExtents);
+}
+
 static void striper_read_aio_req_complete(rados_striper_multi_completion_t c, void *arg)
 {
   libradosstriper::RadosStriperImpl::ReadCompletionData *cdata =
     reinterpret_cast<libradosstriper::RadosStriperImpl::ReadCompletionData*>(arg);
-  cdata->m_striper->unlockObject(cdata->m_soid, cdata->m_lockCookie);
+  // lockless reads did not take the lock
+  if (!cdata->m_lockCookie.empty())
+    cdata->m_striper->unlockObject(cdata->m_soid, cdata->m_lockCookie);
   libradosstriper::MultiAioCompletionImpl *comp =
     reinterpret_cast<libradosstriper::MultiAioCompletionImpl*>(c);
   cdata->complete(comp->rval);
@@ -454,24 +543,67 @@ int libradosstriper::RadosStriperImpl::aio_read(const std::string& soid,
   } else {
     read_len = min(len, (size_t)(size-off));
   }
-  // get list of extents to be read from
-  vector<ObjectExtent> *extents = new vector<ObjectExtent>();
-  if (read_len > 0) {
-    std::string format = soid + RADOS_OBJECT_EXTENSION_FORMAT;
-    Striper::file_to_extents(cct(), format.c_str(), &layout, off, read_len, 0, *extents);
+  std::vector<std::pair<uint64_t, uint64_t> > extents;
+  if (read_len > 0)
+    extents.push_back(std::make_pair(off, read_len));
+  return internal_aio_read(soid, c, bl, extents, layout, lockCookie);
+}
+
+int libradosstriper::RadosStriperImpl::aio_readv(const std::string& soid,
+						 librados::AioCompletionImpl *c,
+						 const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+						 bufferlist* bl)
+{
+  // open the object. This will retrieve its layout and size
+  // and take a shared lock on it
+  ceph_file_layout layout;
+  uint64_t size;
+  std::string lockCookie;
+  int rc = openStripedObjectForRead(soid, &layout, &size, &lockCookie);
+  if (rc) return rc;
+  // clip the extents to the actual size of the object, as read does
+  std::vector<std::pair<uint64_t, uint64_t> > readExtents;
+  uint64_t readLen = 0;
+  for (std::vector<std::pair<uint64_t, uint64_t> >::const_iterator p = extents.begin();
+       p != extents.end();
+       ++p) {
+    if (p->first >= size || p->second == 0)
+      continue;
+    uint64_t len = min(p->second, size - p->first);
+    readExtents.push_back(std::make_pair(p->first, len));
+    readLen += len;
   }
+  // all extents are read directly into a single buffer
+  bl->clear();
+  if (readLen > 0)
+    bl->push_back(buffer::create(readLen));
+  return internal_aio_read(soid, c, bl, readExtents, layout, lockCookie);
+}
+
+int libradosstriper::RadosStriperImpl::internal_aio_read(const std::string& soid,
+							 librados::AioCompletionImpl *c,
+							 bufferlist* bl,
+							 const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+							 const ceph_file_layout& layout,
+							 const std::string& lockCookie)
+{
+  // get list of extents to be read from
+  std::map<object_t, std::vector<ObjectExtent> > objectExtents;
+  file_to_object_extents(soid, layout, extents, &objectExtents);
+  vector<ObjectExtent> *objExtents = new vector<ObjectExtent>();
+  Striper::assimilate_extents(objectExtents, *objExtents);
   
   // create a completion object and transfer ownership of extents and resultbl
-  vector<bufferlist> *resultbl = new vector<bufferlist>(extents->size());
+  vector<bufferlist> *resultbl = new vector<bufferlist>(objExtents->size());
   c->is_read = true;
   c->io = m_ioCtxImpl;
   ReadCompletionData *cdata = new ReadCompletionData(this, soid, lockCookie, c,
-						     bl, extents, resultbl);
+						     bl, objExtents, resultbl);
   libradosstriper::MultiAioCompletionImpl *nc = new libradosstriper::MultiAioCompletionImpl;
   nc->set_complete_callback(cdata, striper_read_aio_req_complete);
   // go through the extents
   int r = 0, i = 0;
-  for (vector<ObjectExtent>::iterator p = extents->begin(); p != extents->end(); ++p) {
+  for (vector<ObjectExtent>::iterator p = objExtents->begin(); p != objExtents->end(); ++p) {
     // create a buffer list describing where to place data read from current extend
     bufferlist *oid_bl = &((*resultbl)[i++]);
     for (vector<pair<uint64_t,uint64_t> >::iterator q = p->buffer_extents.begin();
@@ -667,15 +799,14 @@ int libradosstriper::RadosStriperImpl::write_in_open_object(const std::string& s
 							    const ceph_file_layout& layout,
 							    const std::string& lockCookie,
 							    const bufferlist& bl,
-							    size_t len,
-							    uint64_t off) {
+							    const std::vector<std::pair<uint64_t, uint64_t> >& extents) {
   // create a completion object
   WriteCompletionData *cdata = new WriteCompletionData(this, soid, lockCookie);
   cdata->get();
   libradosstriper::MultiAioCompletionImpl *c = new libradosstriper::MultiAioCompletionImpl;
   c->set_complete_callback(cdata, striper_write_req_complete);
   // call the asynchronous API
-  int rc = internal_aio_write(soid, c, bl, len, off, layout);
+  int rc = internal_aio_write(soid, c, bl, extents, layout);
   if (!rc) {
     // wait for completion and safety of data
     c->wait_for_complete_and_cb();
@@ -714,8 +845,7 @@ int libradosstriper::RadosStriperImpl::aio_write_in_open_object(const std::strin
 								const ceph_file_layout& layout,
 								const std::string& lockCookie,
 								const bufferlist& bl,
-								size_t len,
-								uint64_t off) {
+								const std::vector<std::pair<uint64_t, uint64_t> >& extents) {
   // create a completion object
   m_ioCtxImpl->get();
   // we need 2 references as both striper_write_aio_req_complete and
@@ -726,7 +856,7 @@ int libradosstriper::RadosStriperImpl::aio_write_in_open_object(const std::strin
   nc->set_complete_callback(cdata, striper_write_aio_req_complete);
   nc->set_safe_callback(cdata, striper_write_aio_req_safe);
   // internal asynchronous API
-  int rc = internal_aio_write(soid, nc, bl, len, off, layout);
+  int rc = internal_aio_write(soid, nc, bl, extents, layout);
   nc->put();
   return rc;
 }
@@ -745,35 +875,59 @@ static void rados_req_write_complete(rados_completion_t c, void *arg)
   comp->complete_request(rados_aio_get_return_value(c));
 }
 
+void
+libradosstriper::RadosStriperImpl::file_to_object_extents(const std::string& soid,
+							  const ceph_file_layout& layout,
+							  const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+							  std::map<object_t, std::vector<ObjectExtent> >* objectExtents)
+{
+  std::string format = soid + RADOS_OBJECT_EXTENSION_FORMAT;
+  uint64_t bufferOffset = 0;
+  for (std::vector<std::pair<uint64_t, uint64_t> >::const_iterator p = extents.begin();
+       p != extents.end();
+       ++p) {
+    if (p->second == 0)
+      continue;
+    Striper::file_to_extents(cct(), format.c_str(), &layout, p->first, p->second, 0,
+			     *objectExtents, bufferOffset);
+    bufferOffset += p->second;
+  }
+}
+
 int
 libradosstriper::RadosStriperImpl::internal_aio_write(const std::string& soid,
 						      libradosstriper::MultiAioCompletionImpl *c,
 						      const bufferlist& bl,
-						      size_t len,
-						      uint64_t off,
+						      const std::vector<std::pair<uint64_t, uint64_t> >& extents,
 						      const ceph_file_layout& layout)
 {
-  // get list of extents to be written to
-  vector<ObjectExtent> extents;
-  std::string format = soid + RADOS_OBJECT_EXTENSION_FORMAT;
-  Striper::file_to_extents(cct(), format.c_str(), &layout, off, len, 0, extents);
-  // go through the extents
+  // get list of extents to be written to, grouped by rados object
+  std::map<object_t, std::vector<ObjectExtent> > objectExtents;
+  file_to_object_extents(soid, layout, extents, &objectExtents);
+  // go through the rados objects
   int r = 0;
-  for (vector<ObjectExtent>::iterator p = extents.begin(); p != extents.end(); ++p) {
-    // assemble pieces of a given object into a single buffer list
-    bufferlist oid_bl;
-    for (vector<pair<uint64_t,uint64_t> >::iterator q = p->buffer_extents.begin();
-	 q != p->buffer_extents.end();
-	 ++q) {
-      bufferlist buffer_bl;
-      buffer_bl.substr_of(bl, q->first, q->second);
-      oid_bl.append(buffer_bl);
-    }    
+  for (std::map<object_t, std::vector<ObjectExtent> >::iterator o = objectExtents.begin();
+       o != objectExtents.end();
+       ++o) {
+    // write all extents of a given object in one operation
+    librados::ObjectWriteOperation op;
+    for (vector<ObjectExtent>::iterator p = o->second.begin(); p != o->second.end(); ++p) {
+      // assemble pieces of a given extent into a single buffer list
+      bufferlist oid_bl;
+      for (vector<pair<uint64_t,uint64_t> >::iterator q = p->buffer_extents.begin();
+	   q != p->buffer_extents.end();
+	   ++q) {
+	bufferlist buffer_bl;
+	buffer_bl.substr_of(bl, q->first, q->second);
+	oid_bl.append(buffer_bl);
+      }
+      op.write(p->offset, oid_bl);
+    }
     // and write the object
     c->add_request();
     librados::AioCompletion *rados_completion =
       m_radosCluster.aio_create_completion(c, rados_req_write_complete, rados_req_write_safe);
-    r = m_ioCtx.aio_write(p->oid.name, rados_completion, oid_bl, p->length, p->offset);
+    r = m_ioCtx.aio_operate(o->first.name, rados_completion, &op);
     rados_completion->release();
     if (r < 0) 
       break;
@@ -832,8 +986,15 @@ int libradosstriper::RadosStriperImpl::internal_get_layout_and_size(const std::s
   std::map<std::string, bufferlist> attrs;
   int rc = m_ioCtx.getxattrs(oid, attrs);
   if (rc) return rc;
+  return extract_layout_and_size(attrs, layout, size);
+}
+
+int libradosstriper::RadosStriperImpl::extract_layout_and_size(std::map<std::string, bufferlist> &attrs,
+							       ceph_file_layout *layout,
+							       uint64_t *size)
+{
   // deal with stripe_unit
-  rc = extract_uint32_attr(attrs, XATTR_LAYOUT_STRIPE_UNIT, &layout->fl_stripe_unit);
+  int rc = extract_uint32_attr(attrs, XATTR_LAYOUT_STRIPE_UNIT, &layout->fl_stripe_unit);
   if (rc) return rc;
   // deal with stripe_count
   rc = extract_uint32_attr(attrs, XATTR_LAYOUT_STRIPE_COUNT, &layout->fl_stripe_count);
@@ -853,6 +1014,13 @@ int libradosstriper::RadosStriperImpl::openStripedObjectForRead(const std::strin
 								uint64_t *size,
 								std::string *lockCookie)
 {
+  if (cct()->_conf->rados_striper_lockless_reads) {
+    lockCookie->clear();
+    int rc = openStripedObjectForReadUnlocked(soid, layout, size);
+    if (rc != -EBUSY)
+      return rc;
+    // a truncation or a removal is in flight, go through the locked path
+  }
   // take a lock the first rados object, if it exists and gets its size
   // check, lock and size reading must be atomic and are thus done within a single operation
   librados::ObjectWriteOperation op;
@@ -876,6 +1044,44 @@ int libradosstriper::RadosStriperImpl::openStripedObjectForRead(const std::strin
   return rc;
 }
 
+int libradosstriper::RadosStriperImpl::openStripedObjectForReadUnlocked(const std::string& soid,
+									ceph_file_layout *layout,
+									uint64_t *size)
+{
+  // get the attributes of the first rados object and the state of its lock
+  // in a single operation, so that they are consistent
+  librados::ObjectReadOperation op;
+  std::map<std::string, bufferlist> attrs;
+  int attrsRval = 0;
+  op.getxattrs(&attrs, &attrsRval);
+  bufferlist lockIn, lockOut;
+  int lockRval = 0;
+  cls_lock_get_info_op lockOp;
+  lockOp.name = RADOS_LOCK_NAME;
+  ::encode(lockOp, lockIn);
+  op.exec("lock", "get_info", lockIn, &lockOut, &lockRval);
+  std::string firstObjOid = getObjectId(soid, 0);
+  int rc = m_ioCtx.operate(firstObjOid, &op, NULL);
+  if (rc) {
+    // error case (including -ENOENT)
+    return rc;
+  }
+  std::map<rados::cls::lock::locker_id_t, rados::cls::lock::locker_info_t> lockers;
+  ClsLockType lockType = LOCK_NONE;
+  bufferlist::iterator it = lockOut.begin();
+  rc = rados::cls::lock::get_lock_info_finish(&it, &lockers, &lockType, NULL);
+  if (rc) return rc;
+  if (lockType == LOCK_EXCLUSIVE && !lockers.empty())
+    return -EBUSY;
+  rc = extract_layout_and_size(attrs, layout, size);
+  if (rc) {
+    lderr(cct()) << "RadosStriperImpl::openStripedObjectForReadUnlocked : "
+		 << "could not load layout and size for "
+		 << soid << " : rc = " << rc << dendl;
+  }
+  return rc;
+}
+
 int libradosstriper::RadosStriperImpl::openStripedObjectForWrite(const std::string& soid,
 								 ceph_file_layout *layout,
 								 uint64_t *size,
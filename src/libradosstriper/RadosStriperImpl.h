@@ -16,6 +16,8 @@
 #define CEPH_LIBRADOSSTRIPER_RADOSSTRIPERIMPL_H
 
 #include <string>
+#include <vector>
+#include <utility>
 
 #include "include/atomic.h"
 
@@ -171,6 +173,11 @@ struct libradosstriper::RadosStriperImpl {
   int append(const std::string& soid, const bufferlist& bl, size_t len);
   int write_full(const std::string& soid, const bufferlist& bl);
   int read(const std::string& soid, bufferlist* pbl, size_t len, uint64_t off);
+  int writev(const std::string& soid,
+	     const std::vector<std::pair<uint64_t, bufferlist> >& extents);
+  int readv(const std::string& soid,
+	    const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+	    bufferlist* pbl);
 
   // asynchronous io
   int aio_write(const std::string& soid, librados::AioCompletionImpl *c,
@@ -183,6 +190,11 @@ struct libradosstriper::RadosStriperImpl {
 	       bufferlist* pbl, size_t len, uint64_t off);
   int aio_read(const std::string& soid, librados::AioCompletionImpl *c,
 	       char* buf, size_t len, uint64_t off);
+  int aio_writev(const std::string& soid, librados::AioCompletionImpl *c,
+		 const std::vector<std::pair<uint64_t, bufferlist> >& extents);
+  int aio_readv(const std::string& soid, librados::AioCompletionImpl *c,
+		const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+		bufferlist* pbl);
   int aio_flush();
 
   // stat, deletion and truncation
@@ -218,25 +230,42 @@ struct libradosstriper::RadosStriperImpl {
 		    const std::string& lockCookie);
 
   // internal versions of IO method
+  // In all of them, bl holds the data of the given (offset, length) extents
+  // of the striped object, one after the other
   int write_in_open_object(const std::string& soid,
 			   const ceph_file_layout& layout,
 			   const std::string& lockCookie,
 			   const bufferlist& bl,
-			   size_t len,
-			   uint64_t off);
+			   const std::vector<std::pair<uint64_t, uint64_t> >& extents);
   int aio_write_in_open_object(const std::string& soid,
 			       librados::AioCompletionImpl *c,
 			       const ceph_file_layout& layout,
 			       const std::string& lockCookie,
 			       const bufferlist& bl,
-			       size_t len,
-			       uint64_t off);
+			       const std::vector<std::pair<uint64_t, uint64_t> >& extents);
   int internal_aio_write(const std::string& soid,
 			 libradosstriper::MultiAioCompletionImpl *c,
 			 const bufferlist& bl,
-			 size_t len,
-			 uint64_t off,
+			 const std::vector<std::pair<uint64_t, uint64_t> >& extents,
 			 const ceph_file_layout& layout);
+  int internal_aio_read(const std::string& soid,
+			librados::AioCompletionImpl *c,
+			bufferlist* bl,
+			const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+			const ceph_file_layout& layout,
+			const std::string& lockCookie);
+
+  /**
+   * maps extents of a striped object onto the rados objects holding them,
+   * in a single pass. The buffer_extents of the resulting object extents
+   * are offsets in the concatenation of the data of all given extents.
+   * Pieces of different extents landing contiguously in the same rados
+   * object are merged into a single object extent
+   */
+  void file_to_object_extents(const std::string& soid,
+			      const ceph_file_layout& layout,
+			      const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+			      std::map<object_t, std::vector<ObjectExtent> >* objectExtents);
 
   int extract_uint32_attr(std::map<std::string, bufferlist> &attrs,
 			  const std::string& key,
@@ -246,6 +275,10 @@ struct libradosstriper::RadosStriperImpl {
 			 const std::string& key,
 			 size_t *value);
 
+  int extract_layout_and_size(std::map<std::string, bufferlist> &attrs,
+			      ceph_file_layout *layout,
+			      uint64_t *size);
+
   int internal_get_layout_and_size(const std::string& oid,
 				   ceph_file_layout *layout,
 				   uint64_t *size);
@@ -255,12 +288,27 @@ struct libradosstriper::RadosStriperImpl {
    * @return 0 if everything is ok and the lock was taken. -errcode otherwise
    * In particulae, if the striped object does not exists, -ENOENT is returned
    * In case the return code in not 0, no lock is taken
+   * If rados_striper_lockless_reads is set and no truncation or removal
+   * is in flight, the object is opened without taking the lock and
+   * lockCookie is left empty
    */
   int openStripedObjectForRead(const std::string& soid,
 			       ceph_file_layout *layout,
 			       uint64_t *size,
 			       std::string *lockCookie);
 
+  /**
+   * reads the layout and size of an existing striped object without
+   * locking it, checking in the same rados operation that no truncation
+   * or removal (which hold the exclusive lock) is in flight
+   * @return 0 if everything is ok, -EBUSY if the exclusive lock is held,
+   * -errcode otherwise. In particular, if the striped object does not exist,
+   * -ENOENT is returned
+   */
+  int openStripedObjectForReadUnlocked(const std::string& soid,
+				       ceph_file_layout *layout,
+				       uint64_t *size);
+
   /**
    * opens an existing striped object, takes a shared lock on it
    * and sets its size to the size it will have after the write.
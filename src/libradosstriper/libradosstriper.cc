@@ -264,6 +264,34 @@ int libradosstriper::RadosStriper::aio_read(const std::string& soid,
   return rados_striper_impl->aio_read(soid, c->pc, bl, len, off);
 }
 
+int libradosstriper::RadosStriper::writev(const std::string& soid,
+					  const std::vector<std::pair<uint64_t, bufferlist> >& extents)
+{
+  return rados_striper_impl->writev(soid, extents);
+}
+
+int libradosstriper::RadosStriper::aio_writev(const std::string& soid,
+					      librados::AioCompletion *c,
+					      const std::vector<std::pair<uint64_t, bufferlist> >& extents)
+{
+  return rados_striper_impl->aio_writev(soid, c->pc, extents);
+}
+
+int libradosstriper::RadosStriper::readv(const std::string& soid,
+					 const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+					 bufferlist* bl)
+{
+  return rados_striper_impl->readv(soid, extents, bl);
+}
+
+int libradosstriper::RadosStriper::aio_readv(const std::string& soid,
+					     librados::AioCompletion *c,
+					     const std::vector<std::pair<uint64_t, uint64_t> >& extents,
+					     bufferlist* bl)
+{
+  return rados_striper_impl->aio_readv(soid, c->pc, extents, bl);
+}
+
 int libradosstriper::RadosStriper::stat(const std::string& soid, uint64_t *psize, time_t *pmtime)
 {
   return rados_striper_impl->stat(soid, psize, pmtime);
@@ -3,6 +3,7 @@
 
 #include "common/ceph_context.h"
 #include "common/dout.h"
+#include "common/errno.h"
 #include "common/Mutex.h"
 #include "common/RWLock.h"
 
@@ -88,6 +89,16 @@ namespace librbd {
   int AioRead::send() {
     ldout(m_ictx->cct, 20) << "send " << this << " " << m_oid << " " << m_object_off << "~" << m_object_len << dendl;
 
+    // the object map can tell us the object is missing without asking
+    // the osd; treat it exactly like an ENOENT reply
+    if (m_ictx->object_map.may_skip_read(m_snap_id) &&
+	!m_ictx->object_map.object_may_exist(m_object_no)) {
+      ldout(m_ictx->cct, 20) << "send " << m_oid
+			     << " does not exist per object map" << dendl;
+      complete(-ENOENT);
+      return 0;
+    }
+
     librados::AioCompletion *rados_completion =
       librados::Rados::aio_create_completion(this, rados_req_cb, NULL);
     int r;
@@ -111,6 +122,8 @@ namespace librbd {
 
   AbstractWrite::AbstractWrite()
     : m_state(LIBRBD_AIO_WRITE_FLAT),
+      m_start_state(LIBRBD_AIO_WRITE_FLAT),
+      m_may_create(true),
       m_parent_overlap(0),
       m_snap_seq(0) {}
   AbstractWrite::AbstractWrite(ImageCtx *ictx, const std::string &oid,
@@ -122,7 +135,8 @@ namespace librbd {
 			       bool hide_enoent)
     : AioRequest(ictx, oid, object_no, object_off, len, snap_id, completion,
 		 hide_enoent),
-      m_state(LIBRBD_AIO_WRITE_FLAT), m_snap_seq(snapc.seq.val)
+      m_state(LIBRBD_AIO_WRITE_FLAT), m_start_state(LIBRBD_AIO_WRITE_FLAT),
+      m_may_create(true), m_snap_seq(snapc.seq.val)
   {
     m_object_image_extents = objectx;
     m_parent_overlap = object_overlap;
@@ -150,6 +164,19 @@ namespace librbd {
 
     bool finished = true;
     switch (m_state) {
+    case LIBRBD_AIO_WRITE_PRE:
+      ldout(m_ictx->cct, 20) << "WRITE_PRE" << dendl;
+      if (r < 0) {
+	lderr(m_ictx->cct) << "error updating object map for " << m_oid
+			   << ": " << cpp_strerror(r) << dendl;
+	break;
+      }
+      m_ictx->object_map.mark_updated(m_object_no, m_may_create);
+      m_state = m_start_state;
+      send_write();
+      finished = false;
+      break;
+
     case LIBRBD_AIO_WRITE_GUARD:
       ldout(m_ictx->cct, 20) << "WRITE_CHECK_GUARD" << dendl;
 
@@ -228,6 +255,20 @@ namespace librbd {
 
   int AbstractWrite::send() {
     ldout(m_ictx->cct, 20) << "send " << this << " " << m_oid << " " << m_object_off << "~" << m_object_len << dendl;
+    if (m_ictx->object_map.need_update(m_object_no, m_may_create)) {
+      m_start_state = m_state;
+      m_state = LIBRBD_AIO_WRITE_PRE;
+      librados::AioCompletion *rados_completion =
+	librados::Rados::aio_create_completion(this, NULL, rados_req_cb);
+      int r = m_ictx->object_map.aio_update(m_object_no, m_may_create,
+					    rados_completion);
+      rados_completion->release();
+      return r;
+    }
+    return send_write();
+  }
+
+  int AbstractWrite::send_write() {
     librados::AioCompletion *rados_completion =
       librados::Rados::aio_create_completion(this, NULL, rados_req_cb);
     int r;
@@ -111,7 +111,7 @@ namespace librbd {
   private:
     /**
      * Writes go through the following state machine to deal with
-     * layering:
+     * layering and the object map:
      *
      *                           need copyup
      * LIBRBD_AIO_WRITE_GUARD ---------------> LIBRBD_AIO_WRITE_COPYUP
@@ -123,9 +123,13 @@ namespace librbd {
      * LIBRBD_AIO_WRITE_FLAT
      *
      * Writes start in LIBRBD_AIO_WRITE_GUARD or _FLAT, depending on whether
-     * there is a parent or not.
+     * there is a parent or not.  If the object map does not yet know
+     * that the object exists or has been modified since the latest
+     * snapshot, the write is preceded by LIBRBD_AIO_WRITE_PRE, which
+     * updates the map and then moves on to the starting state.
      */
     enum write_state_d {
+      LIBRBD_AIO_WRITE_PRE,
       LIBRBD_AIO_WRITE_GUARD,
       LIBRBD_AIO_WRITE_COPYUP,
       LIBRBD_AIO_WRITE_FLAT
@@ -135,6 +139,8 @@ namespace librbd {
     virtual void add_copyup_ops() = 0;
 
     write_state_d m_state;
+    write_state_d m_start_state;
+    bool m_may_create;  ///< the write may create the object
     vector<pair<uint64_t,uint64_t> > m_object_image_extents;
     uint64_t m_parent_overlap;
     librados::ObjectWriteOperation m_write;
@@ -143,6 +149,7 @@ namespace librbd {
     std::vector<librados::snap_t> m_snaps;
 
   private:
+    int send_write();
     void send_copyup();
   };
 
@@ -190,10 +197,12 @@ namespace librbd {
 		      objectx, object_overlap,
 		      snapc, snap_id, completion,
 		      true) {
-      if (has_parent())
+      if (has_parent()) {
 	m_write.truncate(0);
-      else
+      } else {
 	m_write.remove();
+	m_may_create = false;
+      }
     }
     virtual ~AioRemove() {}
 
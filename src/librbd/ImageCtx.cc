@@ -6,6 +6,7 @@
 #include "common/dout.h"
 #include "common/errno.h"
 #include "common/perf_counters.h"
+#include "include/stringify.h"
 
 #include "librbd/internal.h"
 #include "librbd/WatchCtx.h"
@@ -41,7 +42,6 @@ namespace librbd {
       refresh_seq(0),
       last_refresh(0),
       md_lock("librbd::ImageCtx::md_lock"),
-      cache_lock("librbd::ImageCtx::cache_lock"),
       snap_lock("librbd::ImageCtx::snap_lock"),
       parent_lock("librbd::ImageCtx::parent_lock"),
       refresh_lock("librbd::ImageCtx::refresh_lock"),
@@ -52,9 +52,10 @@ namespace librbd {
       format_string(NULL),
       id(image_id), parent(NULL),
       stripe_unit(0), stripe_count(0),
-      object_cacher(NULL), writeback_handler(NULL), object_set(NULL),
       readahead(),
       total_bytes_read(0),
+      object_map(this),
+      write_log(NULL),
       pending_aio(0)
   {
     md_ctx.dup(p);
@@ -73,14 +74,15 @@ namespace librbd {
     perf_start(pname);
 
     if (cct->_conf->rbd_cache) {
-      Mutex::Locker l(cache_lock);
       ldout(cct, 20) << "enabling caching..." << dendl;
-      writeback_handler = new LibrbdWriteback(this, cache_lock);
 
+      // the size and dirty limits are split evenly across the shards
+      uint64_t shards = MAX(cct->_conf->rbd_cache_shards, 1);
       uint64_t init_max_dirty = cct->_conf->rbd_cache_max_dirty;
       if (cct->_conf->rbd_cache_writethrough_until_flush)
 	init_max_dirty = 0;
       ldout(cct, 20) << "Initial cache settings:"
+		     << " shards=" << shards
 		     << " size=" << cct->_conf->rbd_cache_size
 		     << " num_objects=" << 10
 		     << " max_dirty=" << init_max_dirty
@@ -88,34 +90,40 @@ namespace librbd {
 		     << " max_dirty_age="
 		     << cct->_conf->rbd_cache_max_dirty_age << dendl;
 
-      object_cacher = new ObjectCacher(cct, pname, *writeback_handler, cache_lock,
-				       NULL, NULL,
-				       cct->_conf->rbd_cache_size,
-				       10,  /* reset this in init */
-				       init_max_dirty,
-				       cct->_conf->rbd_cache_target_dirty,
-				       cct->_conf->rbd_cache_max_dirty_age,
-				       cct->_conf->rbd_cache_block_writes_upfront);
-      object_set = new ObjectCacher::ObjectSet(NULL, data_ctx.get_id(), 0);
-      object_set->return_enoent = true;
-      object_cacher->start();
+      for (uint64_t i = 0; i < shards; ++i) {
+	CacheShard *shard = new CacheShard;
+	Mutex::Locker l(shard->lock);
+	shard->writeback_handler = new LibrbdWriteback(this, shard->lock);
+	string shard_name = pname;
+	if (shards > 1)
+	  shard_name += "-" + stringify(i);
+	shard->object_cacher = new ObjectCacher(
+	  cct, shard_name, *shard->writeback_handler, shard->lock, NULL, NULL,
+	  cct->_conf->rbd_cache_size / shards,
+	  10,  /* reset this in init */
+	  init_max_dirty / shards,
+	  cct->_conf->rbd_cache_target_dirty / shards,
+	  cct->_conf->rbd_cache_max_dirty_age,
+	  cct->_conf->rbd_cache_block_writes_upfront);
+	shard->object_set = new ObjectCacher::ObjectSet(NULL, data_ctx.get_id(),
+							0);
+	shard->object_set->return_enoent = true;
+	shard->object_cacher->start();
+	cache_shards.push_back(shard);
+      }
     }
   }
 
   ImageCtx::~ImageCtx() {
     perf_stop();
-    if (object_cacher) {
-      delete object_cacher;
-      object_cacher = NULL;
-    }
-    if (writeback_handler) {
-      delete writeback_handler;
-      writeback_handler = NULL;
-    }
-    if (object_set) {
-      delete object_set;
-      object_set = NULL;
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p) {
+      delete (*p)->object_cacher;
+      delete (*p)->writeback_handler;
+      delete (*p)->object_set;
+      delete *p;
     }
+    cache_shards.clear();
     delete[] format_string;
   }
 
@@ -166,6 +174,8 @@ namespace librbd {
     md_config_t *conf = cct->_conf;
     readahead.set_trigger_requests(conf->rbd_readahead_trigger_requests);
     readahead.set_max_readahead_size(conf->rbd_readahead_max_bytes);
+    readahead.set_max_streams(conf->rbd_readahead_max_streams);
+    readahead.set_adaptive(conf->rbd_readahead_adaptive);
     return 0;
   }
 
@@ -198,7 +208,7 @@ namespace librbd {
     }
 
     // size object cache appropriately
-    if (object_cacher) {
+    if (cache_enabled()) {
       uint64_t obj = cct->_conf->rbd_cache_max_dirty_object;
       if (!obj) {
         obj = cct->_conf->rbd_cache_size / (1ull << order);
@@ -206,7 +216,12 @@ namespace librbd {
       }
       ldout(cct, 10) << " cache bytes " << cct->_conf->rbd_cache_size << " order " << (int)order
 		     << " -> about " << obj << " objects" << dendl;
-      object_cacher->set_max_objects(obj);
+      obj = MAX(obj / cache_shards.size(), 10);
+      for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	   p != cache_shards.end(); ++p) {
+	Mutex::Locker l((*p)->lock);
+	(*p)->object_cacher->set_max_objects(obj);
+      }
     }
 
     ldout(cct, 10) << "init_layout stripe_unit " << stripe_unit
@@ -248,6 +263,9 @@ namespace librbd {
     plb.add_u64_counter(l_librbd_resize, "resize");
     plb.add_u64_counter(l_librbd_readahead, "readahead");
     plb.add_u64_counter(l_librbd_readahead_bytes, "readahead_bytes");
+    plb.add_u64_counter(l_librbd_readahead_hit_bytes, "readahead_hit_bytes");
+    plb.add_u64_counter(l_librbd_readahead_wasted_bytes,
+			"readahead_wasted_bytes");
 
     perfcounter = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perfcounter);
@@ -473,27 +491,38 @@ namespace librbd {
     return -ENOENT;
   }
 
+  CacheShard *ImageCtx::get_cache_shard(const object_t &o) const {
+    assert(cache_enabled());
+    if (cache_shards.size() == 1)
+      return cache_shards[0];
+    return cache_shards[CEPH_HASH_NAMESPACE::hash<object_t>()(o) %
+			cache_shards.size()];
+  }
+
   void ImageCtx::aio_read_from_cache(object_t o, bufferlist *bl, size_t len,
 				     uint64_t off, Context *onfinish) {
+    CacheShard *shard = get_cache_shard(o);
     snap_lock.get_read();
-    ObjectCacher::OSDRead *rd = object_cacher->prepare_read(snap_id, bl, 0);
+    ObjectCacher::OSDRead *rd = shard->object_cacher->prepare_read(snap_id,
+								   bl, 0);
     snap_lock.put_read();
     ObjectExtent extent(o, 0 /* a lie */, off, len, 0);
     extent.oloc.pool = data_ctx.get_id();
     extent.buffer_extents.push_back(make_pair(0, len));
     rd->extents.push_back(extent);
-    cache_lock.Lock();
-    int r = object_cacher->readx(rd, object_set, onfinish);
-    cache_lock.Unlock();
+    shard->lock.Lock();
+    int r = shard->object_cacher->readx(rd, shard->object_set, onfinish);
+    shard->lock.Unlock();
     if (r != 0)
       onfinish->complete(r);
   }
 
   void ImageCtx::write_to_cache(object_t o, bufferlist& bl, size_t len,
 				uint64_t off, Context *onfinish) {
+    CacheShard *shard = get_cache_shard(o);
     snap_lock.get_read();
-    ObjectCacher::OSDWrite *wr = object_cacher->prepare_write(snapc, bl,
-							      utime_t(), 0);
+    ObjectCacher::OSDWrite *wr = shard->object_cacher->prepare_write(
+      snapc, bl, utime_t(), 0);
     snap_lock.put_read();
     ObjectExtent extent(o, 0, off, len, 0);
     extent.oloc.pool = data_ctx.get_id();
@@ -502,8 +531,9 @@ namespace librbd {
     extent.buffer_extents.push_back(make_pair(0, len));
     wr->extents.push_back(extent);
     {
-      Mutex::Locker l(cache_lock);
-      object_cacher->writex(wr, object_set, cache_lock, onfinish);
+      Mutex::Locker l(shard->lock);
+      shard->object_cacher->writex(wr, shard->object_set, shard->lock,
+				   onfinish);
     }
   }
 
@@ -523,7 +553,7 @@ namespace librbd {
   }
 
   void ImageCtx::user_flushed() {
-    if (object_cacher && cct->_conf->rbd_cache_writethrough_until_flush) {
+    if (cache_enabled() && cct->_conf->rbd_cache_writethrough_until_flush) {
       md_lock.get_read();
       bool flushed_before = flush_encountered;
       md_lock.put_read();
@@ -535,16 +565,33 @@ namespace librbd {
 	md_lock.put_write();
 
 	ldout(cct, 10) << "saw first user flush, enabling writeback" << dendl;
-	Mutex::Locker l(cache_lock);
-	object_cacher->set_max_dirty(max_dirty);
+	for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	     p != cache_shards.end(); ++p) {
+	  Mutex::Locker l((*p)->lock);
+	  (*p)->object_cacher->set_max_dirty(max_dirty / cache_shards.size());
+	}
       }
     }
   }
 
   void ImageCtx::flush_cache_aio(Context *onfinish) {
-    cache_lock.Lock();
-    object_cacher->flush_set(object_set, onfinish);
-    cache_lock.Unlock();
+    if (cache_shards.size() == 1) {
+      CacheShard *shard = cache_shards[0];
+      shard->lock.Lock();
+      shard->object_cacher->flush_set(shard->object_set, onfinish);
+      shard->lock.Unlock();
+      return;
+    }
+
+    C_GatherBuilder gather(cct, onfinish);
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p) {
+      Context *ctx = gather.new_sub();
+      (*p)->lock.Lock();
+      (*p)->object_cacher->flush_set((*p)->object_set, ctx);
+      (*p)->lock.Unlock();
+    }
+    gather.activate();
   }
 
   int ImageCtx::flush_cache() {
@@ -564,31 +611,54 @@ namespace librbd {
     return r;
   }
 
+  void ImageCtx::discard_cache(const vector<ObjectExtent>& extents) {
+    map<CacheShard*, vector<ObjectExtent> > shard_extents;
+    for (vector<ObjectExtent>::const_iterator p = extents.begin();
+	 p != extents.end(); ++p)
+      shard_extents[get_cache_shard(p->oid)].push_back(*p);
+    for (map<CacheShard*, vector<ObjectExtent> >::iterator p =
+	   shard_extents.begin();
+	 p != shard_extents.end(); ++p) {
+      Mutex::Locker l(p->first->lock);
+      p->first->object_cacher->discard_set(p->first->object_set, p->second);
+    }
+  }
+
   void ImageCtx::shutdown_cache() {
     md_lock.get_write();
     invalidate_cache();
     md_lock.put_write();
-    object_cacher->stop();
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p)
+      (*p)->object_cacher->stop();
   }
 
   int ImageCtx::invalidate_cache() {
-    if (!object_cacher)
+    if (!cache_enabled())
       return 0;
-    cache_lock.Lock();
-    object_cacher->release_set(object_set);
-    cache_lock.Unlock();
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p) {
+      Mutex::Locker l((*p)->lock);
+      (*p)->object_cacher->release_set((*p)->object_set);
+    }
     int r = flush_cache();
     if (r == -EBLACKLISTED) {
-      Mutex::Locker l(cache_lock);
       lderr(cct) << "Blacklisted during flush!  Purging cache..." << dendl;
-      object_cacher->purge_set(object_set);
+      for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	   p != cache_shards.end(); ++p) {
+	Mutex::Locker l((*p)->lock);
+	(*p)->object_cacher->purge_set((*p)->object_set);
+      }
     } else if (r) {
       lderr(cct) << "flush_cache returned " << r << dendl;
     }
     wait_for_pending_aio();
-    cache_lock.Lock();
-    loff_t unclean = object_cacher->release_set(object_set);
-    cache_lock.Unlock();
+    loff_t unclean = 0;
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p) {
+      Mutex::Locker l((*p)->lock);
+      unclean += (*p)->object_cacher->release_set((*p)->object_set);
+    }
     if (unclean) {
       lderr(cct) << "could not release all objects from cache: "
                  << unclean << " bytes remain" << dendl;
@@ -598,11 +668,11 @@ namespace librbd {
   }
 
   void ImageCtx::clear_nonexistence_cache() {
-    if (!object_cacher)
-      return;
-    cache_lock.Lock();
-    object_cacher->clear_nonexistence(object_set);
-    cache_lock.Unlock();
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p) {
+      Mutex::Locker l((*p)->lock);
+      (*p)->object_cacher->clear_nonexistence((*p)->object_set);
+    }
   }
 
   int ImageCtx::register_watch() {
@@ -23,6 +23,7 @@
 
 #include "cls/rbd/cls_rbd_client.h"
 #include "librbd/LibrbdWriteback.h"
+#include "librbd/ObjectMap.h"
 #include "librbd/SnapInfo.h"
 #include "librbd/parent_types.h"
 
@@ -32,6 +33,25 @@ class PerfCounters;
 namespace librbd {
 
   class WatchCtx;
+  class WriteLog;
+
+  /**
+   * One shard of the image's cache.  Objects are spread across the
+   * shards by hash, each with its own ObjectCacher, object set and
+   * lock, so that I/O to different objects does not serialize on a
+   * single cache lock, and each shard's flusher writes back
+   * independently.
+   */
+  struct CacheShard {
+    Mutex lock; // used as client_lock for the ObjectCacher
+    LibrbdWriteback *writeback_handler;
+    ObjectCacher *object_cacher;
+    ObjectCacher::ObjectSet *object_set;
+
+    CacheShard()
+      : lock("librbd::ImageCtx::cache_lock"),
+	writeback_handler(NULL), object_cacher(NULL), object_set(NULL) {}
+  };
 
   struct ImageCtx {
     CephContext *cct;
@@ -62,13 +82,12 @@ namespace librbd {
 
     /**
      * Lock ordering:
-     * md_lock, cache_lock, snap_lock, parent_lock, refresh_lock,
-     * aio_lock
+     * md_lock, cache lock (of one CacheShard at a time), snap_lock,
+     * parent_lock, refresh_lock, aio_lock
      */
     RWLock md_lock; // protects access to the mutable image metadata that
                    // isn't guarded by other locks below
                    // (size, features, image locks, etc)
-    Mutex cache_lock; // used as client_lock for the ObjectCacher
     RWLock snap_lock; // protects snapshot-related member variables:
     RWLock parent_lock; // protects parent_md and parent
     Mutex refresh_lock; // protects refresh_seq and last_refresh
@@ -90,13 +109,15 @@ namespace librbd {
 
     ceph_file_layout layout;
 
-    ObjectCacher *object_cacher;
-    LibrbdWriteback *writeback_handler;
-    ObjectCacher::ObjectSet *object_set;
+    std::vector<CacheShard*> cache_shards; // empty if caching is disabled
 
     Readahead readahead;
     uint64_t total_bytes_read;
 
+    ObjectMap object_map;
+
+    WriteLog *write_log; // NULL unless rbd_persistent_cache_path is set
+
     Cond pending_aio_cond;
     uint64_t pending_aio;
 
@@ -146,6 +167,10 @@ namespace librbd {
     uint64_t get_parent_snap_id(librados::snap_t in_snap_id) const;
     int get_parent_overlap(librados::snap_t in_snap_id,
 			   uint64_t *overlap) const;
+    bool cache_enabled() const {
+      return !cache_shards.empty();
+    }
+    CacheShard *get_cache_shard(const object_t &o) const;
     void aio_read_from_cache(object_t o, bufferlist *bl, size_t len,
 			     uint64_t off, Context *onfinish);
     void write_to_cache(object_t o, bufferlist& bl, size_t len, uint64_t off,
@@ -154,6 +179,7 @@ namespace librbd {
     void user_flushed();
     void flush_cache_aio(Context *onfinish);
     int flush_cache();
+    void discard_cache(const vector<ObjectExtent>& extents);
     void shutdown_cache();
     int invalidate_cache();
     void clear_nonexistence_cache();
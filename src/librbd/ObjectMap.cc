@@ -0,0 +1,360 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <stdio.h>
+
+#include "common/dout.h"
+#include "common/errno.h"
+#include "include/rbd/features.h"
+
+#include "cls/rbd/cls_rbd.h"
+#include "cls/rbd/cls_rbd_client.h"
+#include "librbd/ImageCtx.h"
+#include "librbd/internal.h"
+
+#include "librbd/ObjectMap.h"
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::ObjectMap: "
+
+namespace librbd {
+
+  ObjectMap::ObjectMap(ImageCtx *ictx)
+    : m_ictx(ictx), m_lock("librbd::ObjectMap::m_lock"),
+      m_enabled(false), m_head_locked(false), m_update_gen(0)
+  {
+  }
+
+  int ObjectMap::refresh()
+  {
+    bool enabled = !m_ictx->old_format &&
+      (m_ictx->features & RBD_FEATURE_OBJECT_MAP);
+
+    bool head_locked = false;
+    if (enabled && m_ictx->exclusive_locked) {
+      librados::Rados rados(m_ictx->md_ctx);
+      entity_name_t me = entity_name_t::CLIENT(rados.get_instance_id());
+      for (std::map<rados::cls::lock::locker_id_t,
+		    rados::cls::lock::locker_info_t>::const_iterator p =
+	     m_ictx->lockers.begin();
+	   p != m_ictx->lockers.end(); ++p) {
+	if (p->first.locker == me) {
+	  head_locked = true;
+	  break;
+	}
+      }
+    }
+
+    std::string oid = object_map_name(m_ictx->id);
+    uint64_t start_gen;
+    {
+      RWLock::RLocker l(m_lock);
+      start_gen = m_update_gen;
+    }
+    bufferlist bl;
+    std::map<std::string, bufferlist> vals;
+    if (enabled) {
+      librados::ObjectReadOperation op;
+      std::set<std::string> keys;
+      keys.insert(RBD_OBJECT_MAP_DIRTY_HEAD);
+      op.read(0, 0, &bl, NULL);
+      op.omap_get_vals_by_keys(keys, &vals, NULL);
+      int r = m_ictx->md_ctx.operate(oid, &op, NULL);
+      if (r < 0 && r != -ENOENT) {
+	lderr(m_ictx->cct) << "error reading object map " << oid << ": "
+			   << cpp_strerror(r) << dendl;
+	return r;
+      }
+    }
+    bufferlist &dirty = vals[RBD_OBJECT_MAP_DIRTY_HEAD];
+    std::vector<uint8_t> map(bl.c_str(), bl.c_str() + bl.length());
+    std::vector<uint8_t> head_dirty(dirty.c_str(),
+				    dirty.c_str() + dirty.length());
+
+    RWLock::WLocker l(m_lock);
+    if (enabled && m_enabled && m_update_gen != start_gen) {
+      // bits were set in memory after we started reading; our read may
+      // predate their on-disk update, so keep them.  Bits set by earlier
+      // updates are harmless: both maps only need to be supersets.
+      merge_bits(m_map, &map);
+      merge_bits(m_dirty, &head_dirty);
+    }
+    m_enabled = enabled;
+    m_head_locked = head_locked;
+    m_oid = oid;
+    m_map.swap(map);
+    m_dirty.swap(head_dirty);
+    ldout(m_ictx->cct, 20) << "refresh enabled=" << m_enabled
+			   << " head_locked=" << m_head_locked
+			   << " " << m_map.size() << " bytes" << dendl;
+    return 0;
+  }
+
+  bool ObjectMap::enabled() const
+  {
+    RWLock::RLocker l(m_lock);
+    return m_enabled;
+  }
+
+  bool ObjectMap::object_may_exist(uint64_t object_no) const
+  {
+    RWLock::RLocker l(m_lock);
+    return !m_enabled || test_bit(m_map, object_no);
+  }
+
+  bool ObjectMap::may_skip_read(librados::snap_t snap_id) const
+  {
+    RWLock::RLocker l(m_lock);
+    return m_enabled && (snap_id != CEPH_NOSNAP || m_head_locked);
+  }
+
+  bool ObjectMap::need_update(uint64_t object_no, bool may_create) const
+  {
+    RWLock::RLocker l(m_lock);
+    if (!m_enabled)
+      return false;
+    if (!test_bit(m_map, object_no))
+      return may_create;
+    return !test_bit(m_dirty, object_no);
+  }
+
+  int ObjectMap::aio_update(uint64_t object_no, bool may_create,
+			    librados::AioCompletion *c)
+  {
+    std::string oid;
+    {
+      RWLock::RLocker l(m_lock);
+      oid = m_oid;
+    }
+    ldout(m_ictx->cct, 20) << "aio_update " << object_no << " may_create="
+			   << may_create << dendl;
+    librados::ObjectWriteOperation op;
+    cls_client::object_map_update(&op, object_no, object_no + 1,
+				  may_create ? OBJECT_MAP_SET :
+				  OBJECT_MAP_TOUCH);
+    return m_ictx->md_ctx.aio_operate(oid, c, &op);
+  }
+
+  void ObjectMap::mark_updated(uint64_t object_no, bool may_create)
+  {
+    RWLock::WLocker l(m_lock);
+    if (may_create)
+      set_bit(&m_map, object_no);
+    set_bit(&m_dirty, object_no);
+    ++m_update_gen;
+  }
+
+  int ObjectMap::update(uint64_t start, uint64_t end, uint8_t state)
+  {
+    std::string oid;
+    {
+      RWLock::RLocker l(m_lock);
+      if (!m_enabled)
+	return 0;
+      oid = m_oid;
+    }
+
+    ldout(m_ictx->cct, 10) << "update " << start << "~" << (end - start)
+			   << " state " << (int)state << dendl;
+    int r = cls_client::object_map_update(&m_ictx->md_ctx, oid,
+					  start, end, state);
+    if (r < 0) {
+      lderr(m_ictx->cct) << "error updating object map " << oid << ": "
+			 << cpp_strerror(r) << dendl;
+      return r;
+    }
+
+    RWLock::WLocker l(m_lock);
+    for (uint64_t i = start; i < end; ++i) {
+      if (state == OBJECT_MAP_CLEAR) {
+	if (i / 8 >= m_map.size())
+	  break;
+	m_map[i / 8] &= ~(1 << (i % 8));
+      }
+      set_bit(&m_dirty, i);
+    }
+    ++m_update_gen;
+    return 0;
+  }
+
+  int ObjectMap::clear(uint64_t start, uint64_t end)
+  {
+    return update(start, end, OBJECT_MAP_CLEAR);
+  }
+
+  int ObjectMap::mark_dirty(uint64_t start, uint64_t end)
+  {
+    return update(start, end, OBJECT_MAP_TOUCH);
+  }
+
+  int ObjectMap::snap_add(librados::snap_t snap_id)
+  {
+    std::string oid;
+    {
+      RWLock::RLocker l(m_lock);
+      if (!m_enabled)
+	return 0;
+      oid = m_oid;
+    }
+
+    int r = cls_client::object_map_snap_add(&m_ictx->md_ctx, oid, snap_id);
+    if (r < 0) {
+      lderr(m_ictx->cct) << "error starting dirty map for snapshot "
+			 << snap_id << ": " << cpp_strerror(r) << dendl;
+      return r;
+    }
+
+    RWLock::WLocker l(m_lock);
+    m_dirty.clear();
+    return 0;
+  }
+
+  int ObjectMap::snap_remove(librados::snap_t snap_id, uint64_t num_objects)
+  {
+    std::string oid;
+    {
+      RWLock::RLocker l(m_lock);
+      if (!m_enabled)
+	return 0;
+      oid = m_oid;
+    }
+
+    int r = cls_client::object_map_snap_remove(&m_ictx->md_ctx, oid, snap_id,
+					       num_objects);
+    if (r < 0) {
+      lderr(m_ictx->cct) << "error merging dirty map of snapshot "
+			 << snap_id << ": " << cpp_strerror(r) << dendl;
+    }
+    return r;
+  }
+
+  int ObjectMap::load_dirty(const std::vector<librados::snap_t> &snaps,
+			    bool include_head, std::vector<uint8_t> *dirty,
+			    bool *complete)
+  {
+    std::string oid;
+    {
+      RWLock::RLocker l(m_lock);
+      oid = m_oid;
+    }
+
+    std::set<std::string> keys;
+    for (std::vector<librados::snap_t>::const_iterator p = snaps.begin();
+	 p != snaps.end(); ++p)
+      keys.insert(dirty_key(*p));
+    if (include_head)
+      keys.insert(RBD_OBJECT_MAP_DIRTY_HEAD);
+
+    std::map<std::string, bufferlist> vals;
+    int r = m_ictx->md_ctx.omap_get_vals_by_keys(oid, keys, &vals);
+    if (r < 0 && r != -ENOENT) {
+      lderr(m_ictx->cct) << "error reading dirty maps from " << oid << ": "
+			 << cpp_strerror(r) << dendl;
+      return r;
+    }
+
+    // a missing head map just means nothing was written since the
+    // latest snapshot
+    vals.erase(RBD_OBJECT_MAP_DIRTY_HEAD);
+    *complete = (vals.size() == snaps.size());
+
+    dirty->clear();
+    for (std::map<std::string, bufferlist>::iterator p = vals.begin();
+	 p != vals.end(); ++p) {
+      if (dirty->size() < p->second.length())
+	dirty->resize(p->second.length(), 0);
+      const char *q = p->second.c_str();
+      for (unsigned i = 0; i < p->second.length(); ++i)
+	(*dirty)[i] |= q[i];
+    }
+    if (include_head) {
+      // include writes we have made but not yet seen on disk
+      RWLock::RLocker l(m_lock);
+      merge_bits(m_dirty, dirty);
+    }
+    ldout(m_ictx->cct, 20) << "load_dirty " << snaps << " head="
+			   << include_head << " complete=" << *complete
+			   << dendl;
+    return 0;
+  }
+
+  int ObjectMap::write(const std::vector<uint8_t> &exists,
+		       const std::map<librados::snap_t,
+				      std::vector<uint8_t> > &snap_dirty,
+		       const std::vector<uint8_t> &head_dirty)
+  {
+    std::string oid;
+    {
+      RWLock::RLocker l(m_lock);
+      oid = m_oid;
+    }
+
+    bufferlist bl;
+    if (!exists.empty())
+      bl.append((const char *)&exists[0], exists.size());
+    std::map<std::string, bufferlist> vals;
+    for (std::map<librados::snap_t, std::vector<uint8_t> >::const_iterator p =
+	   snap_dirty.begin();
+	 p != snap_dirty.end(); ++p) {
+      bufferlist &v = vals[dirty_key(p->first)];
+      if (!p->second.empty())
+	v.append((const char *)&p->second[0], p->second.size());
+    }
+    bufferlist &v = vals[RBD_OBJECT_MAP_DIRTY_HEAD];
+    if (!head_dirty.empty())
+      v.append((const char *)&head_dirty[0], head_dirty.size());
+
+    librados::ObjectWriteOperation op;
+    op.write_full(bl);
+    op.omap_clear();
+    op.omap_set(vals);
+    int r = m_ictx->md_ctx.operate(oid, &op);
+    if (r < 0) {
+      lderr(m_ictx->cct) << "error writing object map " << oid << ": "
+			 << cpp_strerror(r) << dendl;
+      return r;
+    }
+
+    RWLock::WLocker l(m_lock);
+    m_map = exists;
+    m_dirty = head_dirty;
+    ++m_update_gen;
+    return 0;
+  }
+
+  std::string ObjectMap::dirty_key(librados::snap_t snap_id)
+  {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%016llx", RBD_OBJECT_MAP_DIRTY_PREFIX,
+	     (unsigned long long)snap_id);
+    return buf;
+  }
+
+  bool ObjectMap::test_bit(const std::vector<uint8_t> &bitmap,
+			   uint64_t object_no)
+  {
+    uint64_t byte = object_no / 8;
+    if (byte >= bitmap.size())
+      return false;
+    return bitmap[byte] & (1 << (object_no % 8));
+  }
+
+  void ObjectMap::set_bit(std::vector<uint8_t> *bitmap, uint64_t object_no)
+  {
+    uint64_t byte = object_no / 8;
+    if (byte >= bitmap->size())
+      bitmap->resize(byte + 1, 0);
+    (*bitmap)[byte] |= 1 << (object_no % 8);
+  }
+
+  void ObjectMap::merge_bits(const std::vector<uint8_t> &from,
+			     std::vector<uint8_t> *to)
+  {
+    if (to->size() < from.size())
+      to->resize(from.size(), 0);
+    for (unsigned i = 0; i < from.size(); ++i)
+      (*to)[i] |= from[i];
+  }
+
+}
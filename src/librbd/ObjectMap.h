@@ -0,0 +1,121 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRBD_OBJECTMAP_H
+#define CEPH_LIBRBD_OBJECTMAP_H
+
+#include "include/int_types.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/RWLock.h"
+#include "include/rados/librados.hpp"
+
+namespace librbd {
+
+  struct ImageCtx;
+
+  /**
+   * In-memory copy of an image's object map: one bit per data object,
+   * stored in the rbd_object_map.<id> object.
+   *
+   * A set bit means the object may exist in the head or in some
+   * snapshot; a clear bit means it exists in neither.  Bits are set on
+   * disk before the first write to an object, and only cleared once
+   * the object has been removed from an image without snapshots, so
+   * the on-disk map is always a superset of the objects that exist.
+   *
+   * The same object also keeps, for each snapshot, a bitmap of the
+   * objects modified since the previous snapshot, and one for the
+   * objects modified since the latest snapshot (the head's dirty map,
+   * which we cache here).  These are also supersets: any write,
+   * removal or rollback of an object marks it dirty first, and the
+   * interval of a snapshot may include writes made just after it was
+   * taken, so a diff starting at a snapshot must include that
+   * snapshot's own interval.
+   */
+  class ObjectMap {
+  public:
+    ObjectMap(ImageCtx *ictx);
+
+    /// reload from disk; called with snap_lock held
+    int refresh();
+
+    bool enabled() const;
+
+    /**
+     * Whether the object may exist.  Always true if the map is not
+     * enabled.
+     */
+    bool object_may_exist(uint64_t object_no) const;
+
+    /**
+     * Whether a clear bit can be trusted for reads from snap_id without
+     * reloading the map.  Snapshots are immutable, but the head can be
+     * written by other clients unless we hold the exclusive lock.
+     */
+    bool may_skip_read(librados::snap_t snap_id) const;
+
+    /**
+     * Whether the map must be updated on disk before modifying the
+     * object.  may_create is false for operations that can only remove
+     * the object.
+     */
+    bool need_update(uint64_t object_no, bool may_create) const;
+
+    /// update the object's bits on disk; call mark_updated() when done
+    int aio_update(uint64_t object_no, bool may_create,
+		   librados::AioCompletion *c);
+    void mark_updated(uint64_t object_no, bool may_create);
+
+    /// clear the existence bits of [start, end) on disk and in memory
+    int clear(uint64_t start, uint64_t end);
+
+    /// record [start, end) as modified since the latest snapshot
+    int mark_dirty(uint64_t start, uint64_t end);
+
+    /// start a new dirty interval after adding a snapshot
+    int snap_add(librados::snap_t snap_id);
+
+    /// fold a removed snapshot's dirty map into the following interval
+    int snap_remove(librados::snap_t snap_id, uint64_t num_objects);
+
+    /**
+     * Read the union of the dirty maps of the given snapshots, and of
+     * the head if include_head.  complete is set to false if any of
+     * them is missing, in which case every object must be considered
+     * modified.
+     */
+    int load_dirty(const std::vector<librados::snap_t> &snaps,
+		   bool include_head, std::vector<uint8_t> *dirty,
+		   bool *complete);
+
+    /// replace the whole map on disk
+    int write(const std::vector<uint8_t> &exists,
+	      const std::map<librados::snap_t, std::vector<uint8_t> > &snap_dirty,
+	      const std::vector<uint8_t> &head_dirty);
+
+    static std::string dirty_key(librados::snap_t snap_id);
+    static bool test_bit(const std::vector<uint8_t> &bitmap,
+			 uint64_t object_no);
+    static void set_bit(std::vector<uint8_t> *bitmap, uint64_t object_no);
+    static void merge_bits(const std::vector<uint8_t> &from,
+			   std::vector<uint8_t> *to);
+
+  private:
+    ImageCtx *m_ictx;
+    mutable RWLock m_lock;  ///< protects the members below
+    bool m_enabled;
+    bool m_head_locked;     ///< we hold the exclusive image lock
+    std::string m_oid;
+    std::vector<uint8_t> m_map;
+    std::vector<uint8_t> m_dirty;  ///< modified since the latest snapshot
+    uint64_t m_update_gen;  ///< bumped whenever bits are set in memory
+
+    int update(uint64_t start, uint64_t end, uint8_t state);
+  };
+
+}
+
+#endif
@@ -0,0 +1,806 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "common/blkdev.h"
+#include "common/Clock.h"
+#include "common/dout.h"
+#include "common/errno.h"
+#include "common/safe_io.h"
+#include "include/compat.h"
+#include "include/encoding.h"
+#include "include/stringify.h"
+
+#include "librbd/AioCompletion.h"
+#include "librbd/ImageCtx.h"
+#include "librbd/internal.h"
+
+#include "librbd/WriteLog.h"
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::WriteLog: "
+
+namespace librbd {
+
+  static const uint64_t SUPER_MAGIC = 0x676f6c7764627231ull;  // "1rbdwlog"
+  static const uint64_t RECORD_MAGIC = 0x636572776462723full; // "?rbdwrec"
+
+  class WriteLog::C_Append : public Context {
+  public:
+    C_Append(WriteLog *wl, uint64_t off, uint64_t len, const char *buf,
+	     Context *on_logged)
+      : m_wl(wl), m_off(off), m_len(len), m_buf(buf), m_on_logged(on_logged) {}
+    void finish(int r) {
+      r = m_wl->append(m_off, m_len, m_buf, m_on_logged);
+      if (r < 0)
+	m_on_logged->complete(r);
+    }
+  private:
+    WriteLog *m_wl;
+    uint64_t m_off;
+    uint64_t m_len;
+    const char *m_buf;
+    Context *m_on_logged;
+  };
+
+  class WriteLog::C_WritebackDone : public Context {
+  public:
+    C_WritebackDone(WriteLog *wl, Entry *e) : m_wl(wl), m_entry(e) {}
+    void finish(int r) {
+      m_wl->writeback_finish(m_entry, r);
+    }
+  private:
+    WriteLog *m_wl;
+    Entry *m_entry;
+  };
+
+  class WriteLog::C_Sync : public Context {
+  public:
+    C_Sync(WriteLog *wl, Context *on_safe) : m_wl(wl), m_on_safe(on_safe) {}
+    void finish(int r) {
+      if (::fdatasync(m_wl->m_fd) < 0)
+	r = -errno;
+      if (r == 0) {
+	Mutex::Locker l(m_wl->m_lock);
+	r = m_wl->m_log_error;
+      }
+      m_on_safe->complete(r);
+    }
+  private:
+    WriteLog *m_wl;
+    Context *m_on_safe;
+  };
+
+  WriteLog::WriteLog(ImageCtx *ictx, const std::string &path)
+    : m_ictx(ictx), m_path(path), m_fd(-1), m_ring_size(0), m_max_record(0),
+      m_nonce(0),
+      m_writeback_ops(ictx->cct->_conf->rbd_persistent_cache_writeback_ops),
+      m_writethrough_until_flush(
+	ictx->cct->_conf->rbd_cache_writethrough_until_flush),
+      m_lock("librbd::WriteLog::m_lock"),
+      m_head_pos(0), m_next_seq(1), m_tail_pos(0), m_tail_seq(1),
+      m_durable_tail_pos(0), m_syncing_super(false), m_flush_seen(false),
+      m_stopping(false), m_log_error(0), m_writeback_error(0),
+      m_writeback_in_flight(0), m_space_waiters(0),
+      m_writeback_thread(this), m_append_finisher(ictx->cct),
+      m_sync_finisher(ictx->cct)
+  {
+    if (m_writeback_ops < 1)
+      m_writeback_ops = 1;
+  }
+
+  WriteLog::~WriteLog()
+  {
+    assert(m_fd < 0);
+    for (std::list<Entry*>::iterator p = m_entries.begin();
+	 p != m_entries.end(); ++p)
+      delete *p;
+  }
+
+  int WriteLog::open_device(bool *created)
+  {
+    CephContext *cct = m_ictx->cct;
+    struct stat st;
+    if (::stat(m_path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      m_path += "/rbd-" + stringify(m_ictx->md_ctx.get_id()) + "-" +
+	(m_ictx->id.empty() ? m_ictx->name : m_ictx->id) + ".log";
+    }
+
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0600);
+    if (m_fd < 0) {
+      int r = -errno;
+      lderr(cct) << "error opening " << m_path << ": " << cpp_strerror(r)
+		 << dendl;
+      return r;
+    }
+    if (::flock(m_fd, LOCK_EX | LOCK_NB) < 0) {
+      int r = -errno;
+      lderr(cct) << m_path << " is in use by another image: "
+		 << cpp_strerror(r) << dendl;
+      return r == -EWOULDBLOCK ? -EBUSY : r;
+    }
+
+    int64_t size;
+    if (::fstat(m_fd, &st) < 0) {
+      int r = -errno;
+      lderr(cct) << "error stating " << m_path << ": " << cpp_strerror(r)
+		 << dendl;
+      return r;
+    }
+    *created = false;
+    if (S_ISBLK(st.st_mode)) {
+      int r = get_block_device_size(m_fd, &size);
+      if (r < 0) {
+	lderr(cct) << "error getting size of " << m_path << ": "
+		   << cpp_strerror(r) << dendl;
+	return r;
+      }
+    } else if (st.st_size == 0) {
+      size = cct->_conf->rbd_persistent_cache_size;
+      if (::ftruncate(m_fd, size) < 0) {
+	int r = -errno;
+	lderr(cct) << "error sizing " << m_path << ": " << cpp_strerror(r)
+		   << dendl;
+	return r;
+      }
+      *created = true;
+    } else {
+      size = st.st_size;
+    }
+
+    if (size < (int64_t)(LOG_BLOCK_SIZE + 16 * RECORD_ALIGN)) {
+      lderr(cct) << m_path << " is too small for a write log" << dendl;
+      return -EINVAL;
+    }
+    m_ring_size = (size - LOG_BLOCK_SIZE) / RECORD_ALIGN * RECORD_ALIGN;
+    m_max_record = m_ring_size / 4 / RECORD_ALIGN * RECORD_ALIGN;
+    return 0;
+  }
+
+  int WriteLog::read_super(uint64_t *tail_pos, uint64_t *tail_seq)
+  {
+    bufferptr bp(LOG_BLOCK_SIZE);
+    int r = safe_pread_exact(m_fd, bp.c_str(), LOG_BLOCK_SIZE, 0);
+    if (r < 0)
+      return r;
+    bufferlist bl;
+    bl.append(bp);
+
+    uint64_t magic, ring_size;
+    int64_t pool_id;
+    std::string header_oid;
+    try {
+      bufferlist::iterator p = bl.begin();
+      ::decode(magic, p);
+      if (magic != SUPER_MAGIC)
+	return -EINVAL;
+      ::decode(m_nonce, p);
+      ::decode(pool_id, p);
+      ::decode(header_oid, p);
+      ::decode(ring_size, p);
+      ::decode(*tail_pos, p);
+      ::decode(*tail_seq, p);
+      bufferlist fields;
+      fields.substr_of(bl, 0, p.get_off());
+      uint32_t crc;
+      ::decode(crc, p);
+      if (crc != fields.crc32c(0))
+	return -EINVAL;
+    } catch (buffer::error& e) {
+      return -EINVAL;
+    }
+    if (ring_size > m_ring_size || ring_size < 16 * RECORD_ALIGN)
+      return -EINVAL;
+    m_ring_size = ring_size;
+    m_max_record = m_ring_size / 4 / RECORD_ALIGN * RECORD_ALIGN;
+
+    if (pool_id != m_ictx->md_ctx.get_id() ||
+	header_oid != m_ictx->header_oid)
+      return -EXDEV;
+    return 0;
+  }
+
+  int WriteLog::write_super(uint64_t tail_pos, uint64_t tail_seq)
+  {
+    bufferlist bl;
+    ::encode(SUPER_MAGIC, bl);
+    ::encode(m_nonce, bl);
+    ::encode((int64_t)m_ictx->md_ctx.get_id(), bl);
+    ::encode(m_ictx->header_oid, bl);
+    ::encode(m_ring_size, bl);
+    ::encode(tail_pos, bl);
+    ::encode(tail_seq, bl);
+    ::encode(bl.crc32c(0), bl);
+    bl.append_zero(LOG_BLOCK_SIZE - bl.length());
+
+    int r = safe_pwrite(m_fd, bl.c_str(), bl.length(), 0);
+    if (r == 0 && ::fdatasync(m_fd) < 0)
+      r = -errno;
+    if (r < 0) {
+      lderr(m_ictx->cct) << "error writing superblock of " << m_path << ": "
+			 << cpp_strerror(r) << dendl;
+    }
+    return r;
+  }
+
+  int WriteLog::read_record(uint64_t pos, uint64_t seq, bool *wrap,
+			    uint64_t *off, bufferlist *data)
+  {
+    bufferptr hp(RECORD_ALIGN);
+    int r = safe_pread_exact(m_fd, hp.c_str(), RECORD_ALIGN, file_offset(pos));
+    if (r < 0)
+      return r;
+    bufferlist hbl;
+    hbl.append(hp);
+
+    uint64_t magic, nonce, rseq, len;
+    uint32_t data_crc;
+    try {
+      bufferlist::iterator p = hbl.begin();
+      ::decode(magic, p);
+      ::decode(nonce, p);
+      ::decode(rseq, p);
+      ::decode(*off, p);
+      ::decode(len, p);
+      ::decode(data_crc, p);
+      bufferlist fields;
+      fields.substr_of(hbl, 0, p.get_off());
+      uint32_t crc;
+      ::decode(crc, p);
+      if (crc != fields.crc32c(0))
+	return -ENOENT;
+    } catch (buffer::error& e) {
+      return -ENOENT;
+    }
+    // records from an earlier lap or an earlier log have the wrong
+    // sequence number or nonce
+    if (magic != RECORD_MAGIC || nonce != m_nonce || rseq != seq)
+      return -ENOENT;
+
+    *wrap = (len == 0);
+    if (*wrap)
+      return 0;
+    if (record_length(len) > m_max_record ||
+	pos % m_ring_size + record_length(len) > m_ring_size)
+      return -ENOENT;
+
+    bufferptr bp(len);
+    r = safe_pread_exact(m_fd, bp.c_str(), len,
+			 file_offset(pos) + RECORD_ALIGN);
+    if (r < 0)
+      return r;
+    data->clear();
+    data->append(bp);
+    if (data->crc32c(0) != data_crc)
+      return -ENOENT;  // torn write
+    return 0;
+  }
+
+  int WriteLog::write_record(uint64_t pos, uint64_t seq, uint64_t off,
+			     uint64_t len, const char *buf)
+  {
+    uint64_t rec_len = len ? record_length(len) : RECORD_ALIGN;
+    bufferptr rec(buffer::create_page_aligned(rec_len));
+    rec.zero();
+
+    bufferlist hbl;
+    ::encode(RECORD_MAGIC, hbl);
+    ::encode(m_nonce, hbl);
+    ::encode(seq, hbl);
+    ::encode(off, hbl);
+    ::encode(len, hbl);
+    ::encode(ceph_crc32c(0, (const unsigned char *)buf, len), hbl);
+    ::encode(hbl.crc32c(0), hbl);
+    hbl.copy(0, hbl.length(), rec.c_str());
+    if (len)
+      memcpy(rec.c_str() + RECORD_ALIGN, buf, len);
+
+    return safe_pwrite(m_fd, rec.c_str(), rec_len, file_offset(pos));
+  }
+
+  int WriteLog::replay(uint64_t tail_pos, uint64_t tail_seq)
+  {
+    CephContext *cct = m_ictx->cct;
+    uint64_t pos = tail_pos;
+    uint64_t seq = tail_seq;
+    uint64_t replayed = 0;
+    while (pos - tail_pos < m_ring_size) {
+      bool wrap;
+      uint64_t off;
+      bufferlist data;
+      int r = read_record(pos, seq, &wrap, &off, &data);
+      if (r == -ENOENT)
+	break;
+      if (r < 0) {
+	lderr(cct) << "error reading " << m_path << ": " << cpp_strerror(r)
+		   << dendl;
+	return r;
+      }
+      if (wrap) {
+	pos += m_ring_size - pos % m_ring_size;
+      } else {
+	ldout(cct, 20) << "replay seq " << seq << " " << off << "~"
+		       << data.length() << dendl;
+	ssize_t w = librbd::write(m_ictx, off, data.length(), data.c_str(), 0);
+	if (w == -EINVAL) {
+	  // the image has been shrunk past the write since
+	  ldout(cct, 5) << "replay seq " << seq << " is past the end of the "
+			<< "image, skipping" << dendl;
+	} else if (w < 0) {
+	  lderr(cct) << "error replaying write " << off << "~"
+		     << data.length() << ": " << cpp_strerror(w) << dendl;
+	  return w;
+	}
+	pos += record_length(data.length());
+	++replayed;
+      }
+      ++seq;
+    }
+
+    if (replayed) {
+      ldout(cct, 1) << "replayed " << replayed << " writes from " << m_path
+		    << dendl;
+      int r = flush_image();
+      if (r < 0)
+	return r;
+    }
+    m_head_pos = m_tail_pos = m_durable_tail_pos = pos;
+    m_next_seq = m_tail_seq = seq;
+    return write_super(pos, seq);
+  }
+
+  int WriteLog::init()
+  {
+    CephContext *cct = m_ictx->cct;
+    bool created;
+    int r = open_device(&created);
+    if (r < 0)
+      goto fail;
+
+    uint64_t tail_pos, tail_seq;
+    r = created ? -EINVAL : read_super(&tail_pos, &tail_seq);
+    if (r == -EXDEV) {
+      bool wrap;
+      uint64_t off;
+      bufferlist data;
+      if (read_record(tail_pos, tail_seq, &wrap, &off, &data) == 0) {
+	lderr(cct) << m_path << " holds unwritten data of another image"
+		   << dendl;
+	r = -EEXIST;
+	goto fail;
+      }
+    }
+    if (r < 0) {
+      // start a new log; records of any old one are ignored as their
+      // nonce does not match
+      ldout(cct, 5) << "creating a new log in " << m_path << dendl;
+      m_nonce = ceph_clock_now(cct).to_nsec() ^ ((uint64_t)getpid() << 32);
+      tail_pos = 0;
+      tail_seq = 1;
+    }
+
+    r = replay(tail_pos, tail_seq);
+    if (r < 0)
+      goto fail;
+
+    ldout(cct, 10) << "init " << m_path << " ring " << m_ring_size
+		   << " tail " << m_tail_pos << " seq " << m_tail_seq << dendl;
+    m_append_finisher.start();
+    m_sync_finisher.start();
+    m_writeback_thread.create();
+    return 0;
+
+  fail:
+    if (m_fd >= 0) {
+      VOID_TEMP_FAILURE_RETRY(::close(m_fd));
+      m_fd = -1;
+    }
+    return r;
+  }
+
+  bool WriteLog::skip_writeback() const
+  {
+    return m_ictx->cct->_conf->rbd_persistent_cache_debug_skip_writeback;
+  }
+
+  int WriteLog::shut_down()
+  {
+    int r = skip_writeback() ? -ESHUTDOWN : flush();
+    m_append_finisher.wait_for_empty();
+    m_append_finisher.stop();
+
+    m_lock.Lock();
+    m_stopping = true;
+    m_cond.SignalAll();
+    for (std::list<Waiter>::iterator p = m_waiters.begin();
+	 p != m_waiters.end(); ++p)
+      m_sync_finisher.queue(p->on_ready, -ESHUTDOWN);
+    m_waiters.clear();
+    m_lock.Unlock();
+    m_writeback_thread.join();
+    m_sync_finisher.wait_for_empty();
+    m_sync_finisher.stop();
+
+    if (r < 0) {
+      lderr(m_ictx->cct) << "unable to write back all of " << m_path
+			 << ", it will be replayed on the next open: "
+			 << cpp_strerror(r) << dendl;
+    }
+    VOID_TEMP_FAILURE_RETRY(::close(m_fd));
+    m_fd = -1;
+    return r;
+  }
+
+  int WriteLog::alloc_record(uint64_t len, Entry **wrap, Entry **e)
+  {
+    uint64_t rec_len = record_length(len);
+    uint64_t pad = 0;
+    uint64_t ring_off = m_head_pos % m_ring_size;
+    if (ring_off + rec_len > m_ring_size)
+      pad = m_ring_size - ring_off;
+
+    while (m_log_error == 0 &&
+	   m_head_pos + pad + rec_len - m_durable_tail_pos > m_ring_size) {
+      // without writeback the log will never drain
+      if (m_writeback_error)
+	return m_writeback_error;
+      ldout(m_ictx->cct, 20) << "log full, waiting for writeback" << dendl;
+      ++m_space_waiters;
+      m_cond.SignalAll();
+      m_cond.Wait(m_lock);
+      --m_space_waiters;
+    }
+    if (m_log_error)
+      return m_log_error;
+
+    *wrap = NULL;
+    if (pad) {
+      *wrap = new Entry(m_next_seq++, m_head_pos, pad, 0, 0);
+      m_head_pos += pad;
+      m_entries.push_back(*wrap);
+      m_unacked.push_back(*wrap);
+      m_pending.push_back(*wrap);
+    }
+    *e = new Entry(m_next_seq++, m_head_pos, rec_len, 0, len);
+    m_head_pos += rec_len;
+    m_entries.push_back(*e);
+    m_unacked.push_back(*e);
+    m_pending.push_back(*e);
+    return 0;
+  }
+
+  void WriteLog::finish_logging(Entry *e, int r)
+  {
+    std::list<Context*> acked;
+    {
+      Mutex::Locker l(m_lock);
+      if (r < 0) {
+	lderr(m_ictx->cct) << "error writing to " << m_path << ": "
+			   << cpp_strerror(r) << dendl;
+	// leave a hole that writeback skips; replay would stop at it,
+	// so no further writes are accepted
+	if (m_log_error == 0)
+	  m_log_error = r;
+	if (e->len)
+	  remove_by_off_locked(e);
+	e->len = 0;
+	e->on_logged = NULL;
+	check_waiters_locked();
+      }
+      e->state = ENTRY_PENDING;
+
+      while (!m_unacked.empty() &&
+	     m_unacked.front()->state != ENTRY_LOGGING) {
+	Entry *f = m_unacked.front();
+	if (f->on_logged)
+	  acked.push_back(f->on_logged);
+	f->on_logged = NULL;
+	m_unacked.pop_front();
+      }
+      m_cond.SignalAll();
+    }
+    for (std::list<Context*>::iterator p = acked.begin(); p != acked.end(); ++p)
+      (*p)->complete(0);
+  }
+
+  int WriteLog::append(uint64_t off, uint64_t len, const char *buf,
+		       Context *on_logged)
+  {
+    CephContext *cct = m_ictx->cct;
+    ldout(cct, 20) << "append " << off << "~" << len << dendl;
+    if (len == 0) {
+      on_logged->complete(0);
+      return 0;
+    }
+
+    uint64_t max_len = m_max_record - RECORD_ALIGN;
+    while (len > 0) {
+      uint64_t chunk = std::min(len, max_len);
+      Entry *wrap, *e;
+      bool writethrough;
+      {
+	Mutex::Locker l(m_lock);
+	int r = alloc_record(chunk, &wrap, &e);
+	if (r < 0)
+	  return r;
+	e->off = off;
+	if (chunk == len)
+	  e->on_logged = on_logged;
+	m_entries_by_off.insert(std::make_pair(off, e));
+	writethrough = m_writethrough_until_flush && !m_flush_seen;
+      }
+
+      if (wrap)
+	finish_logging(wrap, write_record(wrap->pos, wrap->seq, 0, 0, NULL));
+      int r = write_record(e->pos, e->seq, off, chunk, buf);
+      if (r == 0 && writethrough && ::fdatasync(m_fd) < 0)
+	r = -errno;
+      finish_logging(e, r);
+      if (r < 0)
+	return r;
+
+      off += chunk;
+      buf += chunk;
+      len -= chunk;
+    }
+    return 0;
+  }
+
+  void WriteLog::aio_append(uint64_t off, uint64_t len, const char *buf,
+			    Context *on_logged)
+  {
+    m_append_finisher.queue(new C_Append(this, off, len, buf, on_logged));
+  }
+
+  void WriteLog::aio_flush(Context *on_safe)
+  {
+    {
+      Mutex::Locker l(m_lock);
+      m_flush_seen = true;
+    }
+    // behind the appends queued so far, but without holding up later ones
+    m_append_finisher.queue(
+      new C_OnFinisher(new C_Sync(this, on_safe), &m_sync_finisher));
+  }
+
+  bool WriteLog::overlaps_locked(uint64_t off, uint64_t len,
+				 bool writing_only) const
+  {
+    // no record holds more than m_max_record bytes
+    uint64_t start = off > m_max_record ? off - m_max_record : 0;
+    for (std::multimap<uint64_t, Entry*>::const_iterator p =
+	   m_entries_by_off.lower_bound(start);
+	 p != m_entries_by_off.end() && p->first < off + len; ++p) {
+      Entry *e = p->second;
+      if (e->off + e->len > off &&
+	  (!writing_only || e->state == ENTRY_WRITING))
+	return true;
+    }
+    return false;
+  }
+
+  bool WriteLog::overlaps_locked(
+    const std::vector<std::pair<uint64_t,uint64_t> > &image_extents) const
+  {
+    for (std::vector<std::pair<uint64_t,uint64_t> >::const_iterator p =
+	   image_extents.begin();
+	 p != image_extents.end(); ++p) {
+      if (overlaps_locked(p->first, p->second, false))
+	return true;
+    }
+    return false;
+  }
+
+  void WriteLog::remove_by_off_locked(Entry *e)
+  {
+    for (std::multimap<uint64_t, Entry*>::iterator p =
+	   m_entries_by_off.lower_bound(e->off);
+	 p != m_entries_by_off.end() && p->first == e->off; ++p) {
+      if (p->second == e) {
+	m_entries_by_off.erase(p);
+	return;
+      }
+    }
+  }
+
+  bool WriteLog::wait_for_writeback(
+    const std::vector<std::pair<uint64_t,uint64_t> > &image_extents,
+    Context *on_ready)
+  {
+    Mutex::Locker l(m_lock);
+    if (m_writeback_error) {
+      m_sync_finisher.queue(on_ready, m_writeback_error);
+      return true;
+    }
+    if (!overlaps_locked(image_extents))
+      return false;
+    ldout(m_ictx->cct, 20) << "waiting for writeback of " << image_extents
+			   << dendl;
+    Waiter w;
+    w.extents = image_extents;
+    w.on_ready = on_ready;
+    m_waiters.push_back(w);
+    return true;
+  }
+
+  void WriteLog::check_waiters_locked()
+  {
+    for (std::list<Waiter>::iterator p = m_waiters.begin();
+	 p != m_waiters.end(); ) {
+      if (m_writeback_error == 0 && overlaps_locked(p->extents)) {
+	++p;
+	continue;
+      }
+      m_sync_finisher.queue(p->on_ready, m_writeback_error);
+      m_waiters.erase(p++);
+    }
+  }
+
+  void WriteLog::retire_entries_locked()
+  {
+    while (!m_entries.empty() && m_entries.front()->state == ENTRY_DONE) {
+      Entry *e = m_entries.front();
+      m_tail_pos = e->pos + e->rec_len;
+      m_tail_seq = e->seq + 1;
+      m_entries.pop_front();
+      delete e;
+    }
+  }
+
+  int WriteLog::flush_image()
+  {
+    if (m_ictx->cache_enabled())
+      return m_ictx->flush_cache();
+    return m_ictx->data_ctx.aio_flush();
+  }
+
+  int WriteLog::sync_super_locked()
+  {
+    while (m_syncing_super)
+      m_cond.Wait(m_lock);
+    retire_entries_locked();
+    uint64_t pos = m_tail_pos;
+    uint64_t seq = m_tail_seq;
+    if (pos == m_durable_tail_pos)
+      return 0;
+
+    // the writes behind the new tail must be stable in the cluster
+    // before the superblock stops replay from covering them
+    m_syncing_super = true;
+    m_lock.Unlock();
+    int r = flush_image();
+    if (r == 0)
+      r = write_super(pos, seq);
+    m_lock.Lock();
+    m_syncing_super = false;
+    if (r == 0) {
+      ldout(m_ictx->cct, 20) << "tail now " << pos << " seq " << seq << dendl;
+      m_durable_tail_pos = pos;
+    } else if (m_writeback_error == 0) {
+      m_writeback_error = r;
+      check_waiters_locked();
+    }
+    m_cond.SignalAll();
+    return r;
+  }
+
+  int WriteLog::flush()
+  {
+    m_append_finisher.wait_for_empty();
+    if (skip_writeback())
+      return 0;
+
+    Mutex::Locker l(m_lock);
+    while (m_writeback_error == 0 &&
+	   (!m_pending.empty() || m_writeback_in_flight > 0)) {
+      m_cond.SignalAll();
+      m_cond.Wait(m_lock);
+    }
+    if (m_writeback_error)
+      return m_writeback_error;
+    return sync_super_locked();
+  }
+
+  void WriteLog::writeback_entry()
+  {
+    m_lock.Lock();
+    while (!m_stopping) {
+      retire_entries_locked();
+      if (m_writeback_error == 0 && !m_syncing_super &&
+	  m_tail_pos != m_durable_tail_pos &&
+	  (m_space_waiters > 0 ||
+	   m_tail_pos - m_durable_tail_pos >= m_ring_size / 4)) {
+	sync_super_locked();
+	continue;
+      }
+
+      bool issued = false;
+      while (!skip_writeback() && m_writeback_error == 0 &&
+	     !m_pending.empty() &&
+	     m_writeback_in_flight < m_writeback_ops) {
+	Entry *e = m_pending.front();
+	if (e->state == ENTRY_LOGGING)
+	  break;
+	if (e->len == 0) {
+	  e->state = ENTRY_DONE;
+	  m_pending.pop_front();
+	  m_cond.SignalAll();
+	  continue;
+	}
+	// keep overlapping writes in order
+	if (overlaps_locked(e->off, e->len, true))
+	  break;
+	m_pending.pop_front();
+	e->state = ENTRY_WRITING;
+	++m_writeback_in_flight;
+	m_lock.Unlock();
+	writeback(e);
+	m_lock.Lock();
+	issued = true;
+      }
+      if (!issued)
+	m_cond.Wait(m_lock);
+    }
+    m_lock.Unlock();
+  }
+
+  void WriteLog::writeback(Entry *e)
+  {
+    ldout(m_ictx->cct, 20) << "writeback seq " << e->seq << " " << e->off
+			   << "~" << e->len << dendl;
+    bufferptr bp(e->len);
+    int r = safe_pread_exact(m_fd, bp.c_str(), e->len,
+			     file_offset(e->pos) + RECORD_ALIGN);
+    if (r < 0) {
+      writeback_finish(e, r);
+      return;
+    }
+
+    Context *ctx = new C_WritebackDone(this, e);
+    AioCompletion *c = aio_create_completion_internal(ctx, rbd_ctx_cb);
+    r = _aio_write(m_ictx, e->off, e->len, bp.c_str(), c, 0);
+    if (r < 0) {
+      c->release();
+      delete ctx;
+      writeback_finish(e, r);
+    }
+  }
+
+  void WriteLog::writeback_finish(Entry *e, int r)
+  {
+    Mutex::Locker l(m_lock);
+    --m_writeback_in_flight;
+    if (r == -EINVAL) {
+      // another client has shrunk the image past the write since; as in
+      // replay(), there is nothing left to write it to
+      ldout(m_ictx->cct, 5) << "writeback " << e->off << "~" << e->len
+			    << " is past the end of the image, skipping"
+			    << dendl;
+      r = 0;
+    }
+    if (r < 0) {
+      lderr(m_ictx->cct) << "error writing back " << e->off << "~" << e->len
+			 << ", stopping writeback: " << cpp_strerror(r)
+			 << dendl;
+      // the write stays in the log, to be replayed on the next open
+      if (m_writeback_error == 0)
+	m_writeback_error = r;
+      e->state = ENTRY_PENDING;
+      m_pending.push_front(e);
+    } else {
+      e->state = ENTRY_DONE;
+      remove_by_off_locked(e);
+    }
+    check_waiters_locked();
+    m_cond.SignalAll();
+  }
+
+}
@@ -0,0 +1,210 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRBD_WRITELOG_H
+#define CEPH_LIBRBD_WRITELOG_H
+
+#include "include/int_types.h"
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/Cond.h"
+#include "common/Finisher.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "include/buffer.h"
+#include "include/Context.h"
+
+namespace librbd {
+
+  struct ImageCtx;
+
+  /**
+   * A persistent write-back log for an image, kept in a local file or
+   * block device (rbd_persistent_cache_path).
+   *
+   * Writes are appended to the log and acknowledged once they are in
+   * it, and a guest flush only has to sync the log, so both see the
+   * latency of the local device.  A writeback thread copies logged
+   * writes to the image in log order, with at most
+   * rbd_persistent_cache_writeback_ops in flight, and never two that
+   * overlap.  Space is reused once the writes in it are stable in the
+   * cluster and the superblock has been updated past them.
+   *
+   * Layout: a superblock in the first LOG_BLOCK_SIZE bytes, followed
+   * by a ring of records.  Each record is a RECORD_ALIGN-sized header
+   * (nonce, sequence number, image extent and crcs) followed by the
+   * data, padded to RECORD_ALIGN; a record with no data marks a wrap
+   * to the start of the ring.  Records are addressed by an
+   * ever-increasing log position, whose remainder modulo the ring
+   * size is the offset within the ring.
+   *
+   * On open, the records after the superblock's tail are replayed to
+   * the image in order, up to the first record that is torn or belongs
+   * to an earlier lap, so writes that were acknowledged but never
+   * reached the cluster survive a crash of the client.
+   *
+   * Writes are acknowledged in log order, so replay never skips a
+   * record that was acknowledged.  Reads and discards that overlap
+   * writes still in the log wait for them to be written back.
+   *
+   * Nothing here blocks the caller: records are written, and waits for
+   * log space made, by a log writer thread, and a read or discard that
+   * has to wait is handed a callback instead.
+   */
+  class WriteLog {
+  public:
+    static const uint64_t LOG_BLOCK_SIZE = 4096;
+    static const uint64_t RECORD_ALIGN = 512;
+
+    WriteLog(ImageCtx *ictx, const std::string &path);
+    ~WriteLog();
+
+    /// open or create the log, and replay it if it is not empty
+    int init();
+
+    /// write everything back and close the log
+    int shut_down();
+
+    /**
+     * Log a write.  on_logged is completed once it and every earlier
+     * write are in the log, or with an error if it cannot be logged.
+     * buf must stay valid until then.
+     */
+    void aio_append(uint64_t off, uint64_t len, const char *buf,
+		    Context *on_logged);
+
+    /// make the writes logged so far durable on the local device
+    void aio_flush(Context *on_safe);
+
+    /**
+     * Check whether a write still in the log overlaps any of the
+     * extents.  If one does, on_ready is completed from another thread
+     * once none does, or with an error if writeback fails, and true is
+     * returned; otherwise on_ready is left to the caller.
+     */
+    bool wait_for_writeback(
+      const std::vector<std::pair<uint64_t,uint64_t> > &image_extents,
+      Context *on_ready);
+
+    /// write back every logged write and mark the log clean
+    int flush();
+
+  private:
+    enum entry_state_t {
+      ENTRY_LOGGING,  ///< being written to the log
+      ENTRY_PENDING,  ///< in the log, waiting to be written back
+      ENTRY_WRITING,  ///< being written back
+      ENTRY_DONE,     ///< written back
+    };
+
+    struct Entry {
+      uint64_t seq;
+      uint64_t pos;      ///< log position of the record
+      uint64_t rec_len;  ///< length of the record, header included
+      uint64_t off, len; ///< image extent; len is 0 for a wrap marker
+      entry_state_t state;
+      Context *on_logged;
+      Entry(uint64_t s, uint64_t p, uint64_t rl, uint64_t o, uint64_t l)
+	: seq(s), pos(p), rec_len(rl), off(o), len(l),
+	  state(ENTRY_LOGGING), on_logged(NULL) {}
+    };
+
+    class WritebackThread : public Thread {
+    public:
+      WritebackThread(WriteLog *wl) : m_wl(wl) {}
+      void *entry() {
+	m_wl->writeback_entry();
+	return 0;
+      }
+    private:
+      WriteLog *m_wl;
+    };
+
+    struct Waiter {
+      std::vector<std::pair<uint64_t,uint64_t> > extents;
+      Context *on_ready;
+    };
+
+    class C_Append;
+    class C_WritebackDone;
+    class C_Sync;
+    friend class C_Append;
+    friend class C_WritebackDone;
+    friend class C_Sync;
+
+    ImageCtx *m_ictx;
+    std::string m_path;
+    int m_fd;
+    uint64_t m_ring_size;   ///< bytes in the ring of records
+    uint64_t m_max_record;  ///< largest record we will write
+    uint64_t m_nonce;       ///< identifies records of this log
+    uint64_t m_writeback_ops;
+    bool m_writethrough_until_flush;
+
+    Mutex m_lock;  ///< protects the members below
+    Cond m_cond;
+    uint64_t m_head_pos;   ///< position of the next record
+    uint64_t m_next_seq;
+    uint64_t m_tail_pos;   ///< position of the oldest live record
+    uint64_t m_tail_seq;
+    uint64_t m_durable_tail_pos; ///< tail recorded in the superblock
+    bool m_syncing_super;
+    bool m_flush_seen;
+    bool m_stopping;
+    int m_log_error;        ///< a record could not be written
+    int m_writeback_error;  ///< a write back to the image failed
+    uint64_t m_writeback_in_flight;
+    unsigned m_space_waiters;
+    std::list<Entry*> m_entries;  ///< live entries, in log order
+    std::list<Entry*> m_unacked;  ///< entries whose writers wait for them
+    std::list<Entry*> m_pending;  ///< entries not yet written back
+    std::multimap<uint64_t, Entry*> m_entries_by_off; ///< not yet DONE
+    std::list<Waiter> m_waiters;  ///< reads and discards waiting for writeback
+
+    WritebackThread m_writeback_thread;
+    Finisher m_append_finisher;  ///< writes records, in order
+    Finisher m_sync_finisher;    ///< syncs the log, completes waiters
+
+    /// rbd_persistent_cache_debug_skip_writeback, followed as it changes
+    bool skip_writeback() const;
+    uint64_t file_offset(uint64_t pos) const {
+      return LOG_BLOCK_SIZE + pos % m_ring_size;
+    }
+    static uint64_t record_length(uint64_t len) {
+      return RECORD_ALIGN + (len + RECORD_ALIGN - 1) / RECORD_ALIGN *
+	RECORD_ALIGN;
+    }
+
+    int open_device(bool *created);
+    int read_super(uint64_t *tail_pos, uint64_t *tail_seq);
+    int write_super(uint64_t tail_pos, uint64_t tail_seq);
+    int read_record(uint64_t pos, uint64_t seq, bool *wrap,
+		    uint64_t *off, bufferlist *data);
+    int write_record(uint64_t pos, uint64_t seq, uint64_t off, uint64_t len,
+		     const char *buf);
+    int replay(uint64_t tail_pos, uint64_t tail_seq);
+
+    int append(uint64_t off, uint64_t len, const char *buf,
+	       Context *on_logged);
+    int alloc_record(uint64_t len, Entry **wrap, Entry **e);
+    void finish_logging(Entry *e, int r);
+    bool overlaps_locked(uint64_t off, uint64_t len, bool writing_only) const;
+    bool overlaps_locked(
+      const std::vector<std::pair<uint64_t,uint64_t> > &image_extents) const;
+    void remove_by_off_locked(Entry *e);
+    void check_waiters_locked();
+    void retire_entries_locked();
+    int flush_image();
+    int sync_super_locked();
+
+    void writeback_entry();
+    void writeback(Entry *e);
+    void writeback_finish(Entry *e, int r);
+  };
+
+}
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "librbd/internal.h"
 #include "librbd/parent_types.h"
+#include "librbd/WriteLog.h"
 #include "include/util.h"
 
 #include "librados/snap_set_diff.h"
@@ -53,6 +54,11 @@ namespace librbd {
     return RBD_HEADER_PREFIX + image_id;
   }
 
+  const string object_map_name(const string &image_id)
+  {
+    return RBD_OBJECT_MAP_PREFIX + image_id;
+  }
+
   const string old_header_name(const string &image_name)
   {
     return image_name + RBD_SUFFIX;
@@ -165,11 +171,43 @@ namespace librbd {
 		   << " to " << (num_objects-1)
 		   << dendl;
 
+    // reload the object map so we see objects other clients created
+    // since we last refreshed; if that fails, remove everything
+    bool use_map = false;
+    bool has_snaps;
+    {
+      RWLock::RLocker l(ictx->snap_lock);
+      int r = ictx->object_map.refresh();
+      if (r < 0) {
+	lderr(cct) << "warning: failed to load object map, not using it: "
+		   << cpp_strerror(r) << dendl;
+      } else {
+	use_map = ictx->object_map.enabled();
+      }
+      has_snaps = !ictx->snaps.empty();
+    }
+
+    // diffs from a snapshot must see the objects we remove or truncate
+    if (use_map && has_snaps) {
+      uint64_t first = delete_start;
+      if (delete_off > newsize)
+	first -= ictx->get_stripe_count();
+      if (first < num_objects) {
+	int r = ictx->object_map.mark_dirty(first, num_objects);
+	if (r < 0)
+	  lderr(cct) << "warning: failed to mark trimmed objects dirty, "
+		     << "snapshot diffs may be incomplete: "
+		     << cpp_strerror(r) << dendl;
+      }
+    }
+
     SimpleThrottle throttle(cct->_conf->rbd_concurrent_management_ops, true);
     if (delete_start < num_objects) {
       ldout(cct, 2) << "trim_image objects " << delete_start << " to "
 		    << (num_objects - 1) << dendl;
       for (uint64_t i = delete_start; i < num_objects; ++i) {
+	if (use_map && !ictx->object_map.object_may_exist(i))
+	  continue;
 	string oid = ictx->get_object_name(i);
 	Context *req_comp = new C_SimpleThrottle(&throttle);
 	librados::AioCompletion *rados_completion =
@@ -190,6 +228,9 @@ namespace librbd {
       for (vector<ObjectExtent>::iterator p = extents.begin();
 	   p != extents.end(); ++p) {
 	ldout(ictx->cct, 20) << " ex " << *p << dendl;
+	// a truncate would create the object
+	if (use_map && !ictx->object_map.object_may_exist(p->objectno))
+	  continue;
 	Context *req_comp = new C_SimpleThrottle(&throttle);
 	librados::AioCompletion *rados_completion =
 	  librados::Rados::aio_create_completion(req_comp, NULL, rados_ctx_cb);
@@ -207,6 +248,10 @@ namespace librbd {
     if (r < 0) {
       lderr(cct) << "warning: failed to remove some object(s): "
 		 << cpp_strerror(r) << dendl;
+    } else if (use_map && !has_snaps && delete_start < num_objects) {
+      // snapshots may still reference removed objects, so only forget
+      // about them when there are none
+      ictx->object_map.clear(delete_start, num_objects);
     }
   }
 
@@ -328,9 +373,25 @@ namespace librbd {
     uint64_t bsize = ictx->get_object_size();
     int r;
     CephContext *cct = ictx->cct;
+    bool use_map = false;
+    {
+      RWLock::RLocker l(ictx->snap_lock);
+      r = ictx->object_map.refresh();
+      if (r == 0)
+	use_map = ictx->object_map.enabled();
+    }
+    if (use_map) {
+      r = ictx->object_map.mark_dirty(0, numseg);
+      if (r < 0)
+	return r;
+    }
+
     SimpleThrottle throttle(cct->_conf->rbd_concurrent_management_ops, true);
 
     for (uint64_t i = 0; i < numseg; i++) {
+      // neither the head nor any snapshot has this object
+      if (use_map && !ictx->object_map.object_may_exist(i))
+	continue;
       string oid = ictx->get_object_name(i);
       Context *req_comp = new C_SimpleThrottle(&throttle);
       librados::AioCompletion *rados_completion =
@@ -481,6 +542,14 @@ namespace librbd {
     if (r < 0)
       return r;
 
+    // logged writes are written back with the snapshot context current
+    // at that time, so they must reach the image before the snapshot
+    if (ictx->write_log) {
+      r = ictx->write_log->flush();
+      if (r < 0)
+	return r;
+    }
+
     RWLock::RLocker l(ictx->md_lock);
     do {
       r = add_snap(ictx, snap_name);
@@ -552,6 +621,23 @@ namespace librbd {
       }
     }
 
+    uint64_t num_objects = 0;
+    {
+      RWLock::RLocker l2(ictx->snap_lock);
+      uint64_t max_size = ictx->size;
+      for (map<snap_t, SnapInfo>::iterator p = ictx->snap_info.begin();
+	   p != ictx->snap_info.end(); ++p)
+	max_size = MAX(max_size, p->second.size);
+      num_objects = Striper::get_num_objects(ictx->layout, max_size);
+    }
+
+    // fold the snapshot's dirty map into the next interval first; if
+    // we fail after this the snapshot is left without one, which is
+    // safe
+    r = ictx->object_map.snap_remove(snap_id, num_objects);
+    if (r < 0)
+      return r;
+
     r = rm_snap(ictx, snap_name);
     if (r < 0)
       return r;
@@ -1467,6 +1553,16 @@ reprotect_and_return_err:
       }
       close_image(ictx);
 
+      if (!old_format) {
+	ldout(cct, 2) << "removing object map..." << dendl;
+	r = io_ctx.remove(object_map_name(id));
+	if (r < 0 && r != -ENOENT) {
+	  lderr(cct) << "error removing object map: " << cpp_strerror(-r)
+		     << dendl;
+	  return r;
+	}
+      }
+
       ldout(cct, 2) << "removing header..." << dendl;
       r = io_ctx.remove(header_oid);
       if (r < 0 && r != -ENOENT) {
@@ -1574,7 +1670,14 @@ reprotect_and_return_err:
     }
 
     RWLock::WLocker l(ictx->md_lock);
-    if (size < ictx->size && ictx->object_cacher) {
+    if (size < ictx->size && ictx->write_log) {
+      // logged writes past the new end must not recreate objects
+      r = ictx->write_log->flush();
+      if (r < 0) {
+	return r;
+      }
+    }
+    if (size < ictx->size && ictx->cache_enabled()) {
       // need to invalidate since we're deleting objects, and
       // ObjectCacher doesn't track non-existent objects
       r = ictx->invalidate_cache();
@@ -1650,6 +1753,9 @@ reprotect_and_return_err:
       return r;
     }
 
+    // the snapshot exists now; if this fails its dirty map is missing,
+    // which diffs treat as every object having changed
+    ictx->object_map.snap_add(snap_id);
     return 0;
   }
 
@@ -1877,6 +1983,10 @@ reprotect_and_return_err:
       }
 
       ictx->data_ctx.selfmanaged_snap_set_write_ctx(ictx->snapc.seq, ictx->snaps);
+
+      int r = ictx->object_map.refresh();
+      if (r < 0)
+	return r;
     } // release snap_lock
 
     if (new_snap) {
@@ -1924,6 +2034,11 @@ reprotect_and_return_err:
     // need to flush any pending writes before resizing and rolling back -
     // writes might create new snapshots. Rolling back will replace
     // the current version, so we have to invalidate that too.
+    if (ictx->write_log) {
+      r = ictx->write_log->flush();
+      if (r < 0)
+	return r;
+    }
     r = ictx->invalidate_cache();
     if (r < 0)
       return r;
@@ -2035,23 +2150,47 @@ reprotect_and_return_err:
       }
       assert(m_bl->length() == (size_t)r);
 
-      if (m_bl->is_zero()) {
-	delete m_bl;
-	m_throttle->end_op(r);
-	return;
+      // write only the runs of stripe units that are not all zeros, so
+      // the destination stays as sparse as the source.  The buffer is
+      // freed and the throttle released once the last write completes.
+      Context *ctx = new C_CopyWrite(m_throttle, m_bl);
+      C_GatherBuilder gather(m_dest->cct);
+      uint64_t su = m_dest->stripe_unit;
+      uint64_t len = m_bl->length();
+      uint64_t run_start = 0;
+      for (uint64_t off = 0; off < len; off += su) {
+	uint64_t n = MIN(su, len - off);
+	bufferlist chunk;
+	chunk.substr_of(*m_bl, off, n);
+	if (chunk.is_zero()) {
+	  if (off > run_start)
+	    write_run(gather.new_sub(), run_start, off - run_start);
+	  run_start = off + n;
+	}
       }
+      if (len > run_start)
+	write_run(gather.new_sub(), run_start, len - run_start);
 
-      Context *ctx = new C_CopyWrite(m_throttle, m_bl);
+      if (gather.has_subs()) {
+	gather.set_finisher(ctx);
+	gather.activate();
+      } else {
+	ctx->complete(0);
+      }
+    }
+  private:
+    void write_run(Context *ctx, uint64_t off, uint64_t len) {
       AioCompletion *comp = aio_create_completion_internal(ctx, rbd_ctx_cb);
-      r = aio_write(m_dest, m_offset, m_bl->length(), m_bl->c_str(), comp, 0);
+      int r = aio_write(m_dest, m_offset + off, len, m_bl->c_str() + off,
+			comp, 0);
       if (r < 0) {
 	ctx->complete(r);
 	comp->release();
 	lderr(m_dest->cct) << "error writing to destination image at offset "
-			   << m_offset << ": " << cpp_strerror(r) << dendl;
+			   << m_offset + off << ": " << cpp_strerror(r) << dendl;
       }
     }
-  private:
+
     SimpleThrottle *m_throttle;
     ImageCtx *m_dest;
     uint64_t m_offset;
@@ -2132,11 +2271,11 @@ reprotect_and_return_err:
     // ignore return value, since we may be set to a non-existent
     // snapshot and the user is trying to fix that
     ictx_check(ictx);
-    if (ictx->object_cacher) {
+    if (ictx->write_log || ictx->cache_enabled()) {
       // complete pending writes before we're set to a snapshot and
       // get -EROFS for writes
       RWLock::WLocker l(ictx->md_lock);
-      ictx->flush_cache();
+      _flush(ictx);
     }
     return _snap_set(ictx, snap_name);
   }
@@ -2170,6 +2309,19 @@ reprotect_and_return_err:
     if ((r = _snap_set(ictx, ictx->snap_name.c_str())) < 0)
       goto err_close;
 
+    if (!ictx->read_only && ictx->snap_id == CEPH_NOSNAP &&
+	!ictx->cct->_conf->rbd_persistent_cache_path.empty()) {
+      // replays anything left by an earlier client before we use it
+      WriteLog *write_log = new WriteLog(
+	ictx, ictx->cct->_conf->rbd_persistent_cache_path);
+      r = write_log->init();
+      if (r < 0) {
+	delete write_log;
+	goto err_close;
+      }
+      ictx->write_log = write_log;
+    }
+
     return 0;
 
   err_close:
@@ -2182,7 +2334,12 @@ reprotect_and_return_err:
     ldout(ictx->cct, 20) << "close_image " << ictx << dendl;
 
     ictx->readahead.wait_for_pending();
-    if (ictx->object_cacher) {
+    if (ictx->write_log) {
+      ictx->write_log->shut_down(); // writes everything back
+      delete ictx->write_log;
+      ictx->write_log = NULL;
+    }
+    if (ictx->cache_enabled()) {
       ictx->shutdown_cache(); // implicitly flushes
     } else {
       flush(ictx);
@@ -2201,6 +2358,38 @@ reprotect_and_return_err:
   }
 
   // 'flatten' child image by copying all parent's blocks
+  /**
+   * Whether the parent (or its ancestors) may have data in the given
+   * image extents, according to the parent's object map.
+   */
+  static bool parent_may_have_data(ImageCtx *ictx,
+				   const vector<pair<uint64_t,uint64_t> >& objectx)
+  {
+    RWLock::RLocker l(ictx->parent_lock);
+    ImageCtx *parent = ictx->parent;
+    if (!parent)
+      return false;
+
+    RWLock::RLocker l2(parent->parent_lock);
+    if (parent->parent ||
+	!parent->object_map.may_skip_read(parent->snap_id))
+      return true;
+
+    for (vector<pair<uint64_t,uint64_t> >::const_iterator p = objectx.begin();
+	 p != objectx.end(); ++p) {
+      vector<ObjectExtent> extents;
+      Striper::file_to_extents(parent->cct, parent->format_string,
+			       &parent->layout, p->first, p->second, 0,
+			       extents);
+      for (vector<ObjectExtent>::iterator q = extents.begin();
+	   q != extents.end(); ++q) {
+	if (parent->object_map.object_may_exist(q->objectno))
+	  return true;
+      }
+    }
+    return false;
+  }
+
   int flatten(ImageCtx *ictx, ProgressContext &prog_ctx)
   {
     CephContext *cct = ictx->cct;
@@ -2266,6 +2455,12 @@ reprotect_and_return_err:
       uint64_t object_overlap = ictx->prune_parent_extents(objectx, overlap);
       assert(object_overlap <= object_size);
 
+      if (!parent_may_have_data(ictx, objectx)) {
+	ldout(cct, 20) << "parent has no data for object " << ono << dendl;
+	prog_ctx.update_progress(ono, overlap_objects);
+	continue;
+      }
+
       bufferlist bl;
       string oid = ictx->get_object_name(ono);
       Context *comp = new C_SimpleThrottle(&throttle);
@@ -2320,6 +2515,127 @@ reprotect_and_return_err:
     return r;
   }
 
+  int check_object_map(ImageCtx *ictx, bool repair, uint64_t *inconsistent,
+		       ProgressContext &prog_ctx)
+  {
+    CephContext *cct = ictx->cct;
+    ldout(cct, 20) << "check_object_map repair=" << repair << dendl;
+
+    if (repair && ictx->read_only)
+      return -EROFS;
+
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+
+    RWLock::WLocker l(ictx->md_lock);
+    vector<snap_t> snaps;
+    uint64_t num_objects;
+    {
+      RWLock::RLocker l2(ictx->snap_lock);
+      r = ictx->object_map.refresh();
+      if (r < 0)
+	return r;
+      if (!ictx->object_map.enabled()) {
+	lderr(cct) << "image does not have an object map" << dendl;
+	return -EINVAL;
+      }
+      uint64_t max_size = ictx->size;
+      for (map<snap_t, SnapInfo>::iterator p = ictx->snap_info.begin();
+	   p != ictx->snap_info.end(); ++p) {
+	snaps.push_back(p->first);
+	max_size = MAX(max_size, p->second.size);
+      }
+      num_objects = Striper::get_num_objects(ictx->layout, max_size);
+    }
+
+    // what is on disk now; a missing snapshot dirty map is treated as
+    // all set, so it can never be inconsistent
+    map<snap_t, vector<uint8_t> > old_snap_dirty;
+    set<snap_t> missing;
+    for (vector<snap_t>::iterator p = snaps.begin(); p != snaps.end(); ++p) {
+      bool complete;
+      r = ictx->object_map.load_dirty(vector<snap_t>(1, *p), false,
+				      &old_snap_dirty[*p], &complete);
+      if (r < 0)
+	return r;
+      if (!complete)
+	missing.insert(*p);
+    }
+    vector<uint8_t> old_head_dirty;
+    bool complete;
+    r = ictx->object_map.load_dirty(vector<snap_t>(), true,
+				    &old_head_dirty, &complete);
+    if (r < 0)
+      return r;
+
+    librados::IoCtx head_ctx;
+    head_ctx.dup(ictx->data_ctx);
+    head_ctx.snap_set_read(CEPH_SNAPDIR);
+
+    vector<uint8_t> exists, head_dirty;
+    map<snap_t, vector<uint8_t> > snap_dirty;
+    for (vector<snap_t>::iterator p = snaps.begin(); p != snaps.end(); ++p)
+      snap_dirty[*p];
+    *inconsistent = 0;
+
+    for (uint64_t i = 0; i < num_objects; ++i) {
+      prog_ctx.update_progress(i, num_objects);
+
+      librados::snap_set_t snap_set;
+      r = head_ctx.list_snaps(ictx->get_object_name(i), &snap_set);
+      if (r == -ENOENT)
+	continue;
+      if (r < 0) {
+	lderr(cct) << "error listing snapshots of object " << i << ": "
+		   << cpp_strerror(r) << dendl;
+	return r;
+      }
+
+      bool bad = !ictx->object_map.object_may_exist(i);
+      ObjectMap::set_bit(&exists, i);
+
+      // which intervals between snapshots (oldest first) changed it
+      snap_t prev = 0;
+      for (vector<snap_t>::iterator p = snaps.begin(); p != snaps.end(); ++p) {
+	interval_set<uint64_t> diff;
+	bool end_exists;
+	calc_snap_set_diff(cct, snap_set, prev, *p, &diff, &end_exists);
+	if (!diff.empty()) {
+	  ObjectMap::set_bit(&snap_dirty[*p], i);
+	  if (!missing.count(*p) &&
+	      !ObjectMap::test_bit(old_snap_dirty[*p], i))
+	    bad = true;
+	}
+	prev = *p;
+      }
+      interval_set<uint64_t> diff;
+      bool end_exists;
+      calc_snap_set_diff(cct, snap_set, prev, CEPH_NOSNAP, &diff, &end_exists);
+      if (!diff.empty()) {
+	ObjectMap::set_bit(&head_dirty, i);
+	if (!ObjectMap::test_bit(old_head_dirty, i))
+	  bad = true;
+      }
+
+      if (bad) {
+	ldout(cct, 2) << "object map is missing object " << i << dendl;
+	++*inconsistent;
+      }
+    }
+
+    if (repair) {
+      ldout(cct, 2) << "rewriting object map" << dendl;
+      r = ictx->object_map.write(exists, snap_dirty, head_dirty);
+      if (r < 0)
+	return r;
+      notify_change(ictx->md_ctx, ictx->header_oid, NULL, ictx);
+    }
+
+    prog_ctx.update_progress(num_objects, num_objects);
+    return 0;
+  }
+
   int list_lockers(ImageCtx *ictx,
 		   std::list<locker_t> *lockers,
 		   bool *exclusive,
@@ -2543,8 +2859,21 @@ reprotect_and_return_err:
     }
     snap_t end_snap_id = ictx->snap_id;
     uint64_t end_size = ictx->get_image_size(end_snap_id);
+    // snapshots whose dirty maps cover the changes from the start
+    // snapshot (inclusive, see ObjectMap) to the end
+    vector<snap_t> dirty_snaps;
+    for (vector<snap_t>::const_iterator p = ictx->snaps.begin();
+	 p != ictx->snaps.end(); ++p) {
+      if (*p >= from_snap_id && *p <= end_snap_id)
+	dirty_snaps.push_back(*p);
+    }
+    // pick up objects created by other clients since our last refresh
+    r = ictx->object_map.refresh();
+    bool use_map = ictx->object_map.enabled();
     ictx->snap_lock.put_read();
     ictx->md_lock.put_read();
+    if (r < 0)
+      return r;
     if (from_snap_id == CEPH_NOSNAP) {
       return -ENOENT;
     }
@@ -2559,6 +2888,19 @@ reprotect_and_return_err:
     // we must list snaps via the head, not end snap
     head_ctx.snap_set_read(CEPH_SNAPDIR);
 
+    // only objects modified since the start snapshot can differ
+    vector<uint8_t> dirty;
+    bool use_dirty = false;
+    if (use_map && from_snap_id != 0) {
+      r = ictx->object_map.load_dirty(dirty_snaps,
+				      end_snap_id == CEPH_NOSNAP,
+				      &dirty, &use_dirty);
+      if (r < 0)
+	return r;
+      ldout(ictx->cct, 20) << "diff_iterate using dirty maps of "
+			   << dirty_snaps << ": " << use_dirty << dendl;
+    }
+
     ldout(ictx->cct, 20) << "diff_iterate from " << from_snap_id << " to " << end_snap_id
 			 << " size from " << from_size << " to " << end_size << dendl;
 
@@ -2600,7 +2942,14 @@ reprotect_and_return_err:
 	ldout(ictx->cct, 20) << "diff_iterate object " << p->first << dendl;
 
 	librados::snap_set_t snap_set;
-	int r = head_ctx.list_snaps(p->first.name, &snap_set);
+	uint64_t objectno = p->second.front().objectno;
+	int r;
+	if (!ictx->object_map.object_may_exist(objectno))
+	  r = -ENOENT;
+	else if (use_dirty && !ObjectMap::test_bit(dirty, objectno))
+	  continue;
+	else
+	  r = head_ctx.list_snaps(p->first.name, &snap_set);
 	if (r == -ENOENT) {
 	  if (from_snap_id == 0 && !parent_diff.empty()) {
 	    // report parent diff instead
@@ -2914,7 +3263,9 @@ reprotect_and_return_err:
     c->add_request();
     c->init_time(ictx, AIO_TYPE_FLUSH);
     C_AioWrite *req_comp = new C_AioWrite(cct, c);
-    if (ictx->object_cacher) {
+    if (ictx->write_log) {
+      ictx->write_log->aio_flush(req_comp);
+    } else if (ictx->cache_enabled()) {
       ictx->flush_cache_aio(req_comp);
     } else {
       librados::AioCompletion *rados_completion =
@@ -2949,8 +3300,15 @@ reprotect_and_return_err:
   {
     CephContext *cct = ictx->cct;
     int r;
-    // flush any outstanding writes
-    if (ictx->object_cacher) {
+    // write back everything in the log, then flush any outstanding writes
+    if (ictx->write_log) {
+      r = ictx->write_log->flush();
+      if (r < 0) {
+	lderr(cct) << "_flush " << ictx << " r = " << r << dendl;
+	return r;
+      }
+    }
+    if (ictx->cache_enabled()) {
       r = ictx->flush_cache();
     } else {
       r = ictx->data_ctx.aio_flush();
@@ -2989,12 +3347,45 @@ reprotect_and_return_err:
       return r;
     }
 
+    if (!ictx->write_log) {
+      return _aio_write(ictx, off, len, buf, c, op_flags);
+    }
+
     uint64_t mylen = len;
     r = clip_io(ictx, off, &mylen);
     if (r < 0) {
       return r;
     }
 
+    ictx->snap_lock.get_read();
+    snapid_t snap_id = ictx->snap_id;
+    ictx->snap_lock.put_read();
+    if (snap_id != CEPH_NOSNAP || ictx->read_only) {
+      return -EROFS;
+    }
+
+    // completed once the write is in the log; it is counted in the
+    // perf counters when the log writes it back
+    c->get();
+    c->init_time(ictx, AIO_TYPE_WRITE);
+    C_AioWrite *req_comp = new C_AioWrite(cct, c);
+    c->add_request();
+    ictx->write_log->aio_append(off, mylen, buf, req_comp);
+    c->finish_adding_requests(cct);
+    c->put();
+    return 0;
+  }
+
+  int _aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
+		 AioCompletion *c, int op_flags)
+  {
+    CephContext *cct = ictx->cct;
+    uint64_t mylen = len;
+    int r = clip_io(ictx, off, &mylen);
+    if (r < 0) {
+      return r;
+    }
+
     ictx->snap_lock.get_read();
     snapid_t snap_id = ictx->snap_id;
     ::SnapContext snapc = ictx->snapc;
@@ -3031,7 +3422,7 @@ reprotect_and_return_err:
       }
 
       C_AioWrite *req_comp = new C_AioWrite(cct, c);
-      if (ictx->object_cacher) {
+      if (ictx->cache_enabled()) {
 	c->add_request();
 	ictx->write_to_cache(p->oid, bl, p->length, p->offset, req_comp);
       } else {
@@ -3064,6 +3455,43 @@ reprotect_and_return_err:
     return r;
   }
 
+  /**
+   * Complete an aio that had to wait for the write log with the error
+   * that kept it from being started.
+   */
+  static void fail_aio(ImageCtx *ictx, AioCompletion *c, aio_type_t type,
+		       int r)
+  {
+    c->get();
+    c->init_time(ictx, type);
+    C_AioWrite *req_comp = new C_AioWrite(ictx->cct, c);
+    c->add_request();
+    req_comp->complete(r);
+    c->finish_adding_requests(ictx->cct);
+    c->put();
+  }
+
+  struct C_DeferredAioDiscard : public Context {
+    ImageCtx *ictx;
+    uint64_t off;
+    uint64_t len;
+    AioCompletion *c;
+    C_DeferredAioDiscard(ImageCtx *ictx, uint64_t off, uint64_t len,
+			 AioCompletion *c)
+      : ictx(ictx), off(off), len(len), c(c) {
+      c->get();
+    }
+    ~C_DeferredAioDiscard() {
+      c->put();
+    }
+    void finish(int r) {
+      if (r == 0)
+	r = _aio_discard(ictx, off, len, c);
+      if (r < 0)
+	fail_aio(ictx, c, AIO_TYPE_DISCARD, r);
+    }
+  };
+
   int aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len, AioCompletion *c)
   {
     CephContext *cct = ictx->cct;
@@ -3080,6 +3508,35 @@ reprotect_and_return_err:
       return r;
     }
 
+    ictx->snap_lock.get_read();
+    snapid_t snap_id = ictx->snap_id;
+    ictx->snap_lock.put_read();
+    if (snap_id != CEPH_NOSNAP || ictx->read_only) {
+      return -EROFS;
+    }
+
+    // logged writes to the range must not land after the discard
+    if (ictx->write_log) {
+      vector<pair<uint64_t,uint64_t> > image_extents;
+      image_extents.push_back(make_pair(off, len));
+      Context *ctx = new C_DeferredAioDiscard(ictx, off, len, c);
+      if (ictx->write_log->wait_for_writeback(image_extents, ctx)) {
+	return 0;
+      }
+      delete ctx;
+    }
+    return _aio_discard(ictx, off, len, c);
+  }
+
+  int _aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len,
+		   AioCompletion *c)
+  {
+    CephContext *cct = ictx->cct;
+    int r = clip_io(ictx, off, &len);
+    if (r < 0) {
+      return r;
+    }
+
     // TODO: check for snap
     ictx->snap_lock.get_read();
     snapid_t snap_id = ictx->snap_id;
@@ -3138,9 +3595,8 @@ reprotect_and_return_err:
     }
     r = 0;
   done:
-    if (ictx->object_cacher) {
-      Mutex::Locker l(ictx->cache_lock);
-      ictx->object_cacher->discard_set(ictx->object_set, extents);
+    if (ictx->cache_enabled()) {
+      ictx->discard_cache(extents);
     }
 
     c->finish_adding_requests(ictx->cct);
@@ -3207,6 +3663,13 @@ reprotect_and_return_err:
     uint64_t readahead_offset = readahead_extent.first;
     uint64_t readahead_length = readahead_extent.second;
 
+    uint64_t hit_bytes, wasted_bytes;
+    ictx->readahead.get_stats(&hit_bytes, &wasted_bytes);
+    if (hit_bytes)
+      ictx->perfcounter->inc(l_librbd_readahead_hit_bytes, hit_bytes);
+    if (wasted_bytes)
+      ictx->perfcounter->inc(l_librbd_readahead_wasted_bytes, wasted_bytes);
+
     if (readahead_length > 0) {
       ldout(ictx->cct, 20) << "(readahead logical) " << readahead_offset << "~" << readahead_length << dendl;
       map<object_t,vector<ObjectExtent> > readahead_object_extents;
@@ -3228,6 +3691,32 @@ reprotect_and_return_err:
     }
   }
 
+  struct C_DeferredAioRead : public Context {
+    ImageCtx *ictx;
+    vector<pair<uint64_t,uint64_t> > image_extents;
+    char *buf;
+    bufferlist *pbl;
+    AioCompletion *c;
+    int op_flags;
+    C_DeferredAioRead(ImageCtx *ictx,
+		      const vector<pair<uint64_t,uint64_t> >& image_extents,
+		      char *buf, bufferlist *pbl, AioCompletion *c,
+		      int op_flags)
+      : ictx(ictx), image_extents(image_extents), buf(buf), pbl(pbl), c(c),
+	op_flags(op_flags) {
+      c->get();
+    }
+    ~C_DeferredAioRead() {
+      c->put();
+    }
+    void finish(int r) {
+      if (r == 0)
+	r = _aio_read(ictx, image_extents, buf, pbl, c, op_flags);
+      if (r < 0)
+	fail_aio(ictx, c, AIO_TYPE_READ, r);
+    }
+  };
+
   int aio_read(ImageCtx *ictx, const vector<pair<uint64_t,uint64_t> >& image_extents,
 	       char *buf, bufferlist *pbl, AioCompletion *c, int op_flags)
   {
@@ -3242,9 +3731,29 @@ reprotect_and_return_err:
     snap_t snap_id = ictx->snap_id;
     ictx->snap_lock.put_read();
 
+    // the log is not read from, so wait for any newer data in it
+    if (ictx->write_log && snap_id == CEPH_NOSNAP) {
+      Context *ctx = new C_DeferredAioRead(ictx, image_extents, buf, pbl, c,
+					   op_flags);
+      if (ictx->write_log->wait_for_writeback(image_extents, ctx)) {
+	return 0;
+      }
+      delete ctx;
+    }
+    return _aio_read(ictx, image_extents, buf, pbl, c, op_flags);
+  }
+
+  int _aio_read(ImageCtx *ictx, const vector<pair<uint64_t,uint64_t> >& image_extents,
+		char *buf, bufferlist *pbl, AioCompletion *c, int op_flags)
+  {
+    ictx->snap_lock.get_read();
+    snap_t snap_id = ictx->snap_id;
+    ictx->snap_lock.put_read();
+    int r;
+
     // readahead
     const md_config_t *conf = ictx->cct->_conf;
-    if (ictx->object_cacher && conf->rbd_readahead_max_bytes > 0) {
+    if (ictx->cache_enabled() && conf->rbd_readahead_max_bytes > 0) {
       readahead(ictx, image_extents, conf);
     }
 
@@ -3289,7 +3798,7 @@ reprotect_and_return_err:
 	req_comp->set_req(req);
 	c->add_request();
 
-	if (ictx->object_cacher) {
+	if (ictx->cache_enabled()) {
 	  C_CacheRead *cache_comp = new C_CacheRead(req);
 	  ictx->aio_read_from_cache(q->oid, &req->data(),
 				    q->length, q->offset,
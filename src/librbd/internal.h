@@ -49,6 +49,8 @@ enum {
 
   l_librbd_readahead,
   l_librbd_readahead_bytes,
+  l_librbd_readahead_hit_bytes,
+  l_librbd_readahead_wasted_bytes,
 
   l_librbd_last,
 };
@@ -72,6 +74,7 @@ namespace librbd {
 
   const std::string id_obj_name(const std::string &name);
   const std::string header_name(const std::string &image_id);
+  const std::string object_map_name(const std::string &image_id);
   const std::string old_header_name(const std::string &image_name);
 
   int detect_format(librados::IoCtx &io_ctx, const std::string &name,
@@ -131,6 +134,14 @@ namespace librbd {
   int copyup_block(ImageCtx *ictx, uint64_t offset, size_t len,
 		   const char *buf);
   int flatten(ImageCtx *ictx, ProgressContext &prog_ctx);
+  /**
+   * Compare the object map and its snapshot dirty maps with the
+   * objects that actually exist, counting the objects they are missing
+   * in inconsistent.  With repair, rewrite them from scratch; nothing
+   * else may modify the image meanwhile.
+   */
+  int check_object_map(ImageCtx *ictx, bool repair, uint64_t *inconsistent,
+		       ProgressContext &prog_ctx);
 
   /* cooperative locking */
   int list_lockers(ImageCtx *ictx,
@@ -184,11 +195,17 @@ namespace librbd {
   int discard(ImageCtx *ictx, uint64_t off, uint64_t len);
   int aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
 		AioCompletion *c, int op_flags);
+  int _aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
+		 AioCompletion *c, int op_flags);
   int aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len, AioCompletion *c);
+  int _aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len,
+		   AioCompletion *c);
   int aio_read(ImageCtx *ictx, uint64_t off, size_t len,
 	       char *buf, bufferlist *pbl, AioCompletion *c, int op_flags);
   int aio_read(ImageCtx *ictx, const vector<pair<uint64_t,uint64_t> >& image_extents,
 	       char *buf, bufferlist *pbl, AioCompletion *c, int op_flags);
+  int _aio_read(ImageCtx *ictx, const vector<pair<uint64_t,uint64_t> >& image_extents,
+		char *buf, bufferlist *pbl, AioCompletion *c, int op_flags);
   int aio_flush(ImageCtx *ictx, AioCompletion *c);
   int flush(ImageCtx *ictx);
   int _flush(ImageCtx *ictx);
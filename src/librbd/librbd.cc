@@ -418,6 +418,26 @@ namespace librbd {
     return r;
   }
 
+  int Image::check_object_map(librbd::ProgressContext& prog_ctx,
+			      uint64_t *inconsistent)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    tracepoint(librbd, check_object_map_enter, ictx, ictx->name.c_str(), ictx->id.c_str(), 0);
+    int r = librbd::check_object_map(ictx, false, inconsistent, prog_ctx);
+    tracepoint(librbd, check_object_map_exit, r);
+    return r;
+  }
+
+  int Image::rebuild_object_map(librbd::ProgressContext& prog_ctx)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    tracepoint(librbd, check_object_map_enter, ictx, ictx->name.c_str(), ictx->id.c_str(), 1);
+    uint64_t inconsistent;
+    int r = librbd::check_object_map(ictx, true, &inconsistent, prog_ctx);
+    tracepoint(librbd, check_object_map_exit, r);
+    return r;
+  }
+
   int Image::list_children(set<pair<string, string> > *children)
   {
     ImageCtx *ictx = (ImageCtx *)ctx;
@@ -985,6 +1005,29 @@ extern "C" int rbd_flatten_with_progress(rbd_image_t image,
   return r;
 }
 
+extern "C" int rbd_check_object_map(rbd_image_t image, uint64_t *inconsistent,
+				    librbd_progress_fn_t cb, void *cbdata)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  tracepoint(librbd, check_object_map_enter, ictx, ictx->name.c_str(), ictx->id.c_str(), 0);
+  librbd::CProgressContext prog_ctx(cb, cbdata);
+  int r = librbd::check_object_map(ictx, false, inconsistent, prog_ctx);
+  tracepoint(librbd, check_object_map_exit, r);
+  return r;
+}
+
+extern "C" int rbd_rebuild_object_map(rbd_image_t image,
+				      librbd_progress_fn_t cb, void *cbdata)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  tracepoint(librbd, check_object_map_enter, ictx, ictx->name.c_str(), ictx->id.c_str(), 1);
+  librbd::CProgressContext prog_ctx(cb, cbdata);
+  uint64_t inconsistent;
+  int r = librbd::check_object_map(ictx, true, &inconsistent, prog_ctx);
+  tracepoint(librbd, check_object_map_exit, r);
+  return r;
+}
+
 extern "C" int rbd_rename(rados_ioctx_t src_p, const char *srcname,
 			  const char *destname)
 {
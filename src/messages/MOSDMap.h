@@ -30,6 +30,9 @@ class MOSDMap : public Message {
   map<epoch_t, bufferlist> incremental_maps;
   epoch_t oldest_map, newest_map;
 
+  /// features maps are already encoded for, if not our own (not sent)
+  uint64_t encode_features;
+
   epoch_t get_first() const {
     epoch_t e = 0;
     map<epoch_t, bufferlist>::const_iterator i = maps.begin();
@@ -48,6 +51,16 @@ class MOSDMap : public Message {
         (e == 0 || i->first > e)) e = i->first;
     return e;
   }
+  uint64_t get_map_bytes() const {
+    uint64_t bytes = 0;
+    for (map<epoch_t, bufferlist>::const_iterator i = maps.begin();
+	 i != maps.end(); ++i)
+      bytes += i->second.length();
+    for (map<epoch_t, bufferlist>::const_iterator i = incremental_maps.begin();
+	 i != incremental_maps.end(); ++i)
+      bytes += i->second.length();
+    return bytes;
+  }
   epoch_t get_oldest() {
     return oldest_map;
   }
@@ -56,15 +69,45 @@ class MOSDMap : public Message {
   }
 
 
-  MOSDMap() : Message(CEPH_MSG_OSD_MAP, HEAD_VERSION) { }
+  MOSDMap() : Message(CEPH_MSG_OSD_MAP, HEAD_VERSION), encode_features(0) { }
   MOSDMap(const uuid_d &f)
     : Message(CEPH_MSG_OSD_MAP, HEAD_VERSION),
       fsid(f),
-      oldest_map(0), newest_map(0) { }
+      oldest_map(0), newest_map(0),
+      encode_features(0) { }
 private:
   ~MOSDMap() {}
 
 public:
+  /// true if a peer with these features can't decode our map encoding
+  static bool needs_reencode(uint64_t features) {
+    return
+      (features & CEPH_FEATURE_PGID64) == 0 ||
+      (features & CEPH_FEATURE_PGPOOL3) == 0 ||
+      (features & CEPH_FEATURE_OSDENC) == 0 ||
+      (features & CEPH_FEATURE_OSDMAP_ENC) == 0;
+  }
+  static void reencode_incremental(bufferlist& bl, uint64_t features) {
+    OSDMap::Incremental inc;
+    bufferlist::iterator q = bl.begin();
+    inc.decode(q);
+    bl.clear();
+    if (inc.fullmap.length()) {
+      // embedded full map?
+      OSDMap m;
+      m.decode(inc.fullmap);
+      inc.fullmap.clear();
+      m.encode(inc.fullmap, features);
+    }
+    inc.encode(bl, features);
+  }
+  static void reencode_full(bufferlist& bl, uint64_t features) {
+    OSDMap m;
+    m.decode(bl);
+    bl.clear();
+    m.encode(bl, features);
+  }
+
   // marshalling
   void decode_payload() {
     bufferlist::iterator p = payload.begin();
@@ -81,44 +124,27 @@ public:
   }
   void encode_payload(uint64_t features) {
     ::encode(fsid, payload);
-    if ((features & CEPH_FEATURE_PGID64) == 0 ||
-	(features & CEPH_FEATURE_PGPOOL3) == 0 ||
-	(features & CEPH_FEATURE_OSDENC) == 0 ||
-        (features & CEPH_FEATURE_OSDMAP_ENC) == 0) {
+    if (needs_reencode(features)) {
       if ((features & CEPH_FEATURE_PGID64) == 0 ||
 	  (features & CEPH_FEATURE_PGPOOL3) == 0)
 	header.version = 1;  // old old_client version
       else if ((features & CEPH_FEATURE_OSDENC) == 0)
 	header.version = 2;  // old pg_pool_t
 
-      // reencode maps using old format
+      // reencode maps using old format, unless the sender already did
+      // (e.g., from a cache of encodings for these features).
       //
-      // FIXME: this can probably be done more efficiently higher up
-      // the stack, or maybe replaced with something that only
+      // FIXME: this could be replaced with something that only
       // includes the pools the client cares about.
-      for (map<epoch_t,bufferlist>::iterator p = incremental_maps.begin();
-	   p != incremental_maps.end();
-	   ++p) {
-	OSDMap::Incremental inc;
-	bufferlist::iterator q = p->second.begin();
-	inc.decode(q);
-	p->second.clear();
-	if (inc.fullmap.length()) {
-	  // embedded full map?
-	  OSDMap m;
-	  m.decode(inc.fullmap);
-	  inc.fullmap.clear();
-	  m.encode(inc.fullmap, features);
-	}
-	inc.encode(p->second, features);
-      }
-      for (map<epoch_t,bufferlist>::iterator p = maps.begin();
-	   p != maps.end();
-	   ++p) {
-	OSDMap m;
-	m.decode(p->second);
-	p->second.clear();
-	m.encode(p->second, features);
+      if (encode_features != features) {
+	for (map<epoch_t,bufferlist>::iterator p = incremental_maps.begin();
+	     p != incremental_maps.end();
+	     ++p)
+	  reencode_incremental(p->second, features);
+	for (map<epoch_t,bufferlist>::iterator p = maps.begin();
+	     p != maps.end();
+	     ++p)
+	  reencode_full(p->second, features);
       }
     }
     ::encode(incremental_maps, payload);
@@ -24,7 +24,7 @@
 
 struct MOSDRepScrub : public Message {
 
-  static const int HEAD_VERSION = 6;
+  static const int HEAD_VERSION = 7;
   static const int COMPAT_VERSION = 2;
 
   spg_t pgid;             // PG to scrub
@@ -36,15 +36,18 @@ struct MOSDRepScrub : public Message {
   hobject_t end;         // upper bound of scrub, exclusive
   bool deep;             // true if scrub should be deep
   uint32_t seed;         // seed value for digest calculation
+  uint8_t hash_tree_depth; // if nonzero, reply with a pg_hash_tree_t summary
 
   MOSDRepScrub()
     : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION, COMPAT_VERSION),
       chunky(false),
       deep(false),
-      seed(0) { }
+      seed(0),
+      hash_tree_depth(0) { }
 
   MOSDRepScrub(spg_t pgid, eversion_t scrub_to, epoch_t map_epoch,
-               hobject_t start, hobject_t end, bool deep, uint32_t seed)
+               hobject_t start, hobject_t end, bool deep, uint32_t seed,
+	       uint8_t hash_tree_depth = 0)
     : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION, COMPAT_VERSION),
       pgid(pgid),
       scrub_to(scrub_to),
@@ -53,7 +56,8 @@ struct MOSDRepScrub : public Message {
       start(start),
       end(end),
       deep(deep),
-      seed(seed) { }
+      seed(seed),
+      hash_tree_depth(hash_tree_depth) { }
 
 
 private:
@@ -68,6 +72,7 @@ public:
         << ",chunky:" << chunky
         << ",deep:" << deep
 	<< ",seed:" << seed
+	<< ",hash_tree_depth:" << (int)hash_tree_depth
         << ",version:" << header.version;
     out << ")";
   }
@@ -83,6 +88,7 @@ public:
     ::encode(deep, payload);
     ::encode(pgid.shard, payload);
     ::encode(seed, payload);
+    ::encode(hash_tree_depth, payload);
   }
   void decode_payload() {
     bufferlist::iterator p = payload.begin();
@@ -115,6 +121,11 @@ public:
     } else {
       seed = 0;
     }
+    if (header.version >= 7) {
+      ::decode(hash_tree_depth, p);
+    } else {
+      hash_tree_depth = 0;
+    }
   }
 };
 
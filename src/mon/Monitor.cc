@@ -520,6 +520,9 @@ int Monitor::preinit()
     pcb.add_u64_counter(l_mon_election_call, "election_call");
     pcb.add_u64_counter(l_mon_election_win, "election_win");
     pcb.add_u64_counter(l_mon_election_lose, "election_lose");
+    pcb.add_u64_counter(l_mon_osdmap_send, "osdmap_send");
+    pcb.add_u64_counter(l_mon_osdmap_send_epochs, "osdmap_send_epochs");
+    pcb.add_u64_counter(l_mon_osdmap_send_bytes, "osdmap_send_bytes");
     logger = pcb.create_perf_counters();
     cct->get_perfcounters_collection()->add(logger);
   }
@@ -1069,7 +1072,8 @@ void Monitor::sync_reset_requester()
   sync_provider = entity_inst_t();
   sync_cookie = 0;
   sync_full = false;
-  sync_start_version = 0;
+  // sync_start_version and sync_last_key are kept so that an
+  // interrupted full sync can be resumed.
 }
 
 void Monitor::sync_reset_provider()
@@ -1091,7 +1095,17 @@ void Monitor::sync_start(entity_inst_t &other, bool full)
 
   sync_full = full;
 
-  if (sync_full) {
+  // we can only resume a full sync whose partial state is still in
+  // the store
+  bool resume = sync_full && !sync_last_key.first.empty() &&
+    store->exists("mon_sync", "in_sync");
+  if (!resume)
+    sync_last_key = pair<string,string>();
+
+  if (resume) {
+    dout(10) << __func__ << " resuming full sync from version "
+	     << sync_start_version << " key " << sync_last_key << dendl;
+  } else if (sync_full) {
     // stash key state, and mark that we are syncing
     MonitorDBStore::TransactionRef t(new MonitorDBStore::Transaction);
     sync_stash_critical_state(t);
@@ -1126,8 +1140,12 @@ void Monitor::sync_start(entity_inst_t &other, bool full)
   sync_reset_timeout();
 
   MMonSync *m = new MMonSync(sync_full ? MMonSync::OP_GET_COOKIE_FULL : MMonSync::OP_GET_COOKIE_RECENT);
-  if (!sync_full)
+  if (!sync_full) {
     m->last_committed = paxos->get_version();
+  } else if (resume) {
+    m->last_committed = sync_start_version;
+    m->last_key = sync_last_key;
+  }
   messenger->send_message(m, sync_provider);
 }
 
@@ -1173,6 +1191,8 @@ void Monitor::sync_finish(version_t last_committed)
 
   assert(g_conf->mon_sync_requester_kill_at != 8);
 
+  sync_last_key = pair<string,string>();
+
   MonitorDBStore::TransactionRef t(new MonitorDBStore::Transaction);
   t->erase("mon_sync", "in_sync");
   t->erase("mon_sync", "force_sync");
@@ -1270,6 +1290,16 @@ void Monitor::handle_sync_get_cookie(MMonSync *m)
     // full scan
     sync_targets = get_sync_targets_names();
     sp.last_committed = paxos->get_version();
+    if (!m->last_key.first.empty() &&
+	m->last_committed <= paxos->get_version() &&
+	m->last_committed >= paxos->get_first_committed()) {
+      // resume an interrupted sync: continue after the last key they
+      // have, and replay paxos from where that sync started so that
+      // whatever they got earlier is brought up to date.
+      sp.last_committed = m->last_committed;
+      sp.last_key = m->last_key;
+      dout(10) << __func__ << " resuming after key " << sp.last_key << dendl;
+    }
     sp.synchronizer = store->get_synchronizer(sp.last_key, sync_targets);
     sp.full = true;
     dout(10) << __func__ << " will sync prefixes " << sync_targets << dendl;
@@ -1281,6 +1311,7 @@ void Monitor::handle_sync_get_cookie(MMonSync *m)
 
   MMonSync *reply = new MMonSync(MMonSync::OP_COOKIE, sp.cookie);
   reply->last_committed = sp.last_committed;
+  reply->last_key = sp.last_key;
   m->get_connection()->send_message(reply);
 }
 
@@ -1365,8 +1396,20 @@ void Monitor::handle_sync_cookie(MMonSync *m)
   sync_cookie = m->cookie;
   sync_start_version = m->last_committed;
 
+  if (sync_full && !sync_last_key.first.empty() &&
+      m->last_key != sync_last_key) {
+    // the provider could not resume our previous sync; start over.
+    dout(10) << __func__ << " provider did not resume after "
+	     << sync_last_key << ", clearing store" << dendl;
+    sync_last_key = pair<string,string>();
+    set<string> targets = get_sync_targets_names();
+    store->clear(targets);
+    paxos->init();
+  }
+
   sync_reset_timeout();
-  sync_get_next_chunk();
+  for (int i = 0; i < MAX(1, g_conf->mon_sync_max_chunks_in_flight); ++i)
+    sync_get_next_chunk();
 
   assert(g_conf->mon_sync_requester_kill_at != 3);
 }
@@ -1410,6 +1453,8 @@ void Monitor::handle_sync_chunk(MMonSync *m)
   *_dout << dendl;
 
   store->apply_transaction(tx);
+  if (sync_full && !m->last_key.first.empty())
+    sync_last_key = m->last_key;
 
   assert(g_conf->mon_sync_requester_kill_at != 6);
 
@@ -1441,6 +1486,13 @@ void Monitor::handle_sync_chunk(MMonSync *m)
 void Monitor::handle_sync_no_cookie(MMonSync *m)
 {
   dout(10) << __func__ << dendl;
+  if (m->cookie && m->cookie != sync_cookie) {
+    // a request still in flight when the provider sent us the last
+    // chunk (or a previous attempt); nothing to do.
+    dout(10) << __func__ << " stale cookie " << m->cookie << ", ignoring"
+	     << dendl;
+    return;
+  }
   bootstrap();
 }
 
@@ -2023,6 +2075,7 @@ void Monitor::get_mon_status(Formatter *f, ostream& ss)
     f->dump_stream("sync_provider") << sync_provider;
     f->dump_unsigned("sync_cookie", sync_cookie);
     f->dump_unsigned("sync_start_version", sync_start_version);
+    f->dump_stream("sync_last_key") << sync_last_key;
     f->close_section();
   }
 
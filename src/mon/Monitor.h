@@ -97,6 +97,9 @@ enum {
   l_mon_election_call,
   l_mon_election_win,
   l_mon_election_lose,
+  l_mon_osdmap_send,
+  l_mon_osdmap_send_epochs,
+  l_mon_osdmap_send_bytes,
   l_mon_last,
 };
 
@@ -285,6 +288,17 @@ private:
   version_t sync_start_version;  ///< last_committed at sync start
   Context *sync_timeout_event;   ///< timeout event
 
+  /**
+   * last key applied during a full sync
+   *
+   * Survives sync_reset_requester() (along with sync_start_version) so
+   * that if the full sync is interrupted (the provider goes away, the
+   * sync times out, ...) the next attempt can ask its provider to pick
+   * up after this key, replaying paxos from sync_start_version, rather
+   * than clearing the store and starting over.
+   */
+  pair<string,string> sync_last_key;
+
   /**
    * floor for sync source
    *
@@ -403,6 +417,10 @@ private:
 
   /**
    * request the next chunk from the provider
+   *
+   * We keep up to mon_sync_max_chunks_in_flight requests outstanding;
+   * the provider answers them in order, and each chunk we get back is
+   * followed by another request.
    */
   void sync_get_next_chunk();
 
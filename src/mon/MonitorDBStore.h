@@ -25,7 +25,17 @@
 #include "include/assert.h"
 #include "common/Formatter.h"
 #include "common/Finisher.h"
+#include "common/Mutex.h"
 #include "common/errno.h"
+#include "common/perf_counters.h"
+
+enum {
+  l_mon_store_first = 456500,
+  l_mon_store_cache_hit,
+  l_mon_store_cache_miss,
+  l_mon_store_cache_bytes,
+  l_mon_store_last,
+};
 
 class MonitorDBStore
 {
@@ -37,6 +47,102 @@ class MonitorDBStore
 
   bool is_open;
 
+  /**
+   * @defgroup MonitorDBStore_h_cache Read cache
+   *
+   * The services keep going back to the store for the same few keys
+   * (the latest full and incremental versions, first/last_committed,
+   * auth keys, ...), which in a busy cluster are also the ones most
+   * recently written.  Keep an LRU of values, bounded by
+   * mon_store_cache_size bytes, filled on read and written through by
+   * every applied transaction.
+   *
+   * Transactions are applied by io_work while reads happen in the
+   * monitor's thread, so a read that raced with a transaction may have
+   * seen either value; we only cache what we read if no transaction was
+   * applied while we were reading (cache_gen did not change).
+   * @{
+   */
+  typedef pair<string,string> cache_key_t;
+  typedef list<pair<cache_key_t, bufferlist> > cache_lru_t;
+
+  Mutex cache_lock;
+  uint64_t cache_gen;    ///< bumped by every applied transaction
+  uint64_t cache_bytes;
+  cache_lru_t cache_lru; ///< most recently used first
+  map<cache_key_t, cache_lru_t::iterator> cache;
+  PerfCounters *logger;
+
+  void _cache_erase(const cache_key_t& k) {
+    map<cache_key_t, cache_lru_t::iterator>::iterator p = cache.find(k);
+    if (p == cache.end())
+      return;
+    cache_bytes -= p->second->second.length();
+    cache_lru.erase(p->second);
+    cache.erase(p);
+  }
+
+  void _cache_trim() {
+    uint64_t max = g_conf->mon_store_cache_size;
+    while (cache_bytes > max) {
+      cache_bytes -= cache_lru.back().second.length();
+      cache.erase(cache_lru.back().first);
+      cache_lru.pop_back();
+    }
+    logger->set(l_mon_store_cache_bytes, cache_bytes);
+  }
+
+  void _cache_add(const cache_key_t& k, const bufferlist& bl) {
+    _cache_erase(k);
+    // don't let one big value push everything else out
+    uint64_t max = g_conf->mon_store_cache_size;
+    if (!max || bl.length() > max / 4)
+      return;
+    // values usually point into a much bigger message or transaction
+    // buffer; keep a compact private copy so that mon_store_cache_size
+    // bounds what we actually pin
+    bufferlist c;
+    if (bl.length()) {
+      c.push_back(buffer::create(bl.length()));
+      bl.copy(0, bl.length(), c.c_str());
+    }
+    cache_lru.push_front(make_pair(k, c));
+    cache[k] = cache_lru.begin();
+    cache_bytes += bl.length();
+    _cache_trim();
+  }
+
+  bool cache_lookup(const cache_key_t& k, bufferlist& bl, uint64_t *gen) {
+    Mutex::Locker l(cache_lock);
+    map<cache_key_t, cache_lru_t::iterator>::iterator p = cache.find(k);
+    if (p == cache.end()) {
+      logger->inc(l_mon_store_cache_miss);
+      *gen = cache_gen;
+      return false;
+    }
+    logger->inc(l_mon_store_cache_hit);
+    cache_lru.splice(cache_lru.begin(), cache_lru, p->second);
+    bl.append(p->second->second);
+    return true;
+  }
+
+  void cache_add(const cache_key_t& k, const bufferlist& bl, uint64_t gen) {
+    Mutex::Locker l(cache_lock);
+    if (gen == cache_gen)
+      _cache_add(k, bl);
+  }
+
+ public:
+  /// bytes of values held by the read cache
+  uint64_t get_cache_bytes() {
+    Mutex::Locker l(cache_lock);
+    return cache_bytes;
+  }
+ private:
+  /**
+   * @}
+   */
+
  public:
 
   struct Op {
@@ -282,6 +388,18 @@ class MonitorDBStore
       }
     }
     int r = db->submit_transaction_sync(dbt);
+    {
+      Mutex::Locker l(cache_lock);
+      ++cache_gen;
+      for (list<Op>::const_iterator it = t->ops.begin();
+	   it != t->ops.end();
+	   ++it) {
+	if (it->type == Transaction::OP_PUT && r >= 0)
+	  _cache_add(make_pair(it->prefix, it->key), it->bl);
+	else if (it->type != Transaction::OP_COMPACT)
+	  _cache_erase(make_pair(it->prefix, it->key));
+      }
+    }
     if (r >= 0) {
       while (!compact.empty()) {
 	if (compact.front().second.first == string() &&
@@ -490,6 +608,11 @@ class MonitorDBStore
   }
 
   int get(const string& prefix, const string& key, bufferlist& bl) {
+    cache_key_t ck(prefix, key);
+    uint64_t gen;
+    if (cache_lookup(ck, bl, &gen))
+      return 0;
+
     set<string> k;
     k.insert(key);
     map<string,bufferlist> out;
@@ -497,6 +620,7 @@ class MonitorDBStore
     db->get(prefix, k, &out);
     if (out.empty())
       return -ENOENT;
+    cache_add(ck, out[key], gen);
     bl.append(out[key]);
 
     return 0;
@@ -530,6 +654,11 @@ class MonitorDBStore
   }
 
   bool exists(const string& prefix, const string& key) {
+    {
+      Mutex::Locker l(cache_lock);
+      if (cache.count(make_pair(prefix, key)))
+	return true;
+    }
     KeyValueDB::Iterator it = db->get_iterator(prefix);
     int err = it->lower_bound(key);
     if (err < 0)
@@ -565,6 +694,20 @@ class MonitorDBStore
       dbt->rmkeys_by_prefix((*iter));
     }
     db->submit_transaction_sync(dbt);
+
+    Mutex::Locker l(cache_lock);
+    ++cache_gen;
+    cache_lru_t::iterator p = cache_lru.begin();
+    while (p != cache_lru.end()) {
+      if (prefixes.count(p->first.first)) {
+	cache_bytes -= p->second.length();
+	cache.erase(p->first);
+	cache_lru.erase(p++);
+      } else {
+	++p;
+      }
+    }
+    logger->set(l_mon_store_cache_bytes, cache_bytes);
   }
 
   int open(ostream &out) {
@@ -610,7 +753,19 @@ class MonitorDBStore
       do_dump(false),
       dump_fd(-1),
       io_work(g_ceph_context, "monstore"),
-      is_open(false) {
+      is_open(false),
+      cache_lock("MonitorDBStore::cache_lock"),
+      cache_gen(0),
+      cache_bytes(0),
+      logger(NULL) {
+    PerfCountersBuilder pcb(g_ceph_context, "monstore",
+			    l_mon_store_first, l_mon_store_last);
+    pcb.add_u64_counter(l_mon_store_cache_hit, "cache_hit");
+    pcb.add_u64_counter(l_mon_store_cache_miss, "cache_miss");
+    pcb.add_u64(l_mon_store_cache_bytes, "cache_bytes");
+    logger = pcb.create_perf_counters();
+    g_ceph_context->get_perfcounters_collection()->add(logger);
+
     string::const_reverse_iterator rit;
     int pos = 0;
     for (rit = path.rbegin(); rit != path.rend(); ++rit, ++pos) {
@@ -648,6 +803,8 @@ class MonitorDBStore
     assert(!is_open);
     if (do_dump)
       ::close(dump_fd);
+    g_ceph_context->get_perfcounters_collection()->remove(logger);
+    delete logger;
   }
 
 };
@@ -1439,8 +1439,8 @@ bool OSDMonitor::prepare_boot(MOSDBoot *m)
 	(g_conf->mon_osd_auto_mark_new_in && (oldstate & CEPH_OSD_NEW)) ||
 	(g_conf->mon_osd_auto_mark_in)) {
       if (can_mark_in(from)) {
-	if (osdmap.osd_xinfo[from].old_weight > 0)
-	  pending_inc.new_weight[from] = osdmap.osd_xinfo[from].old_weight;
+	if ((*osdmap.osd_xinfo)[from].old_weight > 0)
+	  pending_inc.new_weight[from] = (*osdmap.osd_xinfo)[from].old_weight;
 	else
 	  pending_inc.new_weight[from] = CEPH_OSD_IN;
       } else {
@@ -1743,14 +1743,19 @@ bool OSDMonitor::prepare_remove_snaps(MRemoveSnaps *m)
   for (map<int, vector<snapid_t> >::iterator p = m->snaps.begin(); 
        p != m->snaps.end();
        ++p) {
-    pg_pool_t& pi = osdmap.pools[p->first];
+    const pg_pool_t *pi = osdmap.get_pg_pool(p->first);
+    if (!pi) {
+      dout(10) << " ignoring removed_snaps " << p->second
+	       << " on non-existent pool " << p->first << dendl;
+      continue;
+    }
     for (vector<snapid_t>::iterator q = p->second.begin();
 	 q != p->second.end();
 	 ++q) {
-      if (!pi.removed_snaps.contains(*q) &&
+      if (!pi->removed_snaps.contains(*q) &&
 	  (!pending_inc.new_pools.count(p->first) ||
 	   !pending_inc.new_pools[p->first].removed_snaps.contains(*q))) {
-	pg_pool_t *newpi = pending_inc.get_new_pool(p->first, &pi);
+	pg_pool_t *newpi = pending_inc.get_new_pool(p->first, pi);
 	newpi->removed_snaps.insert(*q);
 	dout(10) << " pool " << p->first << " removed_snaps added " << *q
 		 << " (now " << newpi->removed_snaps << ")" << dendl;
@@ -1783,25 +1788,84 @@ void OSDMonitor::send_latest(PaxosServiceMessage *m, epoch_t start)
 }
 
 
-MOSDMap *OSDMonitor::build_latest_full()
+int OSDMonitor::get_version(version_t ver, uint64_t features, bufferlist& bl)
+{
+  if (!MOSDMap::needs_reencode(features))
+    features = 0;
+  pair<version_t,uint64_t> key(ver, features);
+  if (inc_osd_cache.lookup(key, &bl))
+    return 0;
+  int ret;
+  if (features) {
+    ret = get_version(ver, 0, bl);
+    if (ret < 0)
+      return ret;
+    MOSDMap::reencode_incremental(bl, features);
+  } else {
+    ret = PaxosService::get_version(ver, bl);
+    if (ret < 0)
+      return ret;
+  }
+  inc_osd_cache.add(key, bl);
+  return 0;
+}
+
+int OSDMonitor::get_version_full(version_t ver, uint64_t features,
+				 bufferlist& bl)
+{
+  if (!MOSDMap::needs_reencode(features))
+    features = 0;
+  pair<version_t,uint64_t> key(ver, features);
+  if (full_osd_cache.lookup(key, &bl))
+    return 0;
+  int ret;
+  if (features) {
+    ret = get_version_full(ver, 0, bl);
+    if (ret < 0)
+      return ret;
+    MOSDMap::reencode_full(bl, features);
+  } else {
+    ret = PaxosService::get_version_full(ver, bl);
+    if (ret < 0)
+      return ret;
+  }
+  full_osd_cache.add(key, bl);
+  return 0;
+}
+
+void OSDMonitor::note_send_map(const MOSDMap *m)
+{
+  mon->logger->inc(l_mon_osdmap_send);
+  mon->logger->inc(l_mon_osdmap_send_epochs,
+		   m->maps.size() + m->incremental_maps.size());
+  mon->logger->inc(l_mon_osdmap_send_bytes, m->get_map_bytes());
+}
+
+MOSDMap *OSDMonitor::build_latest_full(uint64_t features)
 {
   MOSDMap *r = new MOSDMap(mon->monmap->fsid);
-  get_version_full(osdmap.get_epoch(), r->maps[osdmap.get_epoch()]);
+  get_version_full(osdmap.get_epoch(), features, r->maps[osdmap.get_epoch()]);
   r->oldest_map = get_first_committed();
   r->newest_map = osdmap.get_epoch();
+  if (MOSDMap::needs_reencode(features))
+    r->encode_features = features;
+  note_send_map(r);
   return r;
 }
 
-MOSDMap *OSDMonitor::build_incremental(epoch_t from, epoch_t to)
+MOSDMap *OSDMonitor::build_incremental(epoch_t from, epoch_t to,
+				       uint64_t features)
 {
   dout(10) << "build_incremental [" << from << ".." << to << "]" << dendl;
   MOSDMap *m = new MOSDMap(mon->monmap->fsid);
   m->oldest_map = get_first_committed();
   m->newest_map = osdmap.get_epoch();
+  if (MOSDMap::needs_reencode(features))
+    m->encode_features = features;
 
   for (epoch_t e = to; e >= from && e > 0; e--) {
     bufferlist bl;
-    int err = get_version(e, bl);
+    int err = get_version(e, features, bl);
     if (err == 0) {
       assert(bl.length());
       // if (get_version(e, bl) > 0) {
@@ -1811,7 +1875,7 @@ MOSDMap *OSDMonitor::build_incremental(epoch_t from, epoch_t to)
     } else {
       assert(err == -ENOENT);
       assert(!bl.length());
-      get_version_full(e, bl);
+      get_version_full(e, features, bl);
       if (bl.length() > 0) {
       //else if (get_version("full", e, bl) > 0) {
       dout(20) << "build_incremental   full " << e << " "
@@ -1822,6 +1886,7 @@ MOSDMap *OSDMonitor::build_incremental(epoch_t from, epoch_t to)
       }
     }
   }
+  note_send_map(m);
   return m;
 }
 
@@ -1870,6 +1935,7 @@ void OSDMonitor::send_incremental(PaxosServiceMessage *req, epoch_t first)
     m->oldest_map = first;
     m->newest_map = osdmap.get_epoch();
     m->maps[first] = bl;
+    note_send_map(m);
     mon->send_reply(req, m);
 
     if (osd >= 0)
@@ -1889,7 +1955,8 @@ void OSDMonitor::send_incremental(PaxosServiceMessage *req, epoch_t first)
     osd_epoch[osd] = last;
 }
 
-void OSDMonitor::send_incremental(epoch_t first, entity_inst_t& dest, bool onetime)
+void OSDMonitor::send_incremental(epoch_t first, entity_inst_t& dest, bool onetime,
+				  uint64_t features)
 {
   dout(5) << "send_incremental [" << first << ".." << osdmap.get_epoch() << "]"
 	  << " to " << dest << dendl;
@@ -1897,7 +1964,7 @@ void OSDMonitor::send_incremental(epoch_t first, entity_inst_t& dest, bool oneti
   if (first < get_first_committed()) {
     first = get_first_committed();
     bufferlist bl;
-    int err = get_version_full(first, bl);
+    int err = get_version_full(first, features, bl);
     assert(err == 0);
     assert(bl.length());
 
@@ -1908,13 +1975,16 @@ void OSDMonitor::send_incremental(epoch_t first, entity_inst_t& dest, bool oneti
     m->oldest_map = first;
     m->newest_map = osdmap.get_epoch();
     m->maps[first] = bl;
+    if (MOSDMap::needs_reencode(features))
+      m->encode_features = features;
+    note_send_map(m);
     mon->messenger->send_message(m, dest);
     first++;
   }
 
   while (first <= osdmap.get_epoch()) {
     epoch_t last = MIN(first + g_conf->osd_map_message_max, osdmap.get_epoch());
-    MOSDMap *m = build_incremental(first, last);
+    MOSDMap *m = build_incremental(first, last, features);
     mon->messenger->send_message(m, dest);
     first = last + 1;
     if (onetime)
@@ -1952,10 +2022,14 @@ void OSDMonitor::check_sub(Subscription *sub)
   dout(10) << __func__ << " " << sub << " next " << sub->next
 	   << (sub->onetime ? " (onetime)":" (ongoing)") << dendl;
   if (sub->next <= osdmap.get_epoch()) {
+    // pick maps encoded for this client, so that lots of (old) clients
+    // subscribed to the same epochs share one (re)encoding of them
+    uint64_t features = sub->session->con->get_features();
     if (sub->next >= 1)
-      send_incremental(sub->next, sub->session->inst, sub->incremental_onetime);
+      send_incremental(sub->next, sub->session->inst, sub->incremental_onetime,
+		       features);
     else
-      sub->session->con->send_message(build_latest_full());
+      sub->session->con->send_message(build_latest_full(features));
     if (sub->onetime)
       mon->session_map.remove_sub(sub);
     else
@@ -2043,7 +2117,7 @@ void OSDMonitor::tick()
 
 	  // remember previous weight
 	  if (pending_inc.new_xinfo.count(o) == 0)
-	    pending_inc.new_xinfo[o] = osdmap.osd_xinfo[o];
+	    pending_inc.new_xinfo[o] = (*osdmap.osd_xinfo)[o];
 	  pending_inc.new_xinfo[o].old_weight = osdmap.osd_weight[o];
 
 	  do_propose = true;
@@ -2060,8 +2134,8 @@ void OSDMonitor::tick()
   }
 
   // expire blacklisted items?
-  for (ceph::unordered_map<entity_addr_t,utime_t>::iterator p = osdmap.blacklist.begin();
-       p != osdmap.blacklist.end();
+  for (ceph::unordered_map<entity_addr_t,utime_t>::iterator p = osdmap.blacklist->begin();
+       p != osdmap.blacklist->end();
        ++p) {
     if (p->second < now) {
       dout(10) << "expiring blacklist item " << p->first << " expired " << p->second << " < now " << now << dendl;
@@ -2235,8 +2309,8 @@ void OSDMonitor::get_health(list<pair<health_status_t,string> >& summary,
     // hit_set-less cache_mode?
     if (g_conf->mon_warn_on_cache_pools_without_hit_sets) {
       int problem_cache_pools = 0;
-      for (map<int64_t, pg_pool_t>::const_iterator p = osdmap.pools.begin();
-	   p != osdmap.pools.end();
+      for (map<int64_t, pg_pool_t>::const_iterator p = osdmap.pools->begin();
+	   p != osdmap.pools->end();
 	   ++p) {
 	const pg_pool_t& info = p->second;
 	if (info.cache_mode_requires_hit_set() &&
@@ -2612,8 +2686,8 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
     cmd_getval(g_ceph_context, cmdmap, "auid", auid, int64_t(0));
     if (f)
       f->open_array_section("pools");
-    for (map<int64_t, pg_pool_t>::iterator p = osdmap.pools.begin();
-	 p != osdmap.pools.end();
+    for (map<int64_t, pg_pool_t>::iterator p = osdmap.pools->begin();
+	 p != osdmap.pools->end();
 	 ++p) {
       if (!auid || p->second.auid == (uint64_t)auid) {
 	if (f) {
@@ -2635,8 +2709,8 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
     if (f)
       f->open_array_section("blacklist");
 
-    for (ceph::unordered_map<entity_addr_t,utime_t>::iterator p = osdmap.blacklist.begin();
-	 p != osdmap.blacklist.end();
+    for (ceph::unordered_map<entity_addr_t,utime_t>::iterator p = osdmap.blacklist->begin();
+	 p != osdmap.blacklist->end();
 	 ++p) {
       if (f) {
 	f->open_object_section("entry");
@@ -2656,7 +2730,7 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
       f->close_section();
       f->flush(rdata);
     }
-    ss << "listed " << osdmap.blacklist.size() << " entries";
+    ss << "listed " << osdmap.blacklist->size() << " entries";
 
   } else if (prefix == "osd pool ls") {
     string detail;
@@ -4720,7 +4794,7 @@ bool OSDMonitor::prepare_command_impl(MMonCommand *m,
     if (erasure_code_profile_in_use(pending_inc.new_pools, name, ss))
       goto wait;
 
-    if (erasure_code_profile_in_use(osdmap.pools, name, ss)) {
+    if (erasure_code_profile_in_use(*osdmap.pools, name, ss)) {
       err = -EBUSY;
       goto reply;
     }
@@ -26,6 +26,7 @@
 using namespace std;
 
 #include "include/types.h"
+#include "common/simple_cache.hpp"
 #include "msg/Messenger.h"
 
 #include "osd/OSDMap.h"
@@ -212,12 +213,39 @@ private:
   bool can_mark_out(int o);
   bool can_mark_in(int o);
 
+  /**
+   * encoded incrementals and full maps, keyed by (epoch, features)
+   *
+   * Every subscriber wants the same few recent epochs, so keep them
+   * around instead of going back to the store (and, for old clients,
+   * re-encoding them) for each one.  features is 0 for the encoding
+   * in the store, which is what anyone who can decode it gets.
+   */
+  SimpleLRU<pair<version_t,uint64_t>, bufferlist> inc_osd_cache;
+  SimpleLRU<pair<version_t,uint64_t>, bufferlist> full_osd_cache;
+
+  // these hide (and go through the cache in front of) the
+  // PaxosService versions
+  int get_version(version_t ver, bufferlist& bl) {
+    return get_version(ver, 0, bl);
+  }
+  int get_version(version_t ver, uint64_t features, bufferlist& bl);
+  int get_version_full(version_t ver, bufferlist& bl) {
+    return get_version_full(ver, 0, bl);
+  }
+  int get_version_full(version_t ver, uint64_t features, bufferlist& bl);
+
+  /// account for an osdmap message we are about to send
+  void note_send_map(const MOSDMap *m);
+
   // ...
-  MOSDMap *build_latest_full();
-  MOSDMap *build_incremental(epoch_t first, epoch_t last);
+  MOSDMap *build_latest_full(uint64_t features=0);
+  MOSDMap *build_incremental(epoch_t first, epoch_t last,
+			     uint64_t features=0);
   void send_full(PaxosServiceMessage *m);
   void send_incremental(PaxosServiceMessage *m, epoch_t first);
-  void send_incremental(epoch_t first, entity_inst_t& dest, bool onetime);
+  void send_incremental(epoch_t first, entity_inst_t& dest, bool onetime,
+			uint64_t features=0);
 
   int reweight_by_utilization(int oload, std::string& out_str, bool by_pg,
 			      const set<int64_t> *pools);
@@ -378,7 +406,9 @@ private:
  public:
   OSDMonitor(Monitor *mn, Paxos *p, string service_name)
   : PaxosService(mn, p, service_name),
-    thrash_map(0), thrash_last_up_osd(-1) { }
+    thrash_map(0), thrash_last_up_osd(-1),
+    inc_osd_cache(g_conf->mon_osd_cache_size),
+    full_osd_cache(g_conf->mon_osd_cache_size) { }
 
   void tick();  // check state, take actions
 
@@ -10,6 +10,7 @@
 #include "common/Formatter.h"
 #include "include/ceph_features.h"
 #include "mon/MonitorDBStore.h"
+#include "osd/OSDMap.h"
 
 // --
 
@@ -359,6 +360,8 @@ void PGMap::calc_stats()
   pg_pool_sum.clear();
   pg_sum = pool_stat_t();
   osd_sum = osd_stat_t();
+  num_pg_by_last_epoch_clean.clear();
+  num_unstale_pg_by_primary.clear();
 
   for (ceph::unordered_map<pg_t,pg_stat_t>::iterator p = pg_stat.begin();
        p != pg_stat.end();
@@ -460,6 +463,12 @@ void PGMap::stat_pg_add(const pg_t &pgid, const pg_stat_t &s, bool sumonly)
   pg_pool_sum[pgid.pool()].add(s);
   pg_sum.add(s);
 
+  // the creating pg path (sumonly) may change the acting primary, and
+  // may add a pg it never subtracted; keep these in step with the sums.
+  ++num_pg_by_last_epoch_clean[s.get_effective_last_epoch_clean()];
+  if ((s.state & PG_STATE_STALE) == 0 && s.acting_primary >= 0)
+    ++num_unstale_pg_by_primary[s.acting_primary];
+
   if (sumonly)
     return;
 
@@ -486,6 +495,17 @@ void PGMap::stat_pg_sub(const pg_t &pgid, const pg_stat_t &s, bool sumonly)
     pg_pool_sum.erase(pgid.pool());
   pg_sum.sub(s);
 
+  map<epoch_t,int>::iterator l =
+    num_pg_by_last_epoch_clean.find(s.get_effective_last_epoch_clean());
+  if (l != num_pg_by_last_epoch_clean.end() && --l->second == 0)
+    num_pg_by_last_epoch_clean.erase(l);
+  if ((s.state & PG_STATE_STALE) == 0 && s.acting_primary >= 0) {
+    ceph::unordered_map<int32_t,int>::iterator q =
+      num_unstale_pg_by_primary.find(s.acting_primary);
+    if (q != num_unstale_pg_by_primary.end() && --q->second == 0)
+      num_unstale_pg_by_primary.erase(q);
+  }
+
   if (sumonly)
     return;
 
@@ -527,15 +547,9 @@ void PGMap::stat_osd_sub(const osd_stat_t &s)
 
 epoch_t PGMap::calc_min_last_epoch_clean() const
 {
-  if (pg_stat.empty())
+  if (pg_stat.empty() || num_pg_by_last_epoch_clean.empty())
     return 0;
-  ceph::unordered_map<pg_t,pg_stat_t>::const_iterator p = pg_stat.begin();
-  epoch_t min = p->second.get_effective_last_epoch_clean();
-  for (++p; p != pg_stat.end(); ++p) {
-    epoch_t lec = p->second.get_effective_last_epoch_clean();
-    if (lec < min)
-      min = lec;
-  }
+  epoch_t min = num_pg_by_last_epoch_clean.begin()->first;
   // also scan osd epochs
   // don't trim past the oldest reported osd epoch
   for (ceph::unordered_map<int32_t, epoch_t>::const_iterator i = osd_epochs.begin();
@@ -794,9 +808,49 @@ void PGMap::dump(ostream& ss) const
      << std::endl;
 }
 
+bool PGMap::may_be_stuck(PGMap::StuckPG type, int state)
+{
+  switch (type) {
+  case STUCK_INACTIVE:
+    return (state & PG_STATE_ACTIVE) == 0;
+  case STUCK_UNCLEAN:
+    return (state & PG_STATE_CLEAN) == 0;
+  case STUCK_DEGRADED:
+    return state & PG_STATE_DEGRADED;
+  case STUCK_UNDERSIZED:
+    return state & PG_STATE_UNDERSIZED;
+  case STUCK_STALE:
+    return state & PG_STATE_STALE;
+  default:
+    assert(0 == "invalid type");
+  }
+  return false;
+}
+
+bool PGMap::have_unstale_pgs_on_down_osds(const OSDMap& osdmap) const
+{
+  for (ceph::unordered_map<int32_t,int>::const_iterator p =
+	 num_unstale_pg_by_primary.begin();
+       p != num_unstale_pg_by_primary.end();
+       ++p)
+    if (osdmap.is_down(p->first))
+      return true;
+  return false;
+}
+
 void PGMap::get_stuck_stats(PGMap::StuckPG type, utime_t cutoff,
 			    ceph::unordered_map<pg_t, pg_stat_t>& stuck_pgs) const
 {
+  // usually no pg is in a state that can be stuck; the per-state counts
+  // tell us that without walking every pg.
+  bool any = false;
+  for (ceph::unordered_map<int,int>::const_iterator p = num_pg_by_state.begin();
+       p != num_pg_by_state.end() && !any;
+       ++p)
+    any = p->second > 0 && may_be_stuck(type, p->first);
+  if (!any)
+    return;
+
   for (ceph::unordered_map<pg_t, pg_stat_t>::const_iterator i = pg_stat.begin();
        i != pg_stat.end();
        ++i) {
@@ -29,6 +29,7 @@
 #include "MonitorDBStore.h"
 
 namespace ceph { class Formatter; }
+class OSDMap;
 
 class PGMap {
 public:
@@ -121,6 +122,10 @@ public:
   osd_stat_t osd_sum;
   mutable epoch_t min_last_epoch_clean;
   ceph::unordered_map<int,int> blocked_by_sum;
+  /// number of pgs with each effective last_epoch_clean
+  map<epoch_t,int> num_pg_by_last_epoch_clean;
+  /// number of pgs not yet marked stale, by acting primary
+  ceph::unordered_map<int32_t,int> num_unstale_pg_by_primary;
 
   utime_t stamp;
 
@@ -191,6 +196,10 @@ public:
     STUCK_STALE,
     STUCK_NONE
   };
+  /// true if a pg in state may be stuck in the given way
+  static bool may_be_stuck(StuckPG type, int state);
+  /// true if some pg's acting primary is down but it is not marked stale
+  bool have_unstale_pgs_on_down_osds(const OSDMap& osdmap) const;
   
   PGMap()
     : version(0),
@@ -798,20 +798,25 @@ bool PGMonitor::prepare_pg_stats(MPGStats *stats)
     pg_t pgid = p->first;
     ack->pg_stat[pgid] = make_pair(p->second.reported_seq, p->second.reported_epoch);
 
-    if (pg_map.pg_stat.count(pgid) &&
-        pg_map.pg_stat[pgid].get_version_pair() > p->second.get_version_pair()) {
-      dout(15) << " had " << pgid << " from " << pg_map.pg_stat[pgid].reported_epoch << ":"
-	       << pg_map.pg_stat[pgid].reported_seq << dendl;
+    // one lookup in each map per pg; a report can carry thousands
+    ceph::unordered_map<pg_t,pg_stat_t>::const_iterator cur =
+      pg_map.pg_stat.find(pgid);
+    if (cur != pg_map.pg_stat.end() &&
+        cur->second.get_version_pair() > p->second.get_version_pair()) {
+      dout(15) << " had " << pgid << " from " << cur->second.reported_epoch << ":"
+	       << cur->second.reported_seq << dendl;
       continue;
     }
-    if (pending_inc.pg_stat_updates.count(pgid) && 
-        pending_inc.pg_stat_updates[pgid].get_version_pair() > p->second.get_version_pair()) {
-      dout(15) << " had " << pgid << " from " << pending_inc.pg_stat_updates[pgid].reported_epoch << ":"
-	       << pending_inc.pg_stat_updates[pgid].reported_seq << " (pending)" << dendl;
+    map<pg_t,pg_stat_t>::iterator pending =
+      pending_inc.pg_stat_updates.find(pgid);
+    if (pending != pending_inc.pg_stat_updates.end() &&
+        pending->second.get_version_pair() > p->second.get_version_pair()) {
+      dout(15) << " had " << pgid << " from " << pending->second.reported_epoch << ":"
+	       << pending->second.reported_seq << " (pending)" << dendl;
       continue;
     }
 
-    if (pg_map.pg_stat.count(pgid) == 0) {
+    if (cur == pg_map.pg_stat.end()) {
       dout(15) << " got " << pgid << " reported at " << p->second.reported_epoch << ":"
 	       << p->second.reported_seq
 	       << " state " << pg_state_string(p->second.state)
@@ -822,10 +827,13 @@ bool PGMonitor::prepare_pg_stats(MPGStats *stats)
       
     dout(15) << " got " << pgid
 	     << " reported at " << p->second.reported_epoch << ":" << p->second.reported_seq
-	     << " state " << pg_state_string(pg_map.pg_stat[pgid].state)
+	     << " state " << pg_state_string(cur->second.state)
 	     << " -> " << pg_state_string(p->second.state)
 	     << dendl;
-    pending_inc.pg_stat_updates[pgid] = p->second;
+    if (pending != pending_inc.pg_stat_updates.end())
+      pending->second = p->second;
+    else
+      pending_inc.pg_stat_updates.insert(pending, *p);
 
     /*
     // we don't care much about consistency, here; apply to live map.
@@ -956,7 +964,7 @@ void PGMonitor::check_osd_map(epoch_t epoch)
   }
 }
 
-void PGMonitor::register_pg(pg_pool_t& pool, pg_t pgid, epoch_t epoch, bool new_pool)
+void PGMonitor::register_pg(const pg_pool_t& pool, pg_t pgid, epoch_t epoch, bool new_pool)
 {
   pg_t parent;
   int split_bits = 0;
@@ -1018,11 +1026,11 @@ bool PGMonitor::register_new_pgs()
   OSDMap *osdmap = &mon->osdmon()->osdmap;
 
   int created = 0;
-  for (map<int64_t,pg_pool_t>::iterator p = osdmap->pools.begin();
-       p != osdmap->pools.end();
+  for (map<int64_t,pg_pool_t>::const_iterator p = osdmap->get_pools().begin();
+       p != osdmap->get_pools().end();
        ++p) {
     int64_t poolid = p->first;
-    pg_pool_t &pool = p->second;
+    const pg_pool_t &pool = p->second;
     int ruleno = pool.get_crush_ruleset();
     if (!osdmap->crush->rule_exists(ruleno)) 
       continue;
@@ -1214,6 +1222,12 @@ bool PGMonitor::check_down_pgs()
   OSDMap *osdmap = &mon->osdmon()->osdmap;
   bool ret = false;
 
+  if (!pg_map.have_unstale_pgs_on_down_osds(*osdmap)) {
+    dout(20) << __func__ << " no unstale pgs on down osds" << dendl;
+    need_check_down_pgs = false;
+    return false;
+  }
+
   for (ceph::unordered_map<pg_t,pg_stat_t>::iterator p = pg_map.pg_stat.begin();
        p != pg_map.pg_stat.end();
        ++p) {
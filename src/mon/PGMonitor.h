@@ -114,7 +114,7 @@ private:
   // when we last received PG stats from each osd
   map<int,utime_t> last_osd_report;
 
-  void register_pg(pg_pool_t& pool, pg_t pgid, epoch_t epoch, bool new_pool);
+  void register_pg(const pg_pool_t& pool, pg_t pgid, epoch_t epoch, bool new_pool);
 
   /**
    * check latest osdmap for new pgs to register
@@ -86,6 +86,7 @@ void Paxos::init_logger()
   pcb.add_u64_avg(l_paxos_begin_keys, "begin_keys");
   pcb.add_u64_avg(l_paxos_begin_bytes, "begin_bytes");
   pcb.add_time_avg(l_paxos_begin_latency, "begin_latency");
+  pcb.add_u64_avg(l_paxos_begin_proposals, "begin_proposals");
   pcb.add_u64_counter(l_paxos_commit, "commit");
   pcb.add_u64_avg(l_paxos_commit_keys, "commit_keys");
   pcb.add_u64_avg(l_paxos_commit_bytes, "commit_bytes");
@@ -1039,15 +1040,17 @@ void Paxos::commit_proposal()
     return;  // must have been updating previous
   }
 
-  C_Proposal *proposal = static_cast<C_Proposal*>(proposals.front());
-  if (proposal->proposed) {
+  // every proposal folded into the round we just committed is at the
+  // front of the queue; anything unproposed was queued after we began.
+  while (!proposals.empty()) {
+    C_Proposal *proposal = static_cast<C_Proposal*>(proposals.front());
+    if (!proposal->proposed)
+      break;
     dout(10) << __func__ << " proposal " << proposal << " took "
 	     << (ceph_clock_now(NULL) - proposal->proposal_time)
 	     << " to finish" << dendl;
     proposals.pop_front();
     proposal->complete(0);
-  } else {
-    // must have been updating previous.
   }
 }
 
@@ -1495,16 +1498,42 @@ void Paxos::propose_queued()
   assert(!proposal->proposed);
 
   cancel_events();
-  dout(10) << __func__ << " " << (last_committed + 1)
-	  << " " << proposal->bl.length() << " bytes" << dendl;
   proposal->proposed = true;
 
+  // fold whatever else has queued up (typically other services that
+  // proposed while the previous round was in flight) into this round,
+  // so they share a single accept and commit.
+  unsigned max = MAX(1, g_conf->paxos_max_batch_proposals);
+  unsigned num = 1;
+  list<Context*>::iterator p = proposals.begin();
+  for (++p; p != proposals.end() && num < max; ++p, ++num) {
+    assert(!static_cast<C_Proposal*>(*p)->proposed);
+  }
+
+  bufferlist bl;
+  if (num == 1) {
+    bl = proposal->bl;
+  } else {
+    MonitorDBStore::TransactionRef t(new MonitorDBStore::Transaction);
+    p = proposals.begin();
+    for (unsigned i = 0; i < num; ++i, ++p) {
+      C_Proposal *q = static_cast<C_Proposal*>(*p);
+      q->proposed = true;
+      t->append_from_encoded(q->bl);
+    }
+    t->encode(bl);
+  }
+  logger->inc(l_paxos_begin_proposals, num);
+
+  dout(10) << __func__ << " " << (last_committed + 1)
+	   << " " << num << " proposals, " << bl.length() << " bytes" << dendl;
+
   dout(30) << __func__ << " ";
   list_proposals(*_dout);
   *_dout << dendl;
 
   state = STATE_UPDATING;
-  begin(proposal->bl);
+  begin(bl);
 }
 
 void Paxos::queue_proposal(bufferlist& bl, Context *onfinished)
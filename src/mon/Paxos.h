@@ -138,6 +138,7 @@ enum {
   l_paxos_begin_keys,
   l_paxos_begin_bytes,
   l_paxos_begin_latency,
+  l_paxos_begin_proposals,
   l_paxos_commit,
   l_paxos_commit_keys,
   l_paxos_commit_bytes,
@@ -1054,7 +1055,9 @@ private:
    */
   void queue_proposal(bufferlist& bl, Context *onfinished);
   /**
-   * Begin proposing the Proposal at the front of the proposals queue.
+   * Begin proposing the Proposal at the front of the proposals queue,
+   * along with up to paxos_max_batch_proposals - 1 of the ones queued
+   * behind it, as a single transaction.
    */
   void propose_queued();
 
@@ -1049,6 +1049,10 @@ MOSDMap *OSDService::build_incremental_map_msg(epoch_t since, epoch_t to,
 
 void OSDService::send_map(MOSDMap *m, Connection *con)
 {
+  osd->logger->inc(l_osd_map_send);
+  osd->logger->inc(l_osd_map_send_epochs,
+		   m->maps.size() + m->incremental_maps.size());
+  osd->logger->inc(l_osd_map_send_bytes, m->get_map_bytes());
   con->send_message(m);
 }
 
@@ -1085,7 +1089,7 @@ void OSDService::send_incremental_map(epoch_t since, Connection *con,
   send_map(m, con);
 }
 
-bool OSDService::_get_map_bl(epoch_t e, bufferlist& bl)
+bool OSDService::_get_full_map_bl(epoch_t e, bufferlist& bl)
 {
   bool found = map_bl_cache.lookup(e, &bl);
   if (found)
@@ -1097,9 +1101,87 @@ bool OSDService::_get_map_bl(epoch_t e, bufferlist& bl)
   return found;
 }
 
-bool OSDService::get_inc_map_bl(epoch_t e, bufferlist& bl)
+bool OSDService::_get_map_bl(epoch_t e, bufferlist& bl)
+{
+  if (_get_full_map_bl(e, bl))
+    return true;
+
+  // not a checkpoint; rebuild and encode it the way we would have
+  // when the incremental arrived.
+  OSDMap o;
+  uint64_t features;
+  if (!_rebuild_map(e, &o, &features))
+    return false;
+  bl.clear();
+  o.encode(bl, features);
+  _add_map_bl(e, bl);
+  return true;
+}
+
+bool OSDService::_rebuild_map(epoch_t e, OSDMap *o, uint64_t *features)
+{
+  // walk back to the nearest map we have in full
+  list<bufferlist> incs;
+  OSDMapRef base;
+  bufferlist fbl;
+  epoch_t from = e;
+  while (from > 0) {
+    base = map_cache.lookup(from);
+    if (base || _get_full_map_bl(from, fbl))
+      break;
+    bufferlist bl;
+    if (!_get_inc_map_bl(from, bl)) {
+      dout(10) << "rebuild_map " << e << " missing inc " << from << dendl;
+      return false;
+    }
+    incs.push_front(bl);
+    --from;
+  }
+  dout(20) << "rebuild_map " << e << " from " << from
+	   << (base ? " (cached)" : "") << " + " << incs.size() << " incs"
+	   << dendl;
+
+  if (base)
+    o->deepish_copy_from(*base);
+  else if (from > 0)
+    o->decode(fbl);
+  // else start from the initial (empty) map
+
+  uint64_t f = 0;
+  for (list<bufferlist>::iterator p = incs.begin(); p != incs.end(); ++p) {
+    OSDMap::Incremental inc;
+    bufferlist::iterator q = p->begin();
+    inc.decode(q);
+    if (o->apply_incremental(inc) < 0) {
+      derr << "rebuild_map " << e << " failed to apply inc "
+	   << inc.epoch << dendl;
+      return false;
+    }
+    f = inc.encode_features | CEPH_FEATURE_RESERVED;
+  }
+  if (features) {
+    if (incs.empty()) {
+      // e itself was in the map cache; it must still be encoded with
+      // the features of the incremental that produced it, or the crc
+      // will not match what the mon published.
+      bufferlist bl;
+      if (!_get_inc_map_bl(e, bl)) {
+	dout(10) << "rebuild_map " << e << " missing inc " << e
+		 << " for encode features" << dendl;
+	return false;
+      }
+      OSDMap::Incremental inc;
+      bufferlist::iterator q = bl.begin();
+      inc.decode(q);
+      f = inc.encode_features | CEPH_FEATURE_RESERVED;
+    }
+    *features = f;
+  }
+  return true;
+}
+
+bool OSDService::_get_inc_map_bl(epoch_t e, bufferlist& bl)
 {
-  Mutex::Locker l(map_cache_lock);
   bool found = map_bl_inc_cache.lookup(e, &bl);
   if (found)
     return true;
@@ -1145,6 +1227,9 @@ OSDMapRef OSDService::_add_map(OSDMap *o)
 {
   epoch_t e = o->get_epoch();
 
+  if (cct->_conf->osd_map_pg_mapping_cache)
+    o->enable_pg_mapping_cache();
+
   if (cct->_conf->osd_map_dedup) {
     // Dedup against an existing map at a nearby epoch
     OSDMapRef for_dedup = map_cache.lower_bound(e);
@@ -1173,17 +1258,52 @@ OSDMapRef OSDService::try_get_map(epoch_t epoch)
   if (epoch > 0) {
     dout(20) << "get_map " << epoch << " - loading and decoding " << map << dendl;
     bufferlist bl;
-    if (!_get_map_bl(epoch, bl)) {
+    if (_get_full_map_bl(epoch, bl)) {
+      map->decode(bl);
+    } else if (!_rebuild_map(epoch, map, NULL)) {
       delete map;
       return OSDMapRef();
     }
-    map->decode(bl);
   } else {
     dout(20) << "get_map " << epoch << " - return initial " << map << dendl;
   }
   return _add_map(map);
 }
 
+void OSDService::dump_map_cache_memory(Formatter *f)
+{
+  map<epoch_t, OSDMapRef> maps;
+  map_cache.get_all(&maps);
+
+  // maps share unchanged structures with their neighbours; bytes is
+  // what each would cost on its own, and new_bytes what it adds to the
+  // (older) maps before it.
+  set<const void*> seen;
+  uint64_t bytes = 0, new_bytes = 0;
+  f->open_object_section("osdmap_cache_memory");
+  f->open_array_section("maps");
+  for (map<epoch_t, OSDMapRef>::iterator p = maps.begin();
+       p != maps.end();
+       ++p) {
+    uint64_t b = p->second->get_mem_usage(NULL);
+    uint64_t nb = p->second->get_mem_usage(&seen);
+    f->open_object_section("map");
+    f->dump_unsigned("epoch", p->first);
+    f->dump_unsigned("bytes", b);
+    f->dump_unsigned("new_bytes", nb);
+    f->close_section();
+    bytes += b;
+    new_bytes += nb;
+  }
+  f->close_section(); //maps
+  f->open_object_section("total");
+  f->dump_unsigned("num_maps", maps.size());
+  f->dump_unsigned("bytes", new_bytes);
+  f->dump_unsigned("bytes_unshared", bytes);
+  f->close_section();
+  f->close_section(); //osdmap_cache_memory
+}
+
 bool OSDService::queue_for_recovery(PG *pg)
 {
   bool b = recovery_wq.queue(pg);
@@ -1711,6 +1831,35 @@ bool OSD::asok_command(string command, cmdmap_t& cmdmap, string format,
     }
 
     f->close_section(); //watches
+  } else if (command == "dump_pg_log_memory") {
+    PGLog::mem_usage_t total;
+    f->open_object_section("pg_log_memory");
+    f->open_array_section("pgs");
+    {
+      Mutex::Locker l(osd_lock);
+      RWLock::RLocker l2(pg_map_lock);
+      for (ceph::unordered_map<spg_t,PG*>::iterator it = pg_map.begin();
+          it != pg_map.end();
+          ++it) {
+	PGLog::mem_usage_t usage;
+        PG *pg = it->second;
+        pg->lock();
+	pg->pg_log.get_mem_usage(&usage);
+        pg->unlock();
+	f->open_object_section("pg");
+	f->dump_stream("pgid") << it->first;
+	usage.dump(f);
+	f->close_section();
+	total.add(usage);
+      }
+    }
+    f->close_section(); //pgs
+    f->open_object_section("total");
+    total.dump(f);
+    f->close_section();
+    f->close_section(); //pg_log_memory
+  } else if (command == "dump_osdmap_cache_memory") {
+    service.dump_map_cache_memory(f);
   } else if (command == "dump_reservations") {
     f->open_object_section("reservations");
     f->open_object_section("local_reservations");
@@ -1967,10 +2116,22 @@ void OSD::final_init()
 				     "show clients which have active watches,"
 				     " and on which objects");
   assert(r == 0);
+  r = admin_socket->register_command("dump_pg_log_memory",
+				     "dump_pg_log_memory",
+				     asok_hook,
+				     "show estimated memory used by pg logs"
+				     " and missing sets");
+  assert(r == 0);
   r = admin_socket->register_command("dump_reservations", "dump_reservations",
 				     asok_hook,
 				     "show recovery reservations");
   assert(r == 0);
+  r = admin_socket->register_command("dump_osdmap_cache_memory",
+				     "dump_osdmap_cache_memory",
+				     asok_hook,
+				     "show estimated memory used by cached"
+				     " osdmaps, counting shared parts once");
+  assert(r == 0);
 
   test_ops_hook = new TestOpsSocketHook(&(this->service), this->store);
   // Note: pools are CephString instead of CephPoolname because
@@ -2107,6 +2268,9 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_map, "map_messages");           // osdmap messages
   osd_plb.add_u64_counter(l_osd_mape, "map_message_epochs");         // osdmap epochs
   osd_plb.add_u64_counter(l_osd_mape_dup, "map_message_epoch_dups"); // dup osdmap epochs
+  osd_plb.add_u64_counter(l_osd_map_send, "map_messages_sent");       // osdmap messages we shared
+  osd_plb.add_u64_counter(l_osd_map_send_epochs, "map_message_epochs_sent");
+  osd_plb.add_u64_counter(l_osd_map_send_bytes, "map_message_bytes_sent");
   osd_plb.add_u64_counter(l_osd_waiting_for_map,
 			  "messages_delayed_for_map"); // dup osdmap epochs
 
@@ -2126,12 +2290,16 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_tier_dirty, "tier_dirty");
   osd_plb.add_u64_counter(l_osd_tier_clean, "tier_clean");
   osd_plb.add_u64_counter(l_osd_tier_delay, "tier_delay");
+  osd_plb.add_u64_counter(l_osd_tier_promote_skip, "tier_promote_skip");
 
   osd_plb.add_u64_counter(l_osd_agent_wake, "agent_wake");
   osd_plb.add_u64_counter(l_osd_agent_skip, "agent_skip");
   osd_plb.add_u64_counter(l_osd_agent_flush, "agent_flush");
   osd_plb.add_u64_counter(l_osd_agent_evict, "agent_evict");
 
+  osd_plb.add_u64_counter(l_osd_object_ctx_cache_hit, "object_ctx_cache_hit");
+  osd_plb.add_u64_counter(l_osd_object_ctx_cache_total, "object_ctx_cache_total");
+
   logger = osd_plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -2256,7 +2424,9 @@ int OSD::shutdown()
   cct->get_admin_socket()->unregister_command("dump_op_pq_state");
   cct->get_admin_socket()->unregister_command("dump_blacklist");
   cct->get_admin_socket()->unregister_command("dump_watchers");
+  cct->get_admin_socket()->unregister_command("dump_pg_log_memory");
   cct->get_admin_socket()->unregister_command("dump_reservations");
+  cct->get_admin_socket()->unregister_command("dump_osdmap_cache_memory");
   delete asok_hook;
   asok_hook = NULL;
 
@@ -6059,6 +6229,9 @@ void OSD::handle_osd_map(MOSDMap *m)
   // store new maps: queue for disk and put in the osdmap cache
   epoch_t last_marked_full = 0;
   epoch_t start = MAX(osdmap->get_epoch() + 1, first);
+  OSDMapRef prev = osdmap;  // to carry cached pg placements forward
+  set<epoch_t> full_written;
+  int checkpoint = cct->_conf->osd_map_full_checkpoint_interval;
   for (epoch_t e = start; e <= last; e++) {
     map<epoch_t,bufferlist>::iterator p;
     p = m->maps.find(e);
@@ -6073,8 +6246,10 @@ void OSD::handle_osd_map(MOSDMap *m)
 
       hobject_t fulloid = get_osdmap_pobject_name(e);
       t.write(META_COLL, fulloid, 0, bl.length(), bl);
+      full_written.insert(e);
       pin_map_bl(e, bl);
       pinned_maps.push_back(add_map(o));
+      prev = pinned_maps.back();
       continue;
     }
 
@@ -6087,10 +6262,16 @@ void OSD::handle_osd_map(MOSDMap *m)
       pin_map_inc_bl(e, bl);
 
       OSDMap *o = new OSDMap;
-      if (e > 1) {
+      if (prev && prev->get_epoch() == e - 1) {
+	// start from the previous map in memory rather than decoding it
+	o->deepish_copy_from(*prev);
+	o->inherit_pg_mapping_cache(*prev);
+      } else if (e > 1) {
 	bufferlist obl;
 	get_map_bl(e - 1, obl);
 	o->decode(obl);
+	if (prev)
+	  o->inherit_pg_mapping_cache(*prev);
       }
 
       OSDMap::Incremental inc;
@@ -6104,8 +6285,13 @@ void OSD::handle_osd_map(MOSDMap *m)
       if (o->test_flag(CEPH_OSDMAP_FULL))
 	last_marked_full = e;
 
+      // only every checkpoint'th full map is stored; the rest are
+      // rebuilt from the incrementals on demand (see _rebuild_map).
+      // we still have to encode to verify the crc, though.
+      bool store_full = checkpoint <= 1 || e % checkpoint == 0;
       bufferlist fbl;
-      o->encode(fbl, inc.encode_features | CEPH_FEATURE_RESERVED);
+      if (store_full || inc.have_crc)
+	o->encode(fbl, inc.encode_features | CEPH_FEATURE_RESERVED);
 
       bool injected_failure = false;
       if (g_conf->osd_inject_bad_map_crc_probability > 0 &&
@@ -6127,11 +6313,16 @@ void OSD::handle_osd_map(MOSDMap *m)
 	break;
       }
 
-
-      hobject_t fulloid = get_osdmap_pobject_name(e);
-      t.write(META_COLL, fulloid, 0, fbl.length(), fbl);
-      pin_map_bl(e, fbl);
+      if (store_full) {
+	hobject_t fulloid = get_osdmap_pobject_name(e);
+	t.write(META_COLL, fulloid, 0, fbl.length(), fbl);
+	full_written.insert(e);
+	pin_map_bl(e, fbl);
+      } else if (fbl.length()) {
+	add_map_bl(e, fbl);  // we have it; save peers a rebuild
+      }
       pinned_maps.push_back(add_map(o));
+      prev = pinned_maps.back();
       continue;
     }
 
@@ -6153,6 +6344,17 @@ void OSD::handle_osd_map(MOSDMap *m)
     epoch_t min(
       MIN(m->oldest_map,
 	  service.map_cache.cached_key_lower_bound()));
+    // maps after min may be rebuilt from an earlier checkpoint; keep
+    // everything from the last full map at or before min.
+    while (min > superblock.oldest_map) {
+      if (min >= start && min <= last) {
+	if (full_written.count(min))
+	  break;
+      } else if (store->exists(META_COLL, get_osdmap_pobject_name(min))) {
+	break;
+      }
+      --min;
+    }
     for (epoch_t e = superblock.oldest_map; e < min; ++e) {
       dout(20) << " removing old osdmap epoch " << e << dendl;
       t.remove(META_COLL, get_osdmap_pobject_name(e));
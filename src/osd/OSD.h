@@ -116,6 +116,9 @@ enum {
   l_osd_map,
   l_osd_mape,
   l_osd_mape_dup,
+  l_osd_map_send,
+  l_osd_map_send_epochs,
+  l_osd_map_send_bytes,
 
   l_osd_waiting_for_map,
 
@@ -135,12 +138,16 @@ enum {
   l_osd_tier_dirty,
   l_osd_tier_clean,
   l_osd_tier_delay,
+  l_osd_tier_promote_skip,
 
   l_osd_agent_wake,
   l_osd_agent_skip,
   l_osd_agent_flush,
   l_osd_agent_evict,
 
+  l_osd_object_ctx_cache_hit,
+  l_osd_object_ctx_cache_total,
+
   l_osd_last,
 };
 
@@ -730,6 +737,21 @@ public:
     return _get_map_bl(e, bl);
   }
   bool _get_map_bl(epoch_t e, bufferlist& bl);
+  /// full map bl from the cache or the store only; never rebuilds
+  bool _get_full_map_bl(epoch_t e, bufferlist& bl);
+  /**
+   * reconstruct map e from the nearest earlier full map
+   *
+   * Only every osd_map_full_checkpoint_interval'th full map is stored;
+   * the others are rebuilt by applying incrementals to the closest
+   * cached or stored full map.
+   *
+   * @param e [in] epoch to rebuild
+   * @param o [out] map to rebuild into (should be empty)
+   * @param features [out] features to encode epoch e with, from its incremental
+   * @return false if a needed incremental is missing
+   */
+  bool _rebuild_map(epoch_t e, OSDMap *o, uint64_t *features);
 
   void add_map_inc_bl(epoch_t e, bufferlist& bl) {
     Mutex::Locker l(map_cache_lock);
@@ -737,9 +759,15 @@ public:
   }
   void pin_map_inc_bl(epoch_t e, bufferlist &bl);
   void _add_map_inc_bl(epoch_t e, bufferlist& bl);
-  bool get_inc_map_bl(epoch_t e, bufferlist& bl);
+  bool get_inc_map_bl(epoch_t e, bufferlist& bl) {
+    Mutex::Locker l(map_cache_lock);
+    return _get_inc_map_bl(e, bl);
+  }
+  bool _get_inc_map_bl(epoch_t e, bufferlist& bl);
 
   void clear_map_bl_cache_pins(epoch_t e);
+  /// estimated memory of the maps in map_cache, shared parts counted once
+  void dump_map_cache_memory(Formatter *f);
 
   void need_heartbeat_peer_update();
 
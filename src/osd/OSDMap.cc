@@ -867,19 +867,20 @@ void OSDMap::Incremental::generate_test_instances(list<Incremental*>& o)
 void OSDMap::set_epoch(epoch_t e)
 {
   epoch = e;
-  for (map<int64_t,pg_pool_t>::iterator p = pools.begin();
-       p != pools.end();
+  map<int64_t,pg_pool_t>& p_pools = _cow(pools);
+  for (map<int64_t,pg_pool_t>::iterator p = p_pools.begin();
+       p != p_pools.end();
        ++p)
     p->second.last_change = e;
 }
 
 bool OSDMap::is_blacklisted(const entity_addr_t& a) const
 {
-  if (blacklist.empty())
+  if (blacklist->empty())
     return false;
 
   // this specific instance?
-  if (blacklist.count(a))
+  if (blacklist->count(a))
     return true;
 
   // is entire ip blacklisted?
@@ -887,7 +888,7 @@ bool OSDMap::is_blacklisted(const entity_addr_t& a) const
     entity_addr_t b = a;
     b.set_port(0);
     b.set_nonce(0);
-    if (blacklist.count(b)) {
+    if (blacklist->count(b)) {
       return true;
     }
   }
@@ -897,14 +898,15 @@ bool OSDMap::is_blacklisted(const entity_addr_t& a) const
 
 void OSDMap::get_blacklist(list<pair<entity_addr_t,utime_t> > *bl) const
 {
-  for (ceph::unordered_map<entity_addr_t,utime_t>::const_iterator it = blacklist.begin() ;
-			 it != blacklist.end(); ++it) {
+  for (ceph::unordered_map<entity_addr_t,utime_t>::const_iterator it = blacklist->begin() ;
+			 it != blacklist->end(); ++it) {
     bl->push_back(*it);
   }
 }
 
 void OSDMap::set_max_osd(int m)
 {
+  _invalidate_pg_mapping();
   int o = max_osd;
   max_osd = m;
   osd_state.resize(m);
@@ -913,8 +915,8 @@ void OSDMap::set_max_osd(int m)
     osd_state[o] = 0;
     osd_weight[o] = CEPH_OSD_OUT;
   }
-  osd_info.resize(m);
-  osd_xinfo.resize(m);
+  _cow(osd_info).resize(m);
+  _cow(osd_xinfo).resize(m);
   osd_addrs->client_addr.resize(m);
   osd_addrs->cluster_addr.resize(m);
   osd_addrs->hb_back_addr.resize(m);
@@ -1030,9 +1032,11 @@ uint64_t OSDMap::get_features(int entity_type, uint64_t *pmask) const
     features |= CEPH_FEATURE_CRUSH_TUNABLES2;
   if (crush->has_nondefault_tunables3())
     features |= CEPH_FEATURE_CRUSH_TUNABLES3;
+  if (crush->has_v4_buckets())
+    features |= CEPH_FEATURE_CRUSH_V4;
   mask |= CEPH_FEATURES_CRUSH;
 
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin(); p != pools.end(); ++p) {
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin(); p != pools->end(); ++p) {
     if (p->second.flags & pg_pool_t::FLAG_HASHPSPOOL) {
       features |= CEPH_FEATURE_OSDHASHPSPOOL;
     }
@@ -1140,11 +1144,13 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
   }
 
   // does crush match?
-  bufferlist oc, nc;
-  ::encode(*o->crush, oc);
-  ::encode(*n->crush, nc);
-  if (oc.contents_equal(nc)) {
-    n->crush = o->crush;
+  if (o->crush != n->crush) {
+    bufferlist oc, nc;
+    ::encode(*o->crush, oc);
+    ::encode(*n->crush, nc);
+    if (oc.contents_equal(nc)) {
+      n->crush = o->crush;
+    }
   }
 
   // does pg_temp match?
@@ -1163,6 +1169,39 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
   if (o->osd_uuid->size() == n->osd_uuid->size() &&
       *o->osd_uuid == *n->osd_uuid)
     n->osd_uuid = o->osd_uuid;
+
+  // the copy-on-write members are already shared if one map was copied
+  // from the other; otherwise share them if they are unchanged.
+  if (o->osd_info != n->osd_info &&
+      *o->osd_info == *n->osd_info)
+    n->osd_info = o->osd_info;
+  if (o->osd_xinfo != n->osd_xinfo &&
+      *o->osd_xinfo == *n->osd_xinfo)
+    n->osd_xinfo = o->osd_xinfo;
+
+  if (o->pools != n->pools &&
+      o->pools->size() == n->pools->size()) {
+    bufferlist op, np;
+    ::encode(*o->pools, op, CEPH_FEATURES_ALL);
+    ::encode(*n->pools, np, CEPH_FEATURES_ALL);
+    if (op.contents_equal(np))
+      n->pools = o->pools;
+  }
+
+  if (o->blacklist != n->blacklist &&
+      o->blacklist->size() == n->blacklist->size()) {
+    bool same = true;
+    for (ceph::unordered_map<entity_addr_t,utime_t>::const_iterator p =
+	   n->blacklist->begin();
+	 p != n->blacklist->end() && same;
+	 ++p) {
+      ceph::unordered_map<entity_addr_t,utime_t>::const_iterator q =
+	o->blacklist->find(p->first);
+      same = q != o->blacklist->end() && q->second == p->second;
+    }
+    if (same)
+      n->blacklist = o->blacklist;
+  }
 }
 
 void OSDMap::remove_redundant_temporaries(CephContext *cct, const OSDMap& osdmap,
@@ -1254,6 +1293,15 @@ int OSDMap::apply_incremental(const Incremental &inc)
   }
 
   // nope, incremental.
+
+  // note what cached placements this epoch invalidates before applying it
+  ceph::shared_ptr<pg_mapping_cache_t> old_mapping;
+  old_mapping.swap(pg_mapping);
+  set<int> moved_osds;
+  set<int64_t> moved_pools;
+  if (old_mapping)
+    _get_pg_mapping_changes(inc, &moved_osds, &moved_pools);
+
   if (inc.new_flags >= 0)
     flags = inc.new_flags;
 
@@ -1266,15 +1314,16 @@ int OSDMap::apply_incremental(const Incremental &inc)
   for (set<int64_t>::const_iterator p = inc.old_pools.begin();
        p != inc.old_pools.end();
        ++p) {
-    pools.erase(*p);
+    _cow(pools).erase(*p);
     name_pool.erase(pool_name[*p]);
     pool_name.erase(*p);
   }
   for (map<int64_t,pg_pool_t>::const_iterator p = inc.new_pools.begin();
        p != inc.new_pools.end();
        ++p) {
-    pools[p->first] = p->second;
-    pools[p->first].last_change = epoch;
+    pg_pool_t& pi = _cow(pools)[p->first];
+    pi = p->second;
+    pi.last_change = epoch;
   }
   for (map<int64_t,string>::const_iterator p = inc.new_pool_names.begin();
        p != inc.new_pool_names.end();
@@ -1294,7 +1343,7 @@ int OSDMap::apply_incremental(const Incremental &inc)
     // xinfo old_weight.
     if (i->second) {
       osd_state[i->first] &= ~(CEPH_OSD_AUTOOUT | CEPH_OSD_NEW);
-      osd_xinfo[i->first].old_weight = 0;
+      _cow(osd_xinfo)[i->first].old_weight = 0;
     }
   }
 
@@ -1324,8 +1373,8 @@ int OSDMap::apply_incremental(const Incremental &inc)
     int s = i->second ? i->second : CEPH_OSD_UP;
     if ((osd_state[i->first] & CEPH_OSD_UP) &&
 	(s & CEPH_OSD_UP)) {
-      osd_info[i->first].down_at = epoch;
-      osd_xinfo[i->first].down_stamp = modified;
+      _cow(osd_info)[i->first].down_at = epoch;
+      _cow(osd_xinfo)[i->first].down_stamp = modified;
     }
     if ((osd_state[i->first] & CEPH_OSD_EXISTS) &&
 	(s & CEPH_OSD_EXISTS))
@@ -1348,7 +1397,7 @@ int OSDMap::apply_incremental(const Incremental &inc)
     else
       osd_addrs->hb_front_addr[i->first].reset();
 
-    osd_info[i->first].up_from = epoch;
+    _cow(osd_info)[i->first].up_from = epoch;
   }
   for (map<int32_t,entity_addr_t>::const_iterator i = inc.new_up_cluster.begin();
        i != inc.new_up_cluster.end();
@@ -1359,19 +1408,20 @@ int OSDMap::apply_incremental(const Incremental &inc)
   for (map<int32_t,epoch_t>::const_iterator i = inc.new_up_thru.begin();
        i != inc.new_up_thru.end();
        ++i)
-    osd_info[i->first].up_thru = i->second;
+    _cow(osd_info)[i->first].up_thru = i->second;
   for (map<int32_t,pair<epoch_t,epoch_t> >::const_iterator i = inc.new_last_clean_interval.begin();
        i != inc.new_last_clean_interval.end();
        ++i) {
-    osd_info[i->first].last_clean_begin = i->second.first;
-    osd_info[i->first].last_clean_end = i->second.second;
+    osd_info_t& info = _cow(osd_info)[i->first];
+    info.last_clean_begin = i->second.first;
+    info.last_clean_end = i->second.second;
   }
   for (map<int32_t,epoch_t>::const_iterator p = inc.new_lost.begin(); p != inc.new_lost.end(); ++p)
-    osd_info[p->first].lost_at = p->second;
+    _cow(osd_info)[p->first].lost_at = p->second;
 
   // xinfo
   for (map<int32_t,osd_xinfo_t>::const_iterator p = inc.new_xinfo.begin(); p != inc.new_xinfo.end(); ++p)
-    osd_xinfo[p->first] = p->second;
+    _cow(osd_xinfo)[p->first] = p->second;
 
   // uuid
   for (map<int32_t,uuid_d>::const_iterator p = inc.new_uuid.begin(); p != inc.new_uuid.end(); ++p) 
@@ -1398,13 +1448,13 @@ int OSDMap::apply_incremental(const Incremental &inc)
   for (map<entity_addr_t,utime_t>::const_iterator p = inc.new_blacklist.begin();
        p != inc.new_blacklist.end();
        ++p) {
-    blacklist[p->first] = p->second;
+    _cow(blacklist)[p->first] = p->second;
     new_blacklist_entries = true;
   }
   for (vector<entity_addr_t>::const_iterator p = inc.old_blacklist.begin();
        p != inc.old_blacklist.end();
        ++p)
-    blacklist.erase(*p);
+    _cow(blacklist).erase(*p);
 
   // cluster snapshot?
   if (inc.cluster_snapshot.length()) {
@@ -1424,9 +1474,270 @@ int OSDMap::apply_incremental(const Incremental &inc)
   }
 
   calc_num_osds();
+
+  if (old_mapping)
+    _carry_pg_mapping(inc, old_mapping, moved_osds, moved_pools);
   return 0;
 }
 
+void OSDMap::_get_pg_mapping_changes(const Incremental& inc,
+				     set<int> *osds,
+				     set<int64_t> *pools) const
+{
+  // raw placements depend on osd weights and existence...
+  for (map<int32_t,uint32_t>::const_iterator i = inc.new_weight.begin();
+       i != inc.new_weight.end();
+       ++i)
+    if (i->first >= max_osd || osd_weight[i->first] != i->second)
+      osds->insert(i->first);
+  for (map<int32_t,uint8_t>::const_iterator i = inc.new_state.begin();
+       i != inc.new_state.end();
+       ++i)
+    if (i->second & CEPH_OSD_EXISTS)
+      osds->insert(i->first);
+  for (map<int32_t,entity_addr_t>::const_iterator i =
+	 inc.new_up_client.begin();
+       i != inc.new_up_client.end();
+       ++i)
+    if (!exists(i->first))
+      osds->insert(i->first);
+
+  // ...and on the pool's placement parameters, but not on e.g. snaps
+  for (map<int64_t,pg_pool_t>::const_iterator i = inc.new_pools.begin();
+       i != inc.new_pools.end();
+       ++i) {
+    const pg_pool_t *pool = get_pg_pool(i->first);
+    if (!pool ||
+	pool->get_type() != i->second.get_type() ||
+	pool->get_size() != i->second.get_size() ||
+	pool->get_pg_num() != i->second.get_pg_num() ||
+	pool->get_pgp_num() != i->second.get_pgp_num() ||
+	pool->get_crush_ruleset() != i->second.get_crush_ruleset() ||
+	pool->has_flag(pg_pool_t::FLAG_HASHPSPOOL) !=
+	i->second.has_flag(pg_pool_t::FLAG_HASHPSPOOL))
+      pools->insert(i->first);
+  }
+}
+
+bool OSDMap::_rule_may_map_to(int ruleno, const set<int>& osds) const
+{
+  bool took = false;
+  for (int step = 0; step < crush->get_rule_len(ruleno); ++step) {
+    if (crush->get_rule_op(ruleno, step) != CRUSH_RULE_TAKE)
+      continue;
+    took = true;
+    int root = crush->get_rule_arg1(ruleno, step);
+    for (set<int>::const_iterator p = osds.begin(); p != osds.end(); ++p)
+      if (*p == root || crush->subtree_contains(root, *p))
+	return true;
+  }
+  return !took;
+}
+
+void OSDMap::_carry_pg_mapping(const Incremental& inc,
+			       ceph::shared_ptr<pg_mapping_cache_t> old,
+			       const set<int>& osds,
+			       const set<int64_t>& pools)
+{
+  pg_mapping.reset(new pg_mapping_cache_t);
+  if (inc.crush.length() || inc.new_max_osd >= 0)
+    return;
+
+  Mutex::Locker l(old->lock);
+  for (map<int64_t, ceph::shared_ptr<raw_pg_table_t> >::iterator p =
+	 old->pools.begin();
+       p != old->pools.end();
+       ++p) {
+    const pg_pool_t *pool = get_pg_pool(p->first);
+    if (!pool || pools.count(p->first))
+      continue;
+    if (!osds.empty()) {
+      int ruleno = crush->find_rule(pool->get_crush_ruleset(),
+				    pool->get_type(), pool->get_size());
+      if (ruleno < 0 || _rule_may_map_to(ruleno, osds))
+	continue;
+    }
+    pg_mapping->pools.insert(*p);
+  }
+}
+
+bool OSDMap::_lookup_raw_pg(const pg_pool_t& pool, pg_t pg,
+			    vector<int> *osds) const
+{
+  ceph::shared_ptr<raw_pg_table_t> t;
+  {
+    Mutex::Locker l(pg_mapping->lock);
+    map<int64_t, ceph::shared_ptr<raw_pg_table_t> >::iterator p =
+      pg_mapping->pools.find(pg.pool());
+    if (p == pg_mapping->pools.end())
+      return false;
+    t = p->second;
+  }
+  ps_t ps = pool.raw_pg_to_pg(pg).ps();
+  unsigned c = ps >> raw_pg_table_t::CHUNK_BITS;
+  Mutex::Locker l(t->lock);
+  if (c >= t->chunks.size() || !t->chunks[c])
+    return false;
+  const int32_t *row = &(*t->chunks[c])[
+    (ps & ((1 << raw_pg_table_t::CHUNK_BITS) - 1)) * (t->size + 1)];
+  if (row[0] < 0)
+    return false;
+  osds->assign(row + 1, row + 1 + row[0]);
+  return true;
+}
+
+void OSDMap::_cache_raw_pg(const pg_pool_t& pool, pg_t pg,
+			   const vector<int>& osds) const
+{
+  if (osds.size() > pool.get_size())
+    return;
+  ceph::shared_ptr<raw_pg_table_t> t;
+  {
+    Mutex::Locker l(pg_mapping->lock);
+    ceph::shared_ptr<raw_pg_table_t>& r = pg_mapping->pools[pg.pool()];
+    if (!r)
+      r.reset(new raw_pg_table_t(pool.get_pg_num(), pool.get_size()));
+    t = r;
+  }
+  ps_t ps = pool.raw_pg_to_pg(pg).ps();
+  unsigned c = ps >> raw_pg_table_t::CHUNK_BITS;
+  Mutex::Locker l(t->lock);
+  if (c >= t->chunks.size() || t->size != pool.get_size())
+    return;
+  if (!t->chunks[c])
+    t->chunks[c].reset(new vector<int32_t>(
+      (1 << raw_pg_table_t::CHUNK_BITS) * (t->size + 1), -1));
+  int32_t *row = &(*t->chunks[c])[
+    (ps & ((1 << raw_pg_table_t::CHUNK_BITS) - 1)) * (t->size + 1)];
+  row[0] = osds.size();
+  for (unsigned i = 0; i < osds.size(); ++i)
+    row[i + 1] = osds[i];
+}
+
+uint64_t OSDMap::get_pg_mapping_cache_size() const
+{
+  if (!pg_mapping)
+    return 0;
+  uint64_t n = 0;
+  Mutex::Locker l(pg_mapping->lock);
+  for (map<int64_t, ceph::shared_ptr<raw_pg_table_t> >::iterator p =
+	 pg_mapping->pools.begin();
+       p != pg_mapping->pools.end();
+       ++p) {
+    Mutex::Locker tl(p->second->lock);
+    unsigned stride = p->second->size + 1;
+    for (unsigned c = 0; c < p->second->chunks.size(); ++c) {
+      if (!p->second->chunks[c])
+	continue;
+      const vector<int32_t>& v = *p->second->chunks[c];
+      for (unsigned i = 0; i < v.size(); i += stride)
+	if (v[i] >= 0)
+	  ++n;
+    }
+  }
+  return n;
+}
+
+// rough cost of a map/set/hash node beyond its value
+static const unsigned NODE_OVERHEAD = 4 * sizeof(void*);
+
+// true if p should be counted: not null and not yet seen
+static bool _mem_first_seen(set<const void*> *seen, const void *p)
+{
+  if (!p)
+    return false;
+  return !seen || seen->insert(p).second;
+}
+
+uint64_t OSDMap::get_mem_usage(set<const void*> *seen) const
+{
+  uint64_t n = sizeof(*this);
+  n += osd_state.capacity() * sizeof(uint8_t);
+  n += osd_weight.capacity() * sizeof(__u32);
+  for (map<int64_t,string>::const_iterator p = pool_name.begin();
+       p != pool_name.end();
+       ++p)
+    n += 2 * (NODE_OVERHEAD + sizeof(*p) + p->second.size());  // + name_pool
+  for (map<string,map<string,string> >::const_iterator p =
+	 erasure_code_profiles.begin();
+       p != erasure_code_profiles.end();
+       ++p) {
+    n += NODE_OVERHEAD + sizeof(*p) + p->first.size();
+    for (map<string,string>::const_iterator q = p->second.begin();
+	 q != p->second.end();
+	 ++q)
+      n += NODE_OVERHEAD + sizeof(*q) + q->first.size() + q->second.size();
+  }
+
+  if (_mem_first_seen(seen, osd_addrs.get())) {
+    const vector<ceph::shared_ptr<entity_addr_t> > *v[] = {
+      &osd_addrs->client_addr, &osd_addrs->cluster_addr,
+      &osd_addrs->hb_back_addr, &osd_addrs->hb_front_addr
+    };
+    n += sizeof(addrs_s);
+    for (unsigned i = 0; i < 4; ++i) {
+      n += v[i]->capacity() * sizeof(ceph::shared_ptr<entity_addr_t>);
+      for (unsigned j = 0; j < v[i]->size(); ++j)
+	if (_mem_first_seen(seen, (*v[i])[j].get()))
+	  n += sizeof(entity_addr_t);
+    }
+  }
+  if (_mem_first_seen(seen, osd_info.get()))
+    n += osd_info->capacity() * sizeof(osd_info_t);
+  if (_mem_first_seen(seen, osd_xinfo.get()))
+    n += osd_xinfo->capacity() * sizeof(osd_xinfo_t);
+  if (_mem_first_seen(seen, osd_uuid.get()))
+    n += osd_uuid->capacity() * sizeof(uuid_d);
+  if (_mem_first_seen(seen, osd_primary_affinity.get()))
+    n += osd_primary_affinity->capacity() * sizeof(__u32);
+  if (_mem_first_seen(seen, pg_temp.get())) {
+    for (map<pg_t,vector<int32_t> >::const_iterator p = pg_temp->begin();
+	 p != pg_temp->end();
+	 ++p)
+      n += NODE_OVERHEAD + sizeof(*p) + p->second.capacity() * sizeof(int32_t);
+  }
+  if (_mem_first_seen(seen, primary_temp.get()))
+    n += primary_temp->size() *
+      (NODE_OVERHEAD + sizeof(pair<pg_t,int32_t>));
+  if (_mem_first_seen(seen, pools.get())) {
+    for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin();
+	 p != pools->end();
+	 ++p)
+      n += NODE_OVERHEAD + sizeof(*p) +
+	(p->second.snaps.size() + p->second.removed_snaps.num_intervals() +
+	 p->second.tiers.size() + p->second.properties.size()) *
+	NODE_OVERHEAD * 2;
+  }
+  if (_mem_first_seen(seen, blacklist.get()))
+    n += blacklist->bucket_count() * sizeof(void*) +
+      blacklist->size() *
+      (NODE_OVERHEAD + sizeof(pair<entity_addr_t,utime_t>));
+  if (_mem_first_seen(seen, crush.get())) {
+    // the encoding is a fair proxy for the size of the bucket and
+    // rule arrays and name maps.
+    bufferlist bl;
+    crush->encode(bl);
+    n += sizeof(CrushWrapper) + bl.length();
+  }
+  if (_mem_first_seen(seen, pg_mapping.get())) {
+    Mutex::Locker l(pg_mapping->lock);
+    for (map<int64_t, ceph::shared_ptr<raw_pg_table_t> >::const_iterator p =
+	   pg_mapping->pools.begin();
+	 p != pg_mapping->pools.end();
+	 ++p) {
+      if (!_mem_first_seen(seen, p->second.get()))
+	continue;
+      Mutex::Locker tl(p->second->lock);
+      n += NODE_OVERHEAD + sizeof(raw_pg_table_t) +
+	p->second->chunks.capacity() * sizeof(ceph::shared_ptr<void>);
+      for (unsigned c = 0; c < p->second->chunks.size(); ++c)
+	if (_mem_first_seen(seen, p->second->chunks[c].get()))
+	  n += p->second->chunks[c]->capacity() * sizeof(int32_t);
+    }
+  }
+  return n;
+}
+
 // mapping
 int OSDMap::object_locator_to_pg(
 	const object_t& oid,
@@ -1492,14 +1803,18 @@ int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg,
 {
   // map to osds[]
   ps_t pps = pool.raw_pg_to_pps(pg);  // placement ps
-  unsigned size = pool.get_size();
+  if (!pg_mapping || !_lookup_raw_pg(pool, pg, osds)) {
+    unsigned size = pool.get_size();
 
-  // what crush rule?
-  int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
-  if (ruleno >= 0)
-    crush->do_rule(ruleno, pps, *osds, size, osd_weight);
+    // what crush rule?
+    int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
+    if (ruleno >= 0)
+      crush->do_rule(ruleno, pps, *osds, size, osd_weight);
 
-  _remove_nonexistent_osds(pool, *osds);
+    _remove_nonexistent_osds(pool, *osds);
+    if (pg_mapping)
+      _cache_raw_pg(pool, pg, *osds);
+  }
 
   *primary = -1;
   for (unsigned i = 0; i < osds->size(); ++i) {
@@ -1746,10 +2061,10 @@ void OSDMap::encode_client_old(bufferlist& bl) const
   ::encode(modified, bl);
 
   // for ::encode(pools, bl);
-  __u32 n = pools.size();
+  __u32 n = pools->size();
   ::encode(n, bl);
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
-       p != pools.end();
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin();
+       p != pools->end();
        ++p) {
     n = p->first;
     ::encode(n, bl);
@@ -1809,7 +2124,7 @@ void OSDMap::encode_classic(bufferlist& bl, uint64_t features) const
   ::encode(created, bl);
   ::encode(modified, bl);
 
-  ::encode(pools, bl, features);
+  ::encode(*pools, bl, features);
   ::encode(pool_name, bl);
   ::encode(pool_max, bl);
 
@@ -1831,13 +2146,13 @@ void OSDMap::encode_classic(bufferlist& bl, uint64_t features) const
   __u16 ev = 10;
   ::encode(ev, bl);
   ::encode(osd_addrs->hb_back_addr, bl);
-  ::encode(osd_info, bl);
-  ::encode(blacklist, bl);
+  ::encode(*osd_info, bl);
+  ::encode(*blacklist, bl);
   ::encode(osd_addrs->cluster_addr, bl);
   ::encode(cluster_snapshot_epoch, bl);
   ::encode(cluster_snapshot, bl);
   ::encode(*osd_uuid, bl);
-  ::encode(osd_xinfo, bl);
+  ::encode(*osd_xinfo, bl);
   ::encode(osd_addrs->hb_front_addr, bl);
 }
 
@@ -1870,7 +2185,7 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
     ::encode(created, bl);
     ::encode(modified, bl);
 
-    ::encode(pools, bl, features);
+    ::encode(*pools, bl, features);
     ::encode(pool_name, bl);
     ::encode(pool_max, bl);
 
@@ -1901,13 +2216,13 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
   {
     ENCODE_START(1, 1, bl); // extended, osd-only data
     ::encode(osd_addrs->hb_back_addr, bl);
-    ::encode(osd_info, bl);
+    ::encode(*osd_info, bl);
     {
       // put this in a sorted, ordered map<> so that we encode in a
       // deterministic order.
       map<entity_addr_t,utime_t> blacklist_map;
       for (ceph::unordered_map<entity_addr_t,utime_t>::const_iterator p =
-	     blacklist.begin(); p != blacklist.end(); ++p)
+	     blacklist->begin(); p != blacklist->end(); ++p)
 	blacklist_map.insert(make_pair(p->first, p->second));
       ::encode(blacklist_map, bl);
     }
@@ -1915,7 +2230,7 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
     ::encode(cluster_snapshot_epoch, bl);
     ::encode(cluster_snapshot, bl);
     ::encode(*osd_uuid, bl);
-    ::encode(osd_xinfo, bl);
+    ::encode(*osd_xinfo, bl);
     ::encode(osd_addrs->hb_front_addr, bl);
     ENCODE_FINISH(bl); // osd-only data
   }
@@ -1966,11 +2281,12 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
       ::decode(max_pools, p);
       pool_max = max_pools;
     }
-    pools.clear();
+    map<int64_t,pg_pool_t>& p_pools = _cow(pools);
+    p_pools.clear();
     ::decode(n, p);
     while (n--) {
       ::decode(t, p);
-      ::decode(pools[t], p);
+      ::decode(p_pools[t], p);
     }
     if (v == 4) {
       ::decode(n, p);
@@ -1986,13 +2302,13 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
       pool_max = n;
     }
   } else {
-    ::decode(pools, p);
+    ::decode(_cow(pools), p);
     ::decode(pool_name, p);
     ::decode(pool_max, p);
   }
   // kludge around some old bug that zeroed out pool_max (#2307)
-  if (pools.size() && pool_max < pools.rbegin()->first) {
-    pool_max = pools.rbegin()->first;
+  if (pools->size() && pool_max < pools->rbegin()->first) {
+    pool_max = pools->rbegin()->first;
   }
 
   ::decode(flags, p);
@@ -2017,6 +2333,7 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
   bufferlist cbl;
   ::decode(cbl, p);
   bufferlist::iterator cblp = cbl.begin();
+  crush.reset(new CrushWrapper);
   crush->decode(cblp);
 
   // extended
@@ -2024,11 +2341,11 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
   if (v >= 5)
     ::decode(ev, p);
   ::decode(osd_addrs->hb_back_addr, p);
-  ::decode(osd_info, p);
+  ::decode(_cow(osd_info), p);
   if (v < 5)
     ::decode(pool_name, p);
 
-  ::decode(blacklist, p);
+  ::decode(_cow(blacklist), p);
   if (ev >= 6)
     ::decode(osd_addrs->cluster_addr, p);
   else
@@ -2045,9 +2362,9 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
     osd_uuid->resize(max_osd);
   }
   if (ev >= 9)
-    ::decode(osd_xinfo, p);
+    ::decode(_cow(osd_xinfo), p);
   else
-    osd_xinfo.resize(max_osd);
+    _cow(osd_xinfo).resize(max_osd);
 
   if (ev >= 10)
     ::decode(osd_addrs->hb_front_addr, p);
@@ -2061,6 +2378,7 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
 
 void OSDMap::decode(bufferlist::iterator& bl)
 {
+  _invalidate_pg_mapping();
   /**
    * Older encodings of the OSDMap had a single struct_v which
    * covered the whole encoding, and was prior to our modern
@@ -2090,7 +2408,7 @@ void OSDMap::decode(bufferlist::iterator& bl)
     ::decode(created, bl);
     ::decode(modified, bl);
 
-    ::decode(pools, bl);
+    ::decode(_cow(pools), bl);
     ::decode(pool_name, bl);
     ::decode(pool_max, bl);
 
@@ -2116,6 +2434,7 @@ void OSDMap::decode(bufferlist::iterator& bl)
     bufferlist cbl;
     ::decode(cbl, bl);
     bufferlist::iterator cblp = cbl.begin();
+    crush.reset(new CrushWrapper);
     crush->decode(cblp);
     if (struct_v >= 3) {
       ::decode(erasure_code_profiles, bl);
@@ -2128,13 +2447,13 @@ void OSDMap::decode(bufferlist::iterator& bl)
   {
     DECODE_START(1, bl); // extended, osd-only data
     ::decode(osd_addrs->hb_back_addr, bl);
-    ::decode(osd_info, bl);
-    ::decode(blacklist, bl);
+    ::decode(_cow(osd_info), bl);
+    ::decode(_cow(blacklist), bl);
     ::decode(osd_addrs->cluster_addr, bl);
     ::decode(cluster_snapshot_epoch, bl);
     ::decode(cluster_snapshot, bl);
     ::decode(*osd_uuid, bl);
-    ::decode(osd_xinfo, bl);
+    ::decode(_cow(osd_xinfo), bl);
     ::decode(osd_addrs->hb_front_addr, bl);
     DECODE_FINISH(bl); // osd-only data
   }
@@ -2221,7 +2540,7 @@ void OSDMap::dump(Formatter *f) const
   f->dump_int("max_osd", get_max_osd());
 
   f->open_array_section("pools");
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin(); p != pools.end(); ++p) {
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin(); p != pools->end(); ++p) {
     std::string name("<unknown>");
     map<int64_t,string>::const_iterator pni = pool_name.find(p->first);
     if (pni != pool_name.end())
@@ -2266,7 +2585,7 @@ void OSDMap::dump(Formatter *f) const
     if (exists(i)) {
       f->open_object_section("xinfo");
       f->dump_int("osd", i);
-      osd_xinfo[i].dump(f);
+      (*osd_xinfo)[i].dump(f);
       f->close_section();
     }
   }
@@ -2296,8 +2615,8 @@ void OSDMap::dump(Formatter *f) const
   f->close_section(); // primary_temp
 
   f->open_array_section("blacklist");
-  for (ceph::unordered_map<entity_addr_t,utime_t>::const_iterator p = blacklist.begin();
-       p != blacklist.end();
+  for (ceph::unordered_map<entity_addr_t,utime_t>::const_iterator p = blacklist->begin();
+       p != blacklist->end();
        ++p) {
     stringstream ss;
     ss << p->first;
@@ -2317,7 +2636,7 @@ void OSDMap::generate_test_instances(list<OSDMap*>& o)
   uuid_d fsid;
   o.back()->build_simple(cct, 1, fsid, 16, 7, 8);
   o.back()->created = o.back()->modified = utime_t(1, 2);  // fix timestamp
-  o.back()->blacklist[entity_addr_t()] = utime_t(5, 6);
+  (*o.back()->blacklist)[entity_addr_t()] = utime_t(5, 6);
   cct->put();
 }
 
@@ -2372,7 +2691,7 @@ struct qi {
 
 void OSDMap::print_pools(ostream& out) const
 {
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin(); p != pools.end(); ++p) {
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin(); p != pools->end(); ++p) {
     std::string name("<unknown>");
     map<int64_t,string>::const_iterator pni = pool_name.find(p->first);
     if (pni != pool_name.end())
@@ -2437,8 +2756,8 @@ void OSDMap::print(ostream& out) const
       ++p)
     out << "primary_temp " << p->first << " " << p->second << "\n";
 
-  for (ceph::unordered_map<entity_addr_t,utime_t>::const_iterator p = blacklist.begin();
-       p != blacklist.end();
+  for (ceph::unordered_map<entity_addr_t,utime_t>::const_iterator p = blacklist->begin();
+       p != blacklist->end();
        ++p)
     out << "blacklist " << p->first << " expires " << p->second << "\n";
 
@@ -2619,7 +2938,7 @@ void OSDMap::print_oneline_summary(ostream& out) const
 
 bool OSDMap::crush_ruleset_in_use(int ruleset) const
 {
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin(); p != pools.end(); ++p) {
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin(); p != pools->end(); ++p) {
     if (p->second.crush_ruleset == ruleset)
       return true;
   }
@@ -2688,17 +3007,18 @@ int OSDMap::build_simple(CephContext *cct, epoch_t e, uuid_d &fsid,
   for (vector<string>::iterator p = pool_names.begin();
        p != pool_names.end(); ++p) {
     int64_t pool = ++pool_max;
-    pools[pool].type = pg_pool_t::TYPE_REPLICATED;
-    pools[pool].flags = cct->_conf->osd_pool_default_flags;
+    pg_pool_t& pi = _cow(pools)[pool];
+    pi.type = pg_pool_t::TYPE_REPLICATED;
+    pi.flags = cct->_conf->osd_pool_default_flags;
     if (cct->_conf->osd_pool_default_flag_hashpspool)
-      pools[pool].flags |= pg_pool_t::FLAG_HASHPSPOOL;
-    pools[pool].size = cct->_conf->osd_pool_default_size;
-    pools[pool].min_size = cct->_conf->get_osd_pool_default_min_size();
-    pools[pool].crush_ruleset = default_replicated_ruleset;
-    pools[pool].object_hash = CEPH_STR_HASH_RJENKINS;
-    pools[pool].set_pg_num(poolbase << pg_bits);
-    pools[pool].set_pgp_num(poolbase << pgp_bits);
-    pools[pool].last_change = epoch;
+      pi.flags |= pg_pool_t::FLAG_HASHPSPOOL;
+    pi.size = cct->_conf->osd_pool_default_size;
+    pi.min_size = cct->_conf->get_osd_pool_default_min_size();
+    pi.crush_ruleset = default_replicated_ruleset;
+    pi.object_hash = CEPH_STR_HASH_RJENKINS;
+    pi.set_pg_num(poolbase << pg_bits);
+    pi.set_pgp_num(poolbase << pgp_bits);
+    pi.last_change = epoch;
     pool_name[pool] = *p;
     name_pool[*p] = pool;
   }
@@ -88,6 +88,15 @@ WRITE_CLASS_ENCODER(osd_info_t)
 
 ostream& operator<<(ostream& out, const osd_info_t& info);
 
+inline bool operator==(const osd_info_t& l, const osd_info_t& r) {
+  return l.last_clean_begin == r.last_clean_begin &&
+    l.last_clean_end == r.last_clean_end &&
+    l.up_from == r.up_from &&
+    l.up_thru == r.up_thru &&
+    l.down_at == r.down_at &&
+    l.lost_at == r.lost_at;
+}
+
 struct osd_xinfo_t {
   utime_t down_stamp;      ///< timestamp when we were last marked down
   float laggy_probability; ///< encoded as __u32: 0 = definitely not laggy, 0xffffffff definitely laggy
@@ -107,6 +116,14 @@ WRITE_CLASS_ENCODER(osd_xinfo_t)
 
 ostream& operator<<(ostream& out, const osd_xinfo_t& xi);
 
+inline bool operator==(const osd_xinfo_t& l, const osd_xinfo_t& r) {
+  return l.down_stamp == r.down_stamp &&
+    l.laggy_probability == r.laggy_probability &&
+    l.laggy_interval == r.laggy_interval &&
+    l.features == r.features &&
+    l.old_weight == r.old_weight;
+}
+
 
 /** OSDMap
  */
@@ -226,20 +243,20 @@ private:
   ceph::shared_ptr<addrs_s> osd_addrs;
 
   vector<__u32>   osd_weight;   // 16.16 fixed point, 0x10000 = "in", 0 = "out"
-  vector<osd_info_t> osd_info;
+  ceph::shared_ptr< vector<osd_info_t> > osd_info;
   ceph::shared_ptr< map<pg_t,vector<int32_t> > > pg_temp;  // temp pg mapping (e.g. while we rebuild)
   ceph::shared_ptr< map<pg_t,int32_t > > primary_temp;  // temp primary mapping (e.g. while we rebuild)
   ceph::shared_ptr< vector<__u32> > osd_primary_affinity; ///< 16.16 fixed point, 0x10000 = baseline
 
-  map<int64_t,pg_pool_t> pools;
+  ceph::shared_ptr< map<int64_t,pg_pool_t> > pools;
   map<int64_t,string> pool_name;
   map<string,map<string,string> > erasure_code_profiles;
   map<string,int64_t> name_pool;
 
   ceph::shared_ptr< vector<uuid_d> > osd_uuid;
-  vector<osd_xinfo_t> osd_xinfo;
+  ceph::shared_ptr< vector<osd_xinfo_t> > osd_xinfo;
 
-  ceph::unordered_map<entity_addr_t,utime_t> blacklist;
+  ceph::shared_ptr< ceph::unordered_map<entity_addr_t,utime_t> > blacklist;
 
   epoch_t cluster_snapshot_epoch;
   string cluster_snapshot;
@@ -248,6 +265,72 @@ private:
   mutable bool crc_defined;
   mutable uint32_t crc;
 
+  /**
+   * make a shared member private to this map before modifying it
+   *
+   * pools, osd_info, osd_xinfo and blacklist are shared copy-on-write:
+   * copying a map (operator=, deepish_copy_from) shares them with the
+   * source, and they are only cloned here, by the first change made
+   * through this map.  Anything that changes them must go through _cow();
+   * everything else may read them freely.
+   */
+  template<typename T>
+  static T& _cow(ceph::shared_ptr<T>& p) {
+    if (!p.unique())
+      p.reset(new T(*p));
+    return *p;
+  }
+
+  /**
+   * cached raw CRUSH placements (the output of _pg_to_osds), per pool
+   * and folded ps.
+   *
+   * The tables are filled lazily as pgs are mapped, and apply_incremental()
+   * hands each pool's table on to the next epoch unless the incremental
+   * changes something that placement depends on: the crush map,
+   * max_osd, the pool's size/pg_num/pgp_num/ruleset/flags, or the
+   * weight or existence of an osd under one of the pool's rule's roots.
+   * up/down state, primary affinity and pg_temp/primary_temp are applied
+   * on every lookup, so the (frequent) epochs that only change those
+   * reuse the tables as-is.
+   *
+   * Only maps that are otherwise left alone once published should enable
+   * this: the setters below drop the cache, but direct changes to
+   * *crush do not.
+   */
+  struct raw_pg_table_t {
+    static const unsigned CHUNK_BITS = 6;  ///< pgs per allocation: 64
+    Mutex lock;     ///< tables may be shared by several epochs
+    unsigned size;  ///< pool size; each row is [len (-1 if unset), osds]
+    vector<ceph::shared_ptr<vector<int32_t> > > chunks;
+    raw_pg_table_t(unsigned pg_num, unsigned size)
+      : lock("OSDMap::raw_pg_table_t::lock", false, false),
+	size(size),
+	chunks((pg_num + (1 << CHUNK_BITS) - 1) >> CHUNK_BITS) {}
+  };
+  struct pg_mapping_cache_t {
+    Mutex lock;
+    map<int64_t, ceph::shared_ptr<raw_pg_table_t> > pools;
+    pg_mapping_cache_t()
+      : lock("OSDMap::pg_mapping_cache_t::lock", false, false) {}
+  };
+  ceph::shared_ptr<pg_mapping_cache_t> pg_mapping;
+
+  bool _lookup_raw_pg(const pg_pool_t& pool, pg_t pg,
+		      vector<int> *osds) const;
+  void _cache_raw_pg(const pg_pool_t& pool, pg_t pg,
+		     const vector<int>& osds) const;
+  void _invalidate_pg_mapping() {
+    if (pg_mapping)
+      pg_mapping.reset(new pg_mapping_cache_t);
+  }
+  bool _rule_may_map_to(int ruleno, const set<int>& osds) const;
+  void _get_pg_mapping_changes(const Incremental& inc, set<int> *osds,
+			       set<int64_t> *pools) const;
+  void _carry_pg_mapping(const Incremental& inc,
+			 ceph::shared_ptr<pg_mapping_cache_t> old,
+			 const set<int>& osds, const set<int64_t>& pools);
+
  public:
   bool have_crc() const { return crc_defined; }
   uint32_t get_crc() const { return crc; }
@@ -264,9 +347,13 @@ private:
 	     flags(0),
 	     num_osd(0), max_osd(0),
 	     osd_addrs(new addrs_s),
+	     osd_info(new vector<osd_info_t>),
 	     pg_temp(new map<pg_t,vector<int32_t> >),
 	     primary_temp(new map<pg_t,int32_t>),
+	     pools(new map<int64_t,pg_pool_t>),
 	     osd_uuid(new vector<uuid_d>),
+	     osd_xinfo(new vector<osd_xinfo_t>),
+	     blacklist(new ceph::unordered_map<entity_addr_t,utime_t>),
 	     cluster_snapshot_epoch(0),
 	     new_blacklist_entries(false),
 	     crc_defined(false), crc(0),
@@ -291,9 +378,49 @@ public:
     // NOTE: this still references shared entity_addr_t's.
     osd_addrs.reset(new addrs_s(*o.osd_addrs));
 
-    // NOTE: we do not copy crush.  note that apply_incremental will
-    // allocate a new CrushWrapper, though.
+    if (o.osd_primary_affinity)
+      osd_primary_affinity.reset(new vector<__u32>(*o.osd_primary_affinity));
+
+    // NOTE: we do not copy crush.  note that apply_incremental and
+    // decode will allocate a new CrushWrapper, though, so the copy is
+    // not affected when o moves on through them.
+
+    // pools, osd_info, osd_xinfo and blacklist are copy-on-write; they
+    // stay shared until changed (see _cow).
+
+    // copies are usually modified directly; don't share the cache
+    pg_mapping.reset();
+  }
+
+  /// cache raw pg placements for this map (see pg_mapping_cache_t)
+  void enable_pg_mapping_cache() {
+    if (!pg_mapping)
+      pg_mapping.reset(new pg_mapping_cache_t);
+  }
+  bool has_pg_mapping_cache() const {
+    return (bool)pg_mapping;
   }
+  /**
+   * share o's placement cache.  o must be the same epoch as this map
+   * (e.g., this map was just decoded from o's encoding), typically
+   * ahead of apply_incremental() building the next epoch.
+   */
+  void inherit_pg_mapping_cache(const OSDMap& o) {
+    if (o.pg_mapping && o.epoch == epoch && o.fsid == fsid)
+      pg_mapping = o.pg_mapping;
+  }
+  /// number of pgs with a cached placement, over all pools
+  uint64_t get_pg_mapping_cache_size() const;
+
+  /**
+   * approximate heap memory used by this map
+   *
+   * Structures shared with other maps (see _cow and dedup) are counted
+   * once: anything already in seen is skipped, and what we count is
+   * added to it.  Pass the same set for every map in a cache to get
+   * the cache's real footprint, or NULL to count everything.
+   */
+  uint64_t get_mem_usage(set<const void*> *seen) const;
 
   // map info
   const uuid_d& get_fsid() const { return fsid; }
@@ -351,6 +478,8 @@ public:
   }
   void set_state(int o, unsigned s) {
     assert(o < max_osd);
+    if ((osd_state[o] ^ s) & CEPH_OSD_EXISTS)
+      _invalidate_pg_mapping();
     osd_state[o] = s;
   }
   void set_weightf(int o, float w) {
@@ -358,6 +487,7 @@ public:
   }
   void set_weight(int o, unsigned w) {
     assert(o < max_osd);
+    _invalidate_pg_mapping();
     osd_weight[o] = w;
     if (w)
       osd_state[o] |= CEPH_OSD_EXISTS;
@@ -492,24 +622,24 @@ public:
 
   const epoch_t& get_up_from(int osd) const {
     assert(exists(osd));
-    return osd_info[osd].up_from;
+    return (*osd_info)[osd].up_from;
   }
   const epoch_t& get_up_thru(int osd) const {
     assert(exists(osd));
-    return osd_info[osd].up_thru;
+    return (*osd_info)[osd].up_thru;
   }
   const epoch_t& get_down_at(int osd) const {
     assert(exists(osd));
-    return osd_info[osd].down_at;
+    return (*osd_info)[osd].down_at;
   }
   const osd_info_t& get_info(int osd) const {
     assert(osd < max_osd);
-    return osd_info[osd];
+    return (*osd_info)[osd];
   }
 
   const osd_xinfo_t& get_xinfo(int osd) const {
     assert(osd < max_osd);
-    return osd_xinfo[osd];
+    return (*osd_xinfo)[osd];
   }
   
   int get_any_up_osd() const {
@@ -675,8 +805,8 @@ public:
     pg_to_up_acting_osds(pg, &up, &up_primary, &acting, &acting_primary);
   }
   bool pg_is_ec(pg_t pg) const {
-    map<int64_t, pg_pool_t>::const_iterator i = pools.find(pg.pool());
-    assert(i != pools.end());
+    map<int64_t, pg_pool_t>::const_iterator i = pools->find(pg.pool());
+    assert(i != pools->end());
     return i->second.ec_pool();
   }
   bool get_primary_shard(const pg_t& pgid, spg_t *out) const {
@@ -711,7 +841,7 @@ public:
     return pool_max;
   }
   const map<int64_t,pg_pool_t>& get_pools() const {
-    return pools;
+    return *pools;
   }
   const string& get_pool_name(int64_t p) const {
     map<int64_t, string>::const_iterator i = pool_name.find(p);
@@ -719,28 +849,28 @@ public:
     return i->second;
   }
   bool have_pg_pool(int64_t p) const {
-    return pools.count(p);
+    return pools->count(p);
   }
   const pg_pool_t* get_pg_pool(int64_t p) const {
-    map<int64_t, pg_pool_t>::const_iterator i = pools.find(p);
-    if (i != pools.end())
+    map<int64_t, pg_pool_t>::const_iterator i = pools->find(p);
+    if (i != pools->end())
       return &i->second;
     return NULL;
   }
   unsigned get_pg_size(pg_t pg) const {
-    map<int64_t,pg_pool_t>::const_iterator p = pools.find(pg.pool());
-    assert(p != pools.end());
+    map<int64_t,pg_pool_t>::const_iterator p = pools->find(pg.pool());
+    assert(p != pools->end());
     return p->second.get_size();
   }
   int get_pg_type(pg_t pg) const {
-    assert(pools.count(pg.pool()));
-    return pools.find(pg.pool())->second.get_type();
+    assert(pools->count(pg.pool()));
+    return pools->find(pg.pool())->second.get_type();
   }
 
 
   pg_t raw_pg_to_pg(pg_t pg) const {
-    assert(pools.count(pg.pool()));
-    return pools.find(pg.pool())->second.raw_pg_to_pg(pg);
+    assert(pools->count(pg.pool()));
+    return pools->find(pg.pool())->second.raw_pg_to_pg(pg);
   }
 
   // pg -> acting primary osd
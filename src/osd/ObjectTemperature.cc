@@ -0,0 +1,81 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <math.h>
+
+#include "ObjectTemperature.h"
+
+ObjectTemperature::ObjectTemperature(unsigned d, unsigned w, double hl,
+				     utime_t now)
+  : depth(d ? d : 1), width(w ? w : 1), halflife(hl),
+    cells(depth * width, 0),
+    last_decay(now),
+    rate(hl),
+    total(now)
+{
+}
+
+unsigned ObjectTemperature::get_cell(const hobject_t &oid, unsigned row) const
+{
+  // the object hash is already well mixed; fold in the snap (so clones
+  // are distinct) and a per-row seed, then run a murmur3 finalizer.
+  uint32_t h = oid.get_hash() ^ (uint32_t)oid.snap ^
+    ((uint32_t)(oid.snap >> 32) * 0x85ebca6b) ^ ((row + 1) * 0x9e3779b9);
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return row * width + h % width;
+}
+
+void ObjectTemperature::decay(utime_t now)
+{
+  double el = (double)now - (double)last_decay;
+  if (el < halflife / DECAY_STEPS)
+    return;
+  float f = pow(0.5, el / halflife);
+  for (std::vector<float>::iterator p = cells.begin(); p != cells.end(); ++p) {
+    *p *= f;
+    if (*p < .01)
+      *p = 0;
+  }
+  last_decay = now;
+}
+
+void ObjectTemperature::hit(const hobject_t &oid, utime_t now)
+{
+  decay(now);
+  total.hit(now, rate);
+  for (unsigned row = 0; row < depth; ++row)
+    cells[get_cell(oid, row)] += 1.0;
+}
+
+float ObjectTemperature::get(const hobject_t &oid) const
+{
+  float t = cells[get_cell(oid, 0)];
+  for (unsigned row = 1; row < depth; ++row) {
+    float c = cells[get_cell(oid, row)];
+    if (c < t)
+      t = c;
+  }
+  return t;
+}
+
+void ObjectTemperature::dump(Formatter *f) const
+{
+  f->dump_unsigned("depth", depth);
+  f->dump_unsigned("width", width);
+  f->dump_float("halflife", halflife);
+  f->dump_stream("last_decay") << last_decay;
+  f->dump_float("recent_hits", total.val + total.delta);
+}
@@ -0,0 +1,73 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_OBJECTTEMPERATURE_H
+#define CEPH_OSD_OBJECTTEMPERATURE_H
+
+#include <vector>
+
+#include "include/utime.h"
+#include "common/DecayCounter.h"
+#include "common/hobject.h"
+#include "common/Formatter.h"
+
+/**
+ * approximate per-object access temperature
+ *
+ * A count-min sketch of exponentially decayed hit counts: each object
+ * maps to one counter in each of depth rows, and its temperature is
+ * the smallest of those counters, i.e. roughly the number of hits it
+ * has had in the last halflife seconds.  Collisions can only make an
+ * object look hotter than it is.
+ *
+ * Rather than decaying every counter on every hit, the whole sketch is
+ * decayed in one pass once at least halflife/DECAY_STEPS seconds have
+ * passed, so the estimate lags by at most that much.
+ */
+class ObjectTemperature {
+public:
+  static const unsigned DECAY_STEPS = 16;
+
+private:
+  unsigned depth, width;
+  double halflife;
+  std::vector<float> cells;
+  utime_t last_decay;
+  DecayRate rate;
+  DecayCounter total;  ///< all hits, decayed at the same rate
+
+  unsigned get_cell(const hobject_t &oid, unsigned row) const;
+
+public:
+  ObjectTemperature(unsigned depth, unsigned width, double halflife,
+		    utime_t now);
+
+  /// decay counters if it has been long enough since the last pass
+  void decay(utime_t now);
+
+  /// record an access to oid
+  void hit(const hobject_t &oid, utime_t now);
+
+  /// approximate decayed hits for oid (as of the last decay pass)
+  float get(const hobject_t &oid) const;
+
+  double get_total(utime_t now) {
+    return total.get(now, rate);
+  }
+  uint64_t get_mem_usage() const {
+    return cells.size() * sizeof(float);
+  }
+
+  void dump(Formatter *f) const;
+};
+
+#endif
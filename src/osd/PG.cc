@@ -2828,7 +2828,7 @@ void PG::trim_peers()
   }
 }
 
-void PG::add_log_entry(pg_log_entry_t& e, bufferlist& log_bl)
+void PG::add_log_entry(pg_log_entry_t& e, bufferlist *log_bl)
 {
   // raise last_complete only if we were previously up to date
   if (info.last_complete == info.last_update)
@@ -2853,7 +2853,8 @@ void PG::add_log_entry(pg_log_entry_t& e, bufferlist& log_bl)
   pg_log.add(e);
   dout(10) << "add_log_entry " << e << dendl;
 
-  e.encode_with_checksum(log_bl);
+  if (log_bl)
+    e.encode_with_checksum(*log_bl);
 }
 
 
@@ -2868,12 +2869,14 @@ void PG::append_log(
     update_snap_map(logv, t);
   dout(10) << "append_log " << pg_log.get_log() << " " << logv << dendl;
 
+  // the batched format has no per-entry keys; write_if_dirty() below
+  // packs the new entries into a batch
   map<string,bufferlist> keys;
   for (vector<pg_log_entry_t>::iterator p = logv.begin();
        p != logv.end();
        ++p) {
     p->offset = 0;
-    add_log_entry(*p, keys[p->get_key_name()]);
+    add_log_entry(*p, pg_log.uses_batches() ? 0 : &keys[p->get_key_name()]);
   }
 
   PGLogEntryHandler handler;
@@ -2896,7 +2899,8 @@ void PG::append_log(
   }
 
   dout(10) << "append_log  adding " << keys.size() << " keys" << dendl;
-  t.omap_setkeys(coll, pgmeta_oid, keys);
+  if (!keys.empty())
+    t.omap_setkeys(coll, pgmeta_oid, keys);
 
   pg_log.trim(&handler, trim_to, info);
 
@@ -3263,10 +3267,16 @@ void PG::sub_op_scrub_map(OpRequestRef op)
   dout(10) << " got " << m->from << " scrub map" << dendl;
   bufferlist::iterator p = m->get_data().begin();
 
-  scrubber.received_maps[m->from].decode(p, info.pgid.pool());
+  ScrubMap &rmap = scrubber.received_maps[m->from];
+  rmap.decode(p, info.pgid.pool());
   dout(10) << "map version is "
-	     << scrubber.received_maps[m->from].valid_through
+	     << rmap.valid_through
 	     << dendl;
+  if (rmap.is_summary()) {
+    dout(10) << " map is a summary: " << rmap.hash_tree << dendl;
+    scrubber.received_trees[m->from] = rmap.hash_tree;
+    rmap.hash_tree = pg_hash_tree_t();
+  }
 
   --scrubber.waiting_on;
   scrubber.waiting_on_whom.erase(m->from);
@@ -3280,15 +3290,16 @@ void PG::sub_op_scrub_map(OpRequestRef op)
 void PG::_request_scrub_map(
   pg_shard_t replica, eversion_t version,
   hobject_t start, hobject_t end,
-  bool deep, uint32_t seed)
+  bool deep, uint32_t seed, uint8_t hash_tree_depth)
 {
   assert(replica != pg_whoami);
   dout(10) << "scrub  requesting scrubmap from osd." << replica
-	   << " deep " << (int)deep << " seed " << seed << dendl;
+	   << " deep " << (int)deep << " seed " << seed
+	   << " hash_tree_depth " << (int)hash_tree_depth << dendl;
   MOSDRepScrub *repscrubop = new MOSDRepScrub(
     spg_t(info.pgid.pgid, replica.shard), version,
     get_osdmap()->get_epoch(),
-    start, end, deep, seed);
+    start, end, deep, seed, hash_tree_depth);
   osd->send_message_osd_cluster(
     replica.osd, repscrubop, get_osdmap()->get_epoch());
 }
@@ -3614,6 +3625,10 @@ void PG::repair_object(
  * Wait for last_update_applied to match msg->scrub_to as above. Wait
  * for pushes to complete in case of recent recovery. Build a single
  * scrubmap of objects that are in the range [msg->start, msg->end).
+ *
+ * If msg->hash_tree_depth is set, reply with a pg_hash_tree_t summary
+ * instead and keep the map, so a follow-up request for a divergent
+ * sub-range can be answered without scanning again.
  */
 void PG::replica_scrub(
   MOSDRepScrub *msg,
@@ -3646,9 +3661,47 @@ void PG::replica_scrub(
     return;
   }
 
-  build_scrub_map_chunk(
-    map, msg->start, msg->end, msg->deep, msg->seed,
-    handle);
+  ScrubMap &cached = scrubber.cached_map;
+  if (cached.is_summary() &&
+      cached.hash_tree.contains(msg->start) &&
+      msg->end <= cached.hash_tree.end &&
+      cached.valid_through >= msg->scrub_to &&
+      scrubber.cached_deep == msg->deep &&
+      scrubber.cached_seed == msg->seed) {
+    dout(10) << "replica_scrub using cached map for [" << msg->start
+	     << "," << msg->end << ")" << dendl;
+    map.valid_through = cached.valid_through;
+    map.objects.insert(cached.objects.lower_bound(msg->start),
+		       cached.objects.lower_bound(msg->end));
+  } else {
+    build_scrub_map_chunk(
+      map, msg->start, msg->end, msg->deep, msg->seed,
+      handle);
+  }
+  cached = ScrubMap();
+
+  if (msg->hash_tree_depth) {
+    bool read_error = false;
+    for (std::map<hobject_t, ScrubMap::object>::iterator i =
+	   map.objects.begin();
+	 i != map.objects.end() && !read_error;
+	 ++i)
+      read_error = i->second.read_error;
+    if (read_error) {
+      // a summary could hide matching errors on the primary; send it all
+      dout(10) << "replica_scrub read error in chunk, sending full map"
+	       << dendl;
+    } else {
+      map.hash_tree.reset(msg->start, msg->end, msg->hash_tree_depth);
+      map.build_hash_tree(&map.hash_tree);
+      dout(10) << "replica_scrub sending summary " << map.hash_tree << dendl;
+      cached.objects.swap(map.objects);
+      cached.valid_through = map.valid_through;
+      cached.hash_tree = map.hash_tree;
+      scrubber.cached_deep = msg->deep;
+      scrubber.cached_seed = msg->seed;
+    }
+  }
 
   vector<OSDOp> scrub(1);
   scrub[0].op.op = CEPH_OSD_OP_SCRUB_MAP;
@@ -3938,17 +3991,24 @@ void PG::chunky_scrub(ThreadPool::TPHandle &handle)
         scrubber.waiting_on_whom.insert(pg_whoami);
         ++scrubber.waiting_on;
 
-        // request maps from replicas
-	for (set<pg_shard_t>::iterator i = actingbackfill.begin();
-	     i != actingbackfill.end();
-	     ++i) {
-	  if (*i == pg_whoami) continue;
-          _request_scrub_map(*i, scrubber.subset_last_update,
-                             scrubber.start, scrubber.end, scrubber.deep,
-			     scrubber.seed);
-          scrubber.waiting_on_whom.insert(*i);
-          ++scrubber.waiting_on;
-        }
+        // request maps (or hash tree summaries of them) from replicas
+	{
+	  uint8_t hash_tree_depth = 0;
+	  if (cct->_conf->osd_scrub_hash_tree_depth > 0 &&
+	      !pool.info.ec_pool())
+	    hash_tree_depth = MIN(cct->_conf->osd_scrub_hash_tree_depth,
+				  (int)pg_hash_tree_t::MAX_DEPTH);
+	  for (set<pg_shard_t>::iterator i = actingbackfill.begin();
+	       i != actingbackfill.end();
+	       ++i) {
+	    if (*i == pg_whoami) continue;
+	    _request_scrub_map(*i, scrubber.subset_last_update,
+			       scrubber.start, scrubber.end, scrubber.deep,
+			       scrubber.seed, hash_tree_depth);
+	    scrubber.waiting_on_whom.insert(*i);
+	    ++scrubber.waiting_on;
+	  }
+	}
 
         scrubber.state = PG::Scrubber::WAIT_PUSHES;
 
@@ -3999,6 +4059,16 @@ void PG::chunky_scrub(ThreadPool::TPHandle &handle)
           // will be requeued by sub_op_scrub_map
           dout(10) << "wait for replicas to build scrub map" << dendl;
           done = true;
+        } else {
+          scrubber.state = PG::Scrubber::COMPARE_TREES;
+        }
+        break;
+
+      case PG::Scrubber::COMPARE_TREES:
+        scrub_compare_trees();
+        if (scrubber.waiting_on > 0) {
+          // fetching the divergent ranges of summarized replicas
+          scrubber.state = PG::Scrubber::WAIT_REPLICAS;
         } else {
           scrubber.state = PG::Scrubber::COMPARE_MAPS;
         }
@@ -4079,6 +4149,66 @@ void PG::scrub_clear_state()
   _scrub_clear_state();
 }
 
+/*
+ * Compare each replica hash tree summary against a tree built from our
+ * own map over the same range.  The span covering the divergent leaves
+ * is requested in full; once that arrives, our own entries stand in for
+ * the replica's everywhere outside it, since those leaves matched.
+ */
+void PG::scrub_compare_trees()
+{
+  if (!scrubber.received_trees.empty()) {
+    for (map<pg_shard_t, pg_hash_tree_t>::iterator i =
+	   scrubber.received_trees.begin();
+	 i != scrubber.received_trees.end();
+	 ++i) {
+      pg_hash_tree_t mine;
+      mine.reset(i->second.begin, i->second.end, i->second.depth);
+      scrubber.primary_scrubmap.build_hash_tree(&mine);
+
+      vector<pair<hobject_t, hobject_t> > divergent;
+      mine.compare(i->second, &divergent);
+      if (divergent.empty()) {
+	dout(10) << __func__ << " replica " << i->first << " matches "
+		 << mine << dendl;
+	scrubber.divergent_ranges[i->first] = make_pair(hobject_t(),
+							hobject_t());
+	continue;
+      }
+
+      hobject_t start = divergent.front().first;
+      hobject_t end = divergent.back().second;
+      dout(10) << __func__ << " replica " << i->first << " "
+	       << i->second << " differs from " << mine << " in "
+	       << divergent.size() << " ranges, fetching ["
+	       << start << "," << end << ")" << dendl;
+      scrubber.divergent_ranges[i->first] = make_pair(start, end);
+      _request_scrub_map(i->first, scrubber.subset_last_update,
+			 start, end, scrubber.deep, scrubber.seed);
+      scrubber.waiting_on_whom.insert(i->first);
+      ++scrubber.waiting_on;
+    }
+    scrubber.received_trees.clear();
+    if (scrubber.waiting_on > 0)
+      return;
+  }
+
+  for (map<pg_shard_t, pair<hobject_t, hobject_t> >::iterator i =
+	 scrubber.divergent_ranges.begin();
+       i != scrubber.divergent_ranges.end();
+       ++i) {
+    ScrubMap &rmap = scrubber.received_maps[i->first];
+    for (map<hobject_t, ScrubMap::object>::iterator p =
+	   scrubber.primary_scrubmap.objects.begin();
+	 p != scrubber.primary_scrubmap.objects.end();
+	 ++p) {
+      if (p->first < i->second.first || p->first >= i->second.second)
+	rmap.objects.insert(*p);
+    }
+  }
+  scrubber.divergent_ranges.clear();
+}
+
 void PG::scrub_compare_maps() 
 {
   dout(10) << __func__ << " has maps, analyzing" << dendl;
@@ -6182,6 +6312,10 @@ PG::RecoveryState::Clean::Clean(my_context ctx)
   pg->finish_recovery(*context< RecoveryMachine >().get_on_safe_context_list());
   pg->mark_clean();
 
+  // nothing to recover, so the per-object log index can go until the
+  // next peering or recovery lookup needs it
+  pg->pg_log.unindex_objects();
+
   pg->share_pg_info();
   pg->publish_stats_to_osd();
 
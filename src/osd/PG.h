@@ -1032,7 +1032,8 @@ public:
       num_digest_updates_pending(0),
       state(INACTIVE),
       deep(false),
-      seed(0)
+      seed(0),
+      cached_deep(false), cached_seed(0)
     {
     }
 
@@ -1081,6 +1082,7 @@ public:
       WAIT_LAST_UPDATE,
       BUILD_MAP,
       WAIT_REPLICAS,
+      COMPARE_TREES,
       COMPARE_MAPS,
       WAIT_DIGEST_UPDATES,
       FINISH,
@@ -1090,6 +1092,17 @@ public:
     bool deep;
     uint32_t seed;
 
+    // hash tree summaries received in place of replica maps, and the
+    // range each such replica was then asked to send in full
+    map<pg_shard_t, pg_hash_tree_t> received_trees;
+    map<pg_shard_t, pair<hobject_t, hobject_t> > divergent_ranges;
+
+    // replica: the chunk map behind the last summary we sent, so that the
+    // primary can drill into divergent ranges without a rescan
+    ScrubMap cached_map;
+    bool cached_deep;
+    uint32_t cached_seed;
+
     list<Context*> callbacks;
     void add_callback(Context *context) {
       callbacks.push_back(context);
@@ -1114,6 +1127,7 @@ public:
         case WAIT_LAST_UPDATE: ret = "WAIT_LAST_UPDATE"; break;
         case BUILD_MAP: ret = "BUILD_MAP"; break;
         case WAIT_REPLICAS: ret = "WAIT_REPLICAS"; break;
+        case COMPARE_TREES: ret = "COMPARE_TREES"; break;
         case COMPARE_MAPS: ret = "COMPARE_MAPS"; break;
         case WAIT_DIGEST_UPDATES: ret = "WAIT_DIGEST_UPDATES"; break;
         case FINISH: ret = "FINISH"; break;
@@ -1167,6 +1181,11 @@ public:
       authoritative.clear();
       missing_digest.clear();
       num_digest_updates_pending = 0;
+      received_trees.clear();
+      divergent_ranges.clear();
+      cached_map = ScrubMap();
+      cached_deep = false;
+      cached_seed = 0;
     }
 
   } scrubber;
@@ -1182,6 +1201,7 @@ public:
 
   void scrub(ThreadPool::TPHandle &handle);
   void chunky_scrub(ThreadPool::TPHandle &handle);
+  void scrub_compare_trees();
   void scrub_compare_maps();
   void scrub_process_inconsistent();
   void scrub_finish();
@@ -1192,7 +1212,7 @@ public:
     ThreadPool::TPHandle &handle);
   void _request_scrub_map(pg_shard_t replica, eversion_t version,
                           hobject_t start, hobject_t end, bool deep,
-			  uint32_t seed);
+			  uint32_t seed, uint8_t hash_tree_depth = 0);
   int build_scrub_map_chunk(
     ScrubMap &map,
     hobject_t start, hobject_t end, bool deep, uint32_t seed,
@@ -2121,7 +2141,7 @@ public:
     return at_version;
   }
 
-  void add_log_entry(pg_log_entry_t& e, bufferlist& log_bl);
+  void add_log_entry(pg_log_entry_t& e, bufferlist *log_bl);
   void append_log(
     vector<pg_log_entry_t>& logv,
     eversion_t trim_to,
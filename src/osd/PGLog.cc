@@ -141,9 +141,68 @@ void PGLog::clear() {
   missing.clear();
   log.clear();
   log_keys_debug.clear();
+  log_batches.clear();
+  log_batched = false;
+  batched_to = eversion_t();
   undirty();
 }
 
+// rough per-node overhead of the std/unordered containers (pointers
+// plus malloc header)
+static const uint64_t CONTAINER_NODE_OVERHEAD = 4 * sizeof(void*);
+
+static uint64_t hobject_extra_bytes(const hobject_t &oid)
+{
+  return oid.oid.name.length() + oid.get_key().length() +
+    oid.get_namespace().length();
+}
+
+void PGLog::mem_usage_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("entries", entries);
+  f->dump_unsigned("log_bytes", log_bytes);
+  f->dump_unsigned("index_bytes", index_bytes);
+  f->dump_unsigned("missing_items", missing_items);
+  f->dump_unsigned("missing_bytes", missing_bytes);
+  f->dump_unsigned("total_bytes", total_bytes());
+}
+
+void PGLog::get_mem_usage(mem_usage_t *usage) const
+{
+  for (list<pg_log_entry_t>::const_iterator i = log.log.begin();
+       i != log.log.end();
+       ++i) {
+    ++usage->entries;
+    usage->log_bytes += sizeof(*i) + CONTAINER_NODE_OVERHEAD +
+      hobject_extra_bytes(i->soid) + i->snaps.length() +
+      i->mod_desc.bl.length();
+  }
+  uint64_t index_node = sizeof(pg_log_entry_t*) + CONTAINER_NODE_OVERHEAD;
+  for (ceph::unordered_map<hobject_t,pg_log_entry_t*>::const_iterator i =
+	 log.objects.begin();
+       i != log.objects.end();
+       ++i)
+    usage->index_bytes += sizeof(hobject_t) + index_node +
+      hobject_extra_bytes(i->first);
+  usage->index_bytes += log.caller_ops.size() *
+    (sizeof(osd_reqid_t) + index_node);
+
+  for (map<hobject_t, pg_missing_t::item>::const_iterator i =
+	 missing.missing.begin();
+       i != missing.missing.end();
+       ++i) {
+    ++usage->missing_items;
+    usage->missing_bytes += sizeof(*i) + CONTAINER_NODE_OVERHEAD +
+      hobject_extra_bytes(i->first);
+  }
+  for (map<version_t, hobject_t>::const_iterator i =
+	 missing.rmissing.begin();
+       i != missing.rmissing.end();
+       ++i)
+    usage->missing_bytes += sizeof(*i) + CONTAINER_NODE_OVERHEAD +
+      hobject_extra_bytes(i->second);
+}
+
 void PGLog::clear_info_log(
   spg_t pgid,
   ObjectStore::Transaction *t) {
@@ -347,6 +406,7 @@ void PGLog::_merge_object_divergent_entries(
 	   << " last_divergent_update: " << last_divergent_update
 	   << dendl;
 
+  log.index_objects();
   ceph::unordered_map<hobject_t, pg_log_entry_t*>::const_iterator objiter =
     log.objects.find(hoid);
   if (objiter != log.objects.end() &&
@@ -691,16 +751,43 @@ void PGLog::write_log(
 	     << ", dirty_divergent_priors: " << dirty_divergent_priors
 	     << ", writeout_from: " << writeout_from
 	     << ", trimmed: " << trimmed
+	     << ", batched: " << log_batched << " -> " << use_batches
 	     << dendl;
-    _write_log(
-      t, log, coll, log_oid, divergent_priors,
-      dirty_to,
-      dirty_from,
-      writeout_from,
-      trimmed,
-      dirty_divergent_priors,
-      !touched_log,
-      (pg_log_debug ? &log_keys_debug : 0));
+    if (use_batches) {
+      _write_log_batched(
+	t, log, coll, log_oid, divergent_priors,
+	dirty_to,
+	dirty_from,
+	writeout_from,
+	dirty_divergent_priors,
+	!touched_log,
+	log_batched,
+	batch_max_entries,
+	&log_batches,
+	&batched_to);
+      log_keys_debug.clear();
+    } else {
+      if (log_batched)
+	mark_log_for_rewrite();
+      _write_log(
+	t, log, coll, log_oid, divergent_priors,
+	dirty_to,
+	dirty_from,
+	writeout_from,
+	trimmed,
+	dirty_divergent_priors,
+	!touched_log,
+	(pg_log_debug ? &log_keys_debug : 0));
+      if (log_batched) {
+	// drop the batches the full rewrite above replaces
+	t.omap_rmkeyrange(
+	  coll, log_oid,
+	  get_batch_key_name(eversion_t()),
+	  get_batch_key_name(eversion_t::max()));
+	log_batches.clear();
+      }
+    }
+    log_batched = use_batches;
     undirty();
   } else {
     dout(10) << "log is not dirty" << dendl;
@@ -799,6 +886,184 @@ void PGLog::_write_log(
   t.omap_setkeys(coll, log_oid, keys);
 }
 
+void PGLog::encode_batch(
+  const pg_log_t &log,
+  eversion_t first,
+  list<pg_log_entry_t>::const_iterator begin,
+  list<pg_log_entry_t>::const_iterator end,
+  bufferlist &bl)
+{
+  bufferlist ebl;
+  __u32 n = 0;
+  for (list<pg_log_entry_t>::const_iterator p = begin; p != end; ++p)
+    ++n;
+  ::encode(n, ebl);
+  for (list<pg_log_entry_t>::const_iterator p = begin; p != end; ++p)
+    p->encode(ebl);
+
+  ENCODE_START(1, 1, bl);
+  ::encode(first, bl);
+  ::encode(log.can_rollback_to, bl);
+  ::encode(log.rollback_info_trimmed_to, bl);
+  ::encode(ebl, bl);
+  ::encode(ebl.crc32c(0), bl);
+  ENCODE_FINISH(bl);
+}
+
+unsigned PGLog::decode_batch(
+  bufferlist::iterator &p, eversion_t tail, pg_log_t &log, eversion_t *first)
+{
+  bufferlist ebl;
+  __u32 crc;
+  DECODE_START(1, p);
+  ::decode(*first, p);
+  ::decode(log.can_rollback_to, p);
+  ::decode(log.rollback_info_trimmed_to, p);
+  ::decode(ebl, p);
+  ::decode(crc, p);
+  DECODE_FINISH(p);
+  if (crc != ebl.crc32c(0))
+    throw buffer::malformed_input("bad checksum on pg log batch");
+
+  bufferlist::iterator q = ebl.begin();
+  __u32 n;
+  ::decode(n, q);
+  unsigned kept = 0;
+  while (n--) {
+    pg_log_entry_t e;
+    e.decode(q);
+    // entries up to the tail were trimmed but share a batch with live ones
+    if (e.version <= tail)
+      continue;
+    if (!log.log.empty()) {
+      assert(log.log.back().version.version < e.version.version);
+      assert(log.log.back().version.epoch <= e.version.epoch);
+    }
+    log.log.push_back(e);
+    ++kept;
+  }
+  return kept;
+}
+
+/// pack [p, log end) into keys, batch_max_entries at a time
+static void _write_batches(
+  const pg_log_t &log,
+  list<pg_log_entry_t>::const_iterator p,
+  eversion_t first,
+  unsigned batch_max_entries,
+  map<string, bufferlist> &keys,
+  set<eversion_t> *log_batches)
+{
+  if (batch_max_entries == 0)
+    batch_max_entries = 1;
+  do {
+    list<pg_log_entry_t>::const_iterator q = p;
+    for (unsigned n = 0; q != log.log.end() && n < batch_max_entries; ++n)
+      ++q;
+    if (p != log.log.end())
+      first = p->version;
+    PGLog::encode_batch(log, first, p, q,
+			keys[PGLog::get_batch_key_name(first)]);
+    log_batches->insert(first);
+    p = q;
+  } while (p != log.log.end());
+}
+
+void PGLog::_write_log_batched(
+  ObjectStore::Transaction& t, pg_log_t &log,
+  const coll_t& coll, const ghobject_t &log_oid,
+  map<eversion_t, hobject_t> &divergent_priors,
+  eversion_t dirty_to,
+  eversion_t dirty_from,
+  eversion_t writeout_from,
+  bool dirty_divergent_priors,
+  bool touch_log,
+  bool was_batched,
+  unsigned batch_max_entries,
+  set<eversion_t> *log_batches,
+  eversion_t *batched_to
+  )
+{
+  if (touch_log)
+    t.touch(coll, log_oid);
+
+  map<string,bufferlist> keys;
+  if (!was_batched || dirty_to != eversion_t() || log_batches->empty()) {
+    // rewrite everything, dropping entries in either format
+    t.omap_rmkeyrange(
+      coll, log_oid,
+      eversion_t().get_key_name(), eversion_t::max().get_key_name());
+    t.omap_rmkeyrange(
+      coll, log_oid,
+      get_batch_key_name(eversion_t()), get_batch_key_name(eversion_t::max()));
+    if (!was_batched) {
+      set<string> old_keys;
+      old_keys.insert("can_rollback_to");
+      old_keys.insert("rollback_info_trimmed_to");
+      t.omap_rmkeys(coll, log_oid, old_keys);
+    }
+    log_batches->clear();
+    _write_batches(log, log.log.begin(), log.head, batch_max_entries,
+		   keys, log_batches);
+  } else {
+    // drop the leading batches whose entries have all been trimmed; the
+    // last batch always stays since its header is authoritative
+    eversion_t first_kept = log.log.empty() ?
+      eversion_t::max() : log.log.begin()->version;
+    set<eversion_t>::iterator keep = log_batches->begin();
+    while (true) {
+      set<eversion_t>::iterator next = keep;
+      ++next;
+      if (next == log_batches->end() || *next > first_kept)
+	break;
+      keep = next;
+    }
+    if (keep != log_batches->begin()) {
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	get_batch_key_name(*log_batches->begin()), get_batch_key_name(*keep));
+      log_batches->erase(log_batches->begin(), keep);
+    }
+
+    eversion_t from = MIN(dirty_from, writeout_from);
+    eversion_t start;
+    if (from == eversion_t::max()) {
+      // nothing new; refresh the header in the last batch
+      start = *log_batches->rbegin();
+    } else if (from > *batched_to) {
+      // pure append
+      start = from;
+    } else {
+      // rewriting entries already on disk: restart at their batch
+      set<eversion_t>::iterator b = log_batches->upper_bound(from);
+      if (b != log_batches->begin())
+	--b;
+      start = MIN(*b, from);
+    }
+    if (start <= *log_batches->rbegin()) {
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	get_batch_key_name(start), get_batch_key_name(eversion_t::max()));
+      log_batches->erase(log_batches->lower_bound(start), log_batches->end());
+    }
+
+    list<pg_log_entry_t>::const_iterator p = log.log.end();
+    while (p != log.log.begin()) {
+      --p;
+      if (p->version < start) {
+	++p;
+	break;
+      }
+    }
+    _write_batches(log, p, start, batch_max_entries, keys, log_batches);
+  }
+  *batched_to = log.head;
+
+  if (dirty_divergent_priors)
+    ::encode(divergent_priors, keys["divergent_priors"]);
+  t.omap_setkeys(coll, log_oid, keys);
+}
+
 void PGLog::read_log(ObjectStore *store, coll_t pg_coll,
 		     coll_t log_coll,
 		    ghobject_t log_oid,
@@ -807,7 +1072,9 @@ void PGLog::read_log(ObjectStore *store, coll_t pg_coll,
 		    IndexedLog &log,
 		    pg_missing_t &missing,
 		    ostringstream &oss,
-		    set<string> *log_keys_debug)
+		    set<string> *log_keys_debug,
+		    set<eversion_t> *log_batches,
+		    bool *stale_keys)
 {
   dout(20) << "read_log coll " << pg_coll << " log_oid " << log_oid << dendl;
 
@@ -821,6 +1088,10 @@ void PGLog::read_log(ObjectStore *store, coll_t pg_coll,
   // will get overridden below if it had been recorded
   log.can_rollback_to = info.last_update;
   log.rollback_info_trimmed_to = eversion_t();
+  // per-entry keys, kept apart from the batches: if both are present
+  // the per-entry keys are leftovers and the batches are authoritative
+  list<pg_log_entry_t> entries;
+  bool batched = false;
   ObjectMap::ObjectMapIterator p = store->get_omap_iterator(log_coll, log_oid);
   if (p) {
     for (p->seek_to_first(); p->valid() ; p->next()) {
@@ -840,22 +1111,43 @@ void PGLog::read_log(ObjectStore *store, coll_t pg_coll,
 	bufferlist bl = p->value();
 	bufferlist::iterator bp = bl.begin();
 	::decode(log.rollback_info_trimmed_to, bp);
+      } else if (is_batch_key_name(p->key())) {
+	eversion_t first;
+	unsigned n = decode_batch(bp, info.log_tail, log, &first);
+	dout(20) << "read_log batch " << p->key() << " " << n
+		 << " live entries" << dendl;
+	if (log_batches)
+	  log_batches->insert(first);
+	batched = true;
       } else {
 	pg_log_entry_t e;
 	e.decode_with_checksum(bp);
 	dout(20) << "read_log " << e << dendl;
-	if (!log.log.empty()) {
-	  pg_log_entry_t last_e(log.log.back());
+	if (!entries.empty()) {
+	  pg_log_entry_t last_e(entries.back());
 	  assert(last_e.version.version < e.version.version);
 	  assert(last_e.version.epoch <= e.version.epoch);
 	}
-	log.log.push_back(e);
-	log.head = e.version;
-	if (log_keys_debug)
-	  log_keys_debug->insert(e.get_key_name());
+	entries.push_back(e);
       }
     }
   }
+  if (batched) {
+    if (!entries.empty()) {
+      dout(0) << "read_log ignoring " << entries.size()
+	      << " per-entry keys shadowed by batches" << dendl;
+      if (stale_keys)
+	*stale_keys = true;
+    }
+  } else {
+    for (list<pg_log_entry_t>::iterator i = entries.begin();
+	 i != entries.end();
+	 ++i) {
+      if (log_keys_debug)
+	log_keys_debug->insert(i->get_key_name());
+    }
+    log.log.swap(entries);
+  }
   log.head = info.last_update;
   log.index();
 
@@ -55,7 +55,14 @@ struct PGLog {
    * plus some methods to manipulate it all.
    */
   struct IndexedLog : public pg_log_t {
-    ceph::unordered_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
+    /**
+     * objects indexes the newest entry for each object.  It is only
+     * needed by peering and recovery, so a clean pg may drop it with
+     * unindex_objects(); it is rebuilt on the next lookup through
+     * logged_object() or get_object_entry().
+     */
+    mutable ceph::unordered_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
+    mutable bool objects_indexed;
     ceph::unordered_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
 
     // recovery pointers
@@ -77,6 +84,7 @@ struct PGLog {
 
     /****/
     IndexedLog() :
+      objects_indexed(true),
       complete_to(log.end()),
       last_requested(0),
       rollback_info_trimmed_to_riter(log.rbegin())
@@ -120,8 +128,18 @@ struct PGLog {
     }
 
     bool logged_object(const hobject_t& oid) const {
+      index_objects();
       return objects.count(oid);
     }
+    /// @return newest entry for oid, or NULL if it is not in the log
+    const pg_log_entry_t *get_object_entry(const hobject_t &oid) const {
+      index_objects();
+      ceph::unordered_map<hobject_t,pg_log_entry_t*>::const_iterator p =
+	objects.find(oid);
+      if (p == objects.end())
+	return NULL;
+      return p->second;
+    }
     bool logged_req(const osd_reqid_t &r) const {
       return caller_ops.count(r);
     }
@@ -132,13 +150,32 @@ struct PGLog {
       return p->second;
     }
 
+    /// (re)build the object index if it was dropped
+    void index_objects() const {
+      if (objects_indexed)
+	return;
+      objects.clear();
+      for (list<pg_log_entry_t>::const_iterator i = log.begin();
+	   i != log.end();
+	   ++i)
+	objects[i->soid] = const_cast<pg_log_entry_t*>(&(*i));
+      objects_indexed = true;
+    }
+    /// drop the object index until it is next needed
+    void unindex_objects() {
+      ceph::unordered_map<hobject_t,pg_log_entry_t*> empty;
+      objects.swap(empty);
+      objects_indexed = false;
+    }
+
     void index() {
       objects.clear();
       caller_ops.clear();
       for (list<pg_log_entry_t>::iterator i = log.begin();
            i != log.end();
            ++i) {
-        objects[i->soid] = &(*i);
+	if (objects_indexed)
+	  objects[i->soid] = &(*i);
 	if (i->reqid_is_indexed()) {
 	  //assert(caller_ops.count(i->reqid) == 0);  // divergent merge_log indexes new before unindexing old
 	  caller_ops[i->reqid] = &(*i);
@@ -152,8 +189,9 @@ struct PGLog {
     }
 
     void index(pg_log_entry_t& e) {
-      if (objects.count(e.soid) == 0 || 
-          objects[e.soid]->version < e.version)
+      if (objects_indexed &&
+	  (objects.count(e.soid) == 0 ||
+	   objects[e.soid]->version < e.version))
         objects[e.soid] = &e;
       if (e.reqid_is_indexed()) {
 	//assert(caller_ops.count(i->reqid) == 0);  // divergent merge_log indexes new before unindexing old
@@ -166,7 +204,8 @@ struct PGLog {
     }
     void unindex(pg_log_entry_t& e) {
       // NOTE: this only works if we remove from the _tail_ of the log!
-      if (objects.count(e.soid) && objects[e.soid]->version == e.version)
+      if (objects_indexed &&
+	  objects.count(e.soid) && objects[e.soid]->version == e.version)
         objects.erase(e.soid);
       if (e.reqid_is_indexed() &&
 	  caller_ops.count(e.reqid) &&  // divergent merge_log indexes new before unindexing old
@@ -188,7 +227,8 @@ struct PGLog {
       head = e.version;
 
       // to our index
-      objects[e.soid] = &(log.back());
+      if (objects_indexed)
+	objects[e.soid] = &(log.back());
       if (e.reqid_is_indexed())
 	caller_ops[e.reqid] = &(log.back());
     }
@@ -219,6 +259,22 @@ protected:
   bool dirty_divergent_priors;
   CephContext *cct;
 
+  /**
+   * Batched log format (osd_pg_log_batched)
+   *
+   * Rather than one omap key per entry, each write_log() packs the
+   * entries it writes out, along with can_rollback_to and
+   * rollback_info_trimmed_to, into a single "batch_<first version>" key.
+   * Trimming removes whole batches with one key range removal; a batch
+   * still holding trimmed entries is left alone and those entries are
+   * skipped on read.  The header of the last batch is authoritative.
+   */
+  bool use_batches;            ///< write the log in the batched format
+  bool log_batched;            ///< on-disk log is in the batched format
+  set<eversion_t> log_batches; ///< first version of each batch on disk
+  eversion_t batched_to;       ///< newest entry version on disk
+  unsigned batch_max_entries;  ///< batch size when rewriting the log
+
   bool is_dirty() const {
     return !touched_log ||
       (dirty_to != eversion_t()) ||
@@ -244,6 +300,8 @@ protected:
     dirty_divergent_priors = true;
   }
 public:
+  /// true if new entries are only written by write_log(), in batches
+  bool uses_batches() const { return use_batches; }
   void mark_log_for_rewrite() {
     mark_dirty_to(eversion_t::max());
     mark_dirty_from(eversion_t());
@@ -268,7 +326,7 @@ protected:
 	 log_keys_debug->erase(i++));
   }
   void check() {
-    if (!pg_log_debug)
+    if (!pg_log_debug || log_batched)
       return;
     assert(log.log.size() == log_keys_debug.size());
     for (list<pg_log_entry_t>::iterator i = log.log.begin();
@@ -292,7 +350,10 @@ public:
     pg_log_debug(!(cct && !(cct->_conf->osd_debug_pg_log_writeout))),
     touched_log(false), dirty_from(eversion_t::max()),
     writeout_from(eversion_t::max()),
-    dirty_divergent_priors(false), cct(cct) {}
+    dirty_divergent_priors(false), cct(cct),
+    use_batches(cct && cct->_conf->osd_pg_log_batched),
+    log_batched(false),
+    batch_max_entries(cct ? cct->_conf->osd_pg_log_batch_max_entries : 128) {}
 
 
   void reset_backfill();
@@ -349,6 +410,38 @@ public:
 
   void unindex() { log.unindex(); }
 
+  /// drop the per-object index while it is not needed (e.g., pg is clean)
+  void unindex_objects() { log.unindex_objects(); }
+
+  /**
+   * approximate memory consumed by the in-memory log, its indexes and
+   * the missing set.  this is only an estimate: it counts the size of
+   * each element, its variable length members and a per-node overhead
+   * for the containers, but not allocator slack.
+   */
+  struct mem_usage_t {
+    uint64_t entries;
+    uint64_t log_bytes;
+    uint64_t index_bytes;
+    uint64_t missing_items;
+    uint64_t missing_bytes;
+    mem_usage_t()
+      : entries(0), log_bytes(0), index_bytes(0),
+	missing_items(0), missing_bytes(0) {}
+    uint64_t total_bytes() const {
+      return log_bytes + index_bytes + missing_bytes;
+    }
+    void add(const mem_usage_t &o) {
+      entries += o.entries;
+      log_bytes += o.log_bytes;
+      index_bytes += o.index_bytes;
+      missing_items += o.missing_items;
+      missing_bytes += o.missing_bytes;
+    }
+    void dump(Formatter *f) const;
+  };
+  void get_mem_usage(mem_usage_t *usage) const;
+
   void add(pg_log_entry_t& e) {
     mark_writeout_from(e.version);
     log.add(e);
@@ -561,13 +654,53 @@ public:
     set<string> *log_keys_debug
     );
 
+  static string get_batch_key_name(eversion_t first) {
+    return "batch_" + first.get_key_name();
+  }
+  static bool is_batch_key_name(const string &key) {
+    return key.compare(0, 6, "batch_") == 0;
+  }
+  static void encode_batch(
+    const pg_log_t &log,
+    eversion_t first,
+    list<pg_log_entry_t>::const_iterator begin,
+    list<pg_log_entry_t>::const_iterator end,
+    bufferlist &bl);
+  /// @return number of live (untrimmed) entries appended to log
+  static unsigned decode_batch(
+    bufferlist::iterator &p, eversion_t tail, pg_log_t &log,
+    eversion_t *first);
+
+  static void _write_log_batched(
+    ObjectStore::Transaction& t, pg_log_t &log,
+    const coll_t& coll, const ghobject_t &log_oid,
+    map<eversion_t, hobject_t> &divergent_priors,
+    eversion_t dirty_to,
+    eversion_t dirty_from,
+    eversion_t writeout_from,
+    bool dirty_divergent_priors,
+    bool touch_log,
+    bool was_batched,
+    unsigned batch_max_entries,
+    set<eversion_t> *log_batches,
+    eversion_t *batched_to
+    );
+
   void read_log(ObjectStore *store, coll_t pg_coll,
 		coll_t log_coll, ghobject_t log_oid,
 		const pg_info_t &info, ostringstream &oss) {
-    return read_log(
+    bool stale_keys = false;
+    read_log(
       store, pg_coll, log_coll, log_oid, info, divergent_priors,
       log, missing, oss,
-      (pg_log_debug ? &log_keys_debug : 0));
+      (pg_log_debug ? &log_keys_debug : 0),
+      &log_batches, &stale_keys);
+    log_batched = !log_batches.empty();
+    batched_to = log.log.empty() ? log.tail : log.log.rbegin()->version;
+    if (log_batched)
+      log_keys_debug.clear();
+    if (stale_keys)
+      mark_log_for_rewrite();  // drops the stale per-entry keys
   }
 
   static void read_log(ObjectStore *store, coll_t pg_coll,
@@ -575,7 +708,9 @@ public:
     const pg_info_t &info, map<eversion_t, hobject_t> &divergent_priors,
     IndexedLog &log,
     pg_missing_t &missing, ostringstream &oss,
-    set<string> *log_keys_debug = 0
+    set<string> *log_keys_debug = 0,
+    set<eversion_t> *log_batches = 0,
+    bool *stale_keys = 0  ///< [out] per-entry keys were shadowed by batches
     );
 };
   
@@ -236,7 +236,9 @@ void ReplicatedPG::on_local_recover(
   if (pg_log.get_missing().is_missing(recovery_info.soid) &&
       pg_log.get_missing().missing.find(recovery_info.soid)->second.need > recovery_info.version) {
     assert(is_primary());
-    const pg_log_entry_t *latest = pg_log.get_log().objects.find(recovery_info.soid)->second;
+    const pg_log_entry_t *latest =
+      pg_log.get_log().get_object_entry(recovery_info.soid);
+    assert(latest);
     if (latest->op == pg_log_entry_t::LOST_REVERT &&
 	latest->reverting_to == recovery_info.version) {
       dout(10) << " got old revert version " << recovery_info.version
@@ -1233,6 +1235,7 @@ ReplicatedPG::ReplicatedPG(OSDService *o, OSDMapRef curmap,
   pgbackend(
     PGBackend::build_pg_backend(
       _pool.info, curmap, this, coll_t(p), coll_t::make_temp_coll(p), o->store, cct)),
+  object_contexts(o->cct, o->cct->_conf->osd_pg_object_context_cache_count),
   snapset_contexts_lock("ReplicatedPG::snapset_contexts"),
   new_backfill(false),
   temp_seq(0),
@@ -1538,6 +1541,12 @@ void ReplicatedPG::do_op(OpRequestRef& op)
   }
 
   if (agent_state) {
+    if (agent_state->temperature) {
+      if (missing_oid != hobject_t())
+	agent_state->temperature->hit(missing_oid, m->get_recv_stamp());
+      else if (obc)
+	agent_state->temperature->hit(obc->obs.oi.soid, m->get_recv_stamp());
+    }
     agent_choose_mode();
   }
 
@@ -1784,7 +1793,20 @@ bool ReplicatedPG::maybe_handle_cache(OpRequestRef op,
     if (!must_promote && can_skip_promote(op, obc)) {
       return false;
     }
-    if (op->may_write() || write_ordered || must_promote || !hit_set) {
+    if (op->may_write() || write_ordered || must_promote) {
+      promote_object(op, obc, missing_oid);
+    } else if (agent_state && agent_state->temperature &&
+	       cct->_conf->osd_tier_promote_min_temp > 0) {
+      float temp = agent_state->temperature->get(missing_oid);
+      if (temp >= cct->_conf->osd_tier_promote_min_temp) {
+	promote_object(op, obc, missing_oid);
+      } else {
+	dout(20) << __func__ << " " << missing_oid << " temp " << temp
+		 << " too cold to promote, redirecting read" << dendl;
+	osd->logger->inc(l_osd_tier_promote_skip);
+	do_cache_redirect(op, obc);
+      }
+    } else if (!hit_set) {
       promote_object(op, obc, missing_oid);
     } else {
       switch (pool.info.min_read_recency_for_promote) {
@@ -1796,6 +1818,7 @@ bool ReplicatedPG::maybe_handle_cache(OpRequestRef op,
         if (in_hit_set) {
           promote_object(op, obc, missing_oid);
         } else {
+	  osd->logger->inc(l_osd_tier_promote_skip);
           do_cache_redirect(op, obc);
         }
         break;
@@ -1815,6 +1838,7 @@ bool ReplicatedPG::maybe_handle_cache(OpRequestRef op,
           if (in_other_hit_sets) {
             promote_object(op, obc, missing_oid);
           } else {
+	    osd->logger->inc(l_osd_tier_promote_skip);
             do_cache_redirect(op, obc);
           }
         }
@@ -7592,10 +7616,10 @@ void ReplicatedPG::populate_obc_watchers(ObjectContextRef obc)
   assert(is_active());
   assert((recovering.count(obc->obs.oi.soid) ||
 	  !is_missing_object(obc->obs.oi.soid)) ||
-	 (pg_log.get_log().objects.count(obc->obs.oi.soid) && // or this is a revert... see recover_primary()
-	  pg_log.get_log().objects.find(obc->obs.oi.soid)->second->op ==
+	 (pg_log.get_log().logged_object(obc->obs.oi.soid) && // or this is a revert... see recover_primary()
+	  pg_log.get_log().get_object_entry(obc->obs.oi.soid)->op ==
 	    pg_log_entry_t::LOST_REVERT &&
-	  pg_log.get_log().objects.find(obc->obs.oi.soid)->second->reverting_to ==
+	  pg_log.get_log().get_object_entry(obc->obs.oi.soid)->reverting_to ==
 	    obc->obs.oi.version));
 
   dout(10) << "populate_obc_watchers " << obc->obs.oi.soid << dendl;
@@ -7718,11 +7742,13 @@ ObjectContextRef ReplicatedPG::get_object_context(const hobject_t& soid,
   assert(
     attrs || !pg_log.get_missing().is_missing(soid) ||
     // or this is a revert... see recover_primary()
-    (pg_log.get_log().objects.count(soid) &&
-      pg_log.get_log().objects.find(soid)->second->op ==
+    (pg_log.get_log().logged_object(soid) &&
+      pg_log.get_log().get_object_entry(soid)->op ==
       pg_log_entry_t::LOST_REVERT));
   ObjectContextRef obc = object_contexts.lookup(soid);
+  osd->logger->inc(l_osd_object_ctx_cache_total);
   if (obc) {
+    osd->logger->inc(l_osd_object_ctx_cache_hit);
     dout(10) << __func__ << ": found obc in cache: " << obc
 	     << dendl;
   } else {
@@ -7811,6 +7837,8 @@ void ReplicatedPG::context_registry_on_change()
       }
     }
   }
+  // the cached contexts may be stale once another osd has been primary
+  object_contexts.clear();
 }
 
 
@@ -8557,11 +8585,11 @@ void ReplicatedBackend::prepare_pull(
 	     << " at version " << pmissing.missing.find(soid)->second.have
 	     << " rather than at version " << v << dendl;
     v = pmissing.missing.find(soid)->second.have;
-    assert(get_parent()->get_log().get_log().objects.count(soid) &&
-	   (get_parent()->get_log().get_log().objects.find(soid)->second->op ==
+    assert(get_parent()->get_log().get_log().logged_object(soid) &&
+	   (get_parent()->get_log().get_log().get_object_entry(soid)->op ==
 	    pg_log_entry_t::LOST_REVERT) &&
-	   (get_parent()->get_log().get_log().objects.find(
-	     soid)->second->reverting_to ==
+	   (get_parent()->get_log().get_log().get_object_entry(
+	     soid)->reverting_to ==
 	    v));
   }
   
@@ -10439,7 +10467,7 @@ int ReplicatedPG::recover_primary(int max, ThreadPool::TPHandle &handle)
   dout(25) << "recover_primary " << missing.missing << dendl;
 
   // look at log!
-  pg_log_entry_t *latest = 0;
+  const pg_log_entry_t *latest = 0;
   int started = 0;
   int skipped = 0;
 
@@ -10451,8 +10479,8 @@ int ReplicatedPG::recover_primary(int max, ThreadPool::TPHandle &handle)
     hobject_t soid;
     version_t v = p->first;
 
-    if (pg_log.get_log().objects.count(p->second)) {
-      latest = pg_log.get_log().objects.find(p->second)->second;
+    latest = pg_log.get_log().get_object_entry(p->second);
+    if (latest) {
       assert(latest->is_update());
       soid = latest->soid;
     } else {
@@ -11728,6 +11756,17 @@ void ReplicatedPG::agent_setup()
     dout(10) << __func__ << " keeping existing state" << dendl;
   }
 
+  if (cct->_conf->osd_agent_temp_sketch_width > 0 &&
+      !agent_state->temperature) {
+    agent_state->temperature.reset(
+      new ObjectTemperature(cct->_conf->osd_agent_temp_sketch_depth,
+			    cct->_conf->osd_agent_temp_sketch_width,
+			    cct->_conf->osd_agent_temp_halflife,
+			    ceph_clock_now(cct)));
+  } else if (cct->_conf->osd_agent_temp_sketch_width <= 0) {
+    agent_state->temperature.reset(NULL);
+  }
+
   if (info.stats.stats_invalid) {
     osd->clog->warn() << "pg " << info.pgid << " has invalid (post-split) stats; must scrub before tier agent can activate";
   }
@@ -12050,36 +12089,39 @@ bool ReplicatedPG::agent_maybe_evict(ObjectContextRef& obc)
   if (agent_state->evict_mode != TierAgentState::EVICT_MODE_FULL) {
     // is this object old and/or cold enough?
     int atime = -1, temp = 0;
-    if (hit_set)
-      agent_estimate_atime_temp(soid, &atime, NULL /*FIXME &temp*/);
-
     uint64_t atime_upper = 0, atime_lower = 0;
-    if (atime < 0 && obc->obs.oi.mtime != utime_t()) {
-      if (obc->obs.oi.local_mtime != utime_t()) {
-        atime = ceph_clock_now(NULL).sec() - obc->obs.oi.local_mtime;
-      } else {
-        atime = ceph_clock_now(NULL).sec() - obc->obs.oi.mtime;
+    uint64_t temp_upper = 0, temp_lower = 0;
+    if (agent_state->temperature) {
+      // rank by decayed hit count (in tenths of a hit) instead of
+      // probing each hit set for the last access
+      agent_state->temperature->decay(ceph_clock_now(NULL));
+      temp = agent_state->temperature->get(soid) * 10;
+      agent_state->temp_hist.add(temp);
+      agent_state->temp_hist.get_position_micro(temp, &temp_lower,
+						&temp_upper);
+    } else {
+      if (hit_set)
+	agent_estimate_atime_temp(soid, &atime, NULL);
+      if (atime < 0 && obc->obs.oi.mtime != utime_t()) {
+	if (obc->obs.oi.local_mtime != utime_t()) {
+	  atime = ceph_clock_now(NULL).sec() - obc->obs.oi.local_mtime;
+	} else {
+	  atime = ceph_clock_now(NULL).sec() - obc->obs.oi.mtime;
+	}
       }
-    }
-    if (atime < 0) {
-      if (hit_set) {
-        atime = pool.info.hit_set_period * pool.info.hit_set_count; // "infinite"
-      } else {
-	atime_upper = 1000000;
+      if (atime < 0) {
+	if (hit_set) {
+	  atime = pool.info.hit_set_period * pool.info.hit_set_count; // "infinite"
+	} else {
+	  atime_upper = 1000000;
+	}
+      }
+      if (atime >= 0) {
+	agent_state->atime_hist.add(atime);
+	agent_state->atime_hist.get_position_micro(atime, &atime_lower,
+						   &atime_upper);
       }
     }
-    if (atime >= 0) {
-      agent_state->atime_hist.add(atime);
-      agent_state->atime_hist.get_position_micro(atime, &atime_lower,
-						 &atime_upper);
-    }
-
-    unsigned temp_upper = 0, temp_lower = 0;
-    /*
-    // FIXME: bound atime based on creation time?
-    agent_state->temp_hist.add(atime);
-    agent_state->temp_hist.get_position_micro(temp, &temp_lower, &temp_upper);
-    */
 
     dout(20) << __func__
 	     << " atime " << atime
@@ -12097,10 +12139,13 @@ bool ReplicatedPG::agent_maybe_evict(ObjectContextRef& obc)
     delete f;
     *_dout << dendl;
 
-    // FIXME: ignore temperature for now.
-
-    if (1000000 - atime_upper >= agent_state->evict_effort)
+    if (agent_state->temperature) {
+      // only evict objects colder than all but evict_effort of those seen
+      if (temp_lower >= agent_state->evict_effort)
+	return false;
+    } else if (1000000 - atime_upper >= agent_state->evict_effort) {
       return false;
+    }
   }
 
   dout(10) << __func__ << " evicting " << obc->obs.oi << dendl;
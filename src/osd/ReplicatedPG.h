@@ -35,6 +35,7 @@
 #include "messages/MOSDSubOp.h"
 
 #include "common/sharedptr_registry.hpp"
+#include "common/shared_cache.hpp"
 
 #include "PGBackend.h"
 #include "ReplicatedBackend.h"
@@ -907,8 +908,10 @@ protected:
 
   friend struct C_OnPushCommit;
 
-  // projected object info
-  SharedPtrRegistry<hobject_t, ObjectContext> object_contexts;
+  // projected object info; the most recently used contexts are kept
+  // (osd_pg_object_context_cache_count) after their last user drops
+  // them, until the next interval change
+  SharedLRU<hobject_t, ObjectContext> object_contexts;
   // map from oid.snapdir() to SnapSetContext *
   map<hobject_t, SnapSetContext*> snapset_contexts;
   Mutex snapset_contexts_lock;
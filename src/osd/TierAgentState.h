@@ -14,6 +14,10 @@
 #ifndef CEPH_OSD_TIERAGENT_H
 #define CEPH_OSD_TIERAGENT_H
 
+#include <boost/scoped_ptr.hpp>
+
+#include "ObjectTemperature.h"
+
 struct TierAgentState {
   /// current position iterating across pool
   hobject_t position;
@@ -30,6 +34,9 @@ struct TierAgentState {
   /// past HitSet(s) (not current)
   map<time_t,HitSetRef> hit_set_map;
 
+  /// decayed per-object hit counts (NULL if disabled)
+  boost::scoped_ptr<ObjectTemperature> temperature;
+
   /// a few recent things we've seen that are clean
   list<hobject_t> recent_clean;
 
@@ -113,6 +120,11 @@ struct TierAgentState {
     f->open_object_section("temp_hist");
     temp_hist.dump(f);
     f->close_section();
+    if (temperature) {
+      f->open_object_section("temperature");
+      temperature->dump(f);
+      f->close_section();
+    }
   }
 };
 
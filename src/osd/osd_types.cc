@@ -4491,6 +4491,182 @@ uint64_t PushOp::cost(CephContext *cct) const
   return cost;
 }
 
+// -- pg_hash_tree_t --
+
+void pg_hash_tree_t::reset(const hobject_t &b, const hobject_t &e, unsigned d)
+{
+  assert(b <= e);
+  begin = b;
+  end = e;
+  depth = MIN(d, MAX_DEPTH);
+  num_objects = 0;
+  nodes.clear();
+  nodes.resize((2u << depth) - 1, 0);
+}
+
+uint64_t pg_hash_tree_t::get_begin_key() const
+{
+  return begin.get_filestore_key();
+}
+
+uint64_t pg_hash_tree_t::get_end_key() const
+{
+  return end.get_filestore_key();
+}
+
+unsigned pg_hash_tree_t::get_leaf(const hobject_t &soid) const
+{
+  assert(contains(soid));
+  uint64_t span = get_end_key() - get_begin_key();
+  if (span == 0)
+    return 0;
+  // largest leaf whose lower bound key is <= soid's key
+  uint64_t x = soid.get_filestore_key() - get_begin_key();
+  uint64_t leaf = (((x + 1) << depth) - 1) / span;
+  return MIN(leaf, (uint64_t)get_num_leaves() - 1);
+}
+
+hobject_t pg_hash_tree_t::get_leaf_begin(unsigned leaf) const
+{
+  assert(leaf <= get_num_leaves());
+  if (leaf == 0)
+    return begin;
+  if (leaf == get_num_leaves())
+    return end;
+  uint64_t span = get_end_key() - get_begin_key();
+  uint64_t key = get_begin_key() + ((span * leaf) >> depth);
+  if (key <= get_begin_key())
+    return begin;
+  hobject_t ret;
+  ret.set_hash(hobject_t::_reverse_nibbles(key));
+  return ret;
+}
+
+void pg_hash_tree_t::add(const hobject_t &soid, uint32_t h)
+{
+  assert(!nodes.empty());
+  bufferlist bl;
+  ::encode(soid, bl);
+  nodes[get_num_leaves() - 1 + get_leaf(soid)] ^= bl.crc32c(h);
+  ++num_objects;
+}
+
+void pg_hash_tree_t::finalize()
+{
+  for (int i = (int)get_num_leaves() - 2; i >= 0; --i) {
+    uint32_t right = nodes[2 * i + 2];
+    nodes[i] = ceph_crc32c(nodes[2 * i + 1], (unsigned char *)&right,
+			   sizeof(right));
+  }
+}
+
+void pg_hash_tree_t::_compare(
+  const pg_hash_tree_t &other, unsigned node,
+  vector<pair<hobject_t, hobject_t> > *divergent) const
+{
+  if (nodes[node] == other.nodes[node])
+    return;
+  if (node < get_num_leaves() - 1) {
+    _compare(other, 2 * node + 1, divergent);
+    _compare(other, 2 * node + 2, divergent);
+    return;
+  }
+  unsigned leaf = node - (get_num_leaves() - 1);
+  hobject_t lb = get_leaf_begin(leaf);
+  hobject_t le = get_leaf_begin(leaf + 1);
+  if (lb == le)
+    return;
+  if (!divergent->empty() && divergent->back().second == lb)
+    divergent->back().second = le;
+  else
+    divergent->push_back(make_pair(lb, le));
+}
+
+void pg_hash_tree_t::compare(
+  const pg_hash_tree_t &other,
+  vector<pair<hobject_t, hobject_t> > *divergent) const
+{
+  divergent->clear();
+  if (begin != other.begin || end != other.end || depth != other.depth ||
+      nodes.size() != other.nodes.size() || nodes.empty()) {
+    if (begin != end)
+      divergent->push_back(make_pair(begin, end));
+    return;
+  }
+  _compare(other, 0, divergent);
+}
+
+void pg_hash_tree_t::encode(bufferlist &bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(begin, bl);
+  ::encode(end, bl);
+  ::encode(depth, bl);
+  ::encode(num_objects, bl);
+  vector<uint32_t> leaves;
+  if (!nodes.empty())
+    leaves.assign(nodes.begin() + get_num_leaves() - 1, nodes.end());
+  ::encode(leaves, bl);
+  ENCODE_FINISH(bl);
+}
+
+void pg_hash_tree_t::decode(bufferlist::iterator &bl)
+{
+  vector<uint32_t> leaves;
+  DECODE_START(1, bl);
+  ::decode(begin, bl);
+  ::decode(end, bl);
+  ::decode(depth, bl);
+  ::decode(num_objects, bl);
+  ::decode(leaves, bl);
+  DECODE_FINISH(bl);
+
+  nodes.clear();
+  if (!leaves.empty()) {
+    if (depth > MAX_DEPTH || leaves.size() != get_num_leaves())
+      throw buffer::malformed_input("pg_hash_tree_t leaf count mismatch");
+    nodes.resize(get_num_leaves() - 1, 0);
+    nodes.insert(nodes.end(), leaves.begin(), leaves.end());
+    finalize();
+  }
+}
+
+void pg_hash_tree_t::dump(Formatter *f) const
+{
+  f->dump_stream("begin") << begin;
+  f->dump_stream("end") << end;
+  f->dump_unsigned("depth", depth);
+  f->dump_unsigned("num_objects", num_objects);
+  if (!nodes.empty())
+    f->dump_unsigned("root", get_root());
+  f->open_array_section("leaves");
+  if (!nodes.empty()) {
+    for (unsigned i = get_num_leaves() - 1; i < nodes.size(); ++i)
+      f->dump_unsigned("leaf", nodes[i]);
+  }
+  f->close_section();
+}
+
+void pg_hash_tree_t::generate_test_instances(list<pg_hash_tree_t*>& o)
+{
+  o.push_back(new pg_hash_tree_t);
+  o.push_back(new pg_hash_tree_t);
+  o.back()->reset(hobject_t(), hobject_t::get_max(), 3);
+  o.back()->add(hobject_t(object_t("foo"), "", CEPH_NOSNAP, 0x1234, 1, ""),
+		0xabcd);
+  o.back()->add(hobject_t(object_t("bar"), "", 123, 0x8765, 1, ""), 0);
+  o.back()->finalize();
+}
+
+ostream& operator<<(ostream& out, const pg_hash_tree_t &t)
+{
+  out << "hash_tree([" << t.begin << "," << t.end << ") depth "
+      << (int)t.depth << " objects " << t.num_objects;
+  if (!t.empty())
+    out << " root " << std::hex << t.get_root() << std::dec;
+  return out << ")";
+}
+
 // -- ScrubMap --
 
 void ScrubMap::merge_incr(const ScrubMap &l)
@@ -4512,21 +4688,33 @@ void ScrubMap::merge_incr(const ScrubMap &l)
   }
 }          
 
+void ScrubMap::build_hash_tree(pg_hash_tree_t *tree) const
+{
+  for (map<hobject_t,object>::const_iterator p =
+	 objects.lower_bound(tree->begin);
+       p != objects.end() && p->first < tree->end;
+       ++p) {
+    tree->add(p->first, p->second.get_summary_hash());
+  }
+  tree->finalize();
+}
+
 void ScrubMap::encode(bufferlist& bl) const
 {
-  ENCODE_START(3, 2, bl);
+  ENCODE_START(4, 2, bl);
   ::encode(objects, bl);
   ::encode((__u32)0, bl); // used to be attrs; now deprecated
   bufferlist old_logbl;  // not used
   ::encode(old_logbl, bl);
   ::encode(valid_through, bl);
   ::encode(incr_since, bl);
+  ::encode(hash_tree, bl);
   ENCODE_FINISH(bl);
 }
 
 void ScrubMap::decode(bufferlist::iterator& bl, int64_t pool)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(3, 2, 2, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(4, 2, 2, bl);
   ::decode(objects, bl);
   {
     map<string,string> attrs;  // deprecated
@@ -4536,6 +4724,8 @@ void ScrubMap::decode(bufferlist::iterator& bl, int64_t pool)
   ::decode(old_logbl, bl);
   ::decode(valid_through, bl);
   ::decode(incr_since, bl);
+  if (struct_v >= 4)
+    ::decode(hash_tree, bl);
   DECODE_FINISH(bl);
 
   // handle hobject_t upgrade
@@ -4557,6 +4747,11 @@ void ScrubMap::dump(Formatter *f) const
 {
   f->dump_stream("valid_through") << valid_through;
   f->dump_stream("incremental_since") << incr_since;
+  if (is_summary()) {
+    f->open_object_section("hash_tree");
+    hash_tree.dump(f);
+    f->close_section();
+  }
   f->open_array_section("objects");
   for (map<hobject_t,object>::const_iterator p = objects.begin(); p != objects.end(); ++p) {
     f->open_object_section("object");
@@ -4581,10 +4776,32 @@ void ScrubMap::generate_test_instances(list<ScrubMap*>& o)
   o.back()->objects[hobject_t(object_t("foo"), "fookey", 123, 456, 0, "")] = *obj.back();
   obj.pop_back();
   o.back()->objects[hobject_t(object_t("bar"), string(), 123, 456, 0, "")] = *obj.back();
+  o.push_back(new ScrubMap);
+  o.back()->valid_through = eversion_t(5, 6);
+  o.back()->hash_tree.reset(hobject_t(), hobject_t::get_max(), 2);
+  o.back()->hash_tree.add(hobject_t(object_t("baz"), string(), 123, 456, 0, ""), 789);
+  o.back()->hash_tree.finalize();
 }
 
 // -- ScrubMap::object --
 
+uint32_t ScrubMap::object::get_summary_hash() const
+{
+  // cover exactly what be_compare_scrubmaps() looks at
+  bufferlist bl;
+  ::encode(size, bl);
+  ::encode(negative, bl);
+  ::encode(attrs, bl);
+  ::encode(digest_present, bl);
+  if (digest_present)
+    ::encode(digest, bl);
+  ::encode(omap_digest_present, bl);
+  if (omap_digest_present)
+    ::encode(omap_digest, bl);
+  ::encode(read_error, bl);
+  return bl.crc32c(-1);
+}
+
 void ScrubMap::object::encode(bufferlist& bl) const
 {
   ENCODE_START(6, 2, bl);
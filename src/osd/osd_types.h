@@ -3320,6 +3320,84 @@ WRITE_CLASS_ENCODER(PushOp)
 ostream& operator<<(ostream& out, const PushOp &op);
 
 
+/**
+ * pg_hash_tree_t - hash tree summary of a range of a pg's namespace
+ *
+ * The range [begin, end) is cut into 2^depth leaves of equal width in
+ * filestore key (reversed hash) space, so each leaf covers a contiguous
+ * run of the hobject_t sort order.  A leaf is the xor of the hashes of
+ * the objects it covers and each inner node hashes its two children.
+ * Only the leaves are encoded; the inner nodes are rebuilt on decode.
+ *
+ * Two trees over the same range can be compared top-down, descending
+ * only into subtrees whose hashes differ, to find the (coalesced)
+ * ranges whose contents diverge.
+ */
+struct pg_hash_tree_t {
+  static const unsigned MAX_DEPTH = 16;
+
+  hobject_t begin, end;     ///< covered range, [begin, end)
+  uint8_t depth;
+  uint64_t num_objects;
+  vector<uint32_t> nodes;   ///< implicit binary tree, nodes[0] is the root
+
+  pg_hash_tree_t() : depth(0), num_objects(0) {}
+
+  /// start an empty tree over [b, e) with 2^d leaves
+  void reset(const hobject_t &b, const hobject_t &e, unsigned d);
+
+  bool empty() const {
+    return nodes.empty();
+  }
+  unsigned get_num_leaves() const {
+    return 1u << depth;
+  }
+  uint32_t get_root() const {
+    assert(!nodes.empty());
+    return nodes[0];
+  }
+  bool contains(const hobject_t &soid) const {
+    return soid >= begin && soid < end;
+  }
+
+  /// @return leaf covering soid, which must lie within [begin, end)
+  unsigned get_leaf(const hobject_t &soid) const;
+  /// @return lower bound of leaf i; get_leaf_begin(get_num_leaves()) == end
+  hobject_t get_leaf_begin(unsigned leaf) const;
+
+  /// fold an object with content hash h into its leaf
+  void add(const hobject_t &soid, uint32_t h);
+  /// recompute the inner nodes; must be called after the last add()
+  void finalize();
+
+  /**
+   * find the ranges of this tree that differ from other
+   *
+   * Adjacent divergent leaves are coalesced into a single range.  If the
+   * trees do not cover the same range at the same depth the whole range
+   * is reported.
+   *
+   * @param other [in] tree to compare against
+   * @param divergent [out] sorted, disjoint [begin, end) ranges
+   */
+  void compare(const pg_hash_tree_t &other,
+	       vector<pair<hobject_t, hobject_t> > *divergent) const;
+
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<pg_hash_tree_t*>& o);
+
+private:
+  uint64_t get_begin_key() const;
+  uint64_t get_end_key() const;
+  void _compare(const pg_hash_tree_t &other, unsigned node,
+		vector<pair<hobject_t, hobject_t> > *divergent) const;
+};
+WRITE_CLASS_ENCODER(pg_hash_tree_t)
+ostream& operator<<(ostream& out, const pg_hash_tree_t &t);
+
+
 /*
  * summarize pg contents for purposes of a scrub
  */
@@ -3342,6 +3420,9 @@ struct ScrubMap {
       nlinks(0), omap_digest(0), omap_digest_present(false),
       read_error(false) {}
 
+    /// hash of the fields compared between replicas, for pg_hash_tree_t
+    uint32_t get_summary_hash() const;
+
     void encode(bufferlist& bl) const;
     void decode(bufferlist::iterator& bl);
     void dump(Formatter *f) const;
@@ -3352,9 +3433,18 @@ struct ScrubMap {
   map<hobject_t,object> objects;
   eversion_t valid_through;
   eversion_t incr_since;
+  pg_hash_tree_t hash_tree;  ///< if set, a summary sent in place of objects
+
+  /// true if this map carries only a hash tree summary
+  bool is_summary() const {
+    return !hash_tree.empty();
+  }
 
   void merge_incr(const ScrubMap &l);
 
+  /// fold the objects within [tree->begin, tree->end) into tree
+  void build_hash_tree(pg_hash_tree_t *tree) const;
+
   void encode(bufferlist& bl) const;
   void decode(bufferlist::iterator& bl, int64_t pool=-1);
   void dump(Formatter *f) const;
@@ -71,6 +71,8 @@ enum {
   l_osdc_op_w,
   l_osdc_op_rmw,
   l_osdc_op_pg,
+  l_osdc_op_replica_read,
+  l_osdc_op_replica_fallback,
 
   l_osdc_osdop_stat,
   l_osdc_osdop_create,
@@ -195,6 +197,8 @@ void Objecter::init()
     pcb.add_u64_counter(l_osdc_op_w, "op_w");
     pcb.add_u64_counter(l_osdc_op_rmw, "op_rmw");
     pcb.add_u64_counter(l_osdc_op_pg, "op_pg");
+    pcb.add_u64_counter(l_osdc_op_replica_read, "op_replica_read");
+    pcb.add_u64_counter(l_osdc_op_replica_fallback, "op_replica_fallback");
 
     pcb.add_u64_counter(l_osdc_osdop_stat, "osdop_stat");
     pcb.add_u64_counter(l_osdc_osdop_create, "osdop_create");
@@ -271,11 +275,23 @@ void Objecter::init()
     lderr(cct) << "error registering admin socket command: "
 	       << cpp_strerror(ret) << dendl;
   }
+  ret = admin_socket->register_command("objecter_osd_latency",
+				       "objecter_osd_latency",
+				       m_request_state_hook,
+				       "show read latency and load per osd");
+  if (ret < 0 && ret != -EEXIST) {
+    lderr(cct) << "error registering admin socket command: "
+	       << cpp_strerror(ret) << dendl;
+  }
 
   timer_lock.Lock();
   timer.init();
   timer_lock.Unlock();
 
+  // we only ever change osdmap through decode() and apply_incremental()
+  if (cct->_conf->osd_map_pg_mapping_cache)
+    osdmap->enable_pg_mapping_cache();
+
   initialized.set(1);
 }
 
@@ -299,6 +315,7 @@ void Objecter::shutdown()
   rwlock.get_write();
 
   initialized.set(0);
+  _unpublish_map();
 
   map<int,OSDSession*>::iterator p;
   while (!osd_sessions.empty()) {
@@ -389,6 +406,7 @@ void Objecter::shutdown()
   if (m_request_state_hook) {
     AdminSocket* admin_socket = cct->get_admin_socket();
     admin_socket->unregister_command("objecter_requests");
+    admin_socket->unregister_command("objecter_osd_latency");
     delete m_request_state_hook;
     m_request_state_hook = NULL;
   }
@@ -402,6 +420,8 @@ void Objecter::shutdown()
   // Let go of Objecter write lock so timer thread can shutdown
   rwlock.unlock();
 
+  reclaim_maps();
+
   {
     Mutex::Locker l(timer_lock);
     timer.shutdown();
@@ -885,6 +905,7 @@ void Objecter::_scan_requests(OSDSession *s,
   RWLock::Context lc(rwlock, RWLock::Context::TakenForWrite);
 
   s->lock.get_write();
+  s->map_epoch = osdmap->get_epoch();
 
   // check for changed linger mappings (_before_ regular ops)
   map<ceph_tid_t,LingerOp*>::iterator lp = s->linger_ops.begin();
@@ -982,7 +1003,18 @@ void Objecter::_scan_requests(OSDSession *s,
 
 void Objecter::handle_osd_map(MOSDMap *m)
 {
-  RWLock::WLocker wl(rwlock);
+  rwlock.get_write();
+  _handle_osd_map(m);
+  rwlock.unlock();
+
+  // free the snapshots we replaced once the op_submit() fast path is
+  // done with them
+  reclaim_maps();
+}
+
+void Objecter::_handle_osd_map(MOSDMap *m)
+{
+  assert(rwlock.is_wlocked());
   if (!initialized.read())
     return;
 
@@ -994,6 +1026,7 @@ void Objecter::handle_osd_map(MOSDMap *m)
     return;
   }
 
+  epoch_t old_epoch = osdmap->get_epoch();
   bool was_pauserd = osdmap->test_flag(CEPH_OSDMAP_PAUSERD);
   bool was_full = _osdmap_full_flag();
   bool was_pausewr = osdmap->test_flag(CEPH_OSDMAP_PAUSEWR) || was_full;
@@ -1096,11 +1129,15 @@ void Objecter::handle_osd_map(MOSDMap *m)
     }
   }
 
+  if (osdmap->get_epoch() != old_epoch)
+    _publish_map();
+
   bool pauserd = osdmap->test_flag(CEPH_OSDMAP_PAUSERD);
   bool pausewr = osdmap->test_flag(CEPH_OSDMAP_PAUSEWR) || _osdmap_full_flag();
 
   // was/is paused?
-  if (was_pauserd || was_pausewr || pauserd || pausewr || osdmap->get_epoch() < epoch_barrier) {
+  if (was_pauserd || was_pausewr || pauserd || pausewr ||
+      osdmap->get_epoch() < epoch_barrier.read()) {
     _maybe_request_map();
   }
 
@@ -1182,6 +1219,83 @@ void Objecter::handle_osd_map(MOSDMap *m)
   }
 }
 
+/**
+ * Publish a snapshot of the current osdmap and sessions for the
+ * op_submit() fast path.  The snapshot it replaces is freed by a later
+ * reclaim_maps().
+ */
+void Objecter::_publish_map()
+{
+  assert(rwlock.is_wlocked());
+
+  MapSnapshot *old = published_map.read();
+  MapSnapshot *snap = new MapSnapshot;
+  if (old && old->map->get_epoch() == osdmap->get_epoch()) {
+    // only the sessions changed
+    snap->map = old->map;
+  } else {
+    OSDMap *copy = new OSDMap;
+    copy->deepish_copy_from(*osdmap);
+    copy->inherit_pg_mapping_cache(*osdmap);
+    snap->map.reset(copy);
+  }
+  snap->sessions.resize(snap->map->get_max_osd(), NULL);
+  for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
+       p != osd_sessions.end(); ++p) {
+    if (p->first < (int)snap->sessions.size()) {
+      get_session(p->second);
+      snap->sessions[p->first] = p->second;
+    }
+  }
+  ldout(cct, 20) << __func__ << " e" << snap->map->get_epoch()
+		 << " with " << osd_sessions.size() << " sessions" << dendl;
+
+  published_map.set(snap);
+  if (old) {
+    Mutex::Locker l(retired_maps_lock);
+    retired_maps.push_back(old);
+  }
+}
+
+void Objecter::_unpublish_map()
+{
+  assert(rwlock.is_wlocked());
+
+  MapSnapshot *old = published_map.read();
+  if (!old)
+    return;
+  published_map.set(NULL);
+  Mutex::Locker l(retired_maps_lock);
+  retired_maps.push_back(old);
+}
+
+/**
+ * Free the retired map snapshots, once no op_submit() can still be
+ * using them.  Must not be called with rwlock held for write, since
+ * that would stall the slow path along with the wait.
+ */
+void Objecter::reclaim_maps()
+{
+  list<MapSnapshot*> ls;
+  {
+    Mutex::Locker l(retired_maps_lock);
+    ls.swap(retired_maps);
+  }
+  if (ls.empty())
+    return;
+
+  map_rcu.synchronize();
+  for (list<MapSnapshot*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    MapSnapshot *snap = *p;
+    for (vector<OSDSession*>::iterator q = snap->sessions.begin();
+	 q != snap->sessions.end(); ++q) {
+      if (*q)
+	put_session(*q);
+    }
+    delete snap;
+  }
+}
+
 // op pool check
 
 void Objecter::C_Op_Map_Latest::finish(int r)
@@ -1511,11 +1625,18 @@ int Objecter::_get_session(int osd, OSDSession **session, RWLock::Context& lc)
   OSDSession *s = new OSDSession(cct, osd);
   osd_sessions[osd] = s;
   s->con = messenger->get_connection(osdmap->get_inst(osd));
+  s->map_epoch = osdmap->get_epoch();
   logger->inc(l_osdc_osd_session_open);
   logger->inc(l_osdc_osd_sessions, osd_sessions.size());
   s->get();
   *session = s;
   ldout(cct, 20) << __func__ << " s=" << s << " osd=" << osd << " " << s->get_nref() << dendl;
+
+  // let the fast path use the new session, unless we are in the
+  // middle of handle_osd_map(), which will publish it anyway
+  MapSnapshot *snap = published_map.read();
+  if (snap && snap->map->get_epoch() == osdmap->get_epoch())
+    _publish_map();
   return 0;
 }
 
@@ -1562,6 +1683,8 @@ void Objecter::close_session(OSDSession *s)
     logger->inc(l_osdc_osd_session_close);
   }
   s->lock.get_write();
+  // no map snapshot may add ops to us now
+  s->map_epoch = (epoch_t)-1;
 
   std::list<LingerOp*> homeless_lingers;
   std::list<CommandOp*> homeless_commands;
@@ -1821,6 +1944,9 @@ void Objecter::schedule_tick()
 
 void Objecter::tick()
 {
+  // snapshots replaced when sessions were opened
+  reclaim_maps();
+
   RWLock::RLocker rl(rwlock);
 
   ldout(cct, 10) << "tick" << dendl;
@@ -1962,9 +2088,103 @@ public:
 
 ceph_tid_t Objecter::op_submit(Op *op, int *ctx_budget)
 {
-  RWLock::RLocker rl(rwlock);
-  RWLock::Context lc(rwlock, RWLock::Context::TakenForRead);
-  return _op_submit_with_budget(op, lc, ctx_budget);
+  assert(initialized.read());
+
+  assert(op->ops.size() == op->out_bl.size());
+  assert(op->ops.size() == op->out_rval.size());
+  assert(op->ops.size() == op->out_handler.size());
+
+  // throttle before taking any lock, since it may block
+  if (!op->ctx_budgeted || (ctx_budget && (*ctx_budget == -1))) {
+    int op_budget = take_op_budget(op);
+    // take and pass out the budget for the first OP
+    // in the context session
+    if (ctx_budget && (*ctx_budget == -1)) {
+      *ctx_budget = op_budget;
+    }
+  }
+
+  ceph_tid_t tid;
+  if (!op_submit_fast(op, &tid)) {
+    RWLock::RLocker rl(rwlock);
+    RWLock::Context lc(rwlock, RWLock::Context::TakenForRead);
+    tid = _op_submit(op, lc);
+  }
+
+  add_op_timeout(op, tid);
+  return tid;
+}
+
+/**
+ * Send an op through the published map snapshot, without rwlock.
+ *
+ * Only the common case is handled here.  Ops that would be paused, map
+ * to no osd or to an osd we have no session with, or target a pool we
+ * do not know about are left to _op_submit(): we return false without
+ * touching the op.  Its target is calculated on a copy, since a target
+ * oid and oloc left over from the snapshot would make _op_submit() skip
+ * the tiering check against the live map.
+ */
+bool Objecter::op_submit_fast(Op *op, ceph_tid_t *ptid)
+{
+  unsigned token = map_rcu.read_lock();
+  MapSnapshot *snap = published_map.read();
+  bool sent = snap &&
+    op_submit_in_snapshot(snap->map.get(), snap->sessions, op, ptid);
+  map_rcu.read_unlock(token);
+  return sent;
+}
+
+bool Objecter::op_submit_in_snapshot(const OSDMap *map,
+				     const vector<OSDSession*>& sessions,
+				     Op *op, ceph_tid_t *ptid)
+{
+  assert(op->session == NULL);
+
+  if (target_should_be_paused(map, &op->target))
+    return false;
+  op_target_t target = op->target;
+  if (calc_target(map, &target, false, &sessions) ==
+      RECALC_OP_TARGET_POOL_DNE ||
+      target.osd < 0 ||
+      target.osd >= (int)sessions.size() ||
+      sessions[target.osd] == NULL)
+    return false;
+  OSDSession *s = sessions[target.osd];
+
+  s->lock.get_write();
+  if (s->map_epoch > map->get_epoch()) {
+    // handle_osd_map() has already checked this session's ops against
+    // a newer map, and would miss this one
+    s->lock.unlock();
+    return false;
+  }
+  op->target = target;
+
+  if (op->tid == 0)
+    op->tid = last_tid.inc();
+  _send_op_account(op);
+  ldout(cct, 10) << __func__ << " oid " << op->target.base_oid
+		 << " " << op->target.base_oloc << " " << op->target.target_oloc
+		 << " " << op->ops << " tid " << op->tid
+		 << " osd." << s->osd << " e" << map->get_epoch() << dendl;
+  MOSDOp *m = prepare_osd_op(op, map->get_epoch());
+  _session_op_assign(s, op);
+  _send_op(op, m);
+
+  // the op may be freed by the reply handler once we drop the lock
+  *ptid = op->tid;
+  s->lock.unlock();
+  return true;
+}
+
+void Objecter::add_op_timeout(Op *op, ceph_tid_t tid)
+{
+  if (osd_timeout > 0) {
+    Mutex::Locker l(timer_lock);
+    op->ontimeout = new C_CancelOp(tid, this);
+    timer.add_event_after(osd_timeout, op->ontimeout);
+  }
 }
 
 ceph_tid_t Objecter::_op_submit_with_budget(Op *op, RWLock::Context& lc, int *ctx_budget)
@@ -1987,13 +2207,7 @@ ceph_tid_t Objecter::_op_submit_with_budget(Op *op, RWLock::Context& lc, int *ct
   }
 
   ceph_tid_t tid = _op_submit(op, lc);
-
-  if (osd_timeout > 0) {
-    Mutex::Locker l(timer_lock);
-    op->ontimeout = new C_CancelOp(tid, this);
-    timer.add_event_after(osd_timeout, op->ontimeout);
-  }
-
+  add_op_timeout(op, tid);
   return tid;
 }
 
@@ -2295,14 +2509,14 @@ bool Objecter::is_pg_changed(
   return false;      // same primary (tho replicas may have changed)
 }
 
-bool Objecter::target_should_be_paused(op_target_t *t)
+bool Objecter::target_should_be_paused(const OSDMap *map, op_target_t *t)
 {
-  bool pauserd = osdmap->test_flag(CEPH_OSDMAP_PAUSERD);
-  bool pausewr = osdmap->test_flag(CEPH_OSDMAP_PAUSEWR) || _osdmap_full_flag();
+  bool pauserd = map->test_flag(CEPH_OSDMAP_PAUSERD);
+  bool pausewr = map->test_flag(CEPH_OSDMAP_PAUSEWR) || map_full_flag(map);
 
   return (t->flags & CEPH_OSD_FLAG_READ && pauserd) ||
          (t->flags & CEPH_OSD_FLAG_WRITE && pausewr) ||
-         (osdmap->get_epoch() < epoch_barrier);
+         (map->get_epoch() < epoch_barrier.read());
 }
 
 /**
@@ -2316,12 +2530,12 @@ bool Objecter::osdmap_full_flag() const
 }
 
 /**
- * Wrapper around osdmap->test_flag for special handling of the FULL flag.
+ * Wrapper around map->test_flag for special handling of the FULL flag.
  */
-bool Objecter::_osdmap_full_flag() const
+bool Objecter::map_full_flag(const OSDMap *map) const
 {
   // Ignore the FULL flag if the caller has honor_osdmap_full
-  return osdmap->test_flag(CEPH_OSDMAP_FULL) && honor_osdmap_full;
+  return map->test_flag(CEPH_OSDMAP_FULL) && honor_osdmap_full;
 }
 
 
@@ -2343,14 +2557,13 @@ int64_t Objecter::get_object_pg_hash_position(int64_t pool, const string& key,
   return p->raw_hash_to_pg(p->hash_key(key, ns));
 }
 
-int Objecter::_calc_target(op_target_t *t, bool any_change)
+int Objecter::calc_target(const OSDMap *map, op_target_t *t, bool any_change,
+			  const vector<OSDSession*> *sessions)
 {
-  assert(rwlock.is_locked());
-
   bool is_read = t->flags & CEPH_OSD_FLAG_READ;
   bool is_write = t->flags & CEPH_OSD_FLAG_WRITE;
 
-  const pg_pool_t *pi = osdmap->get_pg_pool(t->base_oloc.pool);
+  const pg_pool_t *pi = map->get_pg_pool(t->base_oloc.pool);
   if (!pi) {
     t->osd = -1;
     return RECALC_OP_TARGET_POOL_DNE;
@@ -2358,7 +2571,7 @@ int Objecter::_calc_target(op_target_t *t, bool any_change)
 
   bool force_resend = false;
   bool need_check_tiering = false;
-  if (osdmap->get_epoch() == pi->last_force_op_resend) {
+  if (map->get_epoch() == pi->last_force_op_resend) {
     force_resend = true;
   }
   if (t->target_oid.name.empty() || force_resend) {
@@ -2382,15 +2595,15 @@ int Objecter::_calc_target(op_target_t *t, bool any_change)
   if (t->precalc_pgid) {
     assert(t->base_oid.name.empty()); // make sure this is a listing op
     ldout(cct, 10) << __func__ << " have " << t->base_pgid << " pool "
-		   << osdmap->have_pg_pool(t->base_pgid.pool()) << dendl;
-    if (!osdmap->have_pg_pool(t->base_pgid.pool())) {
+		   << map->have_pg_pool(t->base_pgid.pool()) << dendl;
+    if (!map->have_pg_pool(t->base_pgid.pool())) {
       t->osd = -1;
       return RECALC_OP_TARGET_POOL_DNE;
     }
-    pgid = osdmap->raw_pg_to_pg(t->base_pgid);
+    pgid = map->raw_pg_to_pg(t->base_pgid);
   } else {
-    int ret = osdmap->object_locator_to_pg(t->target_oid, t->target_oloc,
-					   pgid);
+    int ret = map->object_locator_to_pg(t->target_oid, t->target_oloc,
+					pgid);
     if (ret == -ENOENT) {
       t->osd = -1;
       return RECALC_OP_TARGET_POOL_DNE;
@@ -2401,8 +2614,8 @@ int Objecter::_calc_target(op_target_t *t, bool any_change)
   unsigned pg_num = pi->get_pg_num();
   int up_primary, acting_primary;
   vector<int> up, acting;
-  osdmap->pg_to_up_acting_osds(pgid, &up, &up_primary,
-			       &acting, &acting_primary);
+  map->pg_to_up_acting_osds(pgid, &up, &up_primary,
+			    &acting, &acting_primary);
   if (any_change && pg_interval_t::is_new_interval(
           t->acting_primary,
 	  acting_primary,
@@ -2422,7 +2635,7 @@ int Objecter::_calc_target(op_target_t *t, bool any_change)
 
   bool need_resend = false;
 
-  bool paused = target_should_be_paused(t);
+  bool paused = target_should_be_paused(map, t);
   if (!paused && paused != t->paused) {
     t->paused = false;
     need_resend = true;
@@ -2448,7 +2661,15 @@ int Objecter::_calc_target(op_target_t *t, bool any_change)
     } else {
       int osd;
       bool read = is_read && !is_write;
-      if (read && (t->flags & CEPH_OSD_FLAG_BALANCE_READS)) {
+      if (read && cct->_conf->objecter_balance_reads_by_latency &&
+	  (t->flags & (CEPH_OSD_FLAG_BALANCE_READS |
+		       CEPH_OSD_FLAG_LOCALIZE_READS))) {
+	osd = pick_read_replica(map, pi, up, acting, acting_primary,
+				t->flags & CEPH_OSD_FLAG_LOCALIZE_READS,
+				sessions);
+	if (osd != acting_primary)
+	  t->used_replica = true;
+      } else if (read && (t->flags & CEPH_OSD_FLAG_BALANCE_READS)) {
 	int p = rand() % acting.size();
 	if (p)
 	  t->used_replica = true;
@@ -2461,7 +2682,7 @@ int Objecter::_calc_target(op_target_t *t, bool any_change)
 	int best = -1;
 	int best_locality = 0;
 	for (unsigned i = 0; i < acting.size(); ++i) {
-	  int locality = osdmap->crush->get_common_ancestor_distance(
+	  int locality = map->crush->get_common_ancestor_distance(
 		 cct, acting[i], crush_location);
 	  ldout(cct, 20) << __func__ << " localize: rank " << i
 			 << " osd." << acting[i]
@@ -2491,6 +2712,129 @@ int Objecter::_calc_target(op_target_t *t, bool any_change)
   return RECALC_OP_TARGET_NO_ACTION;
 }
 
+/**
+ * Choose the osd to send a balanced read to.  This only gathers our
+ * sessions with the acting set; see choose_read_replica().
+ *
+ * @param sessions sessions by osd, or NULL to use osd_sessions (rwlock held)
+ */
+int Objecter::pick_read_replica(const OSDMap *map, const pg_pool_t *pi,
+				const vector<int>& up, const vector<int>& acting,
+				int acting_primary, bool localize,
+				const vector<OSDSession*> *sessions)
+{
+  vector<OSDSession*> acting_sessions(acting.size());
+  for (unsigned i = 0; i < acting.size(); ++i) {
+    int osd = acting[i];
+    if (sessions) {
+      if (osd >= 0 && osd < (int)sessions->size())
+	acting_sessions[i] = (*sessions)[osd];
+    } else {
+      assert(rwlock.is_locked());
+      std::map<int, OSDSession*>::iterator p = osd_sessions.find(osd);
+      if (p != osd_sessions.end())
+	acting_sessions[i] = p->second;
+    }
+  }
+  int osd = choose_read_replica(cct, map, pi, up, acting, acting_primary,
+				localize ? &crush_location : NULL,
+				acting_sessions);
+  ldout(cct, 10) << __func__ << " chose osd." << osd << " of " << acting
+		 << dendl;
+  return osd;
+}
+
+/**
+ * Only pgs of replicated pools that look clean in the map (up ==
+ * acting, and all replicas there) are balanced; for the rest we use the
+ * primary.  Otherwise we take the replica with the least expected wait,
+ * its average read latency times the ops we already have queued there.
+ * OSDs with a lower primary affinity look proportionally slower, and
+ * those with none are skipped, as they are for primaries.  The primary
+ * wins ties.  With localize_to, only the replicas closest to that crush
+ * location are considered.
+ *
+ * @param acting_sessions our session with each osd in acting, or NULL
+ */
+int Objecter::choose_read_replica(CephContext *cct, const OSDMap *map,
+				  const pg_pool_t *pi,
+				  const vector<int>& up,
+				  const vector<int>& acting,
+				  int acting_primary,
+				  const std::multimap<string,string> *localize_to,
+				  const vector<OSDSession*>& acting_sessions)
+{
+  assert(acting_sessions.size() == acting.size());
+  if (!pi->is_replicated() || up != acting ||
+      acting.size() < pi->get_size() || acting.size() < 2)
+    return acting_primary;
+
+  int best_locality = -1;
+  if (localize_to) {
+    for (unsigned i = 0; i < acting.size(); ++i) {
+      int locality = map->crush->get_common_ancestor_distance(
+	cct, acting[i], *localize_to);
+      if (locality >= 0 && (best_locality < 0 || locality < best_locality))
+	best_locality = locality;
+    }
+  }
+
+  int best = acting_primary;
+  uint64_t best_load = (uint64_t)-1;
+  for (unsigned i = 0; i < acting.size(); ++i) {
+    if (acting[i] == acting_primary)
+      best_load = read_load(map, acting_primary, acting_sessions[i]);
+  }
+  for (unsigned i = 0; i < acting.size(); ++i) {
+    int osd = acting[i];
+    if (osd == acting_primary)
+      continue;
+    if (best_locality >= 0 &&
+	map->crush->get_common_ancestor_distance(cct, osd, *localize_to) !=
+	best_locality)
+      continue;
+    uint64_t load = read_load(map, osd, acting_sessions[i]);
+    if (load < best_load) {
+      best = osd;
+      best_load = load;
+    }
+  }
+  return best;
+}
+
+/// expected wait for a read from osd, scaled by its primary affinity
+uint64_t Objecter::read_load(const OSDMap *map, int osd, const OSDSession *s)
+{
+  unsigned affinity = map->get_primary_affinity(osd);
+  if (affinity == 0)
+    return (uint64_t)-1;
+  if (!s)
+    return (uint64_t)-1 / 2;  // not connected; prefer those that are
+
+  uint64_t load = (uint64_t)(s->read_latency_us.read() + 1) *
+    (s->num_ops.read() + 1);
+  return load * CEPH_OSD_MAX_PRIMARY_AFFINITY / affinity;
+}
+
+void Objecter::update_read_latency(OSDSession *s, Op *op)
+{
+  assert(s->lock.is_wlocked());
+  if ((op->target.flags & (CEPH_OSD_FLAG_READ | CEPH_OSD_FLAG_WRITE)) !=
+      CEPH_OSD_FLAG_READ)
+    return;
+  utime_t now = ceph_clock_now(cct);
+  if (now < op->stamp)
+    return;
+  int64_t sample = (now - op->stamp).to_nsec() / 1000;
+  int64_t avg = s->read_latency_us.read();
+  // replies on a session are handled under its lock, one at a time
+  if (s->read_samples.inc() == 1)
+    avg = sample;
+  else
+    avg += (sample - avg) / 8;
+  s->read_latency_us.set(avg);
+}
+
 int Objecter::_map_session(op_target_t *target, OSDSession **s,
 			   RWLock::Context& lc)
 {
@@ -2510,6 +2854,7 @@ void Objecter::_session_op_assign(OSDSession *to, Op *op)
   get_session(to);
   op->session = to;
   to->ops[op->tid] = op;
+  to->num_ops.inc();
 
   if (to->is_homeless()) {
     num_homeless_ops.inc();
@@ -2528,6 +2873,7 @@ void Objecter::_session_op_remove(OSDSession *from, Op *op)
   }
 
   from->ops.erase(op->tid);
+  from->num_ops.dec();
   put_session(from);
   op->session = NULL;
 
@@ -2715,10 +3061,8 @@ void Objecter::finish_op(OSDSession *session, ceph_tid_t tid)
   _finish_op(op);
 }
 
-MOSDOp *Objecter::_prepare_osd_op(Op *op)
+MOSDOp *Objecter::prepare_osd_op(Op *op, epoch_t epoch)
 {
-  assert(rwlock.is_locked());
-
   int flags = op->target.flags;
   flags |= CEPH_OSD_FLAG_KNOWN_REDIR;
   if (op->oncommit)
@@ -2732,7 +3076,7 @@ MOSDOp *Objecter::_prepare_osd_op(Op *op)
   MOSDOp *m = new MOSDOp(client_inc.read(), op->tid, 
 			 op->target.target_oid, op->target.target_oloc,
 			 op->target.pgid,
-			 osdmap->get_epoch(),
+			 epoch,
 			 flags);
 
   m->set_snapid(op->snapid);
@@ -2759,7 +3103,8 @@ MOSDOp *Objecter::_prepare_osd_op(Op *op)
 
 void Objecter::_send_op(Op *op, MOSDOp *m)
 {
-  assert(rwlock.is_locked());
+  // rwlock is only needed to prepare the message
+  assert(m || rwlock.is_locked());
   assert(op->session->lock.is_locked());
 
   if (!m) {
@@ -2786,6 +3131,10 @@ void Objecter::_send_op(Op *op, MOSDOp *m)
   }
 
   op->incarnation = op->session->incarnation;
+  if (op->target.used_replica) {
+    op->session->replica_reads.inc();
+    logger->inc(l_osdc_op_replica_read);
+  }
 
   m->set_tid(op->tid);
 
@@ -2836,6 +3185,7 @@ void Objecter::unregister_op(Op *op)
 {
   op->session->lock.get_write();
   op->session->ops.erase(op->tid);
+  op->session->num_ops.dec();
   op->session->lock.unlock();
   put_session(op->session);
   op->session = NULL;
@@ -2916,6 +3266,32 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 
   int rc = m->get_result();
 
+  update_read_latency(s, op);
+
+  if (op->target.used_replica && (rc == -ENXIO || rc == -EAGAIN)) {
+    // the replica can't serve it (not active, or missing the object);
+    // send it to the primary, with the same tid
+    ldout(cct, 5) << " replica osd." << osd_num << " returned " << rc
+		  << ", resending to the primary" << dendl;
+    logger->inc(l_osdc_op_replica_fallback);
+    if (op->onack)
+      num_unacked.dec();
+    if (op->oncommit)
+      num_uncommitted.dec();
+    inflight_ops.dec();
+    logger->dec(l_osdc_op_active);
+    _session_op_remove(s, op);
+    s->lock.unlock();
+    put_session(s);
+
+    op->target.flags &= ~(CEPH_OSD_FLAG_BALANCE_READS |
+			  CEPH_OSD_FLAG_LOCALIZE_READS);
+    op->target.pgid = pg_t();  // make calc_target() pick an osd again
+    _op_submit(op, lc);
+    m->put();
+    return;
+  }
+
   if (m->is_redirect_reply()) {
     ldout(cct, 5) << " got redirect reply; redirecting" << dendl;
     if (op->onack)
@@ -2943,6 +3319,7 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     // new tid
     s->ops.erase(op->tid);
     op->tid = last_tid.inc();
+    s->ops[op->tid] = op;
 
     _send_op(op);
     s->lock.unlock();
@@ -4058,6 +4435,25 @@ void Objecter::_dump_ops(const OSDSession *s, Formatter *fmt)
   }
 }
 
+void Objecter::dump_osd_latency(Formatter *fmt)
+{
+  assert(rwlock.is_locked());
+  fmt->open_array_section("osds");
+  for (map<int, OSDSession *>::const_iterator p = osd_sessions.begin();
+       p != osd_sessions.end();
+       ++p) {
+    OSDSession *s = p->second;
+    fmt->open_object_section("osd");
+    fmt->dump_int("osd", s->osd);
+    fmt->dump_unsigned("read_latency_us", s->read_latency_us.read());
+    fmt->dump_unsigned("read_samples", s->read_samples.read());
+    fmt->dump_unsigned("ops_in_flight", s->num_ops.read());
+    fmt->dump_unsigned("replica_reads", s->replica_reads.read());
+    fmt->close_section();
+  }
+  fmt->close_section();
+}
+
 void Objecter::dump_ops(Formatter *fmt)
 {
   fmt->open_array_section("ops");
@@ -4211,7 +4607,10 @@ bool Objecter::RequestStateHook::call(std::string command, cmdmap_t& cmdmap,
   if (!f)
     f = new_formatter("json-pretty");
   RWLock::RLocker rl(m_objecter->rwlock);
-  m_objecter->dump_requests(f);
+  if (command == "objecter_osd_latency")
+    m_objecter->dump_osd_latency(f);
+  else
+    m_objecter->dump_requests(f);
   f->flush(out);
   delete f;
   return true;
@@ -4513,10 +4912,11 @@ void Objecter::set_epoch_barrier(epoch_t epoch)
 {
   RWLock::WLocker wl(rwlock);
 
-  ldout(cct, 7) << __func__ << ": barrier " << epoch << " (was " << epoch_barrier
-                << ") current epoch " << osdmap->get_epoch() << dendl;
-  if (epoch >= epoch_barrier) {
-    epoch_barrier = epoch;
+  ldout(cct, 7) << __func__ << ": barrier " << epoch << " (was "
+		<< epoch_barrier.read() << ") current epoch "
+		<< osdmap->get_epoch() << dendl;
+  if (epoch >= epoch_barrier.read()) {
+    epoch_barrier.set(epoch);
     _maybe_request_map();
   }
 }
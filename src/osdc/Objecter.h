@@ -24,6 +24,7 @@
 #include "common/admin_socket.h"
 #include "common/Timer.h"
 #include "common/RWLock.h"
+#include "common/RCU.h"
 #include "include/rados/rados_types.hpp"
 
 #include <list>
@@ -1637,12 +1638,21 @@ public:
     int incarnation;
     int num_locks;
     ConnectionRef con;
+    /// epoch our ops were last checked against (see MapSnapshot)
+    epoch_t map_epoch;
+
+    // load, for balancing reads; read without lock by calc_target()
+    atomic_t num_ops;          ///< ops.size()
+    atomic_t read_latency_us;  ///< moving average of read reply times
+    atomic_t read_samples;
+    atomic_t replica_reads;    ///< reads sent to us as a replica
 
     OSDSession(CephContext *cct, int o) :
       lock("OSDSession"),
       osd(o),
       incarnation(0),
-      con(NULL)
+      con(NULL),
+      map_epoch(0)
     {
       num_locks = cct->_conf->objecter_completion_locks_per_session;
       completion_locks = new Mutex *[num_locks];
@@ -1661,6 +1671,23 @@ public:
 
   bool osdmap_full_flag() const;
 
+  static int choose_read_replica(CephContext *cct, const OSDMap *map,
+				 const pg_pool_t *pi,
+				 const vector<int>& up,
+				 const vector<int>& acting,
+				 int acting_primary,
+				 const std::multimap<string,string> *localize_to,
+				 const vector<OSDSession*>& acting_sessions);
+  static uint64_t read_load(const OSDMap *map, int osd, const OSDSession *s);
+
+  int calc_target(const OSDMap *map, op_target_t *t, bool any_change,
+		  const vector<OSDSession*> *sessions=NULL);
+  /// send op through map and sessions (a published snapshot), or leave
+  /// it untouched for _op_submit() and return false
+  bool op_submit_in_snapshot(const OSDMap *map,
+			     const vector<OSDSession*>& sessions,
+			     Op *op, ceph_tid_t *ptid);
+
  private:
   map<uint64_t, LingerOp*>  linger_ops;
   // we use this just to confirm a cookie is valid before dereferencing the ptr
@@ -1676,6 +1703,33 @@ public:
 
   OSDSession *homeless_session;
 
+  /**
+   * What op_submit() needs to send an op without taking rwlock: a
+   * private copy of the osdmap and the open sessions, indexed by osd.
+   *
+   * A snapshot is published through published_map by _publish_map(),
+   * with rwlock held for write, and never changes afterwards.  The
+   * osdmap it copies may move on while it is still published: ops are
+   * only added to a session through a snapshot at least as new as the
+   * session's map_epoch, which _scan_requests() advances under the
+   * session lock, so an op either is seen by the scan for the next map
+   * or goes through the slow path.  Replaced snapshots are freed by
+   * reclaim_maps() once no RCU reader can still see them.
+   */
+  struct MapSnapshot {
+    OSDMapRef map;  ///< shared by snapshots of the same epoch
+    vector<OSDSession*> sessions;  ///< referenced; NULL if not open
+  };
+  RCU map_rcu;
+  RCUPointer<MapSnapshot> published_map;
+  Mutex retired_maps_lock;
+  list<MapSnapshot*> retired_maps;  ///< protected by retired_maps_lock
+
+  void _publish_map();
+  void _unpublish_map();
+  void reclaim_maps();
+  bool op_submit_fast(Op *op, ceph_tid_t *ptid);
+
   // ops waiting for an osdmap with a new pool or confirmation that
   // the pool does not exist (may be expanded to other uses later)
   map<uint64_t, LingerOp*>       check_latest_map_lingers;
@@ -1686,7 +1740,11 @@ public:
 
   double mon_timeout, osd_timeout;
 
-  MOSDOp *_prepare_osd_op(Op *op);
+  MOSDOp *prepare_osd_op(Op *op, epoch_t epoch);
+  MOSDOp *_prepare_osd_op(Op *op) {
+    assert(rwlock.is_locked());
+    return prepare_osd_op(op, osdmap->get_epoch());
+  }
   void _send_op(Op *op, MOSDOp *m = NULL);
   void _send_op_account(Op *op);
   void _cancel_linger_op(Op *op);
@@ -1705,10 +1763,21 @@ public:
     RECALC_OP_TARGET_OSD_DNE,
     RECALC_OP_TARGET_OSD_DOWN,
   };
-  bool _osdmap_full_flag() const;
+  bool map_full_flag(const OSDMap *map) const;
+  bool _osdmap_full_flag() const {
+    return map_full_flag(osdmap);
+  }
 
-  bool target_should_be_paused(op_target_t *op);
-  int _calc_target(op_target_t *t, bool any_change=false);
+  bool target_should_be_paused(const OSDMap *map, op_target_t *op);
+  int _calc_target(op_target_t *t, bool any_change=false) {
+    assert(rwlock.is_locked());
+    return calc_target(osdmap, t, any_change);
+  }
+  int pick_read_replica(const OSDMap *map, const pg_pool_t *pi,
+			const vector<int>& up, const vector<int>& acting,
+			int acting_primary, bool localize,
+			const vector<OSDSession*> *sessions);
+  void update_read_latency(OSDSession *s, Op *op);
   int _map_session(op_target_t *op, OSDSession **s,
 		   RWLock::Context& lc);
 
@@ -1799,6 +1868,19 @@ private:
     op->budgeted = true;
     return op_budget;
   }
+  /// like _take_op_budget(), for callers that do not hold rwlock
+  int take_op_budget(Op *op) {
+    int op_budget = calc_op_budget(op);
+    if (keep_balanced_budget) {
+      op_throttle_bytes.get(op_budget);
+      op_throttle_ops.get(1);
+    } else {
+      op_throttle_bytes.take(op_budget);
+      op_throttle_ops.take(1);
+    }
+    op->budgeted = true;
+    return op_budget;
+  }
   void put_op_budget_bytes(int op_budget) {
     assert(op_budget >= 0);
     op_throttle_bytes.put(op_budget);
@@ -1837,6 +1919,7 @@ private:
     linger_callback_lock("Objecter::linger_callback_lock"),
     num_homeless_ops(0),
     homeless_session(new OSDSession(cct, -1)),
+    retired_maps_lock("Objecter::retired_maps_lock"),
     mon_timeout(mon_timeout),
     osd_timeout(osd_timeout),
     op_throttle_bytes(cct, "objecter_bytes", cct->_conf->objecter_inflight_op_bytes),
@@ -1902,6 +1985,7 @@ private:
   void handle_osd_op_reply(class MOSDOpReply *m);
   void handle_watch_notify(class MWatchNotify *m);
   void handle_osd_map(class MOSDMap *m);
+  void _handle_osd_map(class MOSDMap *m);
   void wait_for_osd_map();
 
   int pool_snap_by_name(int64_t poolid, const char *snap_name, snapid_t *snap);
@@ -1913,6 +1997,7 @@ private:
   // low-level
   ceph_tid_t _op_submit(Op *op, RWLock::Context& lc);
   ceph_tid_t _op_submit_with_budget(Op *op, RWLock::Context& lc, int *ctx_budget = NULL);
+  void add_op_timeout(Op *op, ceph_tid_t tid);
   inline void unregister_op(Op *op);
 
   // public interface
@@ -1929,6 +2014,7 @@ public:
   void _dump_active();
   void dump_active();
   void dump_requests(Formatter *fmt);
+  void dump_osd_latency(Formatter *fmt);
   void _dump_ops(const OSDSession *s, Formatter *fmt);
   void dump_ops(Formatter *fmt);
   void _dump_linger_ops(const OSDSession *s, Formatter *fmt);
@@ -2541,7 +2627,7 @@ public:
   void blacklist_self(bool set);
 
 private:
-  epoch_t epoch_barrier;
+  atomic_t epoch_barrier;  ///< read by the op_submit() fast path
 public:
   void set_epoch_barrier(epoch_t epoch);
 };
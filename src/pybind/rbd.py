@@ -27,6 +27,7 @@ ADMIN_AUID = 0
 
 RBD_FEATURE_LAYERING = 1
 RBD_FEATURE_STRIPINGV2 = 2
+RBD_FEATURE_OBJECT_MAP = 4
 
 class Error(Exception):
     pass
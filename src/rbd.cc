@@ -35,6 +35,7 @@
 #include <boost/scope_exit.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <errno.h>
+#include <iomanip>
 #include <iostream>
 #include <memory>
 #include <sstream>
@@ -124,6 +125,10 @@ void usage()
 "  lock list <image-name>                      show locks held on an image\n"
 "  lock add <image-name> <id> [--shared <tag>] take a lock called id on an image\n"
 "  lock remove <image-name> <id> <locker>      release a lock on an image\n"
+"  object-map check <image-name>               verify the object map of an\n"
+"                                              image against its objects\n"
+"  object-map rebuild <image-name>             rebuild the object map of an\n"
+"                                              image from its objects\n"
 "  bench-write <image-name>                    simple write benchmark\n"
 "                 --io-size <bytes>              write size\n"
 "                 --io-threads <num>             ios in flight\n"
@@ -165,6 +170,8 @@ static string feature_str(uint64_t feature)
     return "layering";
   case RBD_FEATURE_STRIPINGV2:
     return "striping";
+  case RBD_FEATURE_OBJECT_MAP:
+    return "object map";
   default:
     return "";
   }
@@ -174,7 +181,7 @@ static string features_str(uint64_t features)
 {
   string s = "";
 
-  for (uint64_t feature = 1; feature <= RBD_FEATURE_STRIPINGV2;
+  for (uint64_t feature = 1; feature <= RBD_FEATURE_OBJECT_MAP;
        feature <<= 1) {
     if (feature & features) {
       if (s.size())
@@ -188,7 +195,7 @@ static string features_str(uint64_t features)
 static void format_features(Formatter *f, uint64_t features)
 {
   f->open_array_section("features");
-  for (uint64_t feature = 1; feature <= RBD_FEATURE_STRIPINGV2;
+  for (uint64_t feature = 1; feature <= RBD_FEATURE_OBJECT_MAP;
        feature <<= 1) {
     f->dump_string("feature", feature_str(feature));
   }
@@ -198,8 +205,10 @@ static void format_features(Formatter *f, uint64_t features)
 struct MyProgressContext : public librbd::ProgressContext {
   const char *operation;
   int last_pc;
+  utime_t start;
 
-  MyProgressContext(const char *o) : operation(o), last_pc(0) {
+  MyProgressContext(const char *o) : operation(o), last_pc(0),
+				     start(ceph_clock_now(NULL)) {
   }
 
   int update_progress(uint64_t offset, uint64_t total) {
@@ -220,6 +229,19 @@ struct MyProgressContext : public librbd::ProgressContext {
       cerr << "\r" << operation << ": 100% complete...done." << std::endl;
     }
   }
+  // also report the throughput of an operation that moved bytes
+  void finish(uint64_t bytes) {
+    if (progress) {
+      double elapsed = ceph_clock_now(NULL) - start;
+      ostringstream oss;
+      oss << prettybyte_t(bytes) << " in " << std::fixed
+	  << std::setprecision(1) << elapsed << " s";
+      if (elapsed > 0)
+	oss << " (" << prettybyte_t(bytes / elapsed) << "/s)";
+      cerr << "\r" << operation << ": 100% complete...done, " << oss.str()
+	   << "." << std::endl;
+    }
+  }
   void fail() {
     if (progress) {
       cerr << "\r" << operation << ": " << last_pc << "% complete...failed."
@@ -468,6 +490,36 @@ static int do_flatten(librbd::Image& image)
   return 0;
 }
 
+static int do_check_object_map(librbd::Image& image)
+{
+  MyProgressContext pc("Checking object map");
+  uint64_t inconsistent = 0;
+  int r = image.check_object_map(pc, &inconsistent);
+  if (r < 0) {
+    pc.fail();
+    return r;
+  }
+  pc.finish();
+  if (inconsistent) {
+    cerr << "rbd: " << inconsistent << " objects missing from object map"
+	 << std::endl;
+    return -EIO;
+  }
+  return 0;
+}
+
+static int do_rebuild_object_map(librbd::Image& image)
+{
+  MyProgressContext pc("Rebuilding object map");
+  int r = image.rebuild_object_map(pc);
+  if (r < 0) {
+    pc.fail();
+    return r;
+  }
+  pc.finish();
+  return 0;
+}
+
 static int do_rename(librbd::RBD &rbd, librados::IoCtx& io_ctx,
 		     const char *imgname, const char *destname)
 {
@@ -1013,22 +1065,94 @@ struct ExportContext {
   {}
 };
 
+/**
+ * Write exported extents to a stream (which cannot seek) in order,
+ * although the reads complete out of order.  An extent keeps its
+ * throttle slot until it has been written, so the data buffered here
+ * is bounded by the throttle.
+ */
+class OrderedExportWriter
+{
+public:
+  OrderedExportWriter(SimpleThrottle &simple_throttle, int fd)
+    : m_lock("OrderedExportWriter::m_lock"),
+      m_throttle(simple_throttle),
+      m_fd(fd),
+      m_next_offset(0),
+      m_ret(0)
+  {
+  }
+
+  void complete(uint64_t offset, bufferlist &bl, int r)
+  {
+    Mutex::Locker l(m_lock);
+    if (r < 0)
+      fail(r);
+    if (m_ret < 0) {
+      m_throttle.end_op(r);
+      return;
+    }
+
+    m_pending[offset].claim(bl);
+    while (!m_pending.empty() && m_pending.begin()->first == m_next_offset) {
+      bufferlist &next = m_pending.begin()->second;
+      r = next.write_fd(m_fd);
+      if (r < 0) {
+	cerr << "rbd: error writing to destination image at offset "
+	     << m_next_offset << std::endl;
+      }
+      m_next_offset += next.length();
+      m_pending.erase(m_pending.begin());
+      m_throttle.end_op(r);
+      if (r < 0) {
+	fail(r);
+	break;
+      }
+    }
+  }
+
+private:
+  Mutex m_lock;
+  SimpleThrottle &m_throttle;
+  int m_fd;
+  uint64_t m_next_offset;
+  map<uint64_t, bufferlist> m_pending;
+  int m_ret;
+
+  // nothing after a failed extent can be written: release the slots
+  // of the extents waiting for it
+  void fail(int r)
+  {
+    if (m_ret == 0)
+      m_ret = r;
+    for (map<uint64_t, bufferlist>::iterator p = m_pending.begin();
+	 p != m_pending.end(); ++p)
+      m_throttle.end_op(0);
+    m_pending.clear();
+  }
+};
+
 class AioExportContext : public Context
 {
 public:
   AioExportContext(SimpleThrottle &simple_throttle, librbd::Image &image,
-                   uint64_t offset, uint64_t length, int fd)
+                   uint64_t offset, uint64_t length, int fd,
+                   OrderedExportWriter *writer)
     : m_aio_completion(
         new librbd::RBD::AioCompletion(this, &AioExportContext::aio_callback)),
       m_throttle(simple_throttle),
       m_offset(offset),
-      m_fd(fd)
+      m_fd(fd),
+      m_writer(writer)
   {
     m_throttle.start_op();
     int r = image.aio_read(offset, length, m_bufferlist, m_aio_completion);
     if (r < 0) {
       cerr << "rbd: error requesting read from source image" << std::endl;
-      m_throttle.end_op(r);
+      if (m_writer)
+        m_writer->complete(m_offset, m_bufferlist, r);
+      else
+        m_throttle.end_op(r);
     }
   }
 
@@ -1039,6 +1163,15 @@ public:
 
   virtual void finish(int r)
   {
+    if (m_writer) {
+      if (r < 0) {
+        cerr << "rbd: error reading from source image at offset "
+             << m_offset << ": " << cpp_strerror(r) << std::endl;
+      }
+      m_writer->complete(m_offset, m_bufferlist, r);
+      return;
+    }
+
     BOOST_SCOPE_EXIT((&m_throttle) (&r))
     {
       m_throttle.end_op(r);
@@ -1086,6 +1219,7 @@ private:
   bufferlist m_bufferlist;
   uint64_t m_offset;
   int m_fd;
+  OrderedExportWriter *m_writer;
 };
 
 static int do_export(librbd::Image& image, const char *path)
@@ -1096,13 +1230,10 @@ static int do_export(librbd::Image& image, const char *path)
     return r;
 
   int fd;
-  int max_concurrent_ops;
   bool to_stdout = (strcmp(path, "-") == 0);
   if (to_stdout) {
     fd = STDOUT_FILENO;
-    max_concurrent_ops = 1;
   } else {
-    max_concurrent_ops = max(g_conf->rbd_concurrent_management_ops, 1);
     fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
     if (fd < 0) {
       return -errno;
@@ -1111,11 +1242,17 @@ static int do_export(librbd::Image& image, const char *path)
 
   MyProgressContext pc("Exporting image");
 
-  SimpleThrottle throttle(max_concurrent_ops, false);
+  // a stream is written in order as reads complete, so it can use the
+  // same window of reads in flight as a file
+  SimpleThrottle throttle(max(g_conf->rbd_concurrent_management_ops, 1),
+			  false);
+  boost::scoped_ptr<OrderedExportWriter> writer;
+  if (to_stdout)
+    writer.reset(new OrderedExportWriter(throttle, fd));
   uint64_t period = image.get_stripe_count() * (1ull << info.order);
   for (uint64_t offset = 0; offset < info.size; offset += period) {
     uint64_t length = min(period, info.size - offset);
-    new AioExportContext(throttle, image, offset, length, fd);
+    new AioExportContext(throttle, image, offset, length, fd, writer.get());
     pc.update_progress(offset, info.size);
   }
 
@@ -1130,7 +1267,7 @@ static int do_export(librbd::Image& image, const char *path)
   if (r < 0) {
     pc.fail();
   } else {
-    pc.finish();
+    pc.finish(info.size);
   }
   return r;
 }
@@ -1422,15 +1559,13 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
   size_t blklen = 0;		// amount accumulated from reads to fill blk
   librbd::Image image;
 
-  boost::scoped_ptr<SimpleThrottle> throttle;
+  SimpleThrottle throttle(max(g_conf->rbd_concurrent_management_ops, 1),
+			  false);
   bool from_stdin = !strcmp(path, "-");
   if (from_stdin) {
-    throttle.reset(new SimpleThrottle(1, false));
     fd = 0;
     size = 1ULL << *order;
   } else {
-    throttle.reset(new SimpleThrottle(
-      max(g_conf->rbd_concurrent_management_ops, 1), false));
     if ((fd = open(path, O_RDONLY)) < 0) {
       r = -errno;
       cerr << "rbd: error opening " << path << std::endl;
@@ -1487,6 +1622,11 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
     bl.append(p, blklen);
     // resize output image by binary expansion as we go for stdin
     if (from_stdin && (image_pos + (size_t)blklen) > size) {
+      // let the writes in flight finish before growing the image;
+      // with the size doubling each time this happens rarely
+      r = throttle.wait_for_ret();
+      if (r < 0)
+	goto done;
       size *= 2;
       r = image.resize(size);
       if (r < 0) {
@@ -1498,7 +1638,7 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
     // write as much as we got; perhaps less than imgblklen
     // but skip writing zeros to create sparse images
     if (!bl.is_zero()) {
-      new AioImportContext(*throttle, image, bl, image_pos);
+      new AioImportContext(throttle, image, bl, image_pos);
     }
 
     // done with whole block, whether written or not
@@ -1509,7 +1649,7 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
     blklen = 0;
     reqlen = imgblklen;
   }
-  r = throttle->wait_for_ret();
+  r = throttle.wait_for_ret();
   if (r < 0) {
     goto done;
   }
@@ -1529,7 +1669,7 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
     if (r < 0)
       pc.fail();
     else
-      pc.finish();
+      pc.finish(image_pos);
     close(fd);
   }
  done2:
@@ -1717,7 +1857,9 @@ static int do_copy(librbd::Image &src, librados::IoCtx& dest_pp,
     pc.fail();
     return r;
   }
-  pc.finish();
+  uint64_t size = 0;
+  src.size(&size);
+  pc.finish(size);
   return 0;
 }
 
@@ -1964,12 +2106,15 @@ enum {
   OPT_LOCK_LIST,
   OPT_LOCK_ADD,
   OPT_LOCK_REMOVE,
+  OPT_OBJECT_MAP_CHECK,
+  OPT_OBJECT_MAP_REBUILD,
   OPT_BENCH_WRITE,
 };
 
-static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd)
+static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd,
+		   bool objmapcmd)
 {
-  if (!snapcmd && !lockcmd) {
+  if (!snapcmd && !lockcmd && !objmapcmd) {
     if (strcmp(cmd, "ls") == 0 ||
         strcmp(cmd, "list") == 0)
       return OPT_LIST;
@@ -2032,6 +2177,11 @@ static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd)
       return OPT_SNAP_PROTECT;
     if (strcmp(cmd, "unprotect") == 0)
       return OPT_SNAP_UNPROTECT;
+  } else if (objmapcmd) {
+    if (strcmp(cmd, "check") == 0)
+      return OPT_OBJECT_MAP_CHECK;
+    if (strcmp(cmd, "rebuild") == 0)
+      return OPT_OBJECT_MAP_REBUILD;
   } else {
     if (strcmp(cmd, "ls") == 0 ||
         strcmp(cmd, "list") == 0)
@@ -2222,16 +2372,23 @@ int main(int argc, const char **argv)
       cerr << "rbd: which snap command do you want?" << std::endl;
       return EXIT_FAILURE;
     }
-    opt_cmd = get_cmd(*i, true, false);
+    opt_cmd = get_cmd(*i, true, false, false);
   } else if (strcmp(*i, "lock") == 0) {
     i = args.erase(i);
     if (i == args.end()) {
       cerr << "rbd: which lock command do you want?" << std::endl;
       return EXIT_FAILURE;
     }
-    opt_cmd = get_cmd(*i, false, true);
+    opt_cmd = get_cmd(*i, false, true, false);
+  } else if (strcmp(*i, "object-map") == 0) {
+    i = args.erase(i);
+    if (i == args.end()) {
+      cerr << "rbd: which object-map command do you want?" << std::endl;
+      return EXIT_FAILURE;
+    }
+    opt_cmd = get_cmd(*i, false, false, true);
   } else {
-    opt_cmd = get_cmd(*i, false, false);
+    opt_cmd = get_cmd(*i, false, false, false);
   }
   if (opt_cmd == OPT_NO_CMD) {
     cerr << "rbd: error parsing command '" << *i << "'; -h or --help for usage" << std::endl;
@@ -2272,6 +2429,8 @@ if (!set_conf_param(v, p1, p2, p3)) { \
       case OPT_BENCH_WRITE:
       case OPT_LOCK_LIST:
       case OPT_DIFF:
+      case OPT_OBJECT_MAP_CHECK:
+      case OPT_OBJECT_MAP_REBUILD:
 	SET_CONF_PARAM(v, &imgname, NULL, NULL);
 	break;
       case OPT_UNMAP:
@@ -2499,11 +2658,14 @@ if (!set_conf_param(v, p1, p2, p3)) { \
        opt_cmd == OPT_IMPORT_DIFF ||
        opt_cmd == OPT_EXPORT || opt_cmd == OPT_EXPORT_DIFF || opt_cmd == OPT_COPY ||
        opt_cmd == OPT_DIFF ||
-       opt_cmd == OPT_CHILDREN || opt_cmd == OPT_LOCK_LIST)) {
+       opt_cmd == OPT_CHILDREN || opt_cmd == OPT_LOCK_LIST ||
+       opt_cmd == OPT_OBJECT_MAP_CHECK ||
+       opt_cmd == OPT_OBJECT_MAP_REBUILD)) {
 
     if (opt_cmd == OPT_INFO || opt_cmd == OPT_SNAP_LIST ||
 	opt_cmd == OPT_EXPORT || opt_cmd == OPT_EXPORT || opt_cmd == OPT_COPY ||
-	opt_cmd == OPT_CHILDREN || opt_cmd == OPT_LOCK_LIST) {
+	opt_cmd == OPT_CHILDREN || opt_cmd == OPT_LOCK_LIST ||
+	opt_cmd == OPT_OBJECT_MAP_CHECK) {
       r = rbd.open_read_only(io_ctx, image, imgname, NULL);
     } else {
       r = rbd.open(io_ctx, image, imgname);
@@ -2598,6 +2760,24 @@ if (!set_conf_param(v, p1, p2, p3)) { \
     }
     break;
 
+  case OPT_OBJECT_MAP_CHECK:
+    r = do_check_object_map(image);
+    if (r < 0) {
+      cerr << "rbd: object map check failed: " << cpp_strerror(-r)
+	   << std::endl;
+      return -r;
+    }
+    break;
+
+  case OPT_OBJECT_MAP_REBUILD:
+    r = do_rebuild_object_map(image);
+    if (r < 0) {
+      cerr << "rbd: object map rebuild failed: " << cpp_strerror(-r)
+	   << std::endl;
+      return -r;
+    }
+    break;
+
   case OPT_RENAME:
     r = do_rename(rbd, io_ctx, imgname, destname);
     if (r < 0) {
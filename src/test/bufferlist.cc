@@ -610,6 +610,19 @@ TEST(BufferPtr, is_zero) {
     const bufferptr ptr(buffer::create_static(1, str));
     EXPECT_TRUE(ptr.is_zero());
   }
+  {
+    // a single set byte anywhere, including the prefix boundary
+    const unsigned len = 4099;
+    bufferptr ptr(buffer::create(len));
+    ptr.zero();
+    EXPECT_TRUE(ptr.is_zero());
+    for (unsigned i = 0; i < len; ++i) {
+      ptr[i] = 1;
+      EXPECT_FALSE(ptr.is_zero()) << "byte " << i;
+      EXPECT_TRUE(bufferptr(ptr, 0, i).is_zero());
+      ptr[i] = 0;
+    }
+  }
 }
 
 TEST(BufferPtr, copy_out) {
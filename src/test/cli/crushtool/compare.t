@@ -0,0 +1,28 @@
+  $ CEPH_ARGS="--debug-crush 0" crushtool --outfn map --build --num_osds 20 node straw 5 root straw 0
+#
+# a map compared with itself moves nothing
+#
+  $ crushtool -i map --compare map --num-rep 3 --min-x 0 --max-x 1023
+  rule 0 \(.*\) num_rep 3: 0/1024 mappings changed, 0/[0-9]+ placements moved (re)
+  total: 0/1024 mappings changed \(0%\), 0/[0-9]+ placements moved \(0%\) (re)
+#
+# emptying a device moves what it held
+#
+  $ crushtool -i map --reweight-item osd.0 0 -o map.out > /dev/null
+  $ crushtool -i map --compare map.out --num-rep 3 --min-x 0 --max-x 1023
+  rule 0 \(.*\) num_rep 3: [1-9][0-9]*/1024 mappings changed, [1-9][0-9]*/[0-9]+ placements moved (re)
+  total: [1-9][0-9]*/1024 mappings changed \(.*%\), [1-9][0-9]*/[0-9]+ placements moved \(.*%\) (re)
+  $ crushtool -i map --test --show-mappings --num-rep 3 --min-x 0 --max-x 1023 | grep -c '\[0,\|,0,\|,0\]'
+  [1-9][0-9]* (re)
+  $ crushtool -i map.out --test --show-mappings --num-rep 3 --min-x 0 --max-x 1023 | grep -c '\[0,\|,0,\|,0\]'
+  0
+  [1]
+#
+# the mappings do not depend on the number of threads
+#
+  $ crushtool -i map --test --show-mappings --show-statistics --num-rep 3 --min-x 0 --max-x 8191 --threads 1 > one
+  $ crushtool -i map --test --show-mappings --show-statistics --num-rep 3 --min-x 0 --max-x 8191 --threads 4 > four
+  $ cmp one four
+  $ grep -c 'CRUSH rule 0 x' four
+  8192
+  $ rm -f map map.out one four
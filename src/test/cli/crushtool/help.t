@@ -6,7 +6,7 @@
                            specify output for for (de)compilation
      --build --num_osds N layer1 ...
                            build a new map, where each 'layer' is
-                             'name (uniform|straw|list|tree) size'
+                             'name (uniform|straw|straw2|list|tree) size'
      -i mapfn --test       test a range of inputs on the map
         [--min-x x] [--max-x x] [--x x]
         [--min-rule r] [--max-rule r] [--rule r]
@@ -17,6 +17,11 @@
         [--simulate]       simulate placements using a random
                            number generator in place of the CRUSH
                            algorithm
+        [--threads n]      map inputs with n threads
+     -i mapfn --compare mapfn2
+                           count the mappings that change when
+                           switching from mapfn to mapfn2; takes
+                           the same input ranges as --test
      -i mapfn --add-item id weight name [--loc type name ...]
                            insert an item into the hierarchy at the
                            given location
@@ -29,6 +34,10 @@
                            reweight a given item (and adjust ancestor
                            weights as needed)
      -i mapfn --reweight   recalculate all bucket weights
+     -i mapfn --test-reweight-item name weight
+                           report the data movement reweighting an
+                           item would cause with straw and with
+                           straw2 buckets; takes the --test ranges
      -i mapfn --show-location id
                            show location for given device id
      --show-utilization    show OSD usage
@@ -38,6 +47,8 @@
      --show-mappings       show mappings
      --show-bad-mappings   show bad mappings
      --show-choose-tries   show choose tries histogram
+     --show-utilization-stats
+                           show per rule utilization variance
      --set-choose-local-tries N
                            set choose local retries before re-descent
      --set-choose-local-fallback-tries N
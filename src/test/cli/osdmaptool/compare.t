@@ -0,0 +1,38 @@
+  $ CEPH_ARGS="--debug-crush 0" crushtool --outfn crushmap --build --num_osds 40 node straw 10 rack straw 10 root straw 0
+  $ osdmaptool --createsimple 40 --pg_bits 7 om > /dev/null
+  osdmaptool: osdmap file 'om'
+  $ osdmaptool --mark-up-in --import-crush crushmap om > /dev/null
+  osdmaptool: osdmap file 'om'
+#
+# a map compared with itself moves nothing
+#
+  $ cp om om.same
+  $ osdmaptool om --compare om.same
+  osdmaptool: osdmap file 'om'
+  pool 0 pg_num 5120: 0/5120 pgs remapped, 0/[0-9]+ replicas moved (re)
+  #osd\tgained (esc)
+   total 0/5120 pgs remapped \(0%\), 0/[0-9]+ replicas moved \(0%\) (re)
+#
+# emptying a device moves its pgs elsewhere
+#
+  $ crushtool -i crushmap --reweight-item osd.0 0 -o crushmap.out > /dev/null
+  $ cp om om.out
+  $ osdmaptool --import-crush crushmap.out om.out > /dev/null
+  osdmaptool: osdmap file 'om.out'
+  $ osdmaptool om --compare om.out > out
+  osdmaptool: osdmap file 'om'
+  $ grep -E '^pool 0 pg_num 5120: [1-9][0-9]*/5120 pgs remapped, [1-9][0-9]*/[0-9]+ replicas moved$' out > /dev/null
+  $ grep -P '^osd\.0\t' out
+  [1]
+#
+# the results do not depend on the number of threads
+#
+  $ osdmaptool om --compare om.out --threads 4 > out.threads
+  osdmaptool: osdmap file 'om'
+  $ cmp out out.threads
+  $ osdmaptool om --test-map-pgs-dump --threads 1 > one
+  osdmaptool: osdmap file 'om'
+  $ osdmaptool om --test-map-pgs-dump --threads 4 > four
+  osdmaptool: osdmap file 'om'
+  $ cmp one four
+  $ rm -f crushmap crushmap.out om om.same om.out out out.threads one four
@@ -5,6 +5,8 @@
      --import-crush <file>   replace osdmap's crush map with <file>
      --test-map-pgs [--pool <poolid>] map all pgs
      --test-map-pgs-dump [--pool <poolid>] map all pgs
+     --threads <n>           map pgs with n threads
+     --compare <file> [--pool <poolid>] count pgs whose up set differs in <file>
      --mark-up-in            mark osds up and in (but do not persist)
      --clear-temp            clear pg_temp and primary_temp
      --test-random           do random placements
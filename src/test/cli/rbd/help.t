@@ -46,6 +46,10 @@
     lock list <image-name>                      show locks held on an image
     lock add <image-name> <id> [--shared <tag>] take a lock called id on an image
     lock remove <image-name> <id> <locker>      release a lock on an image
+    object-map check <image-name>               verify the object map of an
+                                                image against its objects
+    object-map rebuild <image-name>             rebuild the object map of an
+                                                image from its objects
     bench-write <image-name>                    simple write benchmark
                    --io-size <bytes>              write size
                    --io-threads <num>             ios in flight
@@ -33,6 +33,9 @@ using ::librbd::cls_client::get_children;
 using ::librbd::cls_client::get_snapcontext;
 using ::librbd::cls_client::snapshot_list;
 using ::librbd::cls_client::copyup;
+using ::librbd::cls_client::object_map_update;
+using ::librbd::cls_client::object_map_snap_add;
+using ::librbd::cls_client::object_map_snap_remove;
 using ::librbd::cls_client::get_id;
 using ::librbd::cls_client::set_id;
 using ::librbd::cls_client::dir_get_id;
@@ -132,6 +135,111 @@ TEST_F(TestClsRbd, copyup)
   ioctx.close();
 }
 
+TEST_F(TestClsRbd, object_map_update)
+{
+  librados::IoCtx ioctx;
+  ASSERT_EQ(0, _rados.ioctx_create(_pool_name.c_str(), ioctx));
+
+  string oid = get_temp_image_name();
+  bufferlist bl;
+
+  // clearing bits of a missing map is a no-op
+  ASSERT_EQ(0, object_map_update(&ioctx, oid, 0, 100, 0));
+  ASSERT_EQ(-ENOENT, ioctx.stat(oid, NULL, NULL));
+
+  ASSERT_EQ(-EINVAL, object_map_update(&ioctx, oid, 10, 5, 1));
+  ASSERT_EQ(-EINVAL, object_map_update(&ioctx, oid, 0, 1, 3));
+
+  // setting bits grows the map as needed
+  ASSERT_EQ(0, object_map_update(&ioctx, oid, 3, 4, 1));
+  ASSERT_EQ(0, object_map_update(&ioctx, oid, 14, 18, 1));
+  ASSERT_EQ(3, ioctx.read(oid, bl, 0, 0));
+  ASSERT_EQ(0x08, (uint8_t)bl[0]);
+  ASSERT_EQ(0xc0, (uint8_t)bl[1]);
+  ASSERT_EQ(0x03, (uint8_t)bl[2]);
+
+  // clearing bits past the end does not grow it
+  ASSERT_EQ(0, object_map_update(&ioctx, oid, 15, 1000, 0));
+  bl.clear();
+  ASSERT_EQ(3, ioctx.read(oid, bl, 0, 0));
+  ASSERT_EQ(0x08, (uint8_t)bl[0]);
+  ASSERT_EQ(0x40, (uint8_t)bl[1]);
+  ASSERT_EQ(0x00, (uint8_t)bl[2]);
+
+  ASSERT_EQ(0, ioctx.remove(oid));
+  ioctx.close();
+}
+
+static void read_dirty_maps(librados::IoCtx &ioctx, const string &oid,
+			    map<string, bufferlist> *vals)
+{
+  vals->clear();
+  ASSERT_EQ(0, ioctx.omap_get_vals(oid, "", 100, vals));
+}
+
+TEST_F(TestClsRbd, object_map_dirty)
+{
+  librados::IoCtx ioctx;
+  ASSERT_EQ(0, _rados.ioctx_create(_pool_name.c_str(), ioctx));
+
+  string oid = get_temp_image_name();
+  map<string, bufferlist> vals;
+  bufferlist bl;
+
+  // every update marks its objects dirty in the head interval
+  ASSERT_EQ(0, object_map_update(&ioctx, oid, 1, 2, 1));
+  ASSERT_EQ(0, object_map_update(&ioctx, oid, 9, 10, 2));
+  read_dirty_maps(ioctx, oid, &vals);
+  ASSERT_EQ(1u, vals.size());
+  ASSERT_EQ(2u, vals["dirty_head"].length());
+  ASSERT_EQ(0x02, (uint8_t)vals["dirty_head"][0]);
+  ASSERT_EQ(0x02, (uint8_t)vals["dirty_head"][1]);
+
+  // touching an object does not change its existence bit
+  ASSERT_EQ(1, ioctx.read(oid, bl, 0, 0));
+  ASSERT_EQ(0x02, (uint8_t)bl[0]);
+
+  // adding a snapshot moves the head interval to it
+  ASSERT_EQ(0, object_map_snap_add(&ioctx, oid, 4));
+  read_dirty_maps(ioctx, oid, &vals);
+  ASSERT_EQ(1u, vals.size());
+  ASSERT_EQ(0x02, (uint8_t)vals["dirty_0000000000000004"][0]);
+
+  // an empty interval is still recorded
+  ASSERT_EQ(0, object_map_snap_add(&ioctx, oid, 6));
+  read_dirty_maps(ioctx, oid, &vals);
+  ASSERT_EQ(2u, vals.size());
+  ASSERT_EQ(0u, vals["dirty_0000000000000006"].length());
+
+  ASSERT_EQ(0, object_map_update(&ioctx, oid, 4, 5, 1));
+
+  // removing a snapshot folds its map into the following one
+  ASSERT_EQ(0, object_map_snap_remove(&ioctx, oid, 4, 16));
+  read_dirty_maps(ioctx, oid, &vals);
+  ASSERT_EQ(2u, vals.size());
+  ASSERT_EQ(0u, vals.count("dirty_0000000000000004"));
+  ASSERT_EQ(0x02, (uint8_t)vals["dirty_0000000000000006"][0]);
+  ASSERT_EQ(0x02, (uint8_t)vals["dirty_0000000000000006"][1]);
+  ASSERT_EQ(0x10, (uint8_t)vals["dirty_head"][0]);
+
+  // ... or into the head for the latest snapshot
+  ASSERT_EQ(0, object_map_snap_remove(&ioctx, oid, 6, 16));
+  read_dirty_maps(ioctx, oid, &vals);
+  ASSERT_EQ(1u, vals.size());
+  ASSERT_EQ(0x12, (uint8_t)vals["dirty_head"][0]);
+  ASSERT_EQ(0x02, (uint8_t)vals["dirty_head"][1]);
+
+  // a snapshot without a map marks every object dirty
+  ASSERT_EQ(0, object_map_snap_remove(&ioctx, oid, 8, 12));
+  read_dirty_maps(ioctx, oid, &vals);
+  ASSERT_EQ(1u, vals.size());
+  ASSERT_EQ(0xff, (uint8_t)vals["dirty_head"][0]);
+  ASSERT_EQ(0x0f, (uint8_t)vals["dirty_head"][1]);
+
+  ASSERT_EQ(0, ioctx.remove(oid));
+  ioctx.close();
+}
+
 TEST_F(TestClsRbd, get_and_set_id)
 {
   librados::IoCtx ioctx;
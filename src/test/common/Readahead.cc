@@ -128,3 +128,79 @@ TEST(Readahead, alignment) {
   ASSERT_RA(1400, 300, r.update(1290, 10, Readahead::NO_LIMIT)); // internal readahead size 320
   ASSERT_RA(0, 0, r.update(1300, 10, Readahead::NO_LIMIT));
 }
+
+TEST(Readahead, interleaved_streams) {
+  Readahead single;
+  single.set_trigger_requests(2);
+  ASSERT_RA(0, 0, single.update(1000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, single.update(5000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, single.update(1010, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, single.update(5010, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, single.update(1020, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, single.update(5020, 10, Readahead::NO_LIMIT));
+
+  Readahead r;
+  r.set_trigger_requests(2);
+  r.set_max_streams(3);
+  ASSERT_RA(0, 0, r.update(1000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(5000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1010, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(5010, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(1030, 20, r.update(1020, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(5030, 20, r.update(5020, 10, Readahead::NO_LIMIT));
+  // a random read takes the free slot, not an established stream
+  ASSERT_RA(0, 0, r.update(9000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(1050, 40, r.update(1030, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(5050, 40, r.update(5030, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1040, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(5040, 10, Readahead::NO_LIMIT));
+}
+
+TEST(Readahead, stride) {
+  Readahead r;
+  r.set_trigger_requests(2);
+  r.set_max_streams(2);
+  ASSERT_RA(0, 0, r.update(1000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1015, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(1040, 20, r.update(1030, 10, Readahead::NO_LIMIT));
+  // a different gap is not the same stream
+  ASSERT_RA(0, 0, r.update(1050, 10, Readahead::NO_LIMIT));
+
+  // gaps larger than the reads are not streams
+  Readahead sparse;
+  sparse.set_trigger_requests(2);
+  sparse.set_max_streams(2);
+  ASSERT_RA(0, 0, sparse.update(1000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, sparse.update(1030, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, sparse.update(1060, 10, Readahead::NO_LIMIT));
+}
+
+TEST(Readahead, adaptive) {
+  Readahead r;
+  r.set_trigger_requests(2);
+  r.set_max_readahead_size(1000);
+  r.set_adaptive(true);
+  // short scans whose readahead is never read shrink the window
+  // from 1000 down to its floor of 1000 / 16
+  for (uint64_t base = 10000; base <= 40000; base += 10000) {
+    ASSERT_RA(0, 0, r.update(base, 10, Readahead::NO_LIMIT));
+    ASSERT_RA(0, 0, r.update(base + 10, 10, Readahead::NO_LIMIT));
+    ASSERT_RA(base + 30, 20, r.update(base + 20, 10, Readahead::NO_LIMIT));
+  }
+  ASSERT_RA(0, 0, r.update(1000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1010, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(1030, 20, r.update(1020, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(1050, 40, r.update(1030, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1040, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1050, 10, Readahead::NO_LIMIT));
+  // internal readahead size 80, capped by the window
+  ASSERT_RA(1090, 62, r.update(1060, 10, Readahead::NO_LIMIT));
+
+  uint64_t hit, wasted;
+  r.get_stats(&hit, &wasted);
+  ASSERT_EQ(40u, hit);
+  ASSERT_EQ(80u, wasted);
+  r.get_stats(&hit, &wasted);
+  ASSERT_EQ(0u, hit);
+  ASSERT_EQ(0u, wasted);
+}
@@ -0,0 +1,115 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <sched.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/RCU.h"
+#include "common/Thread.h"
+#include "include/atomic.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+  class Synchronizer : public Thread {
+  public:
+    Synchronizer(RCU *r) : rcu(r) {}
+    void *entry() {
+      rcu->synchronize();
+      done.set(1);
+      return NULL;
+    }
+    RCU *rcu;
+    ceph::atomic_t done;
+  };
+
+  struct Value {
+    static const unsigned LIVE = 0x600dc0de;
+    unsigned magic;
+    Value() : magic(LIVE) {}
+    ~Value() { magic = 0; }
+  };
+
+  class Reader : public Thread {
+  public:
+    Reader(RCU *r, RCUPointer<Value> *p, ceph::atomic_t *s)
+      : rcu(r), ptr(p), stop(s), reads(0), bad(0) {}
+    void *entry() {
+      while (!stop->read()) {
+	unsigned token = rcu->read_lock();
+	Value *v = ptr->read();
+	if (v->magic != Value::LIVE)
+	  ++bad;
+	// give the writer a chance to free v under us if it could
+	if (reads.inc() % 64 == 0)
+	  sched_yield();
+	if (v->magic != Value::LIVE)
+	  ++bad;
+	rcu->read_unlock(token);
+      }
+      return NULL;
+    }
+    RCU *rcu;
+    RCUPointer<Value> *ptr;
+    ceph::atomic_t *stop;
+    ceph::atomic_t reads;
+    uint64_t bad;
+  };
+
+}
+
+TEST(RCU, synchronize_without_readers)
+{
+  RCU rcu;
+  rcu.synchronize();
+  rcu.synchronize();
+}
+
+TEST(RCU, synchronize_waits_for_reader)
+{
+  RCU rcu;
+  unsigned token = rcu.read_lock();
+
+  Synchronizer sync(&rcu);
+  sync.create();
+  usleep(100000);
+  ASSERT_EQ(0u, sync.done.read());
+
+  rcu.read_unlock(token);
+  sync.join();
+  ASSERT_EQ(1u, sync.done.read());
+}
+
+TEST(RCU, replace_and_free)
+{
+  RCU rcu;
+  RCUPointer<Value> ptr;
+  ptr.set(new Value);
+  ceph::atomic_t stop(0);
+
+  std::vector<Reader*> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.push_back(new Reader(&rcu, &ptr, &stop));
+    readers.back()->create();
+  }
+  for (unsigned i = 0; i < readers.size(); ++i) {
+    while (!readers[i]->reads.read())
+      usleep(1000);
+  }
+
+  for (int i = 0; i < 1000; ++i) {
+    Value *old = ptr.read();
+    ptr.set(new Value);
+    rcu.synchronize();
+    delete old;
+  }
+
+  stop.set(1);
+  for (unsigned i = 0; i < readers.size(); ++i) {
+    readers[i]->join();
+    ASSERT_EQ(0u, readers[i]->bad);
+    delete readers[i];
+  }
+  delete ptr.read();
+}
@@ -266,6 +266,48 @@ TEST(SharedCache_all, lru) {
   ASSERT_TRUE(cache.lookup(0));
 }
 
+TEST(SharedCache_all, lookup_or_create) {
+  SharedLRU<int, int> cache(NULL, 2);
+  {
+    shared_ptr<int> ptr = cache.lookup_or_create(1);
+    *ptr = 1;
+    ASSERT_EQ(ptr, cache.lookup_or_create(1));
+  }
+  // still cached after the last user reference is dropped
+  ASSERT_TRUE(cache.lookup(1));
+  ASSERT_EQ(1, *cache.lookup_or_create(1));
+
+  cache.lookup_or_create(2);
+  cache.lookup_or_create(3);
+  ASSERT_FALSE(cache.lookup(1));
+  ASSERT_EQ(0, *cache.lookup_or_create(1));
+}
+
+TEST(SharedCache_all, get_next_and_clear_all) {
+  SharedLRU<int, int> cache(NULL, 2);
+  shared_ptr<int> held = cache.add(5, new int(5));
+  for (int i = 0; i < 4; ++i)
+    cache.add(i, new int(i));
+
+  // entries referenced outside of the lru are still visited
+  pair<int, shared_ptr<int> > next;
+  next.first = -1;
+  vector<int> keys;
+  while (cache.get_next(next.first, &next))
+    keys.push_back(next.first);
+  next = pair<int, shared_ptr<int> >();
+  ASSERT_EQ(3u, keys.size());
+  ASSERT_EQ(2, keys[0]);
+  ASSERT_EQ(3, keys[1]);
+  ASSERT_EQ(5, keys[2]);
+
+  cache.clear();
+  ASSERT_FALSE(cache.empty());
+  ASSERT_FALSE(cache.lookup(3));
+  held = shared_ptr<int>();
+  ASSERT_TRUE(cache.empty());
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
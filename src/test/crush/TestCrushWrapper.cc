@@ -228,6 +228,137 @@ TEST(CrushWrapper, straw_same) {
   ASSERT_LT(ratio, .001);
 }
 
+TEST(CrushWrapper, straw2_distribution) {
+  // straw2 items should be chosen in proportion to their weight.
+
+  CrushWrapper *c = new CrushWrapper;
+  const int ROOT_TYPE = 1;
+  c->set_type_name(ROOT_TYPE, "root");
+  const int OSD_TYPE = 0;
+  c->set_type_name(OSD_TYPE, "osd");
+
+  int n = 10;
+  int items[n], weights[n];
+  int total_weight = 0;
+  for (int i=0; i <n; ++i) {
+    items[i] = i;
+    weights[i] = 0x10000 * (i%3 + 1);
+    total_weight += weights[i];
+  }
+
+  c->set_max_devices(n);
+
+  string root_name0("root0");
+  int root0;
+  EXPECT_EQ(0, c->add_bucket(0, CRUSH_BUCKET_STRAW2, CRUSH_HASH_RJENKINS1,
+			     ROOT_TYPE, n, items, weights, &root0));
+  EXPECT_EQ(0, c->set_item_name(root0, root_name0));
+  EXPECT_TRUE(c->has_v4_buckets());
+
+  string name0("rule0");
+  int ruleset0 = c->add_simple_ruleset(name0, root_name0, "osd",
+				       "firstn", pg_pool_t::TYPE_REPLICATED);
+  EXPECT_EQ(0, ruleset0);
+
+  vector<int> sum(n, 0);
+  vector<unsigned> reweight(n, 0x10000);
+  int max = 100000;
+  for (int i=0; i<max; ++i) {
+    vector<int> out;
+    c->do_rule(ruleset0, i, out, 1, reweight);
+    ASSERT_EQ(1u, out.size());
+    sum[out[0]]++;
+  }
+  for (int i=0; i<n; ++i) {
+    double expected = (double)max * weights[i] / total_weight;
+    ASSERT_LT(fabs(sum[i] - expected) / expected, .05);
+  }
+}
+
+TEST(CrushWrapper, straw2_reweight) {
+  // reweighting a straw2 item should only move inputs to or from that
+  // item; converting the same bucket to straw moves others as well.
+
+  CrushWrapper *c = new CrushWrapper;
+  const int ROOT_TYPE = 1;
+  c->set_type_name(ROOT_TYPE, "root");
+  const int OSD_TYPE = 0;
+  c->set_type_name(OSD_TYPE, "osd");
+
+  int n = 10;
+  int items[n], weights[n];
+  for (int i=0; i <n; ++i) {
+    items[i] = i;
+    weights[i] = 0x10000 * (i%3 + 1);
+  }
+
+  c->set_max_devices(n);
+
+  string root_name0("root0");
+  int root0;
+  EXPECT_EQ(0, c->add_bucket(0, CRUSH_BUCKET_STRAW2, CRUSH_HASH_RJENKINS1,
+			     ROOT_TYPE, n, items, weights, &root0));
+  EXPECT_EQ(0, c->set_item_name(root0, root_name0));
+  for (int i=0; i <n; ++i)
+    EXPECT_EQ(0, c->set_item_name(i, string("osd.") + stringify(i)));
+
+  string name0("rule0");
+  int ruleset0 = c->add_simple_ruleset(name0, root_name0, "osd",
+				       "firstn", pg_pool_t::TYPE_REPLICATED);
+  EXPECT_EQ(0, ruleset0);
+
+  vector<unsigned> reweight(n, 0x10000);
+  int max = 10000;
+  vector<vector<int> > before(max);
+  for (int i=0; i<max; ++i)
+    c->do_rule(ruleset0, i, before[i], 1, reweight);
+
+  EXPECT_LT(0, c->adjust_item_weightf(g_ceph_context, 4, 3.0));
+  int moved = 0;
+  for (int i=0; i<max; ++i) {
+    vector<int> out;
+    c->do_rule(ruleset0, i, out, 1, reweight);
+    ASSERT_EQ(1u, out.size());
+    if (out[0] != before[i][0]) {
+      moved++;
+      // osd.4 gained weight: inputs may only move to it
+      ASSERT_EQ(4, out[0]);
+    }
+  }
+  ASSERT_LT(0, moved);
+
+  // straw buckets keep the same items and weights, but map differently
+  // (and more disruptively)
+  EXPECT_EQ(0, c->bucket_set_alg(root0, CRUSH_BUCKET_STRAW));
+  EXPECT_EQ(CRUSH_BUCKET_STRAW, c->get_bucket_alg(root0));
+  EXPECT_EQ(n, c->get_bucket_size(root0));
+  EXPECT_EQ(0x10000 * 3, c->get_bucket_item_weight(root0, 4));
+  EXPECT_FALSE(c->has_v4_buckets());
+}
+
+TEST(CrushWrapper, straw2_remove_item) {
+  int items[2] = { 0, 1 };
+  int weights[2] = { 0x10000, 0x20000 };
+  crush_bucket *b = crush_make_bucket(NULL, CRUSH_BUCKET_STRAW2,
+				      CRUSH_HASH_RJENKINS1, 1, 2,
+				      items, weights);
+  ASSERT_TRUE(b != NULL);
+  ASSERT_EQ(-ENOENT, crush_bucket_remove_item(NULL, b, 2));
+  ASSERT_EQ(2u, b->size);
+
+  ASSERT_EQ(0, crush_bucket_remove_item(NULL, b, 1));
+  ASSERT_EQ(1u, b->size);
+  ASSERT_EQ(0x10000u, b->weight);
+  ASSERT_EQ(0, b->items[0]);
+
+  // removing the last item empties the bucket
+  ASSERT_EQ(0, crush_bucket_remove_item(NULL, b, 0));
+  ASSERT_EQ(0u, b->size);
+  ASSERT_EQ(0u, b->weight);
+  ASSERT_EQ(-ENOENT, crush_bucket_remove_item(NULL, b, 0));
+  crush_destroy_bucket(b);
+}
+
 TEST(CrushWrapper, move_bucket) {
   CrushWrapper *c = new CrushWrapper;
 
@@ -74,6 +74,7 @@ TYPE(ObjectRecoveryInfo)
 TYPE(ObjectRecoveryProgress)
 TYPE(ScrubMap::object)
 TYPE(ScrubMap)
+TYPE(pg_hash_tree_t)
 TYPE(pg_hit_set_info_t)
 TYPE(pg_hit_set_history_t)
 TYPE(osd_peer_stat_t)
@@ -10,6 +10,7 @@
 #include <string>
 #include <boost/scoped_ptr.hpp>
 #include <utility>
+#include <vector>
 
 using std::ostringstream;
 using namespace librados;
@@ -1592,6 +1593,180 @@ TEST(LibRadosAio, MultiWritePP) {
   delete my_completion3;
 }
 
+TEST(LibRadosAio, OpBatchingPP) {
+  AioTestDataPP test_data;
+  ASSERT_EQ("", test_data.init());
+  test_data.m_ioctx.set_op_batching(true);
+
+  // appends queue up behind the first one; the guarded one fails, and
+  // must neither fail the others nor be applied
+  const int num_ops = 64;
+  const int bad = num_ops / 2;
+  std::vector<AioCompletion*> completions;
+  bufferlist expected;
+  for (int i = 0; i < num_ops; ++i) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "op%04d", i);
+    bufferlist bl;
+    bl.append(buf, strlen(buf));
+    AioCompletion *c = test_data.m_cluster.aio_create_completion(0, 0, 0);
+    if (i == bad) {
+      ObjectWriteOperation op;
+      op.assert_version(1000000);
+      op.append(bl);
+      ASSERT_EQ(0, test_data.m_ioctx.aio_operate("foo", c, &op));
+    } else {
+      ASSERT_EQ(0, test_data.m_ioctx.aio_append("foo", c, bl, bl.length()));
+      expected.append(bl);
+    }
+    completions.push_back(c);
+  }
+  for (int i = 0; i < num_ops; ++i) {
+    {
+      TestAlarm alarm;
+      ASSERT_EQ(0, completions[i]->wait_for_safe());
+    }
+    if (i == bad)
+      ASSERT_GT(0, completions[i]->get_return_value());
+    else
+      ASSERT_EQ(0, completions[i]->get_return_value());
+    completions[i]->release();
+  }
+
+  // a read waits behind the appends queued ahead of it
+  AioCompletion *c = test_data.m_cluster.aio_create_completion(0, 0, 0);
+  AioCompletion *c2 = test_data.m_cluster.aio_create_completion(0, 0, 0);
+  bufferlist bl, bl2;
+  bl.append("tail");
+  bl2.append("tail2");
+  ASSERT_EQ(0, test_data.m_ioctx.aio_append("foo", c, bl, bl.length()));
+  ASSERT_EQ(0, test_data.m_ioctx.aio_append("foo", c2, bl2, bl2.length()));
+  expected.append(bl);
+  expected.append(bl2);
+  bufferlist out;
+  AioCompletion *rc = test_data.m_cluster.aio_create_completion(0, 0, 0);
+  ASSERT_EQ(0, test_data.m_ioctx.aio_read("foo", rc, &out, 1 << 20, 0));
+  {
+    TestAlarm alarm;
+    ASSERT_EQ(0, rc->wait_for_complete());
+  }
+  ASSERT_EQ((int)expected.length(), rc->get_return_value());
+  ASSERT_TRUE(expected.contents_equal(out));
+  ASSERT_EQ(0, c->wait_for_safe());
+  ASSERT_EQ(0, c2->wait_for_safe());
+  c->release();
+  c2->release();
+  rc->release();
+}
+
+struct SyncReadInCallback {
+  IoCtx *ioctx;
+  bufferlist bl;
+  int r;
+  sem_t sem;
+};
+
+static void sync_read_in_callback(rados_completion_t cb, void *arg)
+{
+  SyncReadInCallback *d = (SyncReadInCallback*)arg;
+  d->r = d->ioctx->read("foo", d->bl, 1 << 20, 0);
+  sem_post(&d->sem);
+}
+
+TEST(LibRadosAio, OpBatchingSyncReadInCallbackPP) {
+  AioTestDataPP test_data;
+  ASSERT_EQ("", test_data.init());
+  test_data.m_ioctx.set_op_batching(true);
+
+  // the first append's callback reads the object while the appends
+  // queued behind it are in flight; the read waits for them, so their
+  // commits must not need the thread running the callback
+  SyncReadInCallback d;
+  d.ioctx = &test_data.m_ioctx;
+  d.r = 0;
+  ASSERT_EQ(0, sem_init(&d.sem, 0, 0));
+  const int num_ops = 16;
+  std::vector<AioCompletion*> completions;
+  bufferlist expected;
+  for (int i = 0; i < num_ops; ++i) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "op%04d", i);
+    bufferlist bl;
+    bl.append(buf, strlen(buf));
+    AioCompletion *c = test_data.m_cluster.aio_create_completion(
+      i == 0 ? (void*)&d : 0, i == 0 ? sync_read_in_callback : 0, 0);
+    ASSERT_EQ(0, test_data.m_ioctx.aio_append("foo", c, bl, bl.length()));
+    expected.append(bl);
+    completions.push_back(c);
+  }
+  {
+    TestAlarm alarm;
+    sem_wait(&d.sem);
+  }
+  ASSERT_LT(0, d.r);
+  ASSERT_EQ((unsigned)d.r, d.bl.length());
+  ASSERT_EQ(0, memcmp(expected.c_str(), d.bl.c_str(), d.r));
+  for (int i = 0; i < num_ops; ++i) {
+    {
+      TestAlarm alarm;
+      ASSERT_EQ(0, completions[i]->wait_for_safe());
+    }
+    ASSERT_EQ(0, completions[i]->get_return_value());
+    completions[i]->release();
+  }
+  sem_destroy(&d.sem);
+}
+
+TEST(LibRadosAio, OpBatchingCmpXattrPP) {
+  AioTestDataPP test_data;
+  ASSERT_EQ("", test_data.init());
+  bufferlist attr;
+  attr.append("x");
+  ASSERT_EQ(0, test_data.m_ioctx.setxattr("foo", "guard", attr));
+  test_data.m_ioctx.set_op_batching(true);
+
+  // a failed cmpxattr makes the osd return -ECANCELED for the whole
+  // batch; that must not be mistaken for a local cancel, and the other
+  // ops in the batch must still be applied
+  const int num_ops = 8;
+  const int bad = num_ops / 2;
+  std::vector<AioCompletion*> completions;
+  bufferlist expected;
+  for (int i = 0; i < num_ops; ++i) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "op%04d", i);
+    bufferlist bl;
+    bl.append(buf, strlen(buf));
+    AioCompletion *c = test_data.m_cluster.aio_create_completion(0, 0, 0);
+    if (i == bad) {
+      bufferlist other;
+      other.append("y");
+      ObjectWriteOperation op;
+      op.cmpxattr("guard", LIBRADOS_CMPXATTR_OP_EQ, other);
+      op.append(bl);
+      ASSERT_EQ(0, test_data.m_ioctx.aio_operate("foo", c, &op));
+    } else {
+      ASSERT_EQ(0, test_data.m_ioctx.aio_append("foo", c, bl, bl.length()));
+      expected.append(bl);
+    }
+    completions.push_back(c);
+  }
+  for (int i = 0; i < num_ops; ++i) {
+    {
+      TestAlarm alarm;
+      ASSERT_EQ(0, completions[i]->wait_for_safe());
+    }
+    if (i == bad)
+      ASSERT_EQ(-ECANCELED, completions[i]->get_return_value());
+    else
+      ASSERT_EQ(0, completions[i]->get_return_value());
+    completions[i]->release();
+  }
+  bufferlist out;
+  ASSERT_EQ((int)expected.length(), test_data.m_ioctx.read("foo", out, 1 << 20, 0));
+  ASSERT_TRUE(expected.contents_equal(out));
+}
+
 // EC test cases
 class AioTestDataEC
 {
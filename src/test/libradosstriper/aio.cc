@@ -572,3 +572,42 @@ TEST_F(StriperTestPP, RoundTripWriteFullPP) {
   my_completion2->release();
   my_completion3->release();
 }
+
+TEST_F(StriperTestPP, RoundTripVectoredPP) {
+  AioTestData test_data;
+  AioCompletion *my_completion = librados::Rados::aio_create_completion
+    ((void*)&test_data, set_completion_complete, set_completion_safe);
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+  char buf2[64];
+  memset(buf2, 0xdd, sizeof(buf2));
+  std::vector<std::pair<uint64_t, bufferlist> > wextents(2);
+  wextents[0].first = 0;
+  wextents[0].second.append(buf, sizeof(buf));
+  wextents[1].first = 1000000000;
+  wextents[1].second.append(buf2, sizeof(buf2));
+  ASSERT_EQ(0, striper.aio_writev("RoundTripVectoredPP", my_completion, wextents));
+  {
+    TestAlarm alarm;
+    sem_wait(&test_data.m_sem);
+    sem_wait(&test_data.m_sem);
+  }
+  std::vector<std::pair<uint64_t, uint64_t> > rextents;
+  rextents.push_back(std::make_pair(1000000000, sizeof(buf2)));
+  rextents.push_back(std::make_pair(0, sizeof(buf)));
+  bufferlist bl;
+  AioCompletion *my_completion2 = librados::Rados::aio_create_completion
+    ((void*)&test_data, set_completion_complete, set_completion_safe);
+  ASSERT_EQ(0, striper.aio_readv("RoundTripVectoredPP", my_completion2, rextents, &bl));
+  {
+    TestAlarm alarm;
+    my_completion2->wait_for_complete();
+  }
+  ASSERT_EQ((int)(sizeof(buf) + sizeof(buf2)), my_completion2->get_return_value());
+  ASSERT_EQ(0, memcmp(bl.c_str(), buf2, sizeof(buf2)));
+  ASSERT_EQ(0, memcmp(bl.c_str()+sizeof(buf2), buf, sizeof(buf)));
+  sem_wait(&test_data.m_sem);
+  sem_wait(&test_data.m_sem);
+  my_completion->release();
+  my_completion2->release();
+}
@@ -135,6 +135,92 @@ TEST_F(StriperTestPP, SparseWriteRoundTripPP) {
   ASSERT_EQ(0, memcmp(bl2.c_str(), buf, sizeof(buf)));
 }
 
+TEST_F(StriperTestPP, VectoredRoundTripPP) {
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+  char buf2[64];
+  memset(buf2, 0xdd, sizeof(buf2));
+  // two extents in the same rados object, one far away
+  std::vector<std::pair<uint64_t, bufferlist> > wextents(3);
+  wextents[0].first = 0;
+  wextents[0].second.append(buf, sizeof(buf));
+  wextents[1].first = 1024;
+  wextents[1].second.append(buf2, sizeof(buf2));
+  wextents[2].first = 1000000000;
+  wextents[2].second.append(buf, sizeof(buf));
+  ASSERT_EQ(0, striper.writev("VectoredRoundTripPP", wextents));
+  uint64_t psize;
+  time_t pmtime;
+  ASSERT_EQ(0, striper.stat("VectoredRoundTripPP", &psize, &pmtime));
+  ASSERT_EQ(1000000000 + sizeof(buf), psize);
+  // the last extent is clipped to the size of the object
+  std::vector<std::pair<uint64_t, uint64_t> > rextents;
+  rextents.push_back(std::make_pair(1024, sizeof(buf2)));
+  rextents.push_back(std::make_pair(0, sizeof(buf)));
+  rextents.push_back(std::make_pair(500000000, sizeof(buf)));
+  rextents.push_back(std::make_pair(1000000000, 2*sizeof(buf)));
+  bufferlist bl;
+  ASSERT_EQ((int)(sizeof(buf2) + 3*sizeof(buf)),
+	    striper.readv("VectoredRoundTripPP", rextents, &bl));
+  ASSERT_EQ(0, memcmp(bl.c_str(), buf2, sizeof(buf2)));
+  ASSERT_EQ(0, memcmp(bl.c_str()+sizeof(buf2), buf, sizeof(buf)));
+  ASSERT_EQ(0, memcmp(bl.c_str()+sizeof(buf2)+2*sizeof(buf), buf, sizeof(buf)));
+  memset(buf, 0, sizeof(buf));
+  ASSERT_EQ(0, memcmp(bl.c_str()+sizeof(buf2)+sizeof(buf), buf, sizeof(buf)));
+}
+
+class StriperTestLocklessPP : public StriperTestPP
+{
+public:
+  StriperTestLocklessPP() {}
+  virtual ~StriperTestLocklessPP() {}
+protected:
+  // s_cluster is shared by the whole test case, so the setting must not
+  // outlive the test, even when it fails
+  virtual void SetUp() {
+    StriperTestPP::SetUp();
+    ASSERT_EQ(0, s_cluster.conf_set("rados_striper_lockless_reads", "true"));
+  }
+  virtual void TearDown() {
+    ASSERT_EQ(0, s_cluster.conf_set("rados_striper_lockless_reads", "false"));
+  }
+};
+
+TEST_F(StriperTestLocklessPP, LocklessReadPP) {
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl;
+  bl.append(buf, sizeof(buf));
+  ASSERT_EQ(0, striper.write("LocklessReadPP", bl, sizeof(buf), 0));
+  bufferlist cl;
+  ASSERT_EQ((int)sizeof(buf), striper.read("LocklessReadPP", &cl, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp(buf, cl.c_str(), sizeof(buf)));
+  ASSERT_EQ(-ENOENT, striper.read("nonexistent", &cl, sizeof(buf), 0));
+  // no lock is left behind, so the object can be truncated
+  ASSERT_EQ(0, striper.trunc("LocklessReadPP", sizeof(buf)/2));
+  ASSERT_EQ((int)sizeof(buf)/2, striper.read("LocklessReadPP", &cl, sizeof(buf), 0));
+}
+
+TEST_F(StriperTestLocklessPP, LocklessReadBusyPP) {
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl;
+  bl.append(buf, sizeof(buf));
+  ASSERT_EQ(0, striper.write("LocklessReadBusyPP", bl, sizeof(buf), 0));
+  // pretend a truncation or removal is in flight by holding the exclusive
+  // lock on the first rados object, as they do
+  std::string firstObj = "LocklessReadBusyPP.0000000000000000";
+  ASSERT_EQ(0, ioctx.lock_exclusive(firstObj, "striper.lock", "BusyCookie",
+				    "", NULL, 0));
+  // the lockless path sees the lock and falls back to taking the shared
+  // lock, which cannot be granted
+  bufferlist cl;
+  ASSERT_EQ(-EBUSY, striper.read("LocklessReadBusyPP", &cl, sizeof(buf), 0));
+  ASSERT_EQ(0, ioctx.unlock(firstObj, "striper.lock", "BusyCookie"));
+  ASSERT_EQ((int)sizeof(buf), striper.read("LocklessReadBusyPP", &cl, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp(buf, cl.c_str(), sizeof(buf)));
+}
+
 TEST_F(StriperTest, WriteFullRoundTrip) {
   char buf[128];
   char buf2[64];
@@ -0,0 +1,259 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Measure striped object throughput when a large buffer is written and
+ * read back as --extents pieces of --extent-size bytes, placed every
+ * --stride bytes, either with one aio call per piece (each of them
+ * opening and locking the striped object) or with a single vectored
+ * aio_writev()/aio_readv() call.  Reads are measured both with and
+ * without rados_striper_lockless_reads.
+ */
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "common/ceph_argparse.h"
+#include "common/common_init.h"
+#include "common/config.h"
+#include "common/Clock.h"
+#include "common/errno.h"
+#include "global/global_context.h"
+#include "global/global_init.h"
+#include "include/rados/librados.hpp"
+#include "include/radosstriper/libradosstriper.hpp"
+#include "include/stringify.h"
+
+using namespace librados;
+using namespace libradosstriper;
+
+static void usage()
+{
+  cerr << "usage: ceph_test_rados_striper_bench [options]\n"
+       << "  --pool <pool>             pool to use (default rbd)\n"
+       << "  --extents <n>             number of extents per call (default 256)\n"
+       << "  --extent-size <bytes>     size of each extent (default 64K)\n"
+       << "  --stride <bytes>          distance between extents (default extent size)\n"
+       << "  --iterations <n>          number of passes of each kind (default 4)\n"
+       << "  --stripe-unit <bytes>     striped object layout\n"
+       << "  --stripe-count <n>\n"
+       << "  --object-size <bytes>\n"
+       << std::endl;
+}
+
+struct Workload {
+  std::vector<std::pair<uint64_t, bufferlist> > wextents;
+  std::vector<std::pair<uint64_t, uint64_t> > rextents;
+  uint64_t bytes;
+};
+
+static int wait_and_release(std::vector<AioCompletion*>& completions)
+{
+  int r = 0;
+  for (unsigned i = 0; i < completions.size(); ++i) {
+    completions[i]->wait_for_safe();
+    int ret = completions[i]->get_return_value();
+    if (ret < 0 && r == 0)
+      r = ret;
+    completions[i]->release();
+  }
+  completions.clear();
+  return r;
+}
+
+static int write_pieces(RadosStriper& striper, const std::string& soid,
+			const Workload& w)
+{
+  std::vector<AioCompletion*> completions;
+  for (unsigned i = 0; i < w.wextents.size(); ++i) {
+    AioCompletion *c = Rados::aio_create_completion();
+    completions.push_back(c);
+    int r = striper.aio_write(soid, c, w.wextents[i].second,
+			      w.wextents[i].second.length(), w.wextents[i].first);
+    if (r < 0) {
+      wait_and_release(completions);
+      return r;
+    }
+  }
+  return wait_and_release(completions);
+}
+
+static int write_vectored(RadosStriper& striper, const std::string& soid,
+			  const Workload& w)
+{
+  std::vector<AioCompletion*> completions;
+  completions.push_back(Rados::aio_create_completion());
+  int r = striper.aio_writev(soid, completions.back(), w.wextents);
+  int ret = wait_and_release(completions);
+  return r < 0 ? r : ret;
+}
+
+static int read_pieces(RadosStriper& striper, const std::string& soid,
+		       const Workload& w)
+{
+  std::vector<AioCompletion*> completions;
+  std::vector<bufferlist> bls(w.rextents.size());
+  for (unsigned i = 0; i < w.rextents.size(); ++i) {
+    AioCompletion *c = Rados::aio_create_completion();
+    completions.push_back(c);
+    int r = striper.aio_read(soid, c, &bls[i], w.rextents[i].second,
+			     w.rextents[i].first);
+    if (r < 0) {
+      wait_and_release(completions);
+      return r;
+    }
+  }
+  return wait_and_release(completions);
+}
+
+static int read_vectored(RadosStriper& striper, const std::string& soid,
+			 const Workload& w)
+{
+  std::vector<AioCompletion*> completions;
+  completions.push_back(Rados::aio_create_completion());
+  bufferlist bl;
+  int r = striper.aio_readv(soid, completions.back(), w.rextents, &bl);
+  int ret = wait_and_release(completions);
+  return r < 0 ? r : ret;
+}
+
+typedef int (*bench_fn)(RadosStriper&, const std::string&, const Workload&);
+
+static int run(const char *name, bench_fn fn, RadosStriper& striper,
+	       const std::string& soid, const Workload& w, int iterations)
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int i = 0; i < iterations; ++i) {
+    int r = fn(striper, soid, w);
+    if (r < 0) {
+      cerr << name << " failed: " << cpp_strerror(r) << std::endl;
+      return r;
+    }
+  }
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+  double mbs = (double)(w.bytes * iterations) / elapsed / (1 << 20);
+  std::cout << std::setw(24) << name
+	    << std::setw(12) << std::fixed << std::setprecision(1) << mbs
+	    << std::setw(12) << std::setprecision(3) << elapsed / iterations * 1000
+	    << std::endl;
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  std::vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  std::string pool_name("rbd");
+  long long num_extents = 256;
+  long long extent_size = 64 << 10;
+  long long stride = 0;
+  long long iterations = 4;
+  long long stripe_unit = 0;
+  long long stripe_count = 0;
+  long long object_size = 0;
+  std::string val;
+  std::ostringstream err;
+  std::vector<const char*>::iterator i;
+  for (i = args.begin(); i != args.end();) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &val, "--pool", "-p", (char*)NULL)) {
+      pool_name = val;
+    } else if (ceph_argparse_withlonglong(args, i, &num_extents, &err, "--extents", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &extent_size, &err, "--extent-size", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &stride, &err, "--stride", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &iterations, &err, "--iterations", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &stripe_unit, &err, "--stripe-unit", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &stripe_count, &err, "--stripe-count", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &object_size, &err, "--object-size", (char*)NULL)) {
+    } else {
+      cerr << "unknown option " << *i << std::endl;
+      usage();
+      return EXIT_FAILURE;
+    }
+    if (!err.str().empty()) {
+      cerr << argv[0] << ": " << err.str() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (stride == 0)
+    stride = extent_size;
+  if (num_extents < 1 || extent_size < 1 || stride < extent_size ||
+      iterations < 1 || stripe_unit < 0 || stripe_count < 0 || object_size < 0) {
+    cerr << argv[0] << ": invalid configuration" << std::endl;
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  Rados rados;
+  if (rados.init_with_context(g_ceph_context) < 0) {
+    cerr << "couldn't initialize rados!" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (rados.connect() < 0) {
+    cerr << "couldn't connect to cluster!" << std::endl;
+    return EXIT_FAILURE;
+  }
+  IoCtx ioctx;
+  int r = rados.ioctx_create(pool_name.c_str(), ioctx);
+  if (r < 0) {
+    cerr << "couldn't open pool " << pool_name << ": " << cpp_strerror(r) << std::endl;
+    return EXIT_FAILURE;
+  }
+  RadosStriper striper;
+  r = RadosStriper::striper_create(ioctx, &striper);
+  if (r < 0) {
+    cerr << "couldn't create striper: " << cpp_strerror(r) << std::endl;
+    return EXIT_FAILURE;
+  }
+  if ((stripe_unit && striper.set_object_layout_stripe_unit(stripe_unit) < 0) ||
+      (stripe_count && striper.set_object_layout_stripe_count(stripe_count) < 0) ||
+      (object_size && striper.set_object_layout_object_size(object_size) < 0)) {
+    cerr << argv[0] << ": invalid layout" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Workload w;
+  w.bytes = num_extents * extent_size;
+  bufferptr data(buffer::create(extent_size));
+  memset(data.c_str(), 0xcc, extent_size);
+  for (long long n = 0; n < num_extents; ++n) {
+    bufferlist bl;
+    bl.append(data);
+    w.wextents.push_back(std::make_pair((uint64_t)(n * stride), bl));
+    w.rextents.push_back(std::make_pair((uint64_t)(n * stride), (uint64_t)extent_size));
+  }
+
+  std::string soid = "striper_bench." + stringify(getpid());
+  std::cout << num_extents << " extents of " << extent_size << " bytes every "
+	    << stride << " bytes, " << iterations << " iterations\n\n"
+	    << std::setw(24) << "mode"
+	    << std::setw(12) << "MB/s"
+	    << std::setw(12) << "ms/pass"
+	    << std::endl;
+  r = run("write per extent", write_pieces, striper, soid, w, iterations);
+  if (!r)
+    r = run("writev", write_vectored, striper, soid, w, iterations);
+  if (!r)
+    r = run("read per extent", read_pieces, striper, soid, w, iterations);
+  if (!r)
+    r = run("readv", read_vectored, striper, soid, w, iterations);
+  if (!r) {
+    rados.conf_set("rados_striper_lockless_reads", "true");
+    r = run("read per extent lockless", read_pieces, striper, soid, w, iterations);
+    if (!r)
+      r = run("readv lockless", read_vectored, striper, soid, w, iterations);
+  }
+  striper.remove(soid);
+  return r ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -26,6 +26,7 @@
 #include "gtest/gtest.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,6 +35,7 @@
 #include <unistd.h>
 #include <iostream>
 #include <algorithm>
+#include <map>
 #include <sstream>
 #include <set>
 #include <vector>
@@ -2081,6 +2083,183 @@ TEST_F(TestLibRBD, DiffIterateRegression6926)
   ioctx.close();
 }
 
+static std::set<uint64_t> existing_objects(librados::IoCtx& ioctx,
+					   librbd::Image& image)
+{
+  librbd::image_info_t info;
+  EXPECT_EQ(0, image.stat(info, sizeof(info)));
+  std::string prefix = std::string(info.block_name_prefix) + ".";
+  std::set<uint64_t> objects;
+  for (librados::NObjectIterator it = ioctx.nobjects_begin();
+       it != ioctx.nobjects_end(); ++it) {
+    if (it->get_oid().compare(0, prefix.size(), prefix) == 0) {
+      objects.insert(strtoull(it->get_oid().c_str() + prefix.size(), NULL,
+			      16));
+    }
+  }
+  return objects;
+}
+
+static void check_object_map_consistent(librbd::Image& image, bool *passed)
+{
+  PrintProgress prog_ctx;
+  uint64_t inconsistent = 0;
+  ASSERT_EQ(0, image.check_object_map(prog_ctx, &inconsistent));
+  ASSERT_EQ(0u, inconsistent);
+  *passed = true;
+}
+
+TEST_F(TestLibRBD, ObjectMapReadAfterWrite)
+{
+  librados::IoCtx ioctx;
+  ASSERT_EQ(0, _rados.ioctx_create(m_pool_name.c_str(), ioctx));
+
+  librbd::RBD rbd;
+  int order = 20;
+  std::string name = get_temp_image_name();
+  uint64_t size = 8 << order;
+  ASSERT_EQ(0, rbd.create2(ioctx, name.c_str(), size,
+			   RBD_FEATURE_LAYERING | RBD_FEATURE_OBJECT_MAP,
+			   &order));
+
+  bufferlist data, zero;
+  data.append(std::string(4096, 'a'));
+  zero.append_zero(4096);
+  for (int pass = 0; pass < 2; ++pass) {
+    // the second pass reads with the map loaded from disk
+    librbd::Image image;
+    ASSERT_EQ(0, rbd.open(ioctx, image, name.c_str(), NULL));
+    if (pass == 0) {
+      ASSERT_EQ(4096, image.write(0, 4096, data));
+      ASSERT_EQ(4096, image.write((3 << order) + 512, 4096, data));
+    }
+    bufferlist bl;
+    ASSERT_EQ(4096, image.read(0, 4096, bl));
+    ASSERT_TRUE(bl.contents_equal(data));
+    bl.clear();
+    ASSERT_EQ(4096, image.read((3 << order) + 512, 4096, bl));
+    ASSERT_TRUE(bl.contents_equal(data));
+    bl.clear();
+    ASSERT_EQ(4096, image.read(5 << order, 4096, bl));
+    ASSERT_TRUE(bl.contents_equal(zero));
+    ASSERT_PASSED(check_object_map_consistent, image);
+  }
+  ioctx.close();
+}
+
+TEST_F(TestLibRBD, ObjectMapResizeRemove)
+{
+  librados::IoCtx ioctx;
+  ASSERT_EQ(0, _rados.ioctx_create(m_pool_name.c_str(), ioctx));
+
+  librbd::RBD rbd;
+  int order = 20;
+  std::string name = get_temp_image_name();
+  uint64_t size = 8 << order;
+  ASSERT_EQ(0, rbd.create2(ioctx, name.c_str(), size,
+			   RBD_FEATURE_LAYERING | RBD_FEATURE_OBJECT_MAP,
+			   &order));
+
+  {
+    librbd::Image image;
+    ASSERT_EQ(0, rbd.open(ioctx, image, name.c_str(), NULL));
+    bufferlist data;
+    data.append(std::string(4096, 'a'));
+    ASSERT_EQ(4096, image.write(1 << order, 4096, data));
+    ASSERT_EQ(4096, image.write(5 << order, 4096, data));
+    std::set<uint64_t> expected;
+    expected.insert(1);
+    expected.insert(5);
+    ASSERT_EQ(expected, existing_objects(ioctx, image));
+
+    // shrinking into object 2 must not create it by truncating it
+    ASSERT_EQ(0, image.resize((2 << order) + 4096));
+    expected.erase(5);
+    ASSERT_EQ(expected, existing_objects(ioctx, image));
+    ASSERT_PASSED(check_object_map_consistent, image);
+
+    ASSERT_EQ(0, image.resize(size));
+    bufferlist bl, zero;
+    zero.append_zero(4096);
+    ASSERT_EQ(4096, image.read(5 << order, 4096, bl));
+    ASSERT_TRUE(bl.contents_equal(zero));
+    bl.clear();
+    ASSERT_EQ(4096, image.read(1 << order, 4096, bl));
+    ASSERT_TRUE(bl.contents_equal(data));
+    ASSERT_PASSED(check_object_map_consistent, image);
+  }
+
+  ASSERT_EQ(0, rbd.remove(ioctx, name.c_str()));
+  std::vector<std::string> names;
+  ASSERT_EQ(0, rbd.list(ioctx, names));
+  ASSERT_TRUE(std::find(names.begin(), names.end(), name) == names.end());
+  ioctx.close();
+}
+
+static void diff_iterate_ops(librbd::Image& image, int order, int pass,
+			     bool *passed)
+{
+  // the same writes and discards whatever the image's features
+  bufferlist bl;
+  bl.append(std::string(8192, 'a' + pass));
+  for (int i = 0; i < 12; ++i) {
+    uint64_t off = (((i * 7 + pass * 3) % 16) << order) + i * 4096;
+    if (i % 4 == 3) {
+      ASSERT_EQ(8192, image.discard(off, 8192));
+    } else {
+      ASSERT_EQ(8192, image.write(off, 8192, bl));
+    }
+  }
+  if (pass == 1) {
+    ASSERT_EQ(1 << order, image.discard(2 << order, 1 << order));
+  }
+  *passed = true;
+}
+
+TEST_F(TestLibRBD, ObjectMapDiffIterate)
+{
+  librados::IoCtx ioctx;
+  ASSERT_EQ(0, _rados.ioctx_create(m_pool_name.c_str(), ioctx));
+
+  librbd::RBD rbd;
+  int order = 20;
+  uint64_t size = 16 << order;
+  uint64_t features[] = {
+    RBD_FEATURE_LAYERING,
+    RBD_FEATURE_LAYERING | RBD_FEATURE_OBJECT_MAP
+  };
+  // from the start, from snap1 and from snap2 at the head
+  vector<diff_extent> diffs[2][3];
+  for (int f = 0; f < 2; ++f) {
+    std::string name = get_temp_image_name();
+    ASSERT_EQ(0, rbd.create2(ioctx, name.c_str(), size, features[f],
+			     &order));
+    librbd::Image image;
+    ASSERT_EQ(0, rbd.open(ioctx, image, name.c_str(), NULL));
+
+    ASSERT_PASSED(diff_iterate_ops, image, order, 0);
+    ASSERT_EQ(0, image.snap_create("snap1"));
+    ASSERT_PASSED(diff_iterate_ops, image, order, 1);
+    ASSERT_EQ(0, image.snap_create("snap2"));
+    ASSERT_PASSED(diff_iterate_ops, image, order, 2);
+
+    ASSERT_EQ(0, image.diff_iterate(NULL, 0, size, vector_iterate_cb,
+				    (void *)&diffs[f][0]));
+    ASSERT_EQ(0, image.diff_iterate("snap1", 0, size, vector_iterate_cb,
+				    (void *)&diffs[f][1]));
+    ASSERT_EQ(0, image.diff_iterate("snap2", 0, size, vector_iterate_cb,
+				    (void *)&diffs[f][2]));
+    if (f == 1) {
+      ASSERT_PASSED(check_object_map_consistent, image);
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_FALSE(diffs[0][i].empty());
+    ASSERT_EQ(diffs[0][i], diffs[1][i]);
+  }
+  ioctx.close();
+}
+
 TEST_F(TestLibRBD, ZeroLengthWrite)
 {
   rados_ioctx_t ioctx;
@@ -2244,6 +2423,269 @@ TEST_F(TestLibRBD, TestPendingAio)
   rados_ioctx_destroy(ioctx);
 }
 
+class TestLibRBDWriteLog : public TestLibRBD {
+public:
+  virtual void SetUp() {
+    TestLibRBD::SetUp();
+    char tmpl[] = "/tmp/test_librbd_wlog.XXXXXX";
+    int fd = mkstemp(tmpl);
+    ASSERT_LE(0, fd);
+    close(fd);
+    m_log_path = tmpl;
+    set_conf("rbd_persistent_cache_path", m_log_path);
+    set_conf("rbd_persistent_cache_size", stringify(16 << 20));
+    ASSERT_EQ(0, rados_ioctx_create(_cluster, m_pool_name.c_str(), &m_ioctx));
+  }
+
+  virtual void TearDown() {
+    rados_ioctx_destroy(m_ioctx);
+    for (std::map<std::string, std::string>::iterator p = m_orig_conf.begin();
+	 p != m_orig_conf.end(); ++p) {
+      EXPECT_EQ(0, rados_conf_set(_cluster, p->first.c_str(),
+				  p->second.c_str()));
+    }
+    unlink(m_log_path.c_str());
+  }
+
+  /// images opened after this see the new value
+  void set_conf(const std::string &option, const std::string &value) {
+    if (m_orig_conf.count(option) == 0) {
+      char buf[256];
+      ASSERT_EQ(0, rados_conf_get(_cluster, option.c_str(), buf, sizeof(buf)));
+      m_orig_conf[option] = buf;
+    }
+    ASSERT_EQ(0, rados_conf_set(_cluster, option.c_str(), value.c_str()));
+  }
+
+  /// open without the log, to see what reached the cluster
+  void open_without_log(const std::string &name, rbd_image_t *image) {
+    set_conf("rbd_persistent_cache_path", "");
+    ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), image, NULL));
+    set_conf("rbd_persistent_cache_path", m_log_path);
+  }
+
+  rados_ioctx_t m_ioctx;
+  std::string m_log_path;
+  std::map<std::string, std::string> m_orig_conf;
+};
+
+TEST_F(TestLibRBDWriteLog, ReplayAfterCrash)
+{
+  rbd_image_t image;
+  int order = 0;
+  std::string name = get_temp_image_name();
+  ASSERT_EQ(0, create_image(m_ioctx, name.c_str(), 4 << 20, &order));
+
+  std::string a(4096, 'a'), b(8192, 'b'), zero(8192, '\0');
+  set_conf("rbd_persistent_cache_debug_skip_writeback", "true");
+  ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), &image, NULL));
+  ASSERT_PASSED(write_test_data, image, a.c_str(), 0, a.size(), 0);
+  ASSERT_PASSED(aio_write_test_data, image, b.c_str(), 1 << 20, b.size(), 0);
+  ASSERT_EQ(0, rbd_close(image));
+  set_conf("rbd_persistent_cache_debug_skip_writeback", "false");
+
+  // the writes are only in the log
+  ASSERT_NO_FATAL_FAILURE(open_without_log(name, &image));
+  ASSERT_PASSED(read_test_data, image, zero.c_str(), 0, a.size(), 0);
+  ASSERT_PASSED(read_test_data, image, zero.c_str(), 1 << 20, b.size(), 0);
+  ASSERT_EQ(0, rbd_close(image));
+
+  // opening with the log replays them
+  ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), &image, NULL));
+  ASSERT_PASSED(read_test_data, image, a.c_str(), 0, a.size(), 0);
+  ASSERT_EQ(0, rbd_close(image));
+
+  ASSERT_NO_FATAL_FAILURE(open_without_log(name, &image));
+  ASSERT_PASSED(read_test_data, image, a.c_str(), 0, a.size(), 0);
+  ASSERT_PASSED(read_test_data, image, b.c_str(), 1 << 20, b.size(), 0);
+  ASSERT_EQ(0, rbd_close(image));
+}
+
+TEST_F(TestLibRBDWriteLog, ReplayStopsAtTornRecord)
+{
+  rbd_image_t image;
+  int order = 0;
+  std::string name = get_temp_image_name();
+  ASSERT_EQ(0, create_image(m_ioctx, name.c_str(), 4 << 20, &order));
+
+  std::string a(4096, 'a'), b(4096, 'b'), zero(4096, '\0');
+  set_conf("rbd_persistent_cache_debug_skip_writeback", "true");
+  ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), &image, NULL));
+  ASSERT_PASSED(write_test_data, image, a.c_str(), 0, a.size(), 0);
+  ASSERT_PASSED(write_test_data, image, b.c_str(), 8192, b.size(), 0);
+  ASSERT_EQ(0, rbd_close(image));
+  set_conf("rbd_persistent_cache_debug_skip_writeback", "false");
+
+  // a new log starts after its 4K superblock; each record has a 512
+  // byte header and its data, so the second write's data starts at
+  // 4096 + (512 + 4096) + 512
+  int fd = open(m_log_path.c_str(), O_WRONLY);
+  ASSERT_LE(0, fd);
+  ASSERT_EQ(1, pwrite(fd, "x", 1, 4096 + 4608 + 512 + 100));
+  close(fd);
+
+  ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), &image, NULL));
+  ASSERT_EQ(0, rbd_close(image));
+
+  ASSERT_NO_FATAL_FAILURE(open_without_log(name, &image));
+  ASSERT_PASSED(read_test_data, image, a.c_str(), 0, a.size(), 0);
+  ASSERT_PASSED(read_test_data, image, zero.c_str(), 8192, b.size(), 0);
+  ASSERT_EQ(0, rbd_close(image));
+}
+
+TEST_F(TestLibRBDWriteLog, RingWrap)
+{
+  rbd_image_t image;
+  int order = 0;
+  std::string name = get_temp_image_name();
+  ASSERT_EQ(0, create_image(m_ioctx, name.c_str(), 4 << 20, &order));
+
+  // a 64K ring holds fewer than 16 of these writes at once
+  set_conf("rbd_persistent_cache_size", stringify(4096 + (64 << 10)));
+  ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), &image, NULL));
+  std::vector<std::string> data;
+  for (int i = 0; i < 64; ++i) {
+    data.push_back(std::string(4096, 'A' + i % 26));
+    ASSERT_PASSED(write_test_data, image, data[i].c_str(), i * 4096, 4096, 0);
+  }
+  for (int i = 0; i < 64; ++i) {
+    ASSERT_PASSED(read_test_data, image, data[i].c_str(), i * 4096, 4096, 0);
+  }
+  ASSERT_EQ(0, rbd_close(image));
+
+  ASSERT_NO_FATAL_FAILURE(open_without_log(name, &image));
+  for (int i = 0; i < 64; ++i) {
+    ASSERT_PASSED(read_test_data, image, data[i].c_str(), i * 4096, 4096, 0);
+  }
+  ASSERT_EQ(0, rbd_close(image));
+}
+
+TEST_F(TestLibRBDWriteLog, OtherImagesLog)
+{
+  rbd_image_t image;
+  int order = 0;
+  std::string name = get_temp_image_name();
+  std::string other = get_temp_image_name();
+  ASSERT_EQ(0, create_image(m_ioctx, name.c_str(), 4 << 20, &order));
+  ASSERT_EQ(0, create_image(m_ioctx, other.c_str(), 4 << 20, &order));
+
+  std::string a(4096, 'a');
+  set_conf("rbd_persistent_cache_debug_skip_writeback", "true");
+  ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), &image, NULL));
+  ASSERT_PASSED(write_test_data, image, a.c_str(), 0, a.size(), 0);
+  ASSERT_EQ(0, rbd_close(image));
+  set_conf("rbd_persistent_cache_debug_skip_writeback", "false");
+
+  // the log holds data the other image must not lose
+  ASSERT_EQ(-EEXIST, rbd_open(m_ioctx, other.c_str(), &image, NULL));
+
+  // once it has been written back the log can be reused
+  ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), &image, NULL));
+  ASSERT_EQ(0, rbd_close(image));
+  ASSERT_EQ(0, rbd_open(m_ioctx, other.c_str(), &image, NULL));
+  ASSERT_EQ(0, rbd_close(image));
+}
+
+TEST_F(TestLibRBDWriteLog, ReadAfterWrite)
+{
+  rbd_image_t image;
+  int order = 0;
+  std::string name = get_temp_image_name();
+  ASSERT_EQ(0, create_image(m_ioctx, name.c_str(), 4 << 20, &order));
+  ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), &image, NULL));
+
+  std::string a(65536, 'a'), zero(4096, '\0');
+  char result[65536];
+  for (int i = 0; i < 16; ++i) {
+    // the discard and the read have to wait for the write to be
+    // written back
+    uint64_t off = i * 65536;
+    rbd_completion_t write_comp, discard_comp, read_comp;
+    ASSERT_EQ(0, rbd_aio_create_completion(NULL, NULL, &write_comp));
+    ASSERT_EQ(0, rbd_aio_create_completion(NULL, NULL, &discard_comp));
+    ASSERT_EQ(0, rbd_aio_create_completion(NULL, NULL, &read_comp));
+    ASSERT_EQ(0, rbd_aio_write(image, off, a.size(), a.c_str(), write_comp));
+    ASSERT_EQ(0, rbd_aio_discard(image, off, 4096, discard_comp));
+    ASSERT_EQ(0, rbd_aio_read(image, off + 4096, a.size() - 4096, result,
+			      read_comp));
+    ASSERT_EQ(0, rbd_aio_wait_for_complete(write_comp));
+    ASSERT_EQ(0, rbd_aio_get_return_value(write_comp));
+    ASSERT_EQ(0, rbd_aio_wait_for_complete(discard_comp));
+    ASSERT_EQ(0, rbd_aio_get_return_value(discard_comp));
+    ASSERT_EQ(0, rbd_aio_wait_for_complete(read_comp));
+    ASSERT_EQ((ssize_t)a.size() - 4096, rbd_aio_get_return_value(read_comp));
+    ASSERT_EQ(0, memcmp(result, a.c_str(), a.size() - 4096));
+    rbd_aio_release(write_comp);
+    rbd_aio_release(discard_comp);
+    rbd_aio_release(read_comp);
+    ASSERT_PASSED(read_test_data, image, zero.c_str(), off, 4096, 0);
+  }
+  ASSERT_EQ(0, rbd_close(image));
+}
+
+TEST_F(TestLibRBDWriteLog, SnapshotAndResize)
+{
+  rbd_image_t image;
+  int order = 0;
+  std::string name = get_temp_image_name();
+  uint64_t size = 4 << 20;
+  ASSERT_EQ(0, create_image(m_ioctx, name.c_str(), size, &order));
+  ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), &image, NULL));
+
+  // the log is written back before the snapshot is taken
+  std::string a(4096, 'a'), b(4096, 'b'), zero(4096, '\0');
+  ASSERT_PASSED(write_test_data, image, a.c_str(), 0, a.size(), 0);
+  ASSERT_EQ(0, rbd_snap_create(image, "snap"));
+  ASSERT_PASSED(write_test_data, image, b.c_str(), 0, b.size(), 0);
+  ASSERT_EQ(0, rbd_snap_set(image, "snap"));
+  ASSERT_PASSED(read_test_data, image, a.c_str(), 0, a.size(), 0);
+  ASSERT_EQ(0, rbd_snap_set(image, NULL));
+  ASSERT_PASSED(read_test_data, image, b.c_str(), 0, b.size(), 0);
+
+  // and before the image shrinks, so a logged write past the new end
+  // does not come back when it grows again
+  ASSERT_PASSED(write_test_data, image, a.c_str(), size - 4096, a.size(), 0);
+  ASSERT_EQ(0, rbd_resize(image, size - 8192));
+  ASSERT_EQ(0, rbd_resize(image, size));
+  ASSERT_PASSED(read_test_data, image, zero.c_str(), size - 4096, a.size(), 0);
+  ASSERT_EQ(0, rbd_close(image));
+}
+
+TEST_F(TestLibRBDWriteLog, ShrinkUnderDirtyLog)
+{
+  rbd_image_t image, other;
+  int order = 0;
+  std::string name = get_temp_image_name();
+  uint64_t size = 4 << 20;
+  ASSERT_EQ(0, create_image(m_ioctx, name.c_str(), size, &order));
+
+  std::string a(4096, 'a'), b(4096, 'b'), zero(4096, '\0');
+  set_conf("rbd_persistent_cache_debug_skip_writeback", "true");
+  ASSERT_EQ(0, rbd_open(m_ioctx, name.c_str(), &image, NULL));
+  ASSERT_PASSED(write_test_data, image, a.c_str(), size - 4096, a.size(), 0);
+
+  // another client shrinks the image past the logged write
+  ASSERT_NO_FATAL_FAILURE(open_without_log(name, &other));
+  ASSERT_EQ(0, rbd_resize(other, size - 8192));
+  ASSERT_EQ(0, rbd_close(other));
+  uint64_t cur = size;
+  for (int i = 0; i < 100 && cur != size - 8192; ++i) {
+    usleep(10000);
+    ASSERT_EQ(0, rbd_get_size(image, &cur));
+  }
+  ASSERT_EQ(size - 8192, cur);
+
+  // writing the log back skips that write rather than failing for good
+  set_conf("rbd_persistent_cache_debug_skip_writeback", "false");
+  ASSERT_EQ(0, rbd_flush(image));
+  ASSERT_PASSED(write_test_data, image, b.c_str(), 0, b.size(), 0);
+  ASSERT_EQ(0, rbd_flush(image));
+  ASSERT_PASSED(read_test_data, image, b.c_str(), 0, b.size(), 0);
+  ASSERT_EQ(0, rbd_resize(image, size));
+  ASSERT_PASSED(read_test_data, image, zero.c_str(), size - 4096, a.size(), 0);
+  ASSERT_EQ(0, rbd_close(image));
+}
+
 int main(int argc, char **argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
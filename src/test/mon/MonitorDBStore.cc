@@ -0,0 +1,207 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include <stdlib.h>
+#include <iostream>
+
+#include "mon/MonitorDBStore.h"
+#include "common/Thread.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "include/stringify.h"
+#include "gtest/gtest.h"
+
+class MonitorDBStoreTest : public ::testing::Test {
+public:
+  string dir;
+  MonitorDBStore *store;
+
+  MonitorDBStoreTest() : store(NULL) {}
+
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/unittest_mon_dbstore.XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    dir = tmpl;
+    open();
+  }
+
+  virtual void TearDown() {
+    close();
+    ASSERT_EQ(0, system(("rm -rf " + dir).c_str()));
+  }
+
+  void open() {
+    store = new MonitorDBStore(dir);
+    ASSERT_EQ(0, store->create_and_open(std::cerr));
+  }
+
+  void close() {
+    store->close();
+    delete store;
+    store = NULL;
+  }
+
+  /// close and reopen the store, dropping the cache
+  void reopen() {
+    close();
+    open();
+  }
+
+  int put(const string& prefix, const string& key, const string& value) {
+    MonitorDBStore::TransactionRef t(new MonitorDBStore::Transaction);
+    bufferlist bl;
+    bl.append(value);
+    t->put(prefix, key, bl);
+    return store->apply_transaction(t);
+  }
+
+  int erase(const string& prefix, const string& key) {
+    MonitorDBStore::TransactionRef t(new MonitorDBStore::Transaction);
+    t->erase(prefix, key);
+    return store->apply_transaction(t);
+  }
+
+  string get(const string& prefix, const string& key) {
+    bufferlist bl;
+    if (store->get(prefix, key, bl) < 0)
+      return "(none)";
+    return string(bl.c_str(), bl.length());
+  }
+};
+
+TEST_F(MonitorDBStoreTest, PutGetEraseClear)
+{
+  ASSERT_EQ("(none)", get("a", "k"));
+  ASSERT_EQ(0, put("a", "k", "1"));
+  ASSERT_EQ("1", get("a", "k"));
+  ASSERT_EQ(0, put("a", "k", "2"));
+  ASSERT_EQ("2", get("a", "k"));
+  ASSERT_TRUE(store->exists("a", "k"));
+  ASSERT_EQ(0, erase("a", "k"));
+  ASSERT_EQ("(none)", get("a", "k"));
+  ASSERT_FALSE(store->exists("a", "k"));
+
+  ASSERT_EQ(0, put("a", "k", "3"));
+  ASSERT_EQ(0, put("b", "k", "4"));
+  // fill the cache from the store, then clear one prefix
+  reopen();
+  ASSERT_EQ("3", get("a", "k"));
+  ASSERT_EQ("4", get("b", "k"));
+  set<string> prefixes;
+  prefixes.insert("a");
+  store->clear(prefixes);
+  ASSERT_EQ("(none)", get("a", "k"));
+  ASSERT_EQ("4", get("b", "k"));
+
+  // what was cached matches what was stored
+  reopen();
+  ASSERT_EQ("(none)", get("a", "k"));
+  ASSERT_EQ("4", get("b", "k"));
+}
+
+TEST_F(MonitorDBStoreTest, CacheCompactCopy)
+{
+  // the value is a small slice of a big buffer, as it would be when it
+  // comes from a paxos message
+  bufferlist big;
+  big.push_back(buffer::create(1 << 20));
+  big.zero();
+  big.copy_in(1000, 5, "value");
+  bufferlist value;
+  value.substr_of(big, 1000, 5);
+  MonitorDBStore::TransactionRef t(new MonitorDBStore::Transaction);
+  t->put("a", "k", value);
+  ASSERT_EQ(0, store->apply_transaction(t));
+  ASSERT_EQ(5u, store->get_cache_bytes());
+
+  bufferlist bl;
+  ASSERT_EQ(0, store->get("a", "k", bl));
+  ASSERT_EQ("value", string(bl.c_str(), bl.length()));
+  ASSERT_EQ(1u, bl.buffers().size());
+  ASSERT_EQ(5u, bl.buffers().front().raw_length());
+}
+
+class Writer : public Thread {
+public:
+  MonitorDBStore *store;
+  uint64_t num;
+  Writer(MonitorDBStore *s, uint64_t n) : store(s), num(n) {}
+  void *entry() {
+    bufferlist filler;
+    filler.append(string(1000, 'x'));
+    for (uint64_t i = 1; i <= num; ++i) {
+      MonitorDBStore::TransactionRef t(new MonitorDBStore::Transaction);
+      bufferlist bl;
+      ::encode(i, bl);
+      t->put("a", "k", bl);
+      assert(store->apply_transaction(t) >= 0);
+      // push "k" out of the cache so that readers go to the store
+      for (int j = 0; j < 4; ++j) {
+	MonitorDBStore::TransactionRef f(new MonitorDBStore::Transaction);
+	f->put("filler", stringify(j), filler);
+	assert(store->apply_transaction(f) >= 0);
+      }
+    }
+    return NULL;
+  }
+};
+
+TEST_F(MonitorDBStoreTest, ConcurrentApply)
+{
+  // a read that misses the cache must not cache a value that a
+  // concurrent transaction already replaced
+  string old_size = stringify(g_conf->mon_store_cache_size);
+  g_ceph_context->_conf->set_val("mon_store_cache_size", "4096");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  const uint64_t num = 2000;
+  Writer writer(store, num);
+  writer.create();
+  uint64_t last = 0, stale = 0;
+  while (last < num) {
+    bufferlist bl;
+    if (store->get("a", "k", bl) < 0)
+      continue;
+    uint64_t v;
+    bufferlist::iterator p = bl.begin();
+    ::decode(v, p);
+    if (v < last) {
+      // we already saw a newer value
+      stale = v;
+      break;
+    }
+    last = v;
+  }
+  writer.join();
+
+  g_ceph_context->_conf->set_val("mon_store_cache_size", old_size);
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ASSERT_EQ(0u, stale);
+  bufferlist bl;
+  ASSERT_EQ(0, store->get("a", "k", bl));
+  uint64_t v;
+  bufferlist::iterator p = bl.begin();
+  ::decode(v, p);
+  ASSERT_EQ(num, v);
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
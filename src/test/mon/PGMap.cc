@@ -12,6 +12,7 @@
  */
 
 #include "mon/PGMap.h"
+#include "test/mon/PGMapRandom.h"
 #include "gtest/gtest.h"
 
 #include "common/ceph_argparse.h"
@@ -83,6 +84,57 @@ TEST(pgmap, min_last_epoch_clean)
 
 
 
+TEST(pgmap, incremental_aggregates)
+{
+  const int num_pools = 4, pgs_per_pool = 256, num_osds = 20;
+  srand(1);
+  PGMap pg_map;
+  for (int v = 0; v < 50; ++v) {
+    PGMap::Incremental inc;
+    random_stats_inc(pg_map, num_pools, pgs_per_pool, num_osds,
+		     v ? 100 : num_pools * pgs_per_pool, &inc);
+    if (v % 10 == 9)
+      inc.pg_remove.insert(pg_t(rand() % pgs_per_pool, rand() % num_pools));
+    pg_map.apply_incremental(g_ceph_context, inc);
+    ASSERT_EQ(scan_min_last_epoch_clean(pg_map),
+	      pg_map.get_min_last_epoch_clean());
+  }
+
+  // the same as recomputing everything from scratch
+  bufferlist bl;
+  pg_map.encode(bl);
+  PGMap fresh;
+  bufferlist::iterator p = bl.begin();
+  fresh.decode(p);
+  ASSERT_EQ(fresh.get_min_last_epoch_clean(),
+	    pg_map.get_min_last_epoch_clean());
+  ASSERT_TRUE(fresh.num_pg_by_last_epoch_clean ==
+	      pg_map.num_pg_by_last_epoch_clean);
+  ASSERT_EQ(fresh.num_unstale_pg_by_primary.size(),
+	    pg_map.num_unstale_pg_by_primary.size());
+  for (ceph::unordered_map<int32_t,int>::const_iterator q =
+	 fresh.num_unstale_pg_by_primary.begin();
+       q != fresh.num_unstale_pg_by_primary.end();
+       ++q)
+    ASSERT_EQ(q->second, pg_map.num_unstale_pg_by_primary[q->first]);
+  ASSERT_EQ(fresh.pg_sum.stats.sum.num_objects,
+	    pg_map.pg_sum.stats.sum.num_objects);
+
+  // stuck stats still find what a full scan finds
+  utime_t cutoff(500, 0);
+  ceph::unordered_map<pg_t, pg_stat_t> stuck;
+  pg_map.get_stuck_stats(PGMap::STUCK_STALE, cutoff, stuck);
+  unsigned expected = 0;
+  for (ceph::unordered_map<pg_t,pg_stat_t>::const_iterator q =
+	 pg_map.pg_stat.begin();
+       q != pg_map.pg_stat.end();
+       ++q)
+    if ((q->second.state & PG_STATE_STALE) &&
+	q->second.last_unstale < cutoff)
+      ++expected;
+  ASSERT_EQ(expected, stuck.size());
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -0,0 +1,84 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef CEPH_TEST_MON_PGMAPRANDOM_H
+#define CEPH_TEST_MON_PGMAPRANDOM_H
+
+#include <stdlib.h>
+
+#include "mon/PGMap.h"
+
+/*
+ * synthetic pg stats: num_pools pools of pgs_per_pool pgs, acting sets
+ * drawn from num_osds osds, with a random mix of states and epochs.
+ */
+inline pg_stat_t random_pg_stat(int num_osds, epoch_t epoch)
+{
+  static const int states[] = {
+    PG_STATE_ACTIVE | PG_STATE_CLEAN,
+    PG_STATE_ACTIVE | PG_STATE_CLEAN,
+    PG_STATE_ACTIVE | PG_STATE_CLEAN,
+    PG_STATE_ACTIVE | PG_STATE_DEGRADED,
+    PG_STATE_ACTIVE | PG_STATE_UNDERSIZED | PG_STATE_DEGRADED,
+    PG_STATE_PEERING,
+    PG_STATE_STALE | PG_STATE_ACTIVE | PG_STATE_CLEAN,
+  };
+  pg_stat_t s;
+  s.state = states[rand() % (sizeof(states) / sizeof(states[0]))];
+  s.reported_epoch = epoch;
+  s.last_epoch_clean = epoch - rand() % 50;
+  for (int i = 0; i < 3; ++i)
+    s.acting.push_back(rand() % num_osds);
+  s.acting_primary = s.acting[0];
+  s.stats.sum.num_objects = rand() % 1000;
+  s.stats.sum.num_bytes = s.stats.sum.num_objects * 4096;
+  s.last_active = utime_t(rand() % 1000, 0);
+  s.last_clean = utime_t(rand() % 1000, 0);
+  s.last_unstale = utime_t(rand() % 1000, 0);
+  s.last_undegraded = utime_t(rand() % 1000, 0);
+  s.last_fullsized = utime_t(rand() % 1000, 0);
+  return s;
+}
+
+inline void random_stats_inc(const PGMap& pg_map, int num_pools,
+			     int pgs_per_pool, int num_osds, int num_updates,
+			     PGMap::Incremental *inc)
+{
+  inc->version = pg_map.version + 1;
+  epoch_t epoch = 100 + pg_map.version;
+  for (int i = 0; i < num_updates; ++i) {
+    pg_t pgid(rand() % pgs_per_pool, rand() % num_pools);
+    inc->pg_stat_updates[pgid] = random_pg_stat(num_osds, epoch);
+  }
+  for (int osd = 0; osd < num_osds; ++osd)
+    if (rand() % 4 == 0)
+      inc->update_stat(osd, epoch - rand() % 10, osd_stat_t());
+}
+
+inline epoch_t scan_min_last_epoch_clean(const PGMap& pg_map)
+{
+  if (pg_map.pg_stat.empty())
+    return 0;
+  epoch_t min = pg_map.pg_stat.begin()->second.get_effective_last_epoch_clean();
+  for (ceph::unordered_map<pg_t,pg_stat_t>::const_iterator p =
+	 pg_map.pg_stat.begin();
+       p != pg_map.pg_stat.end();
+       ++p)
+    min = MIN(min, p->second.get_effective_last_epoch_clean());
+  for (ceph::unordered_map<int32_t,epoch_t>::const_iterator p =
+	 pg_map.osd_epochs.begin();
+       p != pg_map.osd_epochs.end();
+       ++p)
+    min = MIN(min, p->second);
+  return min;
+}
+
+#endif
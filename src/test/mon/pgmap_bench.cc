@@ -0,0 +1,147 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Time applying --reports stats reports of --updates pgs each to a map
+ * of --pools pools of --pgs-per-pool pgs, together with the per-report
+ * queries the mon makes of it (min last_epoch_clean for osdmap trimming,
+ * and the stuck checks behind health/status), and compare that with
+ * scanning every pg for the min last_epoch_clean alone.
+ */
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <sstream>
+
+#include "common/ceph_argparse.h"
+#include "common/common_init.h"
+#include "common/Clock.h"
+#include "global/global_context.h"
+#include "global/global_init.h"
+#include "mon/PGMap.h"
+#include "test/mon/PGMapRandom.h"
+
+static void usage()
+{
+  cerr << "usage: ceph_test_pgmap_bench [options]\n"
+       << "  --pools <n>               number of pools (default 10)\n"
+       << "  --pgs-per-pool <n>        pgs in each pool (default 10000)\n"
+       << "  --osds <n>                number of osds (default 1000)\n"
+       << "  --reports <n>             stats reports to apply (default 100)\n"
+       << "  --updates <n>             pg stats in each report (default 100)\n"
+       << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  std::vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int num_pools = 10;
+  int pgs_per_pool = 10000;
+  int num_osds = 1000;
+  int num_reports = 100;
+  int num_updates = 100;
+  std::ostringstream err;
+  std::vector<const char*>::iterator i;
+  for (i = args.begin(); i != args.end();) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_withint(args, i, &num_pools, &err, "--pools", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &pgs_per_pool, &err, "--pgs-per-pool", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &num_osds, &err, "--osds", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &num_reports, &err, "--reports", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &num_updates, &err, "--updates", (char*)NULL)) {
+    } else {
+      cerr << "unknown option " << *i << std::endl;
+      usage();
+      return EXIT_FAILURE;
+    }
+    if (!err.str().empty()) {
+      cerr << argv[0] << ": " << err.str() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (num_pools < 1 || pgs_per_pool < 1 || num_osds < 1 ||
+      num_reports < 1 || num_updates < 0) {
+    cerr << argv[0] << ": invalid configuration" << std::endl;
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  srand(2);
+  PGMap pg_map;
+  {
+    PGMap::Incremental inc;
+    inc.version = 1;
+    for (int pool = 0; pool < num_pools; ++pool)
+      for (int ps = 0; ps < pgs_per_pool; ++ps) {
+	pg_stat_t s = random_pg_stat(num_osds, 100);
+	s.state = PG_STATE_ACTIVE | PG_STATE_CLEAN;
+	inc.pg_stat_updates[pg_t(ps, pool)] = s;
+      }
+    pg_map.apply_incremental(g_ceph_context, inc);
+  }
+
+  std::list<PGMap::Incremental> incs;
+  PGMap tmp;
+  tmp.version = pg_map.version;
+  for (int n = 0; n < num_reports; ++n) {
+    incs.push_back(PGMap::Incremental());
+    random_stats_inc(tmp, num_pools, pgs_per_pool, num_osds, num_updates,
+		     &incs.back());
+    for (map<pg_t,pg_stat_t>::iterator p =
+	   incs.back().pg_stat_updates.begin();
+	 p != incs.back().pg_stat_updates.end();
+	 ++p)
+      p->second.state = PG_STATE_ACTIVE | PG_STATE_CLEAN;
+    tmp.version++;
+  }
+
+  utime_t cutoff(500, 0);
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (std::list<PGMap::Incremental>::iterator p = incs.begin();
+       p != incs.end();
+       ++p) {
+    pg_map.apply_incremental(g_ceph_context, *p);
+    pg_map.get_min_last_epoch_clean();
+    ceph::unordered_map<pg_t, pg_stat_t> stuck;
+    pg_map.get_stuck_stats(PGMap::STUCK_INACTIVE, cutoff, stuck);
+    pg_map.get_stuck_stats(PGMap::STUCK_UNCLEAN, cutoff, stuck);
+    pg_map.get_stuck_stats(PGMap::STUCK_STALE, cutoff, stuck);
+  }
+  double incremental = ceph_clock_now(g_ceph_context) - start;
+
+  start = ceph_clock_now(g_ceph_context);
+  for (int n = 0; n < num_reports; ++n)
+    scan_min_last_epoch_clean(pg_map);
+  double scan = ceph_clock_now(g_ceph_context) - start;
+
+  if (scan_min_last_epoch_clean(pg_map) != pg_map.get_min_last_epoch_clean()) {
+    cerr << "min last_epoch_clean mismatch: scanned "
+	 << scan_min_last_epoch_clean(pg_map) << ", tracked "
+	 << pg_map.get_min_last_epoch_clean() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << num_reports << " reports of " << num_updates << " pgs on "
+	    << pg_map.pg_stat.size() << " pgs\n\n"
+	    << std::setw(24) << "mode"
+	    << std::setw(12) << "total s"
+	    << std::setw(12) << "ms/report"
+	    << std::endl;
+  std::cout << std::setw(24) << "apply and query"
+	    << std::setw(12) << std::fixed << std::setprecision(3) << incremental
+	    << std::setw(12) << incremental / num_reports * 1000
+	    << std::endl;
+  std::cout << std::setw(24) << "scan last_epoch_clean"
+	    << std::setw(12) << scan
+	    << std::setw(12) << scan / num_reports * 1000
+	    << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -400,3 +400,139 @@ TEST_F(OSDMapTest, PrimaryAffinity) {
     osdmap.set_primary_affinity(1, 0x10000);
   }
 }
+
+static void check_mappings_match(const OSDMap& a, const OSDMap& b)
+{
+  for (map<int64_t,pg_pool_t>::const_iterator p = a.get_pools().begin();
+       p != a.get_pools().end();
+       ++p) {
+    for (unsigned ps = 0; ps < p->second.get_pg_num(); ++ps) {
+      pg_t pgid(ps, p->first);
+      vector<int> up_a, acting_a, up_b, acting_b;
+      int up_primary_a, acting_primary_a, up_primary_b, acting_primary_b;
+      a.pg_to_up_acting_osds(pgid, &up_a, &up_primary_a,
+			     &acting_a, &acting_primary_a);
+      b.pg_to_up_acting_osds(pgid, &up_b, &up_primary_b,
+			     &acting_b, &acting_primary_b);
+      ASSERT_EQ(up_b, up_a);
+      ASSERT_EQ(up_primary_b, up_primary_a);
+      ASSERT_EQ(acting_b, acting_a);
+      ASSERT_EQ(acting_primary_b, acting_primary_a);
+    }
+  }
+}
+
+TEST_F(OSDMapTest, PGMappingCache) {
+  set_up_map();
+  OSDMap uncached;
+  uncached.deepish_copy_from(osdmap);
+  osdmap.enable_pg_mapping_cache();
+  ASSERT_FALSE(uncached.has_pg_mapping_cache());
+
+  uint64_t num_pgs = 0;
+  for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+       p != osdmap.get_pools().end();
+       ++p)
+    num_pgs += p->second.get_pg_num();
+
+  check_mappings_match(osdmap, uncached);
+  ASSERT_EQ(num_pgs, osdmap.get_pg_mapping_cache_size());
+  // cached results are the same on the second pass
+  check_mappings_match(osdmap, uncached);
+
+  // marking an osd down does not change raw placements
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.fsid = osdmap.get_fsid();
+    inc.new_state[0] = CEPH_OSD_UP;
+    osdmap.apply_incremental(inc);
+    uncached.apply_incremental(inc);
+  }
+  ASSERT_FALSE(osdmap.is_up(0));
+  ASSERT_EQ(num_pgs, osdmap.get_pg_mapping_cache_size());
+  check_mappings_match(osdmap, uncached);
+
+  // neither does a pool change that leaves its placement alone
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.fsid = osdmap.get_fsid();
+    int64_t pool = osdmap.lookup_pg_pool_name("ec");
+    pg_pool_t *p = inc.get_new_pool(pool, osdmap.get_pg_pool(pool));
+    p->last_change = inc.epoch;
+    osdmap.apply_incremental(inc);
+    uncached.apply_incremental(inc);
+  }
+  ASSERT_EQ(num_pgs, osdmap.get_pg_mapping_cache_size());
+  check_mappings_match(osdmap, uncached);
+
+  // marking an osd out does, for every pool that can reach it
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.fsid = osdmap.get_fsid();
+    inc.new_weight[1] = CEPH_OSD_OUT;
+    osdmap.apply_incremental(inc);
+    uncached.apply_incremental(inc);
+  }
+  ASSERT_EQ(0u, osdmap.get_pg_mapping_cache_size());
+  check_mappings_match(osdmap, uncached);
+  ASSERT_EQ(num_pgs, osdmap.get_pg_mapping_cache_size());
+
+  // direct changes drop the cache
+  osdmap.set_weight(1, CEPH_OSD_IN);
+  uncached.set_weight(1, CEPH_OSD_IN);
+  ASSERT_EQ(0u, osdmap.get_pg_mapping_cache_size());
+  check_mappings_match(osdmap, uncached);
+}
+
+TEST_F(OSDMapTest, CopyOnWrite) {
+  set_up_map();
+  set<const void*> seen;
+  uint64_t base_bytes = osdmap.get_mem_usage(&seen);
+  ASSERT_EQ(base_bytes, osdmap.get_mem_usage(NULL));
+
+  // the next epoch shares everything an osd going down leaves alone
+  OSDMap next;
+  next.deepish_copy_from(osdmap);
+  OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+  inc.fsid = osdmap.get_fsid();
+  inc.modified = ceph_clock_now(g_ceph_context);
+  inc.new_state[0] = CEPH_OSD_UP;
+  next.apply_incremental(inc);
+  ASSERT_FALSE(next.is_up(0));
+  ASSERT_EQ(next.get_epoch(), next.get_down_at(0));
+  ASSERT_TRUE(osdmap.is_up(0));
+  ASSERT_NE(next.get_epoch(), osdmap.get_down_at(0));
+  ASSERT_EQ(utime_t(), osdmap.get_xinfo(0).down_stamp);
+
+  uint64_t next_bytes = next.get_mem_usage(NULL);
+  uint64_t next_new_bytes = next.get_mem_usage(&seen);
+  ASSERT_LT(next_new_bytes, next_bytes);
+
+  // changing a pool leaves the original alone
+  OSDMap next2;
+  next2.deepish_copy_from(next);
+  OSDMap::Incremental inc2(next.get_epoch() + 1);
+  inc2.fsid = next.get_fsid();
+  int64_t pool = next.lookup_pg_pool_name("ec");
+  pg_pool_t *p = inc2.get_new_pool(pool, next.get_pg_pool(pool));
+  p->set_pg_num(p->get_pg_num() * 2);
+  next2.apply_incremental(inc2);
+  ASSERT_EQ(next.get_pg_pool(pool)->get_pg_num() * 2,
+	    next2.get_pg_pool(pool)->get_pg_num());
+  ASSERT_EQ(osdmap.get_pg_pool(pool)->get_pg_num(),
+	    next.get_pg_pool(pool)->get_pg_num());
+
+  // decoded maps are shared again by dedup
+  bufferlist bl;
+  next.encode(bl, CEPH_FEATURES_ALL | CEPH_FEATURE_RESERVED);
+  OSDMap *decoded = new OSDMap;
+  decoded->decode(bl);
+  set<const void*> seen2;
+  osdmap.get_mem_usage(&seen2);
+  uint64_t before = decoded->get_mem_usage(&seen2);
+  OSDMap::dedup(&osdmap, decoded);
+  set<const void*> seen3;
+  osdmap.get_mem_usage(&seen3);
+  ASSERT_LT(decoded->get_mem_usage(&seen3), before);
+  delete decoded;
+}
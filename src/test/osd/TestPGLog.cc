@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <signal.h>
 #include "osd/PGLog.h"
+#include "os/MemStore.h"
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
 #include <gtest/gtest.h>
@@ -74,6 +75,16 @@ public:
     e.prior_version = pv;
     return e;
   }
+  /// add an entry and stage the per-entry key the way PG::append_log does
+  void append(ObjectStore::Transaction &t, const coll_t &coll,
+	      const ghobject_t &log_oid, pg_log_entry_t e) {
+    map<string,bufferlist> keys;
+    if (!uses_batches())
+      e.encode_with_checksum(keys[e.get_key_name()]);
+    add(e);
+    if (!keys.empty())
+      t.omap_setkeys(coll, log_oid, keys);
+  }
   static pg_log_entry_t mk_ple_dt_rb(
     const hobject_t &hoid, eversion_t v, eversion_t pv) {
     pg_log_entry_t e;
@@ -1862,6 +1873,210 @@ TEST_F(PGLogTest, merge_log_prior_version_have) {
   run_test_case(t);
 }
 
+TEST_F(PGLogTest, batch_encoding) {
+  pg_log_t src;
+  for (unsigned i = 1; i <= 10; ++i)
+    src.log.push_back(mk_ple_mod(mk_obj(i), mk_evt(10, i), mk_evt(10, i - 1)));
+  src.can_rollback_to = mk_evt(10, 8);
+  src.rollback_info_trimmed_to = mk_evt(10, 7);
+
+  bufferlist bl;
+  encode_batch(src, src.log.begin()->version, src.log.begin(), src.log.end(),
+	       bl);
+
+  // entries up to the tail are skipped
+  pg_log_t dst;
+  eversion_t first;
+  bufferlist::iterator p = bl.begin();
+  ASSERT_EQ(6u, decode_batch(p, mk_evt(10, 4), dst, &first));
+  ASSERT_EQ(mk_evt(10, 1), first);
+  ASSERT_EQ(6u, dst.log.size());
+  ASSERT_EQ(mk_evt(10, 5), dst.log.begin()->version);
+  ASSERT_EQ(mk_evt(10, 10), dst.log.rbegin()->version);
+  ASSERT_EQ(src.can_rollback_to, dst.can_rollback_to);
+  ASSERT_EQ(src.rollback_info_trimmed_to, dst.rollback_info_trimmed_to);
+
+  // corruption is detected
+  bufferlist bad;
+  bl.copy(0, bl.length() - 8, bad);
+  char c = bl[bl.length() - 8] ^ 0xff;
+  bad.append(&c, 1);
+  bad.append(bl.c_str() + bl.length() - 7, 7);
+  pg_log_t dst2;
+  p = bad.begin();
+  ASSERT_THROW(decode_batch(p, eversion_t(), dst2, &first),
+	       buffer::malformed_input);
+}
+
+/*
+ * Steady state writes, trimming in osd_pg_log_trim_min steps the way
+ * PG::calc_trim_to does: batched entries must cost fewer transaction
+ * bytes per op than per-entry keys, counting everything PG::append_log
+ * writes.
+ */
+TEST_F(PGLogTest, write_log_bytes_per_op) {
+  const unsigned ops = 5000;
+  const unsigned keep = 1000;
+  const unsigned trim_min = 100;
+  coll_t coll;
+  ghobject_t log_oid(hobject_t(sobject_t("pglog", CEPH_NOSNAP)));
+  list<hobject_t> remove_snap;
+  TestHandler h(remove_snap);
+  uint64_t bytes[2];
+
+  for (int batched = 0; batched < 2; ++batched) {
+    clear();
+    use_batches = batched;
+    bytes[batched] = 0;
+    pg_info_t info;
+    for (unsigned i = 1; i <= ops; ++i) {
+      ObjectStore::Transaction t;
+      pg_log_entry_t e = mk_ple_mod(mk_obj(i % 128), mk_evt(10, i),
+				    mk_evt(10, i > 128 ? i - 128 : 0));
+      append(t, coll, log_oid, e);
+      info.last_update = info.last_complete = e.version;
+      if (log.log.size() >= keep + trim_min)
+	trim(&h, mk_evt(10, i - keep), info);
+
+      write_log(t, coll, log_oid);
+      bytes[batched] += t.get_encoded_bytes();
+    }
+    ASSERT_EQ(keep, log.log.size());
+    ASSERT_EQ((bool)batched, log_batched);
+    if (batched)
+      ASSERT_GE(log.log.size() + 1, log_batches.size());
+  }
+
+  ASSERT_LT(bytes[1], bytes[0]);
+}
+
+TEST_F(PGLogTest, append_read_log) {
+  char tmpl[] = "/tmp/unittest_pglog.XXXXXX";
+  ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+  string dir = tmpl;
+  MemStore store(g_ceph_context, dir);
+  ASSERT_EQ(0, store.mkfs());
+  ASSERT_EQ(0, store.mount());
+
+  spg_t pgid(pg_t(0, 1), shard_id_t::NO_SHARD);
+  coll_t coll(pgid);
+  ghobject_t log_oid(pgid.make_pgmeta_oid());
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(coll);
+    store.apply_transaction(t);
+  }
+  list<hobject_t> remove_snap;
+  TestHandler h(remove_snap);
+
+  for (int batched = 0; batched < 2; ++batched) {
+    clear();
+    use_batches = batched;
+    pg_info_t info;
+    info.pgid = pgid;
+    {
+      ObjectStore::Transaction t;
+      t.remove(coll, log_oid);
+      t.touch(coll, log_oid);
+      store.apply_transaction(t);
+    }
+    for (unsigned i = 1; i <= 300; ++i) {
+      ObjectStore::Transaction t;
+      pg_log_entry_t e = mk_ple_mod(mk_obj(i % 16), mk_evt(10, i),
+				    mk_evt(10, i > 16 ? i - 16 : 0));
+      append(t, coll, log_oid, e);
+      info.last_update = info.last_complete = e.version;
+      if (log.log.size() >= 120)
+	trim(&h, mk_evt(10, i - 100), info);
+      write_log(t, coll, log_oid);
+      store.apply_transaction(t);
+    }
+
+    IndexedLog rlog;
+    pg_missing_t rmissing;
+    map<eversion_t, hobject_t> priors;
+    ostringstream oss;
+    set<eversion_t> batches;
+    bool stale = false;
+    read_log(&store, coll, coll, log_oid, info, priors, rlog, rmissing, oss,
+	     0, &batches, &stale);
+    ASSERT_FALSE(stale);
+    ASSERT_EQ((bool)batched, !batches.empty());
+    ASSERT_EQ(log.log.size(), rlog.log.size());
+    list<pg_log_entry_t>::iterator p = log.log.begin();
+    list<pg_log_entry_t>::iterator q = rlog.log.begin();
+    for (; p != log.log.end(); ++p, ++q)
+      ASSERT_EQ(p->version, q->version);
+
+    if (!batched)
+      continue;
+
+    // per-entry keys left next to the batches are ignored on read, and
+    // dropped by the next write
+    {
+      map<string,bufferlist> keys;
+      for (p = log.log.begin(); p != log.log.end(); ++p)
+	p->encode_with_checksum(keys[p->get_key_name()]);
+      ObjectStore::Transaction t;
+      t.omap_setkeys(coll, log_oid, keys);
+      store.apply_transaction(t);
+    }
+    list<pg_log_entry_t> expected = log.log;
+    clear();
+    read_log(&store, coll, coll, log_oid, info, oss);
+    ASSERT_TRUE(log_batched);
+    ASSERT_TRUE(is_dirty());
+    ASSERT_EQ(expected.size(), log.log.size());
+    {
+      ObjectStore::Transaction t;
+      write_log(t, coll, log_oid);
+      store.apply_transaction(t);
+    }
+    IndexedLog rlog2;
+    stale = false;
+    read_log(&store, coll, coll, log_oid, info, priors, rlog2, rmissing, oss,
+	     0, 0, &stale);
+    ASSERT_FALSE(stale);
+    ASSERT_EQ(expected.size(), rlog2.log.size());
+  }
+
+  ASSERT_EQ(0, store.umount());
+  ASSERT_EQ(0, system(("rm -rf " + dir).c_str()));
+}
+
+TEST_F(PGLogTest, unindex_objects) {
+  clear();
+  for (unsigned i = 1; i <= 10; ++i) {
+    pg_log_entry_t e = mk_ple_mod(mk_obj(i % 4), mk_evt(10, i),
+				  mk_evt(10, i - 1));
+    add(e);
+  }
+  ASSERT_EQ(4u, log.objects.size());
+
+  mem_usage_t before;
+  get_mem_usage(&before);
+  ASSERT_EQ(10u, before.entries);
+
+  unindex_objects();
+  ASSERT_TRUE(log.objects.empty());
+  mem_usage_t after;
+  get_mem_usage(&after);
+  ASSERT_EQ(before.log_bytes, after.log_bytes);
+  ASSERT_LT(after.index_bytes, before.index_bytes);
+
+  // appending while unindexed does not index
+  pg_log_entry_t e = mk_ple_mod(mk_obj(1), mk_evt(10, 11), mk_evt(10, 10));
+  add(e);
+  ASSERT_TRUE(log.objects.empty());
+
+  // a lookup rebuilds the index with the newest entry per object
+  ASSERT_TRUE(log.logged_object(mk_obj(1)));
+  ASSERT_EQ(4u, log.objects.size());
+  ASSERT_EQ(mk_evt(10, 11), log.get_object_entry(mk_obj(1))->version);
+  ASSERT_EQ(mk_evt(10, 10), log.get_object_entry(mk_obj(2))->version);
+  ASSERT_TRUE(log.get_object_entry(mk_obj(5)) == NULL);
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -12,6 +12,7 @@
 
 #include "gtest/gtest.h"
 #include "osd/HitSet.h"
+#include "osd/ObjectTemperature.h"
 #include <iostream>
 
 class HitSetTestStrap {
@@ -195,3 +196,35 @@ TEST_F(ExplicitObjectHitSetTest, RejectsNoMatch) {
   }
   EXPECT_EQ(matches, 0);
 }
+
+TEST(ObjectTemperature, HitsAndDecay) {
+  utime_t now(1000, 0);
+  ObjectTemperature temp(4, 1024, 100, now);
+  char buf[50];
+  for (int i = 0; i < 100; ++i) {
+    sprintf(buf, "hitsettest_%d", i);
+    hobject_t obj(object_t(buf), "", 0, i, 0, "");
+    for (int j = 0; j < i % 5; ++j)
+      temp.hit(obj, now);
+  }
+  // collisions can only overestimate
+  int exact = 0;
+  for (int i = 0; i < 100; ++i) {
+    sprintf(buf, "hitsettest_%d", i);
+    hobject_t obj(object_t(buf), "", 0, i, 0, "");
+    EXPECT_GE(temp.get(obj), i % 5);
+    if (temp.get(obj) == i % 5)
+      ++exact;
+  }
+  EXPECT_GE(exact, 95);
+
+  hobject_t hot(object_t("hitsettest_4"), "", 0, 4, 0, "");
+  EXPECT_EQ(4, temp.get(hot));
+  // too soon to decay
+  temp.decay(now + utime_t(1, 0));
+  EXPECT_EQ(4, temp.get(hot));
+  temp.decay(now + utime_t(100, 0));
+  EXPECT_FLOAT_EQ(2, temp.get(hot));
+  temp.decay(now + utime_t(100 * 20, 0));
+  EXPECT_EQ(0, temp.get(hot));
+}
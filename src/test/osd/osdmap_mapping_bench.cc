@@ -0,0 +1,148 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Time a full pass over a pool of --pgs pgs on a map of --osds osds,
+ * without the pg placement cache, when filling it, once it is filled,
+ * and after an epoch that marks an osd down.
+ */
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "common/ceph_argparse.h"
+#include "common/common_init.h"
+#include "common/Clock.h"
+#include "global/global_context.h"
+#include "global/global_init.h"
+#include "osd/OSDMap.h"
+
+static void usage()
+{
+  cerr << "usage: ceph_test_osdmap_mapping_bench [options]\n"
+       << "  --osds <n>                number of osds (default 1000)\n"
+       << "  --pgs <n>                 pgs in the pool (default 100000)\n"
+       << std::endl;
+}
+
+static uint32_t map_all_pgs(const OSDMap& osdmap, int64_t pool)
+{
+  uint32_t sum = 0;
+  unsigned pg_num = osdmap.get_pg_pool(pool)->get_pg_num();
+  vector<int> up, acting;
+  int up_primary, acting_primary;
+  for (unsigned ps = 0; ps < pg_num; ++ps) {
+    osdmap.pg_to_up_acting_osds(pg_t(ps, pool), &up, &up_primary,
+				&acting, &acting_primary);
+    sum += acting_primary + up.size();
+  }
+  return sum;
+}
+
+static void print(const char *name, double elapsed, unsigned num_pgs)
+{
+  std::cout << std::setw(24) << name
+	    << std::setw(12) << std::fixed << std::setprecision(3) << elapsed
+	    << std::setw(12) << elapsed / num_pgs * 1000000
+	    << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  std::vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int num_osds = 1000;
+  int num_pgs = 100000;
+  std::ostringstream err;
+  std::vector<const char*>::iterator i;
+  for (i = args.begin(); i != args.end();) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_withint(args, i, &num_osds, &err, "--osds", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &num_pgs, &err, "--pgs", (char*)NULL)) {
+    } else {
+      cerr << "unknown option " << *i << std::endl;
+      usage();
+      return EXIT_FAILURE;
+    }
+    if (!err.str().empty()) {
+      cerr << argv[0] << ": " << err.str() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (num_osds < 3 || num_pgs < 1) {
+    cerr << argv[0] << ": invalid configuration" << std::endl;
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  OSDMap osdmap;
+  uuid_d fsid;
+  osdmap.build_simple(g_ceph_context, 0, fsid, num_osds, 0, 0);
+  OSDMap::Incremental pending_inc(osdmap.get_epoch() + 1);
+  pending_inc.fsid = osdmap.get_fsid();
+  entity_addr_t sample_addr;
+  for (int n = 0; n < num_osds; ++n) {
+    sample_addr.nonce = n;
+    pending_inc.new_state[n] = CEPH_OSD_EXISTS | CEPH_OSD_NEW;
+    pending_inc.new_up_client[n] = sample_addr;
+    pending_inc.new_up_cluster[n] = sample_addr;
+    pending_inc.new_hb_back_up[n] = sample_addr;
+    pending_inc.new_hb_front_up[n] = sample_addr;
+    pending_inc.new_weight[n] = CEPH_OSD_IN;
+  }
+  osdmap.apply_incremental(pending_inc);
+
+  OSDMap::Incremental new_pool_inc(osdmap.get_epoch() + 1);
+  new_pool_inc.new_pool_max = osdmap.get_pool_max();
+  new_pool_inc.fsid = osdmap.get_fsid();
+  pg_pool_t empty;
+  int64_t pool = ++new_pool_inc.new_pool_max;
+  pg_pool_t *p = new_pool_inc.get_new_pool(pool, &empty);
+  p->size = 3;
+  p->set_pg_num(num_pgs);
+  p->set_pgp_num(num_pgs);
+  p->type = pg_pool_t::TYPE_REPLICATED;
+  p->crush_ruleset = osdmap.get_pg_pool(0)->get_crush_ruleset();
+  new_pool_inc.new_pool_names[pool] = "bench";
+  osdmap.apply_incremental(new_pool_inc);
+
+  std::cout << num_pgs << " pgs on " << num_osds << " osds\n\n"
+	    << std::setw(24) << "mode"
+	    << std::setw(12) << "total s"
+	    << std::setw(12) << "us/pg"
+	    << std::endl;
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  uint32_t expected = map_all_pgs(osdmap, pool);
+  print("uncached", ceph_clock_now(g_ceph_context) - start, num_pgs);
+
+  osdmap.enable_pg_mapping_cache();
+  start = ceph_clock_now(g_ceph_context);
+  uint32_t filled = map_all_pgs(osdmap, pool);
+  print("filling", ceph_clock_now(g_ceph_context) - start, num_pgs);
+
+  start = ceph_clock_now(g_ceph_context);
+  uint32_t cached = map_all_pgs(osdmap, pool);
+  print("cached", ceph_clock_now(g_ceph_context) - start, num_pgs);
+
+  if (filled != expected || cached != expected) {
+    cerr << "cached mappings differ from uncached ones" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  OSDMap::Incremental down_inc(osdmap.get_epoch() + 1);
+  down_inc.fsid = osdmap.get_fsid();
+  down_inc.new_state[0] = CEPH_OSD_UP;
+  osdmap.apply_incremental(down_inc);
+  start = ceph_clock_now(g_ceph_context);
+  map_all_pgs(osdmap, pool);
+  print("next epoch", ceph_clock_now(g_ceph_context) - start, num_pgs);
+  return EXIT_SUCCESS;
+}
@@ -1292,6 +1292,95 @@ TEST(shard_id_t, iostream) {
     ASSERT_EQ(out.str(), "0,1,2");
 }
 
+TEST(pg_hash_tree_t, leaves) {
+  hobject_t begin, end;
+  begin.set_hash(hobject_t::_reverse_nibbles(0x10000000));
+  end.set_hash(hobject_t::_reverse_nibbles(0x20000000));
+  pg_hash_tree_t t;
+  t.reset(begin, end, 4);
+  ASSERT_EQ(16u, t.get_num_leaves());
+  ASSERT_EQ(begin, t.get_leaf_begin(0));
+  ASSERT_EQ(end, t.get_leaf_begin(t.get_num_leaves()));
+  srand(getpid());
+  for (int i = 0; i < 1000; ++i) {
+    uint32_t key = 0x10000000 + (rand() % 0x10000000);
+    hobject_t o(object_t("foo"), "", CEPH_NOSNAP,
+		hobject_t::_reverse_nibbles(key), 1, "");
+    ASSERT_TRUE(t.contains(o));
+    unsigned leaf = t.get_leaf(o);
+    ASSERT_LE(t.get_leaf_begin(leaf), o);
+    ASSERT_GT(t.get_leaf_begin(leaf + 1), o);
+  }
+}
+
+TEST(pg_hash_tree_t, compare) {
+  ScrubMap a;
+  for (unsigned i = 0; i < 100; ++i) {
+    hobject_t o(object_t("obj"), "", CEPH_NOSNAP, i * 0x1234567, 1, "");
+    a.objects[o].size = i;
+  }
+  ScrubMap b(a);
+
+  pg_hash_tree_t ta, tb;
+  ta.reset(hobject_t(), hobject_t::get_max(), 6);
+  tb.reset(hobject_t(), hobject_t::get_max(), 6);
+  a.build_hash_tree(&ta);
+  b.build_hash_tree(&tb);
+  ASSERT_EQ(100u, ta.num_objects);
+  ASSERT_EQ(ta.get_root(), tb.get_root());
+  vector<pair<hobject_t, hobject_t> > divergent;
+  ta.compare(tb, &divergent);
+  ASSERT_TRUE(divergent.empty());
+
+  // one changed object and one missing object
+  hobject_t changed = b.objects.begin()->first;
+  b.objects[changed].size = 12345;
+  hobject_t missing = b.objects.rbegin()->first;
+  b.objects.erase(missing);
+  tb.reset(hobject_t(), hobject_t::get_max(), 6);
+  b.build_hash_tree(&tb);
+  ASSERT_NE(ta.get_root(), tb.get_root());
+  ta.compare(tb, &divergent);
+  ASSERT_FALSE(divergent.empty());
+  ASSERT_LE(divergent.size(), 2u);
+  ASSERT_LE(divergent.front().first, changed);
+  ASSERT_GT(divergent.front().second, changed);
+  ASSERT_LE(divergent.back().first, missing);
+  ASSERT_GT(divergent.back().second, missing);
+
+  // only the divergent ranges hold differing objects
+  for (map<hobject_t, ScrubMap::object>::iterator p = a.objects.begin();
+       p != a.objects.end();
+       ++p) {
+    bool inside = false;
+    for (unsigned i = 0; i < divergent.size(); ++i)
+      inside |= (p->first >= divergent[i].first &&
+		 p->first < divergent[i].second);
+    if (!inside) {
+      ASSERT_TRUE(b.objects.count(p->first));
+      ASSERT_EQ(p->second.size, b.objects[p->first].size);
+    }
+  }
+
+  // the summary survives encoding
+  bufferlist bl;
+  ::encode(tb, bl);
+  pg_hash_tree_t tc;
+  bufferlist::iterator bp = bl.begin();
+  ::decode(tc, bp);
+  ASSERT_EQ(tb.get_root(), tc.get_root());
+  ASSERT_EQ(tb.num_objects, tc.num_objects);
+  tb.compare(tc, &divergent);
+  ASSERT_TRUE(divergent.empty());
+
+  // trees over different ranges diverge entirely
+  tc.reset(hobject_t(), changed, 6);
+  ta.compare(tc, &divergent);
+  ASSERT_EQ(1u, divergent.size());
+  ASSERT_EQ(ta.begin, divergent[0].first);
+  ASSERT_EQ(ta.end, divergent[0].second);
+}
+
 /*
  * Local Variables:
  * compile-command: "cd ../.. ;
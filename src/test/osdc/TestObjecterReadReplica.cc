@@ -0,0 +1,234 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include "gtest/gtest.h"
+#include "osd/OSDMap.h"
+#include "osdc/Objecter.h"
+
+#include "global/global_context.h"
+#include "global/global_init.h"
+#include "common/common_init.h"
+#include "include/stringify.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+int main(int argc, char **argv) {
+  std::vector<const char *> preargs;
+  std::vector<const char*> args(argv, argv+argc);
+  global_init(&preargs, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY,
+              CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->set_val("osd_pool_default_size", "3", false);
+  g_ceph_context->_conf->set_val("osd_crush_chooseleaf_type", "0", false);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+class ObjecterReadReplicaTest : public testing::Test {
+public:
+  static const int num_osds = 6;
+
+  OSDMap osdmap;
+  int64_t pool;
+  vector<Objecter::OSDSession*> sessions;  ///< by osd; NULL if not connected
+
+  // the pg we read from
+  vector<int> up, acting;
+  int acting_primary;
+
+  ObjecterReadReplicaTest() : pool(-1), acting_primary(-1) {}
+
+  virtual void SetUp() {
+    uuid_d fsid;
+    osdmap.build_simple(g_ceph_context, 0, fsid, num_osds, 4, 4);
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.fsid = osdmap.get_fsid();
+    entity_addr_t sample_addr;
+    uuid_d sample_uuid;
+    for (int i = 0; i < num_osds; ++i) {
+      sample_uuid.uuid[i] = i;
+      sample_addr.nonce = i;
+      inc.new_state[i] = CEPH_OSD_EXISTS | CEPH_OSD_NEW;
+      inc.new_up_client[i] = sample_addr;
+      inc.new_up_cluster[i] = sample_addr;
+      inc.new_hb_back_up[i] = sample_addr;
+      inc.new_hb_front_up[i] = sample_addr;
+      inc.new_weight[i] = CEPH_OSD_IN;
+      inc.new_uuid[i] = sample_uuid;
+    }
+    osdmap.apply_incremental(inc);
+    pool = osdmap.lookup_pg_pool_name("rbd");
+    ASSERT_LE(0, pool);
+    ASSERT_EQ(3u, osdmap.get_pg_pool(pool)->get_size());
+
+    for (int i = 0; i < num_osds; ++i) {
+      sessions.push_back(new Objecter::OSDSession(g_ceph_context, i));
+      set_load(i, 1000, 0);
+    }
+    map_pg(0);
+  }
+
+  virtual void TearDown() {
+    for (unsigned i = 0; i < sessions.size(); ++i) {
+      if (sessions[i])
+	sessions[i]->put();
+    }
+  }
+
+  void map_pg(unsigned ps) {
+    int up_primary;
+    osdmap.pg_to_up_acting_osds(pg_t(ps, pool, -1), &up, &up_primary,
+				&acting, &acting_primary);
+  }
+
+  /// map a pg that osd serves as a replica, not as the primary
+  bool find_pg_with_replica(int osd) {
+    unsigned pg_num = osdmap.get_pg_pool(pool)->get_pg_num();
+    for (unsigned ps = 0; ps < pg_num; ++ps) {
+      map_pg(ps);
+      if (acting.size() == 3 && osd != acting_primary &&
+	  std::find(acting.begin(), acting.end(), osd) != acting.end())
+	return true;
+    }
+    return false;
+  }
+
+  void set_load(int osd, uint64_t latency_us, uint64_t ops) {
+    sessions[osd]->read_latency_us.set(latency_us);
+    sessions[osd]->num_ops.set(ops);
+  }
+
+  void set_primary_affinity(int osd, unsigned affinity) {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.fsid = osdmap.get_fsid();
+    inc.new_primary_affinity[osd] = affinity;
+    osdmap.apply_incremental(inc);
+  }
+
+  /// the first acting osd other than the primary
+  int replica(int n = 0) {
+    for (unsigned i = 0; i < acting.size(); ++i) {
+      if (acting[i] != acting_primary && n-- == 0)
+	return acting[i];
+    }
+    return -1;
+  }
+
+  int choose(const vector<int>& up, const vector<int>& acting,
+	     const std::multimap<string,string> *localize_to = NULL) {
+    vector<Objecter::OSDSession*> acting_sessions;
+    for (unsigned i = 0; i < acting.size(); ++i)
+      acting_sessions.push_back(acting[i] >= 0 ? sessions[acting[i]] : NULL);
+    return Objecter::choose_read_replica(
+      g_ceph_context, &osdmap, osdmap.get_pg_pool(pool), up, acting,
+      acting_primary, localize_to, acting_sessions);
+  }
+
+  int choose(const std::multimap<string,string> *localize_to = NULL) {
+    return choose(up, acting, localize_to);
+  }
+};
+
+TEST_F(ObjecterReadReplicaTest, PrimaryWinsTies) {
+  ASSERT_EQ(3u, acting.size());
+  ASSERT_EQ(acting_primary, choose());
+
+  // no load information at all
+  for (unsigned i = 0; i < sessions.size(); ++i) {
+    sessions[i]->put();
+    sessions[i] = NULL;
+  }
+  ASSERT_EQ(acting_primary, choose());
+}
+
+TEST_F(ObjecterReadReplicaTest, LeastExpectedWait) {
+  set_load(acting_primary, 1000, 4);
+  set_load(replica(0), 1000, 2);
+  set_load(replica(1), 4000, 0);
+  ASSERT_EQ(replica(0), choose());
+
+  // queued ops count as much as latency
+  set_load(replica(1), 1000, 1);
+  ASSERT_EQ(replica(1), choose());
+
+  // a replica we are not connected to only beats nothing
+  sessions[replica(1)]->put();
+  sessions[replica(1)] = NULL;
+  ASSERT_EQ(replica(0), choose());
+}
+
+TEST_F(ObjecterReadReplicaTest, ZeroAffinitySkipped) {
+  int idle = num_osds - 1;
+  set_primary_affinity(idle, 0);
+  ASSERT_TRUE(find_pg_with_replica(idle));
+  for (unsigned i = 0; i < acting.size(); ++i)
+    set_load(acting[i], 1000, 8);
+  set_load(idle, 1, 0);
+  int r = choose();
+  ASSERT_NE(idle, r);
+  ASSERT_NE(-1, r);
+
+  // half the affinity makes an osd look twice as busy
+  set_primary_affinity(idle, CEPH_OSD_MAX_PRIMARY_AFFINITY / 2);
+  ASSERT_TRUE(find_pg_with_replica(idle));
+  for (unsigned i = 0; i < acting.size(); ++i)
+    set_load(acting[i], 1000, 0);
+  set_load(idle, 400, 0);
+  ASSERT_EQ(idle, choose());
+  set_load(idle, 600, 0);
+  ASSERT_EQ(acting_primary, choose());
+}
+
+TEST_F(ObjecterReadReplicaTest, UncleanPGUsesPrimary) {
+  set_load(acting_primary, 1000, 8);
+  set_load(replica(0), 1, 0);
+  set_load(replica(1), 1, 0);
+  ASSERT_NE(acting_primary, choose());
+
+  // up != acting, e.g. while backfilling
+  vector<int> other_up = up;
+  for (int osd = 0; osd < num_osds; ++osd) {
+    if (std::find(up.begin(), up.end(), osd) == up.end()) {
+      other_up.back() = osd;
+      break;
+    }
+  }
+  ASSERT_NE(other_up, acting);
+  ASSERT_EQ(acting_primary, choose(other_up, acting));
+
+  // degraded: fewer replicas than the pool size
+  vector<int> degraded;
+  degraded.push_back(acting_primary);
+  degraded.push_back(replica(0));
+  ASSERT_EQ(acting_primary, choose(degraded, degraded));
+}
+
+TEST_F(ObjecterReadReplicaTest, Localize) {
+  // move one osd to a host of its own, then find a pg it serves as a
+  // replica
+  int local = num_osds - 1;
+  map<string,string> loc;
+  loc["host"] = "otherhost";
+  loc["rack"] = "localrack";
+  loc["root"] = "default";
+  ASSERT_LE(0, osdmap.crush->create_or_move_item(g_ceph_context, local, 1.0,
+						 "osd." + stringify(local),
+						 loc));
+  ASSERT_TRUE(find_pg_with_replica(local));
+  int remote = replica(0) == local ? replica(1) : replica(0);
+
+  set_load(acting_primary, 1000, 8);
+  set_load(remote, 1, 0);
+  set_load(local, 1000, 2);
+  ASSERT_EQ(remote, choose());
+
+  std::multimap<string,string> localize_to;
+  localize_to.insert(make_pair(string("host"), string("otherhost")));
+  ASSERT_EQ(local, choose(&localize_to));
+
+  // the primary is still used if the local replica is busier
+  set_load(local, 1000, 16);
+  ASSERT_EQ(acting_primary, choose(&localize_to));
+}
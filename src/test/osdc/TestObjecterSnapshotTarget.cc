@@ -0,0 +1,110 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include "gtest/gtest.h"
+#include "osd/OSDMap.h"
+#include "osdc/Objecter.h"
+
+#include "global/global_context.h"
+#include "global/global_init.h"
+#include "common/common_init.h"
+
+#include <iostream>
+
+using namespace std;
+
+int main(int argc, char **argv) {
+  std::vector<const char *> preargs;
+  std::vector<const char*> args(argv, argv+argc);
+  global_init(&preargs, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY,
+              CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+/*
+ * An op that the fast path gives up on is recalculated by _op_submit()
+ * against the live map, which may have added or removed a cache tier
+ * since the published snapshot.
+ */
+class ObjecterSnapshotTargetTest : public testing::Test {
+public:
+  static const int num_osds = 6;
+
+  Objecter objecter;
+  int64_t base, cache;
+  vector<Objecter::OSDSession*> no_sessions;
+
+  ObjecterSnapshotTargetTest()
+    : objecter(g_ceph_context, NULL, NULL, NULL, 0, 0),
+      base(-1), cache(-1),
+      no_sessions(num_osds, (Objecter::OSDSession*)NULL) {}
+
+  void build_map(OSDMap *osdmap, bool tiered) {
+    uuid_d fsid;
+    osdmap->build_simple(g_ceph_context, 0, fsid, num_osds, 4, 4);
+    OSDMap::Incremental inc(osdmap->get_epoch() + 1);
+    inc.fsid = osdmap->get_fsid();
+    entity_addr_t sample_addr;
+    for (int i = 0; i < num_osds; ++i) {
+      sample_addr.nonce = i;
+      inc.new_state[i] = CEPH_OSD_EXISTS | CEPH_OSD_NEW;
+      inc.new_up_client[i] = sample_addr;
+      inc.new_up_cluster[i] = sample_addr;
+      inc.new_hb_back_up[i] = sample_addr;
+      inc.new_hb_front_up[i] = sample_addr;
+      inc.new_weight[i] = CEPH_OSD_IN;
+    }
+    osdmap->apply_incremental(inc);
+
+    base = osdmap->lookup_pg_pool_name("rbd");
+    ASSERT_LE(0, base);
+    OSDMap::Incremental pool_inc(osdmap->get_epoch() + 1);
+    pool_inc.fsid = osdmap->get_fsid();
+    pool_inc.new_pool_max = osdmap->get_pool_max();
+    cache = ++pool_inc.new_pool_max;
+    pg_pool_t *c = pool_inc.get_new_pool(cache, osdmap->get_pg_pool(base));
+    pool_inc.new_pool_names[cache] = "cache";
+    if (tiered) {
+      pg_pool_t *b = pool_inc.get_new_pool(base, osdmap->get_pg_pool(base));
+      b->tiers.insert(cache);
+      b->read_tier = b->write_tier = cache;
+      c->tier_of = base;
+    }
+    osdmap->apply_incremental(pool_inc);
+  }
+
+  Objecter::Op *make_write() {
+    vector<OSDOp> ops(1);
+    ops[0].op.op = CEPH_OSD_OP_WRITEFULL;
+    return new Objecter::Op(object_t("foo"), object_locator_t(base), ops,
+			    CEPH_OSD_FLAG_WRITE, NULL, NULL, NULL);
+  }
+
+  /// fall back from snap, then calculate the target the way _op_submit does
+  int64_t fall_back(const OSDMap& snap, const OSDMap& live) {
+    Objecter::Op *op = make_write();
+    ceph_tid_t tid = 0;
+    EXPECT_FALSE(objecter.op_submit_in_snapshot(&snap, no_sessions, op, &tid));
+    EXPECT_TRUE(op->target.target_oid.name.empty());
+    EXPECT_TRUE(op->target.target_oloc.empty());
+    objecter.calc_target(&live, &op->target, false);
+    int64_t pool = op->target.target_oloc.pool;
+    op->put();
+    return pool;
+  }
+};
+
+TEST_F(ObjecterSnapshotTargetTest, TierAdded) {
+  OSDMap snap, live;
+  build_map(&snap, false);
+  build_map(&live, true);
+  ASSERT_EQ(cache, fall_back(snap, live));
+}
+
+TEST_F(ObjecterSnapshotTargetTest, TierRemoved) {
+  OSDMap snap, live;
+  build_map(&snap, true);
+  build_map(&live, false);
+  ASSERT_EQ(base, fall_back(snap, live));
+}
@@ -0,0 +1,319 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Measure ObjectCacher throughput with many threads issuing small I/Os,
+ * with all objects behind one cache and lock, and with the objects
+ * spread over several independently locked caches the way librbd
+ * shards its cache (rbd_cache_shards).
+ */
+
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/ceph_argparse.h"
+#include "common/common_init.h"
+#include "common/config.h"
+#include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "common/snap_types.h"
+#include "global/global_init.h"
+#include "include/buffer.h"
+#include "include/Context.h"
+#include "include/object.h"
+#include "include/stringify.h"
+#include "osdc/ObjectCacher.h"
+
+#include "FakeWriteback.h"
+
+struct bench_config {
+  uint64_t num_objs;
+  uint64_t obj_size;
+  uint64_t op_size;
+  uint64_t ops_per_thread;
+  uint64_t delay_ns;
+  float percent_reads;
+};
+
+struct CacheShard {
+  Mutex lock;
+  FakeWriteback writeback;
+  ObjectCacher cache;
+  ObjectCacher::ObjectSet object_set;
+
+  CacheShard(const string &name, uint64_t size, uint64_t delay_ns)
+    : lock("object_cacher_bench::object_cacher"),
+      writeback(g_ceph_context, &lock, delay_ns),
+      cache(g_ceph_context, name, writeback, lock, NULL, NULL,
+	    size, 1000000, size / 2, size / 4,
+	    g_conf->client_oc_max_dirty_age, true),
+      object_set(NULL, 0, 0)
+  {
+    cache.start();
+  }
+
+  ~CacheShard() {
+    lock.Lock();
+    cache.release_set(&object_set);
+    lock.Unlock();
+
+    Mutex mylock("object_cacher_bench::flush");
+    Cond cond;
+    bool done = false;
+    int r;
+    lock.Lock();
+    bool flushed = cache.flush_set(&object_set,
+				   new C_SafeCond(&mylock, &cond, &done, &r));
+    lock.Unlock();
+    if (!flushed) {
+      mylock.Lock();
+      while (!done)
+	cond.Wait(mylock);
+      mylock.Unlock();
+    }
+
+    lock.Lock();
+    cache.release_set(&object_set);
+    lock.Unlock();
+    cache.stop();
+  }
+};
+
+class Bench {
+public:
+  Bench(const bench_config &c, unsigned num_shards)
+    : conf(c)
+  {
+    uint64_t size = conf.num_objs * conf.obj_size * 2 / num_shards;
+    for (unsigned i = 0; i < num_shards; ++i)
+      shards.push_back(new CacheShard("bench" + stringify(num_shards) +
+				      "-" + stringify(i),
+				      size, conf.delay_ns));
+    bufferptr bp(conf.obj_size);
+    bp.zero();
+    zeros.append(bp);
+  }
+
+  ~Bench() {
+    for (vector<CacheShard*>::iterator p = shards.begin();
+	 p != shards.end(); ++p)
+      delete *p;
+  }
+
+  CacheShard *get_shard(const object_t &oid) {
+    return shards[CEPH_HASH_NAMESPACE::hash<object_t>()(oid) % shards.size()];
+  }
+
+  object_t get_oid(uint64_t n) {
+    return object_t("bench" + stringify(n));
+  }
+
+  void read(const object_t &oid, uint64_t off, uint64_t len) {
+    CacheShard *shard = get_shard(oid);
+    bufferlist bl;
+    ObjectCacher::OSDRead *rd = shard->cache.prepare_read(CEPH_NOSNAP, &bl,
+							   0);
+    rd->extents.push_back(make_extent(oid, off, len));
+
+    Mutex mylock("object_cacher_bench::read");
+    Cond cond;
+    bool done = false;
+    int r;
+    Context *onfinish = new C_SafeCond(&mylock, &cond, &done, &r);
+    shard->lock.Lock();
+    r = shard->cache.readx(rd, &shard->object_set, onfinish);
+    shard->lock.Unlock();
+    if (r != 0) {
+      delete onfinish;
+      return;
+    }
+    mylock.Lock();
+    while (!done)
+      cond.Wait(mylock);
+    mylock.Unlock();
+  }
+
+  void write(const object_t &oid, uint64_t off, uint64_t len) {
+    CacheShard *shard = get_shard(oid);
+    bufferlist bl;
+    bl.substr_of(zeros, 0, len);
+    ObjectCacher::OSDWrite *wr = shard->cache.prepare_write(snapc, bl,
+							     utime_t(), 0);
+    wr->extents.push_back(make_extent(oid, off, len));
+    Mutex::Locker l(shard->lock);
+    shard->cache.writex(wr, &shard->object_set, shard->lock, NULL);
+  }
+
+  /// fill the cache so that the timed reads are hits
+  void warm_up() {
+    for (uint64_t i = 0; i < conf.num_objs; ++i)
+      write(get_oid(i), 0, conf.obj_size);
+  }
+
+  /// run the ops of one thread
+  void run(unsigned seed) {
+    uint64_t blocks = conf.obj_size / conf.op_size;
+    for (uint64_t i = 0; i < conf.ops_per_thread; ++i) {
+      object_t oid = get_oid(rand_r(&seed) % conf.num_objs);
+      uint64_t off = (rand_r(&seed) % blocks) * conf.op_size;
+      if (rand_r(&seed) < conf.percent_reads * RAND_MAX)
+	read(oid, off, conf.op_size);
+      else
+	write(oid, off, conf.op_size);
+    }
+  }
+
+private:
+  bench_config conf;
+  vector<CacheShard*> shards;
+  bufferlist zeros;
+  SnapContext snapc;
+
+  ObjectExtent make_extent(const object_t &oid, uint64_t off, uint64_t len) {
+    ObjectExtent extent(oid, 0, off, len, 0);
+    extent.oloc.pool = 0;
+    extent.buffer_extents.push_back(make_pair(0, len));
+    return extent;
+  }
+};
+
+class BenchThread : public Thread {
+public:
+  BenchThread(Bench *b, unsigned s) : bench(b), seed(s) {}
+  void *entry() {
+    bench->run(seed);
+    return NULL;
+  }
+private:
+  Bench *bench;
+  unsigned seed;
+};
+
+double run_bench(const bench_config &conf, unsigned num_shards,
+		 unsigned num_threads, int seed)
+{
+  Bench bench(conf, num_shards);
+  bench.warm_up();
+
+  vector<BenchThread*> threads;
+  for (unsigned i = 0; i < num_threads; ++i)
+    threads.push_back(new BenchThread(&bench, seed + i));
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (unsigned i = 0; i < num_threads; ++i)
+    threads[i]->create();
+  for (unsigned i = 0; i < num_threads; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+
+  return (double)(conf.ops_per_thread * num_threads) / elapsed;
+}
+
+int main(int argc, const char **argv)
+{
+  std::vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+
+  long long delay_ns = 0;
+  long long num_ops = 100000;
+  long long num_objs = 64;
+  long long obj_bytes = 1 << 20;
+  long long op_bytes = 4096;
+  long long num_shards = 8;
+  long long max_threads = 32;
+  float percent_reads = 0.90;
+  int seed = time(0) % 100000;
+  std::ostringstream err;
+  std::vector<const char*>::iterator i;
+  for (i = args.begin(); i != args.end();) {
+    if (ceph_argparse_withlonglong(args, i, &delay_ns, &err, "--delay-ns", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &num_ops, &err, "--ops", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &num_objs, &err, "--objects", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &obj_bytes, &err, "--obj-size", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &op_bytes, &err, "--op-size", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &num_shards, &err, "--shards", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &max_threads, &err, "--max-threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withfloat(args, i, &percent_reads, &err, "--percent-read", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withint(args, i, &seed, &err, "--seed", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else {
+      cerr << "unknown option " << *i << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (num_objs < 1 || num_shards < 1 || max_threads < 1 || op_bytes < 1 ||
+      obj_bytes < op_bytes) {
+    cerr << argv[0] << ": invalid configuration" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  bench_config conf;
+  conf.num_objs = num_objs;
+  conf.obj_size = obj_bytes;
+  conf.op_size = op_bytes;
+  conf.ops_per_thread = num_ops;
+  conf.delay_ns = delay_ns;
+  conf.percent_reads = percent_reads;
+
+  std::cout << "ops/thread " << num_ops << ", " << num_objs << " objects of "
+	    << obj_bytes << " bytes, " << op_bytes << " byte ops, "
+	    << percent_reads * 100 << "% reads\n\n"
+	    << setw(8) << "threads"
+	    << setw(16) << "iops 1 shard"
+	    << setw(16) << ("iops " + stringify(num_shards) + " shards")
+	    << std::endl;
+  for (long long threads = 1; threads <= max_threads; threads *= 2) {
+    double single = run_bench(conf, 1, threads, seed);
+    double sharded = run_bench(conf, num_shards, threads, seed);
+    std::cout << setw(8) << threads
+	      << setw(16) << std::fixed << std::setprecision(0) << single
+	      << setw(16) << sharded << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
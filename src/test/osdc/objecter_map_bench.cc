@@ -0,0 +1,321 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Measure how op submission scales with the number of submitting
+ * threads when the osdmap is read under a global RWLock, the way the
+ * Objecter's slow path does, and when it is read through an RCU
+ * published snapshot, the way its op_submit() fast path does.
+ *
+ * Each op maps an object to a pg and its acting primary, registers
+ * itself with that osd's session under the session lock, and later
+ * unregisters itself, as a reply would.  A map thread publishes a new
+ * epoch every --map-interval-ms, holding the write lock for
+ * --map-hold-us to stand in for handle_osd_map().
+ */
+
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "common/ceph_argparse.h"
+#include "common/common_init.h"
+#include "common/config.h"
+#include "common/Clock.h"
+#include "common/RCU.h"
+#include "common/RWLock.h"
+#include "common/Thread.h"
+#include "global/global_init.h"
+#include "include/atomic.h"
+#include "include/stringify.h"
+#include "osd/OSDMap.h"
+
+struct Session {
+  RWLock lock;
+  map<ceph_tid_t, int> ops;
+  epoch_t map_epoch;
+  Session() : lock("objecter_map_bench::Session"), map_epoch(0) {}
+};
+
+struct Snapshot {
+  OSDMapRef map;
+};
+
+class Bench {
+public:
+  Bench(int num_osds, int pg_bits, bool use_rcu)
+    : rcu_mode(use_rcu), stopping(0), lock("objecter_map_bench::lock"),
+      osdmap(NULL), sessions(num_osds), last_tid(0)
+  {
+    osdmap = new OSDMap;
+    uuid_d fsid;
+    osdmap->build_simple(g_ceph_context, 0, fsid, num_osds, pg_bits, pg_bits);
+    OSDMap::Incremental inc(osdmap->get_epoch() + 1);
+    inc.fsid = osdmap->get_fsid();
+    entity_addr_t addr;
+    for (int i = 0; i < num_osds; ++i) {
+      addr.nonce = i;
+      inc.new_state[i] = CEPH_OSD_EXISTS | CEPH_OSD_NEW;
+      inc.new_up_client[i] = addr;
+      inc.new_up_cluster[i] = addr;
+      inc.new_hb_back_up[i] = addr;
+      inc.new_hb_front_up[i] = addr;
+      inc.new_weight[i] = CEPH_OSD_IN;
+      uuid_d uuid;
+      uuid.generate_random();
+      inc.new_uuid[i] = uuid;
+    }
+    osdmap->apply_incremental(inc);
+    osdmap->enable_pg_mapping_cache();
+    for (int i = 0; i < num_osds; ++i)
+      sessions[i] = new Session;
+    publish();
+  }
+
+  ~Bench() {
+    delete published.read();
+    delete osdmap;
+    for (unsigned i = 0; i < sessions.size(); ++i)
+      delete sessions[i];
+  }
+
+  /// submit and complete one op on the object
+  void op(const object_t &oid) {
+    object_locator_t oloc(0);
+    Session *s;
+    ceph_tid_t tid;
+    if (rcu_mode) {
+      unsigned token = rcu.read_lock();
+      Snapshot *snap = published.read();
+      s = sessions[map_to_osd(snap->map.get(), oid, oloc)];
+      s->lock.get_write();
+      if (s->map_epoch > snap->map->get_epoch()) {
+	// the real fast path falls back to the slow path here
+	s->lock.unlock();
+	rcu.read_unlock(token);
+	RWLock::RLocker l(lock);
+	s = sessions[map_to_osd(osdmap, oid, oloc)];
+	tid = register_op(s);
+      } else {
+	tid = last_tid.inc();
+	s->ops[tid] = 0;
+	s->lock.unlock();
+	rcu.read_unlock(token);
+      }
+    } else {
+      RWLock::RLocker l(lock);
+      s = sessions[map_to_osd(osdmap, oid, oloc)];
+      tid = register_op(s);
+    }
+
+    // reply
+    RWLock::WLocker l(s->lock);
+    s->ops.erase(tid);
+  }
+
+  /// apply a new epoch, holding the write lock for hold_us
+  void new_epoch(int hold_us) {
+    lock.get_write();
+    OSDMap::Incremental inc(osdmap->get_epoch() + 1);
+    inc.fsid = osdmap->get_fsid();
+    osdmap->apply_incremental(inc);
+    for (unsigned i = 0; i < sessions.size(); ++i) {
+      RWLock::WLocker l(sessions[i]->lock);
+      sessions[i]->map_epoch = osdmap->get_epoch();
+    }
+    if (hold_us)
+      usleep(hold_us);
+    Snapshot *old = published.read();
+    publish();
+    lock.unlock();
+
+    rcu.synchronize();
+    delete old;
+  }
+
+  bool rcu_mode;
+  atomic_t stopping;
+
+private:
+  RWLock lock;
+  OSDMap *osdmap;
+  vector<Session*> sessions;
+  RCU rcu;
+  RCUPointer<Snapshot> published;
+  atomic64_t last_tid;
+
+  void publish() {
+    OSDMap *copy = new OSDMap;
+    copy->deepish_copy_from(*osdmap);
+    copy->inherit_pg_mapping_cache(*osdmap);
+    Snapshot *snap = new Snapshot;
+    snap->map.reset(copy);
+    published.set(snap);
+  }
+
+  static int map_to_osd(const OSDMap *map, const object_t &oid,
+			const object_locator_t &oloc) {
+    pg_t pgid;
+    map->object_locator_to_pg(oid, oloc, pgid);
+    vector<int> up, acting;
+    int up_primary, acting_primary;
+    map->pg_to_up_acting_osds(pgid, &up, &up_primary, &acting,
+			      &acting_primary);
+    assert(acting_primary >= 0);
+    return acting_primary;
+  }
+
+  ceph_tid_t register_op(Session *s) {
+    RWLock::WLocker l(s->lock);
+    ceph_tid_t tid = last_tid.inc();
+    s->ops[tid] = 0;
+    return tid;
+  }
+};
+
+class SubmitThread : public Thread {
+public:
+  SubmitThread(Bench *b, uint64_t n, unsigned s)
+    : bench(b), num_ops(n), seed(s) {}
+  void *entry() {
+    for (uint64_t i = 0; i < num_ops; ++i)
+      bench->op(object_t("bench" + stringify(rand_r(&seed) % 100000)));
+    return NULL;
+  }
+private:
+  Bench *bench;
+  uint64_t num_ops;
+  unsigned seed;
+};
+
+class MapThread : public Thread {
+public:
+  MapThread(Bench *b, int i, int h) : bench(b), interval_ms(i), hold_us(h) {}
+  void *entry() {
+    while (!bench->stopping.read()) {
+      usleep(interval_ms * 1000);
+      bench->new_epoch(hold_us);
+    }
+    return NULL;
+  }
+private:
+  Bench *bench;
+  int interval_ms;
+  int hold_us;
+};
+
+double run_bench(bool use_rcu, int num_osds, int pg_bits, unsigned num_threads,
+		 uint64_t ops_per_thread, int interval_ms, int hold_us,
+		 int seed)
+{
+  Bench bench(num_osds, pg_bits, use_rcu);
+
+  vector<SubmitThread*> threads;
+  for (unsigned i = 0; i < num_threads; ++i)
+    threads.push_back(new SubmitThread(&bench, ops_per_thread, seed + i));
+  MapThread map_thread(&bench, interval_ms, hold_us);
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  if (interval_ms > 0)
+    map_thread.create();
+  for (unsigned i = 0; i < num_threads; ++i)
+    threads[i]->create();
+  for (unsigned i = 0; i < num_threads; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+  bench.stopping.set(1);
+  if (interval_ms > 0)
+    map_thread.join();
+
+  return (double)(ops_per_thread * num_threads) / elapsed;
+}
+
+int main(int argc, const char **argv)
+{
+  std::vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+
+  long long num_ops = 200000;
+  long long num_osds = 64;
+  long long pg_bits = 6;
+  long long max_threads = 32;
+  long long interval_ms = 100;
+  long long hold_us = 1000;
+  int seed = time(0) % 100000;
+  std::ostringstream err;
+  std::vector<const char*>::iterator i;
+  for (i = args.begin(); i != args.end();) {
+    if (ceph_argparse_withlonglong(args, i, &num_ops, &err, "--ops", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &num_osds, &err, "--osds", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &pg_bits, &err, "--pg-bits", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &max_threads, &err, "--max-threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &interval_ms, &err, "--map-interval-ms", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &hold_us, &err, "--map-hold-us", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withint(args, i, &seed, &err, "--seed", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else {
+      cerr << "unknown option " << *i << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (num_ops < 1 || num_osds < 1 || pg_bits < 0 || max_threads < 1 ||
+      interval_ms < 0 || hold_us < 0) {
+    cerr << argv[0] << ": invalid configuration" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "ops/thread " << num_ops << ", " << num_osds << " osds, "
+	    << (num_osds << pg_bits) << " pgs, new map every "
+	    << interval_ms << " ms held for " << hold_us << " us\n\n"
+	    << setw(8) << "threads"
+	    << setw(16) << "ops/s rwlock"
+	    << setw(16) << "ops/s rcu"
+	    << std::endl;
+  for (long long threads = 1; threads <= max_threads; threads *= 2) {
+    double locked = run_bench(false, num_osds, pg_bits, threads, num_ops,
+			      interval_ms, hold_us, seed);
+    double rcu = run_bench(true, num_osds, pg_bits, threads, num_ops,
+			   interval_ms, hold_us, seed);
+    std::cout << setw(8) << threads
+	      << setw(16) << std::fixed << std::setprecision(0) << locked
+	      << setw(16) << rcu << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
@@ -967,14 +967,34 @@ int export_files(ObjectStore *store, coll_t coll)
 
 int get_osdmap(ObjectStore *store, epoch_t e, OSDMap &osdmap)
 {
+  // the osd only keeps periodic full maps; find the nearest one at or
+  // before e and apply the incrementals after it.
+  list<bufferlist> incs;
   bufferlist bl;
-  bool found = store->read(
-      META_COLL, OSD::get_osdmap_pobject_name(e), 0, 0, bl) >= 0;
-  if (!found) {
-    cerr << "Can't find OSDMap for pg epoch " << e << std::endl;
-    return ENOENT;
+  epoch_t from = e;
+  while (from > 0 &&
+	 store->read(META_COLL, OSD::get_osdmap_pobject_name(from),
+		     0, 0, bl) < 0) {
+    bufferlist ibl;
+    if (store->read(META_COLL, OSD::get_inc_osdmap_pobject_name(from),
+		    0, 0, ibl) < 0) {
+      cerr << "Can't find OSDMap for pg epoch " << e << std::endl;
+      return ENOENT;
+    }
+    incs.push_front(ibl);
+    --from;
+  }
+  if (from > 0)
+    osdmap.decode(bl);
+  for (list<bufferlist>::iterator p = incs.begin(); p != incs.end(); ++p) {
+    OSDMap::Incremental inc;
+    bufferlist::iterator q = p->begin();
+    inc.decode(q);
+    if (osdmap.apply_incremental(inc) < 0) {
+      cerr << "Can't apply OSDMap incremental " << inc.epoch << std::endl;
+      return EINVAL;
+    }
   }
-  osdmap.decode(bl);
   if (debug)
     cerr << osdmap << std::endl;
   return 0;
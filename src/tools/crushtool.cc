@@ -91,7 +91,7 @@ void usage()
   cout << "                         specify output for for (de)compilation\n";
   cout << "   --build --num_osds N layer1 ...\n";
   cout << "                         build a new map, where each 'layer' is\n";
-  cout << "                           'name (uniform|straw|list|tree) size'\n";
+  cout << "                           'name (uniform|straw|straw2|list|tree) size'\n";
   cout << "   -i mapfn --test       test a range of inputs on the map\n";
   cout << "      [--min-x x] [--max-x x] [--x x]\n";
   cout << "      [--min-rule r] [--max-rule r] [--rule r]\n";
@@ -102,6 +102,11 @@ void usage()
   cout << "      [--simulate]       simulate placements using a random\n";
   cout << "                         number generator in place of the CRUSH\n";
   cout << "                         algorithm\n";
+  cout << "      [--threads n]      map inputs with n threads\n";
+  cout << "   -i mapfn --compare mapfn2\n";
+  cout << "                         count the mappings that change when\n";
+  cout << "                         switching from mapfn to mapfn2; takes\n";
+  cout << "                         the same input ranges as --test\n";
   cout << "   -i mapfn --add-item id weight name [--loc type name ...]\n";
   cout << "                         insert an item into the hierarchy at the\n";
   cout << "                         given location\n";
@@ -114,6 +119,10 @@ void usage()
   cout << "                         reweight a given item (and adjust ancestor\n"
        << "                         weights as needed)\n";
   cout << "   -i mapfn --reweight   recalculate all bucket weights\n";
+  cout << "   -i mapfn --test-reweight-item name weight\n";
+  cout << "                         report the data movement reweighting an\n";
+  cout << "                         item would cause with straw and with\n";
+  cout << "                         straw2 buckets; takes the --test ranges\n";
   cout << "   -i mapfn --show-location id\n";
   cout << "                         show location for given device id\n";
   cout << "   --show-utilization    show OSD usage\n";
@@ -123,6 +132,8 @@ void usage()
   cout << "   --show-mappings       show mappings\n";
   cout << "   --show-bad-mappings   show bad mappings\n";
   cout << "   --show-choose-tries   show choose tries histogram\n";
+  cout << "   --show-utilization-stats\n";
+  cout << "                         show per rule utilization variance\n";
   cout << "   --set-choose-local-tries N\n";
   cout << "                         set choose local retries before re-descent\n";
   cout << "   --set-choose-local-fallback-tries N\n";
@@ -150,6 +161,7 @@ struct bucket_types_t {
   { "uniform", CRUSH_BUCKET_UNIFORM },
   { "list", CRUSH_BUCKET_LIST },
   { "straw", CRUSH_BUCKET_STRAW },
+  { "straw2", CRUSH_BUCKET_STRAW2 },
   { "tree", CRUSH_BUCKET_TREE },
   { 0, 0 },
 };
@@ -170,6 +182,7 @@ int main(int argc, const char **argv)
   bool compile = false;
   bool decompile = false;
   bool test = false;
+  std::string compare_fn;
   bool display = false;
   int full_location = -1;
   bool write_to_file = false;
@@ -182,6 +195,8 @@ int main(int argc, const char **argv)
   float add_weight = 0;
   map<string,string> add_loc;
   float reweight_weight = 0;
+  std::string test_reweight_name;
+  float test_reweight_weight = 0;
 
   bool adjust = false;
 
@@ -247,11 +262,16 @@ int main(int argc, const char **argv)
     } else if (ceph_argparse_flag(args, i, "--show_choose_tries", (char*)NULL)) {
       display = true;
       tester.set_output_choose_tries(true);
+    } else if (ceph_argparse_flag(args, i, "--show_utilization_stats", (char*)NULL)) {
+      display = true;
+      tester.set_output_utilization_stats(true);
     } else if (ceph_argparse_witharg(args, i, &val, "-c", "--compile", (char*)NULL)) {
       srcfn = val;
       compile = true;
     } else if (ceph_argparse_flag(args, i, "-t", "--test", (char*)NULL)) {
       test = true;
+    } else if (ceph_argparse_witharg(args, i, &val, "--compare", (char*)NULL)) {
+      compare_fn = val;
     } else if (ceph_argparse_withint(args, i, &full_location, &err, "--show-location", (char*)NULL)) {
     } else if (ceph_argparse_flag(args, i, "-s", "--simulate", (char*)NULL)) {
       tester.set_random_placement();
@@ -347,6 +367,14 @@ int main(int argc, const char **argv)
       }
       reweight_weight = atof(*i);
       i = args.erase(i);
+    } else if (ceph_argparse_witharg(args, i, &val, "--test_reweight_item", (char*)NULL)) {
+      test_reweight_name = val;
+      if (i == args.end()) {
+	cerr << "expecting additional argument to --test-reweight-item" << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      test_reweight_weight = atof(*i);
+      i = args.erase(i);
     } else if (ceph_argparse_flag(args, i, "--build", (char*)NULL)) {
       build = true;
     } else if (ceph_argparse_withint(args, i, &num_osds, &err, "--num_osds", (char*)NULL)) {
@@ -402,6 +430,12 @@ int main(int argc, const char **argv)
 	exit(EXIT_FAILURE);
       }
       tester.set_batches(x);
+    } else if (ceph_argparse_withint(args, i, &x, &err, "--threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      tester.set_num_threads(x);
     } else if (ceph_argparse_withfloat(args, i, &y, &err, "--mark-down-ratio", (char*)NULL)) {
       if (!err.str().empty()) {
         cerr << err.str() << std::endl;
@@ -443,8 +477,9 @@ int main(int argc, const char **argv)
     exit(EXIT_FAILURE);
   }
   if (!compile && !decompile && !build && !test && !reweight && !adjust &&
-      add_item < 0 && full_location < 0 &&
-      remove_name.empty() && reweight_name.empty()) {
+      compare_fn.empty() && add_item < 0 && full_location < 0 &&
+      remove_name.empty() && reweight_name.empty() &&
+      test_reweight_name.empty()) {
     cerr << "no action specified; -h for help" << std::endl;
     exit(EXIT_FAILURE);
   }
@@ -763,6 +798,34 @@ int main(int argc, const char **argv)
       exit(1);
   }
 
+  if (!compare_fn.empty()) {
+    bufferlist bl;
+    std::string error;
+    int r = bl.read_file(compare_fn.c_str(), &error);
+    if (r < 0) {
+      cerr << me << ": error reading '" << compare_fn << "': "
+	   << error << std::endl;
+      exit(1);
+    }
+    CrushWrapper other;
+    bufferlist::iterator p = bl.begin();
+    other.decode(p);
+    r = tester.compare(other);
+    if (r < 0)
+      exit(1);
+  }
+
+  if (!test_reweight_name.empty()) {
+    if (!crush.name_exists(test_reweight_name)) {
+      cerr << " name " << test_reweight_name << " dne" << std::endl;
+      exit(1);
+    }
+    int item = crush.get_item_id(test_reweight_name);
+    int r = tester.test_reweight(g_ceph_context, item, test_reweight_weight);
+    if (r < 0)
+      exit(1);
+  }
+
   return 0;
 }
 /*
@@ -17,12 +17,92 @@
 
 #include "common/ceph_argparse.h"
 #include "common/errno.h"
+#include "common/Thread.h"
 
 #include "global/global_init.h"
 #include "osd/OSDMap.h"
 
 using namespace std;
 
+// don't bother spinning up a thread for fewer pgs than this
+#define MIN_PGS_PER_THREAD 1024
+
+/**
+ * maps a contiguous range of a pool's pgs
+ *
+ * Each thread works on its own copy of the map (including the crush
+ * map) so that the threads don't serialize on the crush mapper lock.
+ */
+class PGMapperThread : public Thread {
+  OSDMap osdmap;
+  int64_t pool;
+  unsigned first, last;
+  bool up;
+  vector<int> *osds;
+  int *primary;
+
+public:
+  PGMapperThread(const OSDMap& m, int64_t p, unsigned f, unsigned l,
+		 bool u, vector<int> *o, int *pr)
+    : pool(p), first(f), last(l), up(u), osds(o), primary(pr) {
+    osdmap.deepish_copy_from(m);
+    bufferlist bl;
+    m.crush->encode(bl);
+    bufferlist::iterator q = bl.begin();
+    osdmap.crush.reset(new CrushWrapper);
+    osdmap.crush->decode(q);
+  }
+
+  static void map_pg(const OSDMap& m, pg_t pgid, bool up,
+		     vector<int> *osds, int *primary) {
+    if (up)
+      m.pg_to_up_acting_osds(pgid, osds, primary, NULL, NULL);
+    else
+      m.pg_to_acting_osds(pgid, osds, primary);
+  }
+
+  void *entry() {
+    for (unsigned ps = first; ps < last; ++ps)
+      map_pg(osdmap, pg_t(ps, pool), up, &osds[ps - first],
+	     &primary[ps - first]);
+    return NULL;
+  }
+};
+
+/**
+ * map the first pg_num pgs of a pool to their up (or acting) sets
+ */
+void map_pool_pgs(const OSDMap& osdmap, int64_t pool, unsigned pg_num,
+		  int threads, bool up,
+		  vector<vector<int> > *osds, vector<int> *primary)
+{
+  osds->resize(pg_num);
+  primary->resize(pg_num);
+  if (threads > (int)(pg_num / MIN_PGS_PER_THREAD))
+    threads = pg_num / MIN_PGS_PER_THREAD;
+  if (threads <= 1) {
+    for (unsigned ps = 0; ps < pg_num; ++ps)
+      PGMapperThread::map_pg(osdmap, pg_t(ps, pool), up, &(*osds)[ps],
+			     &(*primary)[ps]);
+    return;
+  }
+
+  vector<PGMapperThread*> workers;
+  for (int i = 0; i < threads; ++i) {
+    unsigned f = (uint64_t)pg_num * i / threads;
+    unsigned l = (uint64_t)pg_num * (i + 1) / threads;
+    workers.push_back(new PGMapperThread(osdmap, pool, f, l, up,
+					 &(*osds)[f], &(*primary)[f]));
+    workers.back()->create();
+  }
+  for (vector<PGMapperThread*>::iterator p = workers.begin();
+       p != workers.end();
+       ++p) {
+    (*p)->join();
+    delete *p;
+  }
+}
+
 void usage()
 {
   cout << " usage: [--print] [--createsimple <numosd> [--clobber] [--pg_bits <bitsperosd>]] <mapfilename>" << std::endl;
@@ -30,6 +110,8 @@ void usage()
   cout << "   --import-crush <file>   replace osdmap's crush map with <file>" << std::endl;
   cout << "   --test-map-pgs [--pool <poolid>] map all pgs" << std::endl;
   cout << "   --test-map-pgs-dump [--pool <poolid>] map all pgs" << std::endl;
+  cout << "   --threads <n>           map pgs with n threads" << std::endl;
+  cout << "   --compare <file> [--pool <poolid>] count pgs whose up set differs in <file>" << std::endl;
   cout << "   --mark-up-in            mark osds up and in (but do not persist)" << std::endl;
   cout << "   --clear-temp            clear pg_temp and primary_temp" << std::endl;
   cout << "   --test-random           do random placements" << std::endl;
@@ -72,6 +154,8 @@ int main(int argc, const char **argv)
   bool test_map_pgs = false;
   bool test_map_pgs_dump = false;
   bool test_random = false;
+  int threads = 1;
+  std::string compare_fn;
 
   std::string val;
   std::ostringstream err;
@@ -133,6 +217,13 @@ int main(int argc, const char **argv)
         cerr << err.str() << std::endl;
         exit(EXIT_FAILURE);
       }
+    } else if (ceph_argparse_withint(args, i, &threads, &err, "--threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+        cerr << err.str() << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_witharg(args, i, &val, "--compare", (char*)NULL)) {
+      compare_fn = val;
     } else {
       ++i;
     }
@@ -330,6 +421,11 @@ int main(int argc, const char **argv)
 	continue;
       cout << "pool " << p->first
 	   << " pg_num " << p->second.get_pg_num() << std::endl;
+      vector<vector<int> > pool_osds;
+      vector<int> pool_primary;
+      if (!test_random)
+	map_pool_pgs(osdmap, p->first, p->second.get_pg_num(), threads, false,
+		     &pool_osds, &pool_primary);
       for (unsigned i = 0; i < p->second.get_pg_num(); ++i) {
 	pg_t pgid = pg_t(i, p->first);
 
@@ -342,7 +438,8 @@ int main(int argc, const char **argv)
 	  }
 	  primary = osds[0];
 	} else {
-	  osdmap.pg_to_acting_osds(pgid, &osds, &primary);
+	  osds.swap(pool_osds[i]);
+	  primary = pool_primary[i];
 	}
 	size[osds.size()]++;
 
@@ -419,6 +516,89 @@ int main(int argc, const char **argv)
       cout << "size " << i << "\t" << size[i] << std::endl;
     }
   }
+  if (!compare_fn.empty()) {
+    OSDMap other;
+    bufferlist obl;
+    std::string error;
+    r = obl.read_file(compare_fn.c_str(), &error);
+    if (r < 0) {
+      cerr << me << ": couldn't open " << compare_fn << ": " << error
+	   << std::endl;
+      exit(1);
+    }
+    try {
+      other.decode(obl);
+    }
+    catch (const buffer::error &e) {
+      cerr << me << ": error decoding osdmap '" << compare_fn << "'" << std::endl;
+      exit(1);
+    }
+    if (pool != -1 && !osdmap.have_pg_pool(pool)) {
+      cerr << "There is no pool " << pool << std::endl;
+      exit(1);
+    }
+
+    uint64_t total_pgs = 0, total_remapped = 0;
+    uint64_t total_replicas = 0, total_moved = 0;
+    vector<int> moved_to(max(osdmap.get_max_osd(), other.get_max_osd()), 0);
+    const map<int64_t,pg_pool_t>& pools = osdmap.get_pools();
+    for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+	 p != pools.end(); ++p) {
+      if (pool != -1 && p->first != pool)
+	continue;
+      const pg_pool_t *opi = other.get_pg_pool(p->first);
+      if (!opi) {
+	cout << "pool " << p->first << " dne in " << compare_fn << std::endl;
+	continue;
+      }
+      // pgs that split or merge necessarily move; only compare the pgs
+      // present in both maps
+      unsigned pg_num = MIN(p->second.get_pg_num(), opi->get_pg_num());
+
+      vector<vector<int> > before, after;
+      vector<int> before_primary, after_primary;
+      map_pool_pgs(osdmap, p->first, pg_num, threads, true,
+		   &before, &before_primary);
+      map_pool_pgs(other, p->first, pg_num, threads, true,
+		   &after, &after_primary);
+
+      unsigned remapped = 0, replicas = 0, moved = 0;
+      for (unsigned i = 0; i < pg_num; ++i) {
+	if (before[i] != after[i])
+	  remapped++;
+	for (vector<int>::iterator q = after[i].begin();
+	     q != after[i].end();
+	     ++q) {
+	  if (*q == CRUSH_ITEM_NONE)
+	    continue;
+	  replicas++;
+	  if (find(before[i].begin(), before[i].end(), *q) == before[i].end()) {
+	    moved++;
+	    moved_to[*q]++;
+	  }
+	}
+      }
+      cout << "pool " << p->first << " pg_num " << pg_num
+	   << ": " << remapped << "/" << pg_num << " pgs remapped, "
+	   << moved << "/" << replicas << " replicas moved" << std::endl;
+      total_pgs += pg_num;
+      total_remapped += remapped;
+      total_replicas += replicas;
+      total_moved += moved;
+    }
+
+    cout << "#osd	gained" << std::endl;
+    for (unsigned i = 0; i < moved_to.size(); ++i)
+      if (moved_to[i])
+	cout << "osd." << i << "\t" << moved_to[i] << std::endl;
+    cout << " total " << total_remapped << "/" << total_pgs
+	 << " pgs remapped (" << (total_pgs ?
+				  100.0 * total_remapped / total_pgs : 0)
+	 << "%), " << total_moved << "/" << total_replicas
+	 << " replicas moved (" << (total_replicas ?
+				    100.0 * total_moved / total_replicas : 0)
+	 << "%)" << std::endl;
+  }
   if (test_crush) {
     int pass = 0;
     while (1) {
@@ -453,7 +633,7 @@ int main(int argc, const char **argv)
   if (!print && !print_json && !tree && !modified && 
       export_crush.empty() && import_crush.empty() && 
       test_map_pg.empty() && test_map_object.empty() &&
-      !test_map_pgs && !test_map_pgs_dump) {
+      !test_map_pgs && !test_map_pgs_dump && compare_fn.empty()) {
     cerr << me << ": no action specified?" << std::endl;
     usage();
   }